@@ -118,8 +118,7 @@ void alarm_network_init(void)
 	if_init(&eth_iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
 		&iface_queues.rx, &iface_queues.tx, 0);
 
-	dft_route.iface = &eth_iface;
-	dft_route.ip = 0x0b00a8c0;
+	route_add(0, 0, 0x0b00a8c0, &eth_iface);
 #if defined(CONFIG_UDP) || defined(CONFIG_TCP)
 	socket_init();
 #endif
@@ -0,0 +1,437 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+/* Benchmark of the network stack over the loopback interface: both ends
+ * of the UDP and TCP flows run in this process, no kernel is involved.
+ *
+ * usage: lo-bench [-t] [-r] [-z] [-n rounds] [-s size] [-l loss] [-m mtu]
+ *   -t  tx checksum offload (checksums are not computed)
+ *   -r  rx checksum offload (checksums are not verified)
+ *   -z  requests are answered with the packets they came in
+ *   -l  percentage of packets lost during the tcp bulk transfer
+ *   -m  interface MTU, larger udp datagrams are fragmented and reassembled.
+ *       The tcp benchmark is skipped, segments are not sized to the MTU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timer.h>
+#include <sys/scheduler.h>
+#include <net/route.h>
+#define SOCKLEN_DEFINED
+#include <net/socket.h>
+#undef SOCKLEN_DEFINED
+#include <net/eth.h>
+#include <net/ip.h>
+#include <net/udp.h>
+#include <net/tcp.h>
+#include <net/lo.h>
+#include <net/pkt-mempool.h>
+
+#define LO_BENCH_PORT 7
+/* datagrams or segments in flight during bulk transfers */
+#define LO_BENCH_WINDOW (CONFIG_PKT_NB_MAX / 4)
+/* largest datagram a packet holds, tcp writes are segmented */
+#define LO_BENCH_SIZE_MAX (CONFIG_PKT_SIZE - sizeof(eth_hdr_t)	\
+			   - sizeof(ip_hdr_t) - sizeof(udp_hdr_t))
+
+static uint8_t lo_ip[] = { 127, 0, 0, 1 };
+static uint8_t lo_ip_mask[] = { 255, 0, 0, 0 };
+
+static int lo_bench_send(iface_t *iface, pkt_t *pkt);
+
+static iface_t lo_iface = {
+	.flags = IF_UP|IF_RUNNING,
+	.ip4_addr = lo_ip,
+	.ip4_mask = lo_ip_mask,
+	.send = lo_bench_send,
+};
+
+static struct lo_queues {
+	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
+} lo_queues = {
+	.rx = RING_INIT(lo_queues.rx),
+};
+
+static uint8_t payload[LO_BENCH_SIZE_MAX];
+static unsigned rounds = 10000;
+static unsigned size = 64;
+static double loss;
+static unsigned lo_bench_zero_copy;
+static unsigned lo_bench_lossy;
+static unsigned lo_bench_dropped;
+/* packets sent and lowest number of free packets during a phase */
+static unsigned lo_bench_tx;
+static unsigned lo_bench_pool_min;
+
+static double lo_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* packets are lost like on a wire, the sender does not know it */
+static int lo_bench_send(iface_t *iface, pkt_t *pkt)
+{
+	unsigned nb_free = pkt_pool_get_nb_free();
+
+	lo_bench_tx++;
+	if (nb_free < lo_bench_pool_min)
+		lo_bench_pool_min = nb_free;
+	if (lo_bench_lossy && rand() < loss / 100 * RAND_MAX) {
+		pkt_free(pkt);
+		lo_bench_dropped++;
+		return 0;
+	}
+	return lo_send(iface, pkt);
+}
+
+/* timers run from the main loop instead of a signal handler, with real
+ * time ticks */
+static void lo_bench_timers(void)
+{
+	static double last;
+	double now = lo_bench_now();
+
+	if (last == 0)
+		last = now;
+	while (now - last >= CONFIG_TIMER_RESOLUTION_US / 1e6) {
+		timer_process();
+		last += CONFIG_TIMER_RESOLUTION_US / 1e6;
+	}
+}
+
+/* run the stack until all the looped back packets are processed */
+static void lo_bench_poll(void)
+{
+	do {
+		lo_bench_timers();
+		scheduler_run_task();
+	} while (!ring_is_empty(lo_iface.rx));
+}
+
+/* read all pending data, return the number of bytes read */
+static unsigned lo_bench_drain(sock_info_t *sock_info, uint32_t *addr,
+			       uint16_t *port)
+{
+	unsigned len = 0;
+	pkt_t *pkt;
+
+	while (__socket_get_pkt(sock_info, &pkt, addr, port) >= 0) {
+		len += pkt_len(pkt);
+		pkt_free(pkt);
+	}
+	return len;
+}
+
+/* answer a request of size bytes */
+static int lo_bench_reply(sock_info_t *sock_info, const sbuf_t *sb)
+{
+	unsigned len = 0;
+	uint32_t addr;
+	uint16_t port;
+	pkt_t *pkt;
+
+	if (!lo_bench_zero_copy) {
+		if (lo_bench_drain(sock_info, &addr, &port) != size)
+			return -1;
+		return __socket_put_sbuf(sock_info, sb, addr, port);
+	}
+	while (__socket_get_pkt(sock_info, &pkt, &addr, &port) >= 0) {
+		len += pkt_len(pkt);
+		if (socket_put_pkt(sock_info, pkt, addr, port) < 0) {
+			pkt_free(pkt);
+			return -1;
+		}
+	}
+	return len == size ? 0 : -1;
+}
+
+/* datagrams in flight during the udp bulk transfer, their fragments must
+ * fit in the window */
+static unsigned lo_bench_udp_window(void)
+{
+#ifdef CONFIG_IP_FRAG
+	unsigned len = sizeof(ip_hdr_t) + sizeof(udp_hdr_t) + size;
+	unsigned frag_len;
+
+	if (lo_iface.mtu == 0 || len <= lo_iface.mtu)
+		return LO_BENCH_WINDOW;
+	frag_len = (lo_iface.mtu - sizeof(ip_hdr_t)) & ~7;
+	return MAX(LO_BENCH_WINDOW / ((len - sizeof(ip_hdr_t) + frag_len - 1)
+				      / frag_len), 1);
+#else
+	return LO_BENCH_WINDOW;
+#endif
+}
+
+/* tcp segments are sized to the packets, not to the MTU */
+static int lo_bench_udp_only(void)
+{
+#ifdef CONFIG_IP_FRAG
+	return lo_iface.mtu != 0;
+#else
+	return 0;
+#endif
+}
+
+static double lo_bench_start(void)
+{
+	lo_bench_tx = 0;
+	lo_bench_pool_min = pkt_pool_get_nb_free();
+	return lo_bench_now();
+}
+
+/* tx: packets sent per round or per data packet, pool: peak number of
+ * packets in use */
+static void lo_bench_report(const char *name, unsigned nb, unsigned bytes,
+			    double elapsed)
+{
+	if (bytes == 0)
+		printf("%-10s %8u rounds %10.2f us/round  ", name, nb,
+		       elapsed * 1e6 / nb);
+	else
+		printf("%-10s %8u pkts   %10.2f Mbit/s %10.0f pkts/s", name, nb,
+		       bytes * 8 / elapsed / 1e6, nb / elapsed);
+	printf(" %6.2f tx %4u pool\n", (double)lo_bench_tx / nb,
+	       CONFIG_PKT_NB_MAX - 1 - lo_bench_pool_min);
+}
+
+static int lo_bench_udp(void)
+{
+	uint32_t addr = *(uint32_t *)lo_ip;
+	sock_info_t server, client;
+	sbuf_t sb = SBUF_INIT(payload, size);
+	unsigned i, sent = 0, received = 0, window = lo_bench_udp_window();
+	double start;
+	int ret = -1;
+
+	if (sock_info_init(&server, SOCK_DGRAM) < 0)
+		return -1;
+	if (sock_info_init(&client, SOCK_DGRAM) < 0)
+		goto end_server;
+	if (sock_info_bind(&server, htons(LO_BENCH_PORT)) < 0
+	    || sock_info_bind(&client, 0) < 0)
+		goto end;
+
+	/* request/response */
+	start = lo_bench_start();
+	for (i = 0; i < rounds; i++) {
+		if (__socket_put_sbuf(&client, &sb, addr,
+				      htons(LO_BENCH_PORT)) < 0)
+			goto end;
+		lo_bench_poll();
+		if (lo_bench_reply(&server, &sb) < 0)
+			goto end;
+		lo_bench_poll();
+		if (lo_bench_drain(&client, NULL, NULL) != size)
+			goto end;
+	}
+	lo_bench_report("udp rr", rounds, 0, lo_bench_now() - start);
+
+	/* bulk */
+	start = lo_bench_start();
+	for (i = 0; i < rounds; i += window) {
+		unsigned j;
+
+		for (j = 0; j < window; j++) {
+			if (__socket_put_sbuf(&client, &sb, addr,
+					      htons(LO_BENCH_PORT)) < 0)
+				goto end;
+			sent += size;
+		}
+		lo_bench_poll();
+		received += lo_bench_drain(&server, NULL, NULL);
+	}
+	if (received != sent)
+		goto end;
+	lo_bench_report("udp bulk", i, received, lo_bench_now() - start);
+	ret = 0;
+
+ end:
+	sock_info_close(&client);
+ end_server:
+	sock_info_close(&server);
+	return ret;
+}
+
+static int lo_bench_tcp(void)
+{
+	uint32_t addr = *(uint32_t *)lo_ip;
+	sock_info_t server, client, conn;
+	sbuf_t sb = SBUF_INIT(payload, size);
+	unsigned i, total = rounds * size, sent = 0, received = 0;
+	uint32_t src_addr;
+	uint16_t src_port;
+	double start;
+	int ret = -1;
+
+	if (sock_info_init(&server, SOCK_STREAM) < 0)
+		return -1;
+	if (sock_info_listen(&server, 1) < 0
+	    || sock_info_bind(&server, htons(LO_BENCH_PORT)) < 0)
+		goto end_server;
+	if (sock_info_init(&client, SOCK_STREAM) < 0)
+		goto end_server;
+	if (sock_info_connect(&client, addr, htons(LO_BENCH_PORT)) < 0)
+		goto end_client;
+	lo_bench_poll();
+	if (sock_info_state(&client) != SOCK_CONNECTED
+	    || sock_info_accept(&server, &conn, &src_addr, &src_port) < 0)
+		goto end_client;
+
+	/* request/response */
+	start = lo_bench_start();
+	for (i = 0; i < rounds; i++) {
+		if (__socket_put_sbuf(&client, &sb, 0, 0) < 0)
+			goto end;
+		lo_bench_poll();
+		if (lo_bench_reply(&conn, &sb) < 0)
+			goto end;
+		lo_bench_poll();
+		if (lo_bench_drain(&client, NULL, NULL) != size)
+			goto end;
+	}
+	lo_bench_report("tcp rr", rounds, 0, lo_bench_now() - start);
+
+	/* bulk, acknowledgments free the segments kept for retransmission.
+	 * Writes fail while the windows are full. */
+	lo_bench_lossy = 1;
+	start = lo_bench_start();
+	while (received < total) {
+		for (i = 0; i < LO_BENCH_WINDOW && sent < total; i++) {
+			if (__socket_put_sbuf(&client, &sb, 0, 0) < 0)
+				break;
+			sent += size;
+		}
+		lo_bench_poll();
+		received += lo_bench_drain(&conn, NULL, NULL);
+		if (sock_info_state(&client) != SOCK_CONNECTED)
+			goto end;
+	}
+	lo_bench_report("tcp bulk", rounds, received, lo_bench_now() - start);
+	if (loss)
+		printf("%-10s %8u pkts   %10.2f %%\n", "lost", lo_bench_dropped,
+		       loss);
+	ret = 0;
+
+ end:
+	lo_bench_lossy = 0;
+	sock_info_close(&conn);
+ end_client:
+	sock_info_close(&client);
+	lo_bench_poll();
+ end_server:
+	sock_info_close(&server);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "trzn:s:l:m:")) != -1) {
+		switch (opt) {
+#ifdef CONFIG_CSUM_OFFLOAD
+		case 't':
+			lo_iface.offload |= IF_OFFLOAD_TX_CSUM;
+			break;
+		case 'r':
+			lo_iface.offload |= IF_OFFLOAD_RX_CSUM;
+			break;
+#endif
+		case 'z':
+			lo_bench_zero_copy = 1;
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'l':
+			loss = atof(optarg);
+			break;
+#ifdef CONFIG_IP_FRAG
+		case 'm':
+			lo_iface.mtu = atoi(optarg);
+			break;
+#endif
+		default:
+			fprintf(stderr, "usage: %s [-t] [-r] [-z] [-n rounds] "
+				"[-s size] [-l loss] [-m mtu]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (rounds == 0 || size == 0 || size > LO_BENCH_SIZE_MAX) {
+		fprintf(stderr, "size must be in [1, %lu]\n",
+			(unsigned long)LO_BENCH_SIZE_MAX);
+		exit(EXIT_FAILURE);
+	}
+	if (loss < 0 || loss >= 100) {
+		fprintf(stderr, "loss must be in [0, 100[\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(payload, 0x5A, sizeof(payload));
+
+	pkt_mempool_init();
+	timer_subsystem_init();
+	timer_subsystem_stop();
+	socket_init();
+	if_init(&lo_iface, IF_TYPE_LOOPBACK, NULL, &lo_queues.rx, NULL, 0);
+	route_add(*(uint32_t *)lo_ip & *(uint32_t *)lo_ip_mask, 8, 0,
+		  &lo_iface);
+
+#ifdef CONFIG_CSUM_OFFLOAD
+	printf("payload: %u bytes, offload:%s%s\n", size,
+	       lo_iface.offload & IF_OFFLOAD_TX_CSUM ? " tx" : "",
+	       lo_iface.offload & IF_OFFLOAD_RX_CSUM ? " rx" : "");
+#else
+	printf("payload: %u bytes\n", size);
+#endif
+#ifdef CONFIG_IP_FRAG
+	if (lo_iface.mtu)
+		printf("mtu: %u bytes\n", lo_iface.mtu);
+#endif
+	if (lo_bench_udp() < 0) {
+		fprintf(stderr, "udp benchmark failed\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!lo_bench_udp_only() && lo_bench_tcp() < 0) {
+		fprintf(stderr, "tcp benchmark failed\n");
+		exit(EXIT_FAILURE);
+	}
+#ifdef CONFIG_IFACE_STATS
+	printf("lo: %u rx, %u tx, %u tx errors\n", lo_iface.rx_packets,
+	       lo_iface.tx_packets, lo_iface.tx_errors);
+#endif
+	return 0;
+}
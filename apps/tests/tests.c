@@ -32,6 +32,8 @@
 #include <sys/ring.h>
 #include <sys/list.h>
 #include <sys/hash-tables.h>
+#include <sys/obj-pool.h>
+#include <sys/chksum.h>
 #include <sys/timer.h>
 #include <sys/scheduler.h>
 #include <net/tests.h>
@@ -220,6 +222,112 @@ static int list_check(void)
 	return 0;
 }
 
+#define OBJ_POOL_ELEMS 4
+STATIC_OBJ_POOL_DECL(obj_pool_chk, list_el_t, OBJ_POOL_ELEMS);
+
+static int obj_pool_check(void)
+{
+	list_el_t *els[OBJ_POOL_ELEMS];
+	const obj_pool_stats_t *stats = obj_pool_get_stats(&obj_pool_chk);
+	list_el_t el;
+	int i;
+
+	for (i = 0; i < OBJ_POOL_ELEMS; i++) {
+		if ((els[i] = obj_pool_alloc(&obj_pool_chk)) == NULL) {
+			fprintf(stderr, "%s:%d failed i:%d\n", __func__,
+				__LINE__, i);
+			return -1;
+		}
+		els[i]->a = els[i]->b = i;
+		if (!obj_pool_owns(&obj_pool_chk, els[i])) {
+			fprintf(stderr, "%s:%d failed\n", __func__, __LINE__);
+			return -1;
+		}
+	}
+	for (i = 0; i < OBJ_POOL_ELEMS; i++) {
+		if (els[i]->a != i || els[i]->b != i) {
+			fprintf(stderr, "%s:%d failed i:%d\n", __func__,
+				__LINE__, i);
+			return -1;
+		}
+	}
+	if (obj_pool_alloc(&obj_pool_chk) != NULL || stats->failures != 1
+	    || obj_pool_owns(&obj_pool_chk, &el)) {
+		fprintf(stderr, "%s:%d failed\n", __func__, __LINE__);
+		return -1;
+	}
+
+	/* the last object released is allocated first */
+	obj_pool_free(&obj_pool_chk, els[1]);
+	obj_pool_free(&obj_pool_chk, els[2]);
+	if (obj_pool_alloc(&obj_pool_chk) != els[2]
+	    || obj_pool_alloc(&obj_pool_chk) != els[1]) {
+		fprintf(stderr, "%s:%d failed\n", __func__, __LINE__);
+		return -1;
+	}
+	for (i = 0; i < OBJ_POOL_ELEMS; i++)
+		obj_pool_free(&obj_pool_chk, els[i]);
+	if (stats->used != 0 || stats->high_water != OBJ_POOL_ELEMS) {
+		fprintf(stderr, "%s:%d failed used:%u high water:%u\n",
+			__func__, __LINE__, stats->used, stats->high_water);
+		return -1;
+	}
+	return 0;
+}
+
+#define CKSUM_CHK_LEN 40
+#define CKSUM_CHK_ROUNDS 32
+
+/* incremental updates give the checksum computed again over the data */
+static int cksum_check(void)
+{
+	uint8_t buf[CKSUM_CHK_LEN + 24];
+	uint16_t csum, old16, new16;
+	uint32_t old32, new32;
+	int i, j, len;
+
+	for (i = 0; i < CKSUM_CHK_ROUNDS; i++) {
+		for (j = 0; j < (int)sizeof(buf); j++)
+			buf[j] = i * 31 + j * 7 + (j >> 2);
+		csum = cksum(buf, CKSUM_CHK_LEN);
+
+		memcpy(&old16, buf + 10, sizeof(old16));
+		new16 = old16 ^ (0x1234 + i);
+		memcpy(buf + 10, &new16, sizeof(new16));
+		csum = cksum_update16(csum, old16, new16);
+		if (csum != cksum(buf, CKSUM_CHK_LEN)) {
+			fprintf(stderr, "%s:%d failed i:%d\n", __func__,
+				__LINE__, i);
+			return -1;
+		}
+
+		memcpy(&old32, buf + 12, sizeof(old32));
+		new32 = old32 + 0x01020304 * (i + 1);
+		memcpy(buf + 12, &new32, sizeof(new32));
+		csum = cksum_update32(csum, old32, new32);
+		if (csum != cksum(buf, CKSUM_CHK_LEN)) {
+			fprintf(stderr, "%s:%d failed i:%d\n", __func__,
+				__LINE__, i);
+			return -1;
+		}
+
+		/* odd and even lengths appended at an even offset */
+		for (len = 1; len <= (int)sizeof(buf) - CKSUM_CHK_LEN; len++) {
+			uint32_t partial = cksum_partial(buf + CKSUM_CHK_LEN,
+							 len);
+			uint16_t all = cksum(buf, CKSUM_CHK_LEN + len);
+
+			if (cksum_add(csum, partial) != all
+			    || cksum_sub(all, partial) != csum) {
+				fprintf(stderr, "%s:%d failed i:%d len:%d\n",
+					__func__, __LINE__, i, len);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
 static int slist_check(void)
 {
 	int i;
@@ -549,6 +657,9 @@ static int driver_rf_checks(void)
 	rf_init(&iface, &rf_ctx);
 	ret = rf_checks(&iface);
 	net_swen_l3_flush_scheduler();
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	if_remove(&iface);
+#endif
 
 	pkt_mempool_shutdown();
 	return ret;
@@ -581,6 +692,18 @@ int main(int argc, char **argv)
 	}
 	printf("  ==> singly linked list checks succeeded\n");
 
+	if (obj_pool_check() < 0) {
+		fprintf(stderr, "  ==> object pool checks failed\n");
+		return -1;
+	}
+	printf("  ==> object pool checks succeeded\n");
+
+	if (cksum_check() < 0) {
+		fprintf(stderr, "  ==> checksum checks failed\n");
+		return -1;
+	}
+	printf("  ==> checksum checks succeeded\n");
+
 #ifdef CONFIG_HT_STORAGE
 	if (htable_check(1024) < 0) {
 		fprintf(stderr, "  ==> htable checks failed (htable size: 1024)\n");
@@ -632,6 +755,24 @@ int main(int argc, char **argv)
 	}
 	printf("  ==> net arp tests succeeded\n");
 
+	if (net_arp_cache_tests() < 0) {
+		fprintf(stderr, "  ==> net arp cache tests failed\n");
+		return -1;
+	}
+	printf("  ==> net arp cache tests succeeded\n");
+
+	if (net_arp_queue_tests() < 0) {
+		fprintf(stderr, "  ==> net arp queue tests failed\n");
+		return -1;
+	}
+	printf("  ==> net arp queue tests succeeded\n");
+
+	if (net_route_tests() < 0) {
+		fprintf(stderr, "  ==> net route tests failed\n");
+		return -1;
+	}
+	printf("  ==> net route tests succeeded\n");
+
 #ifdef CONFIG_ICMP
 	if (net_icmp_tests() < 0) {
 		fprintf(stderr, "  ==> net icmp tests failed\n");
@@ -646,6 +787,44 @@ int main(int argc, char **argv)
 	}
 	printf("  ==> net udp tests succeeded\n");
 #endif
+#if defined(CONFIG_IP_FRAG) && defined(CONFIG_UDP)
+	if (net_ip_frag_tests() < 0) {
+		fprintf(stderr, "  ==> net ip fragmentation tests failed\n");
+		return -1;
+	}
+	printf("  ==> net ip fragmentation tests succeeded\n");
+#endif
+#if defined(CONFIG_MORE_THAN_ONE_INTERFACE) && defined(CONFIG_UDP)
+	if (net_multi_iface_tests() < 0) {
+		fprintf(stderr, "  ==> net multi-interface tests failed\n");
+		return -1;
+	}
+	printf("  ==> net multi-interface tests succeeded\n");
+#endif
+#if defined(CONFIG_IP_FORWARD) && defined(CONFIG_ICMP)
+	if (net_ip_forward_tests() < 0) {
+		fprintf(stderr, "  ==> net ip forwarding tests failed\n");
+		return -1;
+	}
+	printf("  ==> net ip forwarding tests succeeded\n");
+#endif
+#if defined(CONFIG_LOOPBACK) && defined(CONFIG_UDP) \
+	&& defined(CONFIG_MORE_THAN_ONE_INTERFACE)
+	if (net_lo_tests() < 0) {
+		fprintf(stderr, "  ==> net loopback tests failed\n");
+		return -1;
+	}
+	printf("  ==> net loopback tests succeeded\n");
+#endif
+#if defined(CONFIG_LOOPBACK) && defined(CONFIG_UDP) \
+	&& defined(CONFIG_MORE_THAN_ONE_INTERFACE) && defined(CONFIG_TCP) \
+	&& defined(CONFIG_TCP_CLIENT) && !defined(CONFIG_BSD_COMPAT)
+	if (net_lo_tcp_tests() < 0) {
+		fprintf(stderr, "  ==> net loopback tcp tests failed\n");
+		return -1;
+	}
+	printf("  ==> net loopback tcp tests succeeded\n");
+#endif
 #ifdef CONFIG_TCP
 	if (net_tcp_tests() < 0) {
 		fprintf(stderr, "  ==> net tcp tests failed\n");
@@ -32,6 +32,11 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#ifdef CONFIG_CSUM_OFFLOAD
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/virtio_net.h>
+#endif
 
 #include <sys/timer.h>
 #include <sys/scheduler.h>
@@ -39,41 +44,104 @@
 #include <net/route.h>
 #define SOCKLEN_DEFINED
 #include <net/socket.h>
+#ifdef CONFIG_CSUM_OFFLOAD
+#include <net/ip.h>
+#include <net/udp.h>
+#include <net/tcp.h>
+#endif
 #undef SOCKLEN_DEFINED
 #include <net-apps/net-apps.h>
 #include <net/pkt-mempool.h>
 #include "tun.h"
 
-static uint8_t ip[] = { 1, 1, 2, 2 };
-static uint8_t ip_mask[] = { 255, 255, 255, 0 };
-static uint8_t mac[] = { 0x54, 0x52, 0x00, 0x02, 0x00, 0x41 };
-static struct pollfd tun_fds[1];
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+#define TAP_MAX CONFIG_IFACE_MAX
+#else
+#define TAP_MAX 1
+#endif
 
 static int send(iface_t *iface, pkt_t *pkt);
 static void recv(iface_t *iface) {}
 
-static iface_t iface = {
-	.flags = IF_UP|IF_RUNNING,
-	.hw_addr = mac,
-	.ip4_addr = ip,
-	.ip4_mask = ip_mask,
-	.send = &send,
-	.recv = &recv,
-};
-
-static struct iface_queues {
+/* tap i is available on 1.1.(2 + i).2, the host being 1.1.(2 + i).1 */
+typedef struct tap {
+	iface_t iface;
+	uint8_t ip[IP_ADDR_LEN];
+	uint8_t ip_mask[IP_ADDR_LEN];
+	uint8_t mac[ETHER_ADDR_LEN];
 	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
 	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
-} iface_queues = {
-	.rx = RING_INIT(iface_queues.rx),
-	.tx = RING_INIT(iface_queues.tx),
-};
+} tap_t;
+
+static tap_t taps[TAP_MAX];
+static struct pollfd tun_fds[TAP_MAX];
+static uint8_t nb_taps;
+
+static void tap_init(tap_t *tap, struct pollfd *tun_fd, uint8_t idx)
+{
+	iface_t *iface = &tap->iface;
+	uint8_t mac[] = { 0x54, 0x52, 0x00, 0x02, 0x00, 0x41 + idx };
+
+	tap->ip[0] = 1;
+	tap->ip[1] = 1;
+	tap->ip[2] = 2 + idx;
+	tap->ip[3] = 2;
+	memset(tap->ip_mask, 255, IP_ADDR_LEN - 1);
+	tap->ip_mask[IP_ADDR_LEN - 1] = 0;
+	memcpy(tap->mac, mac, ETHER_ADDR_LEN);
+	ring_init(&tap->rx, CONFIG_PKT_NB_MAX);
+	ring_init(&tap->tx, CONFIG_PKT_NB_MAX);
+
+	iface->flags = IF_UP|IF_RUNNING;
+	iface->hw_addr = tap->mac;
+	iface->ip4_addr = tap->ip;
+	iface->ip4_mask = tap->ip_mask;
+	iface->send = &send;
+	iface->recv = &recv;
+#ifdef CONFIG_CSUM_OFFLOAD
+	iface->offload = IF_OFFLOAD_TX_CSUM | IF_OFFLOAD_RX_CSUM;
+#endif
+	iface->priv = tun_fd;
+	if_init(iface, IF_TYPE_ETHERNET, NULL, &tap->rx, &tap->tx, 0);
+}
+
+#ifdef CONFIG_CSUM_OFFLOAD
+static void tun_set_vnet_hdr(struct virtio_net_hdr *vnet_hdr, const pkt_t *pkt)
+{
+	const ip_hdr_t *ip_hdr;
+
+	memset(vnet_hdr, 0, sizeof(struct virtio_net_hdr));
+	vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+	if (!(pkt->flags & PKT_CSUM_PARTIAL))
+		return;
+
+	ip_hdr = (ip_hdr_t *)(pkt->buf.data + sizeof(eth_hdr_t));
+	vnet_hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	vnet_hdr->csum_start = sizeof(eth_hdr_t) + ip_hdr->hl * 4;
+	if (ip_hdr->p == IPPROTO_TCP)
+		vnet_hdr->csum_offset = offsetof(tcp_hdr_t, checksum);
+	else
+		vnet_hdr->csum_offset = offsetof(udp_hdr_t, checksum);
+}
+#endif
 
 static int send(iface_t *iface, pkt_t *pkt)
 {
+	const struct pollfd *tun_fd = iface->priv;
 	ssize_t nwrite;
+#ifdef CONFIG_CSUM_OFFLOAD
+	struct virtio_net_hdr vnet_hdr;
+	struct iovec iov[2];
 
-	nwrite = write(tun_fds[0].fd, pkt->buf.data, pkt->buf.len);
+	tun_set_vnet_hdr(&vnet_hdr, pkt);
+	iov[0].iov_base = &vnet_hdr;
+	iov[0].iov_len = sizeof(vnet_hdr);
+	iov[1].iov_base = pkt->buf.data;
+	iov[1].iov_len = pkt->buf.len;
+	nwrite = writev(tun_fd->fd, iov, 2);
+#else
+	nwrite = write(tun_fd->fd, pkt->buf.data, pkt->buf.len);
+#endif
 	pkt_free(pkt);
 	if (nwrite < 0) {
 		if (errno != EAGAIN) {
@@ -87,20 +155,28 @@ static int send(iface_t *iface, pkt_t *pkt)
 
 static int tun_receive_pkt(const iface_t *iface)
 {
+	const struct pollfd *tun_fd = iface->priv;
 	pkt_t *pkt;
 	uint8_t buf[2048];
 	ssize_t nread;
+#ifdef CONFIG_CSUM_OFFLOAD
+	struct virtio_net_hdr vnet_hdr;
+	struct iovec iov[2] = {
+		{ .iov_base = &vnet_hdr, .iov_len = sizeof(vnet_hdr) },
+		{ .iov_base = buf, .iov_len = sizeof(buf) },
+	};
+#endif
 
-	if (poll(tun_fds, 1, -1) < 0) {
-		if (errno == EINTR)
-			return -1;
-		fprintf(stderr, "cannot poll on tun fd (%m (%d))\n", errno);
-		return -1;
-	}
-	if ((tun_fds[0].revents & POLLIN) == 0)
+	if ((tun_fd->revents & POLLIN) == 0)
 		return -1;
 
-	nread = read(tun_fds[0].fd, buf, sizeof(buf));
+#ifdef CONFIG_CSUM_OFFLOAD
+	nread = readv(tun_fd->fd, iov, 2);
+	if (nread >= 0)
+		nread = MAX(nread - (ssize_t)sizeof(vnet_hdr), 0);
+#else
+	nread = read(tun_fd->fd, buf, sizeof(buf));
+#endif
 	if (nread < 0 && errno == EAGAIN) {
 		return -1;
 	}
@@ -132,42 +208,77 @@ static int tun_receive_pkt(const iface_t *iface)
 		pkt_free(pkt);
 		return -1;
 	}
+#ifdef CONFIG_CSUM_OFFLOAD
+	/* frames coming from the host stack may only carry a partial
+	 * checksum, they are trusted as is. The checksum is completed if
+	 * they are forwarded. */
+	if (vnet_hdr.flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM
+			      | VIRTIO_NET_HDR_F_DATA_VALID))
+		pkt->flags |= PKT_CSUM_VERIFIED;
+	if (vnet_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+		pkt->flags |= PKT_CSUM_PARTIAL;
+#endif
 	pkt_put(iface->rx, pkt);
 	return 0;
 }
 
+static void tun_poll(void)
+{
+	uint8_t i;
+
+	if (poll(tun_fds, nb_taps, -1) < 0) {
+		if (errno != EINTR)
+			fprintf(stderr, "cannot poll on tun fds (%m (%d))\n",
+				errno);
+		return;
+	}
+	for (i = 0; i < nb_taps; i++) {
+		iface_t *iface = &taps[i].iface;
+
+		if (tun_receive_pkt(iface) >= 0)
+			iface->if_input(iface);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	char dev[256];
-	char *dev_name;
 	#define CMD_SIZE 1024
 	char cmd[CMD_SIZE];
+	int i;
 
 	LOG("Tun-driver version %s\n", VERSION);
-	memset(dev, 0, sizeof(dev));
-	if (argc > 1)
-		strncpy(dev, argv[1], sizeof(dev) - 1);
-
-	tun_alloc(dev, tun_fds);
-	if (tun_fds[0].fd < 0)
+	if (argc - 1 > TAP_MAX) {
+		fprintf(stderr, "at most %d tap devices are supported\n",
+			TAP_MAX);
 		exit(EXIT_FAILURE);
+	}
+	pkt_mempool_init();
 
-	dev_name = argc ? dev : "tap0";
-	snprintf(cmd, CMD_SIZE, "sudo ip link set up dev %s && "
-		 "sudo ip a a 1.1.2.1/24 dev %s",  dev_name, dev_name);
-	if (system(cmd) < 0)
-		fprintf(stderr, "failed to run command: `%s'\n", cmd);
-	printf("the system is available on IP address 1.1.2.2 (interface: %s)\n",
-	       dev_name);
+	/* usage: tun-driver [tap0 [tap1 ...]] */
+	do {
+		memset(dev, 0, sizeof(dev));
+		if (nb_taps + 1 < argc)
+			strncpy(dev, argv[nb_taps + 1], sizeof(dev) - 1);
 
-	pkt_mempool_init();
-	if_init(&iface, IF_TYPE_ETHERNET, NULL,
-		&iface_queues.rx, &iface_queues.tx, 0);
+		tun_alloc(dev, &tun_fds[nb_taps]);
+		if (tun_fds[nb_taps].fd < 0)
+			exit(EXIT_FAILURE);
+		if (fcntl(tun_fds[nb_taps].fd, F_SETFL, O_NONBLOCK) < 0) {
+			fprintf(stderr, "cannot set non blocking tun fd (%m)\n");
+			exit(EXIT_FAILURE);
+		}
+		tap_init(&taps[nb_taps], &tun_fds[nb_taps], nb_taps);
 
-	if (fcntl(tun_fds[0].fd, F_SETFL, O_NONBLOCK) < 0) {
-		fprintf(stderr, "cannot set non blocking tcp socket (%m)\n");
-		exit(EXIT_FAILURE);
-	}
+		snprintf(cmd, CMD_SIZE, "sudo ip link set up dev %s && "
+			 "sudo ip a a 1.1.%d.1/24 dev %s", dev, 2 + nb_taps,
+			 dev);
+		if (system(cmd) < 0)
+			fprintf(stderr, "failed to run command: `%s'\n", cmd);
+		printf("the system is available on IP address 1.1.%d.2 "
+		       "(interface: %s)\n", 2 + nb_taps, dev);
+		nb_taps++;
+	} while (nb_taps + 1 < argc);
 
 	timer_subsystem_init();
 
@@ -175,12 +286,18 @@ int main(int argc, char *argv[])
 	timer_checks();
 #endif
 	socket_init();
-	dft_route.iface = &iface;
+	for (i = 0; i < nb_taps; i++) {
+		uint32_t prefix = *(uint32_t *)taps[i].ip
+			& *(uint32_t *)taps[i].ip_mask;
+
+		route_add(prefix, 24, 0, &taps[i].iface);
+	}
+	/* the host of the first tap is the default gateway */
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-	dft_route.ip = 0x01020101;
+	route_add(0, 0, 0x01020101, &taps[0].iface);
 #endif
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-	dft_route.ip = 0x01010201;
+	route_add(0, 0, 0x01010201, &taps[0].iface);
 #endif
 
 #ifdef CONFIG_UDP
@@ -202,9 +319,7 @@ int main(int argc, char *argv[])
 	}
 #endif
 	while (1) {
-		if (tun_receive_pkt(&iface) >= 0)
-			iface.if_input(&iface);
-
+		tun_poll();
 		scheduler_run_task();
 #if defined(CONFIG_TCP) && !defined(CONFIG_EVENT)
 		udp_app();
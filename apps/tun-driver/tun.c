@@ -52,11 +52,21 @@ void tun_alloc(char *dev, struct pollfd *tun_fds)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+#ifdef CONFIG_CSUM_OFFLOAD
+	/* every frame is preceded by a struct virtio_net_hdr */
+	ifr.ifr_flags |= IFF_VNET_HDR;
+#endif
 	strncpy(ifr.ifr_name, dev, IFNAMSIZ);
 	if (ioctl(tun_fds[0].fd, TUNSETIFF, (void *) &ifr) < 0) {
 		fprintf(stderr, "%s: cannot ioctl tun device (%m)\n", __func__);
 		exit(EXIT_FAILURE);
 	}
+#ifdef CONFIG_CSUM_OFFLOAD
+	/* let the kernel hand us frames with partial checksums */
+	if (ioctl(tun_fds[0].fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0)
+		fprintf(stderr, "%s: cannot enable checksum offload (%m)\n",
+			__func__);
+#endif
 	strncpy(dev, ifr.ifr_name, IFNAMSIZ);
 	tun_fds[0].events = POLLIN;
 }
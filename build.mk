@@ -93,10 +93,33 @@ ifdef CONFIG_ETHERNET
 CFLAGS += -DCONFIG_ETHERNET
 endif
 
+ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+CFLAGS += -DCONFIG_MORE_THAN_ONE_INTERFACE
+ifdef CONFIG_IFACE_MAX
+CFLAGS += -DCONFIG_IFACE_MAX=$(CONFIG_IFACE_MAX)
+endif
+endif
+
 ifdef CONFIG_IP
 CFLAGS += -DCONFIG_IP
 endif
 
+ifdef CONFIG_LOOPBACK
+CFLAGS += -DCONFIG_LOOPBACK
+endif
+
+ifdef CONFIG_IP_FORWARD
+CFLAGS += -DCONFIG_IP_FORWARD
+endif
+
+ifdef CONFIG_IP_FRAG
+CFLAGS += -DCONFIG_IP_FRAG
+endif
+
+ifdef CONFIG_ICMP
+CFLAGS += -DCONFIG_ICMP
+endif
+
 ifdef CONFIG_UDP
 CFLAGS += -DCONFIG_UDP
 endif
@@ -110,6 +133,12 @@ CFLAGS += -DCONFIG_TCP
 ifdef CONFIG_TCP_CLIENT
 CFLAGS += -DCONFIG_TCP_CLIENT
 endif
+ifdef CONFIG_TCP_RETRANSMIT
+CFLAGS += -DCONFIG_TCP_RETRANSMIT
+endif
+ifdef CONFIG_TCP_KEEPALIVE
+CFLAGS += -DCONFIG_TCP_KEEPALIVE
+endif
 endif
 
 ifdef CONFIG_BSD_COMPAT
@@ -118,6 +147,9 @@ endif
 
 ifdef CONFIG_EVENT
 CFLAGS += -DCONFIG_EVENT
+ifdef CONFIG_EVENT_POLL
+CFLAGS += -DCONFIG_EVENT_POLL
+endif
 endif
 
 ifdef CONFIG_EEPROM_SIZE
@@ -143,6 +175,10 @@ ifdef CONFIG_IFACE_STATS
 CFLAGS += -DCONFIG_IFACE_STATS=y
 endif
 
+ifdef CONFIG_CSUM_OFFLOAD
+CFLAGS += -DCONFIG_CSUM_OFFLOAD
+endif
+
 ifdef CONFIG_SWEN_L3
 CFLAGS += -DCONFIG_SWEN_L3
 SRC += $(ROOT_PATH)/crypto/xtea.c
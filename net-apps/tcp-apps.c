@@ -217,8 +217,11 @@ void tcp_app(void)
 				goto reset_sb;
 			}
 		}
-		if (__socket_put_sbuf(&ctx[i].sock_info, &ctx[i].sb, 0, 0) < 0) {
-			DEBUG_LOG("cannot put sbuf to socket (len:%d) (from pkt:%p)\n",
+		if (ctx[i].sb.len == 0)
+			continue;
+		/* the segment is sent back in place */
+		if (socket_put_pkt(&ctx[i].sock_info, ctx[i].pkt, 0, 0) < 0) {
+			DEBUG_LOG("cannot put pkt to socket (len:%d) (pkt:%p)\n",
 				  ctx[i].sb.len, ctx[i].pkt);
 			if (sock_info_state(&ctx[i].sock_info) != SOCK_CONNECTED) {
 				sock_info_close(&ctx[i].sock_info);
@@ -226,6 +229,8 @@ void tcp_app(void)
 			}
 			continue;
 		}
+		sbuf_reset(&ctx[i].sb);
+		continue;
 	reset_sb:
 		if (ctx[i].sb.len) {
 			sbuf_reset(&ctx[i].sb);
@@ -265,12 +270,14 @@ static void ev_clients_cb(event_t *ev, uint8_t events)
 	}
 
 	if (events & EV_WRITE) {
-		if (__socket_put_sbuf(&ctx->sock_info, &ctx->sb, 0,
-				      0) < 0) {
+		if (ctx->sb.len == 0) {
+			socket_event_set_mask(&ctx->sock_info, EV_READ);
+			return;
+		}
+		if (socket_put_pkt(&ctx->sock_info, ctx->pkt, 0, 0) < 0) {
 			LOG("%s:%d write failed\n", __func__, __LINE__);
 			return;
 		}
-		pkt_free(ctx->pkt);
 		sbuf_reset(&ctx->sb);
 		socket_event_set_mask(&ctx->sock_info, EV_READ);
 	}
@@ -53,15 +53,14 @@ static void udp_get_pkt(sock_info_t *sock_info)
 	pkt_t *pkt;
 
 	if (__socket_get_pkt(sock_info, &pkt, &src_addr, &src_port) >= 0) {
-		sbuf_t sb = PKT2SBUF(pkt);
-
-		if (__socket_put_sbuf(sock_info, &sb, src_addr, src_port) < 0)
-			DEBUG_LOG("can't put sbuf to udp socket\n");
-
-		src_port = ntohs(src_port);
 		DEBUG_LOG("got from 0x%X on port %u: %.*s\n", src_addr,
-			  src_port, sb.len, sb.data);
-		pkt_free(pkt);
+			  ntohs(src_port), pkt_len(pkt), (char *)btod(pkt));
+
+		/* the datagram is sent back in place */
+		if (socket_put_pkt(sock_info, pkt, src_addr, src_port) < 0) {
+			DEBUG_LOG("can't put pkt to udp socket\n");
+			pkt_free(pkt);
+		}
 	}
 }
 
@@ -26,6 +26,7 @@
 #include "eth.h"
 #include "ip.h"
 #include <sys/timer.h>
+#include <sys/obj-pool.h>
 
 static arp_entries_t arp_entries;
 #ifdef CONFIG_IPV6
@@ -34,59 +35,222 @@ static arp6_entries_t arp6_entries;
 
 uint8_t broadcast_mac[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
+#if CONFIG_ARP_QUEUE_LEN == 0 || CONFIG_ARP_QUEUE_MAX > 255
+#error "CONFIG_ARP_QUEUE_LEN must be positive, CONFIG_ARP_QUEUE_MAX is limited to 255"
+#endif
+
 #define ARP_RETRY_TIMEOUT 3 /* seconds */
 #define ARP_RETRIES 2
 
 typedef struct arp_res {
 	list_t list;
-	list_t pkt_list;
+	list_t pkt_list;	/* oldest first */
 	tim_t tim;
 	iface_t *iface;
+	uint32_t ip;		/* next hop */
+	uint8_t nb_pkts;
 	uint8_t retries;
 } arp_res_t;
 
+/* oldest resolution first */
 static list_t arp_wait_list = LIST_HEAD_INIT(arp_wait_list);
+STATIC_OBJ_POOL_DECL(arp_res_pool, arp_res_t, CONFIG_ARP_RES_MAX);
+static uint8_t arp_nb_pkts;
+static arp_stats_t arp_stats;
 
-int
-arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t **iface)
-{
-	int i;
+#define ARP_IDX(e) ((arp_idx_t)((e) - arp_entries.entries + 1))
+#define ARP_ENTRY(idx) (&arp_entries.entries[(idx) - 1])
+
+#ifdef CONFIG_ARP_EXPIRY
+#define ARP_TICKS_PER_SEC (1000000UL / CONFIG_TIMER_RESOLUTION_US)
+#define ARP_EXPIRY_TICKS (CONFIG_ARP_EXPIRY * ARP_TICKS_PER_SEC)
+/* neighbors are asked to confirm their entry during the last quarter
+ * of its lifetime */
+#define ARP_REFRESH_TICKS (ARP_EXPIRY_TICKS - ARP_EXPIRY_TICKS / 4)
+#define ARP_PROBE_TICKS (ARP_EXPIRY_TICKS / 4 / ARP_RETRIES)
+#endif
 
-	/* linear search ... that's bad but it saves space */
-	for (i = 0; i < CONFIG_ARP_TABLE_SIZE; i++) {
-		if (arp_entries.entries[i].ip == *ip) {
-			*mac = arp_entries.entries[i].mac;
+static inline int
+arp_entry_match(const arp_entry_t *e, uint32_t ip, const iface_t *iface)
+{
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-			*iface = arp_entries.entries[i].iface;
+	return e->ip == ip && e->iface == iface;
 #else
-			(void)iface;
+	(void)iface;
+	return e->ip == ip;
 #endif
-			return 0;
-		}
+}
+
+static inline arp_idx_t *arp_bucket(uint32_t ip)
+{
+	ip ^= ip >> 16;
+	ip ^= ip >> 8;
+	return &arp_entries.ht[ip & (CONFIG_ARP_HT_SIZE - 1)];
+}
+
+static void arp_lru_unlink(arp_entry_t *e)
+{
+	if (e->lru_prev)
+		ARP_ENTRY(e->lru_prev)->lru_next = e->lru_next;
+	else
+		arp_entries.lru_head = e->lru_next;
+	if (e->lru_next)
+		ARP_ENTRY(e->lru_next)->lru_prev = e->lru_prev;
+	else
+		arp_entries.lru_tail = e->lru_prev;
+}
+
+static void arp_lru_add_head(arp_entry_t *e)
+{
+	arp_idx_t idx = ARP_IDX(e);
+
+	e->lru_prev = 0;
+	e->lru_next = arp_entries.lru_head;
+	if (arp_entries.lru_head)
+		ARP_ENTRY(arp_entries.lru_head)->lru_prev = idx;
+	else
+		arp_entries.lru_tail = idx;
+	arp_entries.lru_head = idx;
+}
+
+static void arp_lru_add_tail(arp_entry_t *e)
+{
+	arp_idx_t idx = ARP_IDX(e);
+
+	e->lru_prev = arp_entries.lru_tail;
+	e->lru_next = 0;
+	if (arp_entries.lru_tail)
+		ARP_ENTRY(arp_entries.lru_tail)->lru_next = idx;
+	else
+		arp_entries.lru_head = idx;
+	arp_entries.lru_tail = idx;
+}
+
+static void arp_lru_touch(arp_entry_t *e)
+{
+	if (arp_entries.lru_tail == ARP_IDX(e))
+		return;
+	arp_lru_unlink(e);
+	arp_lru_add_tail(e);
+}
+
+static void arp_hash_unlink(arp_entry_t *e)
+{
+	arp_idx_t *link = arp_bucket(e->ip);
+	arp_idx_t idx = ARP_IDX(e);
+
+	while (*link != idx)
+		link = &ARP_ENTRY(*link)->next;
+	*link = e->next;
+}
+
+static arp_entry_t *arp_lookup(uint32_t ip, const iface_t *iface)
+{
+	arp_idx_t idx = *arp_bucket(ip);
+
+	while (idx) {
+		arp_entry_t *e = ARP_ENTRY(idx);
+
+		if (arp_entry_match(e, ip, iface))
+			return e;
+		idx = e->next;
+	}
+	return NULL;
+}
+
+static void arp_entry_del(arp_entry_t *e)
+{
+	arp_hash_unlink(e);
+	e->ip = 0;
+	/* reuse it first */
+	arp_lru_unlink(e);
+	arp_lru_add_head(e);
+}
+
+static arp_entry_t *arp_entry_alloc(uint32_t ip)
+{
+	arp_entry_t *e;
+	arp_idx_t *bucket = arp_bucket(ip);
+
+	if (arp_entries.nb < CONFIG_ARP_TABLE_SIZE) {
+		e = &arp_entries.entries[arp_entries.nb++];
+		arp_lru_add_tail(e);
+	} else {
+		e = ARP_ENTRY(arp_entries.lru_head);
+		if (e->ip)
+			arp_hash_unlink(e);
+		arp_lru_touch(e);
+	}
+	e->ip = ip;
+	e->next = *bucket;
+	*bucket = ARP_IDX(e);
+	return e;
+}
+
+#ifdef CONFIG_ARP_EXPIRY
+static int arp_entry_check_age(arp_entry_t *e, iface_t *iface)
+{
+	uint32_t age = timer_ticks - e->updated;
+
+	if (age >= ARP_EXPIRY_TICKS)
+		return -1;
+	/* keep using the entry while it is being confirmed */
+	if (e->probes < ARP_RETRIES
+	    && age >= ARP_REFRESH_TICKS + e->probes * ARP_PROBE_TICKS) {
+		e->probes++;
+		arp_output(iface, ARPOP_REQUEST, e->mac, (uint8_t *)&e->ip);
+	}
+	return 0;
+}
+#endif
+
+int arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t *iface)
+{
+	arp_entry_t *e;
+
+	if ((e = arp_lookup(*ip, iface)) == NULL)
+		return -1;
+#ifdef CONFIG_ARP_EXPIRY
+	if (arp_entry_check_age(e, iface) < 0) {
+		arp_entry_del(e);
+		return -1;
 	}
-	return -1;
+#endif
+	arp_lru_touch(e);
+	*mac = e->mac;
+	return 0;
 }
 
 void arp_add_entry(const uint8_t *sha, const uint8_t *spa, const iface_t *iface)
 {
 	int i;
-	arp_entry_t *e = &arp_entries.entries[arp_entries.pos];
-	uint8_t *ip = (uint8_t *)&e->ip;
+	arp_entry_t *e;
+	uint32_t ip;
+	uint8_t *ip_p = (uint8_t *)&ip;
 
-	STATIC_ASSERT(POWEROF2(CONFIG_ARP_TABLE_SIZE));
+	STATIC_ASSERT(POWEROF2(CONFIG_ARP_HT_SIZE));
 
 	for (i = 0; i < IP_ADDR_LEN; i++)
-		ip[i] = spa[i];
+		ip_p[i] = spa[i];
+	/* address probes (RFC 5227) do not announce a neighbor */
+	if (ip == 0)
+		return;
+
+	if ((e = arp_lookup(ip, iface)))
+		arp_lru_touch(e);
+	else
+		e = arp_entry_alloc(ip);
 
 	for (i = 0; i < ETHER_ADDR_LEN; i++)
 		e->mac[i] = sha[i];
 
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
 	e->iface = iface;
-#else
-	(void)iface;
 #endif
-	arp_entries.pos = (arp_entries.pos + 1) & (CONFIG_ARP_TABLE_SIZE - 1);
+#ifdef CONFIG_ARP_EXPIRY
+	e->updated = timer_ticks;
+	e->probes = 0;
+#endif
 }
 
 #ifdef CONFIG_IPV6
@@ -154,22 +318,12 @@ arp_output(iface_t *iface, int op, const uint8_t *tha, const uint8_t *tpa)
 	return eth_output(out, iface, L3_PROTO_ARP, tha);
 }
 
-static uint32_t arp_res_get_ip(arp_res_t *arp_res)
-{
-	pkt_t *pkt = LIST_FIRST_ENTRY(&arp_res->pkt_list, pkt_t, list);
-	ip_hdr_t *ip_hdr = btod(pkt);
-
-	return ip_hdr->dst;
-}
-
-static arp_res_t *arp_res_lookup(const uint32_t *ip)
+static arp_res_t *arp_res_lookup(const uint32_t *ip, const iface_t *iface)
 {
 	arp_res_t *arp_res;
 
 	LIST_FOR_EACH_ENTRY(arp_res, &arp_wait_list, list) {
-		uint32_t arp_res_ip = arp_res_get_ip(arp_res);
-
-		if (arp_res_ip == *ip)
+		if (arp_res->ip == *ip && arp_res->iface == iface)
 			return arp_res;
 	}
 	return NULL;
@@ -182,24 +336,26 @@ static void __arp_process_wait_list(arp_res_t *arp_res, uint8_t delete)
 	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &arp_res->pkt_list, list) {
 		list_del(&pkt->list);
 		if (!delete) {
-			ip_hdr_t *ip_hdr = btod(pkt);
-
-			eth_output(pkt, arp_res->iface, ETHERTYPE_IP,
-				   &ip_hdr->dst);
+			eth_output(pkt, arp_res->iface, L3_PROTO_IP,
+				   &arp_res->ip);
+			arp_stats.sent++;
 			continue;
 		}
 		pkt_free(pkt);
+		arp_stats.timeouts++;
 	}
+	arp_nb_pkts -= arp_res->nb_pkts;
 	timer_del(&arp_res->tim);
 	list_del(&arp_res->list);
-	free(arp_res);
+	obj_pool_free(&arp_res_pool, arp_res);
 }
 
-static void arp_process_wait_list(uint32_t *ip, uint8_t delete)
+static void
+arp_process_wait_list(uint32_t *ip, const iface_t *iface, uint8_t delete)
 {
 	arp_res_t *arp_res;
 
-	if ((arp_res = arp_res_lookup(ip)) == NULL)
+	if ((arp_res = arp_res_lookup(ip, iface)) == NULL)
 		return;
 	__arp_process_wait_list(arp_res, delete);
 }
@@ -259,7 +415,7 @@ void arp_input(pkt_t *pkt, iface_t *iface)
 		}
 #endif
 		arp_add_entry(sha, spa, iface);
-		arp_process_wait_list((uint32_t *)spa, 0);
+		arp_process_wait_list((uint32_t *)spa, iface, 0);
 		break;
 
 	default:
@@ -274,7 +430,6 @@ void arp_input(pkt_t *pkt, iface_t *iface)
 void arp_retry_cb(void *arg)
 {
 	arp_res_t *arp_res = arg;
-	uint32_t ip;
 
 	arp_res->retries++;
 	if (arp_res->retries >= ARP_RETRIES) {
@@ -282,8 +437,40 @@ void arp_retry_cb(void *arg)
 		return;
 	}
 	timer_reschedule(&arp_res->tim, ARP_RETRY_TIMEOUT * 1000000);
-	ip = arp_res_get_ip(arp_res);
-	arp_output(arp_res->iface, ARPOP_REQUEST, broadcast_mac, (uint8_t *)&ip);
+	arp_output(arp_res->iface, ARPOP_REQUEST, broadcast_mac,
+		   (uint8_t *)&arp_res->ip);
+}
+
+static void arp_res_drop_oldest(arp_res_t *arp_res)
+{
+	pkt_t *pkt = LIST_FIRST_ENTRY(&arp_res->pkt_list, pkt_t, list);
+
+	list_del(&pkt->list);
+	pkt_free(pkt);
+	arp_res->nb_pkts--;
+	arp_nb_pkts--;
+	arp_stats.dropped++;
+}
+
+static void arp_res_queue(arp_res_t *arp_res, pkt_t *pkt)
+{
+	arp_res_t *oldest;
+
+	if (arp_res->nb_pkts >= CONFIG_ARP_QUEUE_LEN)
+		arp_res_drop_oldest(arp_res);
+	else if (arp_nb_pkts >= CONFIG_ARP_QUEUE_MAX) {
+		/* an unreachable neighbor cannot hold the whole pool */
+		LIST_FOR_EACH_ENTRY(oldest, &arp_wait_list, list) {
+			if (oldest->nb_pkts) {
+				arp_res_drop_oldest(oldest);
+				break;
+			}
+		}
+	}
+	list_add_tail(&pkt->list, &arp_res->pkt_list);
+	arp_res->nb_pkts++;
+	arp_nb_pkts++;
+	arp_stats.queued++;
 }
 
 void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface)
@@ -293,42 +480,55 @@ void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface)
 	ip_hdr_t *ip_hdr = btod(pkt);
 #endif
 
-	arp_output(iface, ARPOP_REQUEST, broadcast_mac, (uint8_t *)ip_dst);
+	if ((arp_res = arp_res_lookup(ip_dst, iface)) == NULL) {
+		if ((arp_res = obj_pool_alloc(&arp_res_pool)) == NULL) {
+			pkt_free(pkt);
+			arp_stats.dropped++;
+			return;
+		}
+		memset(&arp_res->tim, 0, sizeof(tim_t));
+		INIT_LIST_HEAD(&arp_res->list);
+		INIT_LIST_HEAD(&arp_res->pkt_list);
+		timer_init(&arp_res->tim);
+		arp_res->ip = *ip_dst;
+		arp_res->nb_pkts = 0;
+		arp_res->retries = 0;
+		arp_res->iface = iface;
+		timer_add(&arp_res->tim, ARP_RETRY_TIMEOUT * 1000000,
+			  arp_retry_cb, arp_res);
+		list_add_tail(&arp_res->list, &arp_wait_list);
+		arp_output(iface, ARPOP_REQUEST, broadcast_mac,
+			   (uint8_t *)ip_dst);
+	}
 
 #ifdef CONFIG_TCP_RETRANSMIT
+	/* tcp segments are retransmitted anyway */
 	if (ip_hdr->p == IPPROTO_TCP) {
 		pkt_free(pkt);
 		return;
 	}
 #endif
-	if ((arp_res = arp_res_lookup(ip_dst))) {
-		list_add_tail(&pkt->list, &arp_res->pkt_list);
-		return;
-	}
+	arp_res_queue(arp_res, pkt);
+}
 
-	if ((arp_res = malloc(sizeof(arp_res_t))) == NULL) {
-		pkt_free(pkt);
-		return;
-	}
-	memset(&arp_res->tim, 0, sizeof(tim_t));
-	INIT_LIST_HEAD(&arp_res->list);
-	INIT_LIST_HEAD(&arp_res->pkt_list);
-	timer_init(&arp_res->tim);
-	list_add_tail(&pkt->list, &arp_res->pkt_list);
-	arp_res->retries = 0;
-	arp_res->iface = iface;
-	timer_add(&arp_res->tim, ARP_RETRY_TIMEOUT * 1000000, arp_retry_cb,
-		  arp_res);
-	/* add a hash table on ip_dst if we have more RAM */
-	list_add_tail(&arp_res->list, &arp_wait_list);
+void arp_flush(void)
+{
+	arp_res_t *arp_res, *arp_res_tmp;
+
+	memset(&arp_entries, 0, sizeof(arp_entries));
+	LIST_FOR_EACH_ENTRY_SAFE(arp_res, arp_res_tmp, &arp_wait_list, list)
+		__arp_process_wait_list(arp_res, 1);
 }
 
-#ifdef CONFIG_ARP_EXPIRY
-static void arp_flush(void)
+unsigned arp_get_nb_pkts(void)
 {
-	/* TODO */
+	return arp_nb_pkts;
+}
+
+const arp_stats_t *arp_get_stats(void)
+{
+	return &arp_stats;
 }
-#endif
 
 #ifdef TEST
 arp_entries_t *arp_get_entries(void)
@@ -42,32 +42,73 @@ struct arp_hdr {
 
 typedef struct arp_hdr arp_hdr_t;
 
+#ifndef CONFIG_ARP_TABLE_SIZE
+#define CONFIG_ARP_TABLE_SIZE 2
+#endif
+
+/* number of hash buckets, must be a power of 2 */
+#ifndef CONFIG_ARP_HT_SIZE
+#define CONFIG_ARP_HT_SIZE CONFIG_ARP_TABLE_SIZE
+#endif
+
+/* entries are linked by index + 1, 0 ends a list */
+#if CONFIG_ARP_TABLE_SIZE < 255
+typedef uint8_t arp_idx_t;
+#else
+typedef uint16_t arp_idx_t;
+#endif
+
 typedef struct arp_entry {
-	uint32_t ip;
+	uint32_t ip;	/* 0 if unused */
 	uint8_t mac[ETHER_ADDR_LEN];
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-	iface_t *iface;
+	const iface_t *iface;
 #endif
 #ifdef CONFIG_ARP_EXPIRY
-	uint8_t updated; /* used by arp_timer */
+	uint32_t updated;	/* timer ticks of the last confirmation */
+	uint8_t probes;		/* refresh requests sent since */
 #endif
+	arp_idx_t next;		/* hash bucket */
+	arp_idx_t lru_prev;
+	arp_idx_t lru_next;
 } arp_entry_t;
 
-#ifndef CONFIG_ARP_TABLE_SIZE
-#define CONFIG_ARP_TABLE_SIZE 2
-#endif
-
 typedef struct arp_entries {
 	arp_entry_t entries[CONFIG_ARP_TABLE_SIZE];
-	uint8_t pos;
+	arp_idx_t ht[CONFIG_ARP_HT_SIZE];
+	arp_idx_t lru_head;	/* least recently used, evicted first */
+	arp_idx_t lru_tail;
+	arp_idx_t nb;		/* number of entries ever used */
 } arp_entries_t;
 
+/* packets awaiting the resolution of a neighbor */
+#ifndef CONFIG_ARP_QUEUE_LEN
+#define CONFIG_ARP_QUEUE_LEN 2
+#endif
+
+/* packets awaiting resolutions, all neighbors included */
+#ifndef CONFIG_ARP_QUEUE_MAX
+#define CONFIG_ARP_QUEUE_MAX 4
+#endif
+
+/* neighbors resolved simultaneously */
+#ifndef CONFIG_ARP_RES_MAX
+#define CONFIG_ARP_RES_MAX 4
+#endif
+
+typedef struct arp_stats {
+	uint16_t queued;
+	uint16_t sent;		/* queued packets sent once resolved */
+	uint16_t dropped;	/* queue overflows */
+	uint16_t timeouts;	/* queued packets of unresolved neighbors */
+} arp_stats_t;
+
 #ifdef CONFIG_IPV6
 typedef struct arp6_entry {
 	uint8_t ip[IP6_ADDR_LEN];
 	uint8_t mac[ETHER_ADDR_LEN];
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-	iface_t *iface;
+	const iface_t *iface;
 #endif
 } arp_entry_t;
 
@@ -86,16 +127,65 @@ extern uint8_t broadcast_mac[];
  */
 void arp_input(pkt_t *pkt, iface_t *iface);
 
-int arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t **iface);
+/** Look up a neighbor
+ *
+ * With CONFIG_MORE_THAN_ONE_INTERFACE, entries learnt on another
+ * interface are ignored. With CONFIG_ARP_EXPIRY, entries are dropped
+ * CONFIG_ARP_EXPIRY seconds after their last confirmation. During the
+ * last quarter of that time, they are still returned while unicast
+ * requests are sent to confirm them.
+ *
+ * @param[in]  ip     neighbor address
+ * @param[out] mac    neighbor hardware address
+ * @param[in]  iface  interface the neighbor is reached through
+ * @return 0 on success, -1 if the neighbor is unknown
+ */
+int arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t *iface);
 int arp_output(iface_t *iface, int op, const uint8_t *tha, const uint8_t *tpa);
+
+/** Add or refresh a neighbor
+ *
+ * The least recently used entry is replaced when the table is full.
+ *
+ * @param[in]  sha    neighbor hardware address
+ * @param[in]  spa    neighbor address
+ * @param[in]  iface  interface the neighbor has been seen on
+ */
 void
 arp_add_entry(const uint8_t *sha, const uint8_t *spa, const iface_t *iface);
+
+/** Delete all neighbors and pending resolutions
+ */
+void arp_flush(void);
 #ifdef CONFIG_IPV6
 static void arp6_add_entry(uint8_t *sha, uint8_t *spa, const iface_t *iface);
 #endif
 
+/** Queue a packet until its next hop is resolved
+ *
+ * A request is broadcast when the resolution starts. Up to
+ * CONFIG_ARP_QUEUE_LEN packets are queued per next hop and
+ * CONFIG_ARP_QUEUE_MAX in total. Beyond either limit, the oldest packet
+ * of the next hop, respectively of the oldest resolution, is dropped.
+ *
+ * @param[in] pkt     packet, pointing to its ip header
+ * @param[in] ip_dst  next hop address
+ * @param[in] iface   output interface
+ */
 void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface);
 
+/** Get number of packets awaiting resolutions
+ *
+ * @return number of packets
+ */
+unsigned arp_get_nb_pkts(void);
+
+/** Get resolution queue statistics
+ *
+ * @return statistics
+ */
+const arp_stats_t *arp_get_stats(void);
+
 #ifdef TEST
 arp_entries_t *arp_get_entries(void);
 #endif
@@ -34,6 +34,19 @@ CFLAGS += -DCONFIG_ETHERNET -DCONFIG_ARP
 endif
 
 SRC += if.c
+ifdef CONFIG_LOOPBACK
+ifeq ($(CONFIG_IP),)
+$(error CONFIG_IP is required for the loopback interface)
+endif
+SRC += lo.c
+CFLAGS += -DCONFIG_LOOPBACK
+endif
+ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+CFLAGS += -DCONFIG_MORE_THAN_ONE_INTERFACE
+ifdef CONFIG_IFACE_MAX
+CFLAGS += -DCONFIG_IFACE_MAX=$(CONFIG_IFACE_MAX)
+endif
+endif
 
 ifdef CONFIG_IP
 SRC += ip.c
@@ -41,9 +54,34 @@ CFLAGS += -DCONFIG_IP
 ifdef CONFIG_IP_TTL
 CFLAGS += -DCONFIG_IP_TTL=$(CONFIG_IP_TTL)
 endif
+ifdef CONFIG_IP_FORWARD
+ifeq ($(CONFIG_MORE_THAN_ONE_INTERFACE),)
+$(error CONFIG_MORE_THAN_ONE_INTERFACE is required for IP forwarding)
+endif
+CFLAGS += -DCONFIG_IP_FORWARD
+endif
+ifdef CONFIG_IP_FRAG
+SRC += ip-frag.c
+CFLAGS += -DCONFIG_IP_FRAG
+ifdef CONFIG_IP_FRAG_MAX_CTX
+CFLAGS += -DCONFIG_IP_FRAG_MAX_CTX=$(CONFIG_IP_FRAG_MAX_CTX)
+endif
+ifdef CONFIG_IP_FRAG_MAX_FRAGS
+CFLAGS += -DCONFIG_IP_FRAG_MAX_FRAGS=$(CONFIG_IP_FRAG_MAX_FRAGS)
+endif
+ifdef CONFIG_IP_FRAG_TIMEOUT
+CFLAGS += -DCONFIG_IP_FRAG_TIMEOUT=$(CONFIG_IP_FRAG_TIMEOUT)
+endif
+endif
 endif
 
 SRC += tr-chksum.c ../sys/chksum.c route.c
+ifdef CONFIG_ROUTE_TABLE_SIZE
+CFLAGS += -DCONFIG_ROUTE_TABLE_SIZE=$(CONFIG_ROUTE_TABLE_SIZE)
+endif
+ifdef CONFIG_ROUTE_CACHE_SIZE
+CFLAGS += -DCONFIG_ROUTE_CACHE_SIZE=$(CONFIG_ROUTE_CACHE_SIZE)
+endif
 
 ifdef CONFIG_PKT_NB_MAX
 CFLAGS += -DCONFIG_PKT_NB_MAX=$(CONFIG_PKT_NB_MAX)
@@ -55,9 +93,16 @@ CFLAGS += -DCONFIG_PKT_MEM_POOL_EMERGENCY_PKT=$(CONFIG_PKT_MEM_POOL_EMERGENCY_PK
 endif
 endif
 
+ifdef CONFIG_CSUM_OFFLOAD
+CFLAGS += -DCONFIG_CSUM_OFFLOAD
+endif
+
 ifdef CONFIG_ICMP
 SRC += icmp.c
 CFLAGS += -DCONFIG_ICMP
+ifdef CONFIG_ICMP_ERROR_RATE
+CFLAGS += -DCONFIG_ICMP_ERROR_RATE=$(CONFIG_ICMP_ERROR_RATE)
+endif
 endif
 
 ifdef CONFIG_UDP
@@ -74,6 +119,9 @@ $(error CONFIG_EVENT is required for DNS)
 endif
 SRC += dns.c
 CFLAGS += -DCONFIG_DNS
+ifdef CONFIG_DNS_MAX_QUERIES
+CFLAGS += -DCONFIG_DNS_MAX_QUERIES=$(CONFIG_DNS_MAX_QUERIES)
+endif
 endif
 
 ifdef CONFIG_TCP
@@ -83,22 +131,102 @@ ifdef CONFIG_TCP_CLIENT
 CFLAGS += -DCONFIG_TCP_CLIENT
 endif
 CFLAGS += -DCONFIG_TCP_MAX_CONNS=$(CONFIG_TCP_MAX_CONNS)
+ifdef CONFIG_TCP_MAX_LISTENS
+CFLAGS += -DCONFIG_TCP_MAX_LISTENS=$(CONFIG_TCP_MAX_LISTENS)
+endif
+ifdef CONFIG_TCP_OOO_MAX
+CFLAGS += -DCONFIG_TCP_OOO_MAX=$(CONFIG_TCP_OOO_MAX)
+endif
+ifdef CONFIG_TCP_DELAYED_ACK
+CFLAGS += -DCONFIG_TCP_DELAYED_ACK
+ifdef CONFIG_TCP_DELAYED_ACK_TIMEOUT
+CFLAGS += -DCONFIG_TCP_DELAYED_ACK_TIMEOUT=$(CONFIG_TCP_DELAYED_ACK_TIMEOUT)
+endif
+endif
+ifdef CONFIG_TCP_NAGLE
+CFLAGS += -DCONFIG_TCP_NAGLE
+endif
 endif
 ifdef CONFIG_TCP_RETRANSMIT
+SRC += tcp-cc.c
 CFLAGS += -DCONFIG_TCP_RETRANSMIT
 ifdef CONFIG_TCP_RETRANSMIT_TIMEOUT
 CFLAGS += -DCONFIG_TCP_RETRANSMIT_TIMEOUT=$(CONFIG_TCP_RETRANSMIT_TIMEOUT)
 else
 CFLAGS += -DCONFIG_TCP_RETRANSMIT_TIMEOUT=3000
 endif
+ifdef CONFIG_TCP_RTO_MIN
+CFLAGS += -DCONFIG_TCP_RTO_MIN=$(CONFIG_TCP_RTO_MIN)
+endif
+ifdef CONFIG_TCP_RTO_MAX
+CFLAGS += -DCONFIG_TCP_RTO_MAX=$(CONFIG_TCP_RTO_MAX)
+endif
+ifdef CONFIG_TCP_RETRANSMIT_RETRIES
+CFLAGS += -DCONFIG_TCP_RETRANSMIT_RETRIES=$(CONFIG_TCP_RETRANSMIT_RETRIES)
+endif
+ifdef CONFIG_TCP_CC_NEWRENO
+CFLAGS += -DCONFIG_TCP_CC_NEWRENO
+endif
+ifdef CONFIG_TCP_CC_COMPACT
+CFLAGS += -DCONFIG_TCP_CC_COMPACT
+endif
+endif
+ifdef CONFIG_TCP_SACK
+ifeq ($(CONFIG_TCP_RETRANSMIT),)
+$(error CONFIG_TCP_RETRANSMIT is required for SACK)
+endif
+CFLAGS += -DCONFIG_TCP_SACK
+endif
+ifdef CONFIG_TCP_WSCALE
+CFLAGS += -DCONFIG_TCP_WSCALE
+endif
+ifdef CONFIG_TCP_TIMESTAMPS
+CFLAGS += -DCONFIG_TCP_TIMESTAMPS
+endif
+ifdef CONFIG_TCP_SYN_COOKIES
+CFLAGS += -DCONFIG_TCP_SYN_COOKIES
+endif
+ifdef CONFIG_TCP_SYN_TIMEOUT
+CFLAGS += -DCONFIG_TCP_SYN_TIMEOUT=$(CONFIG_TCP_SYN_TIMEOUT)
+endif
+ifdef CONFIG_TCP_KEEPALIVE
+ifeq ($(CONFIG_TCP_RETRANSMIT),)
+$(error CONFIG_TCP_RETRANSMIT is required for KEEPALIVE)
+endif
+CFLAGS += -DCONFIG_TCP_KEEPALIVE
+ifdef CONFIG_TCP_KEEPALIVE_IDLE
+CFLAGS += -DCONFIG_TCP_KEEPALIVE_IDLE=$(CONFIG_TCP_KEEPALIVE_IDLE)
+endif
+ifdef CONFIG_TCP_KEEPALIVE_INTVL
+CFLAGS += -DCONFIG_TCP_KEEPALIVE_INTVL=$(CONFIG_TCP_KEEPALIVE_INTVL)
+endif
+ifdef CONFIG_TCP_KEEPALIVE_PROBES
+CFLAGS += -DCONFIG_TCP_KEEPALIVE_PROBES=$(CONFIG_TCP_KEEPALIVE_PROBES)
+endif
 endif
 
 ifdef CONFIG_ARP_TABLE_SIZE
 CFLAGS += -DCONFIG_ARP_TABLE_SIZE=$(CONFIG_ARP_TABLE_SIZE)
 endif
 
+ifdef CONFIG_ARP_HT_SIZE
+CFLAGS += -DCONFIG_ARP_HT_SIZE=$(CONFIG_ARP_HT_SIZE)
+endif
+
 ifdef CONFIG_ARP_EXPIRY
-CFLAGS += -DCONFIG_ARP_EXPIRY
+CFLAGS += -DCONFIG_ARP_EXPIRY=$(CONFIG_ARP_EXPIRY)
+endif
+
+ifdef CONFIG_ARP_QUEUE_LEN
+CFLAGS += -DCONFIG_ARP_QUEUE_LEN=$(CONFIG_ARP_QUEUE_LEN)
+endif
+
+ifdef CONFIG_ARP_QUEUE_MAX
+CFLAGS += -DCONFIG_ARP_QUEUE_MAX=$(CONFIG_ARP_QUEUE_MAX)
+endif
+
+ifdef CONFIG_ARP_RES_MAX
+CFLAGS += -DCONFIG_ARP_RES_MAX=$(CONFIG_ARP_RES_MAX)
 endif
 
 ifeq "$(or $(CONFIG_UDP), $(CONFIG_TCP))" "y"
@@ -107,6 +235,9 @@ CFLAGS += -DCONFIG_TRANSPORT_MAX_HT=$(CONFIG_TRANSPORT_MAX_HT)
 CFLAGS += -DCONFIG_TCP_SYN_TABLE_SIZE=$(CONFIG_TCP_SYN_TABLE_SIZE)
 CFLAGS += -DCONFIG_EPHEMERAL_PORT_START=$(CONFIG_EPHEMERAL_PORT_START)
 CFLAGS += -DCONFIG_EPHEMERAL_PORT_END=$(CONFIG_EPHEMERAL_PORT_END)
+ifdef CONFIG_MAX_SOCKS
+CFLAGS += -DCONFIG_MAX_SOCKS=$(CONFIG_MAX_SOCKS)
+endif
 endif
 
 ifdef CONFIG_HT_STORAGE
@@ -125,6 +256,15 @@ endif
 ifdef CONFIG_EVENT
 CFLAGS += -DCONFIG_EVENT
 SRC += event.c
+ifdef CONFIG_EVENT_POLL
+CFLAGS += -DCONFIG_EVENT_POLL
+endif
+ifdef CONFIG_EVENT_RESUME_BUDGET
+CFLAGS += -DCONFIG_EVENT_RESUME_BUDGET=$(CONFIG_EVENT_RESUME_BUDGET)
+endif
+ifdef CONFIG_EVENT_RESUME_QUOTA
+CFLAGS += -DCONFIG_EVENT_RESUME_QUOTA=$(CONFIG_EVENT_RESUME_QUOTA)
+endif
 endif
 
 ifdef CONFIG_SWEN
@@ -26,6 +26,7 @@
 #include <log.h>
 #include <sys/timer.h>
 #include <sys/list.h>
+#include <sys/obj-pool.h>
 #include "dns.h"
 #include "socket.h"
 
@@ -74,10 +75,11 @@ typedef struct dns_query_ctx {
 	tim_t timer;
 	uint16_t tr_id;
 	void (*cb)(uint32_t ip);
-	uint8_t name_len;
-	/* space for name must be here */
 } dns_query_ctx_t;
 
+STATIC_OBJ_POOL_DECL(dns_query_ctx_pool, dns_query_ctx_t,
+		     CONFIG_DNS_MAX_QUERIES);
+
 #define DNS_QUERY_TIMEOUT 10000UL /* millisecs */
 #define DNS_TYPE_LEN 2
 #define DNS_CLASS_LEN 2
@@ -87,7 +89,7 @@ static void dns_query_ctx_free(dns_query_ctx_t *ctx)
 	sock_info_close(&ctx->sock_info);
 	list_del(&ctx->list);
 	timer_del(&ctx->timer);
-	free(ctx);
+	obj_pool_free(&dns_query_ctx_pool, ctx);
 }
 
 static void dns_query_timeout_cb(void *arg)
@@ -207,16 +209,14 @@ static void ev_dns_cb(event_t *ev, uint8_t events)
 	pkt_free(pkt);
 }
 
-static int dns_query_ctx_init(dns_query_ctx_t *ctx, const sbuf_t *sb)
+static int dns_query_ctx_init(dns_query_ctx_t *ctx)
 {
 	memset(ctx, 0, sizeof(dns_query_ctx_t));
 	if (sock_info_init(&ctx->sock_info, SOCK_DGRAM) < 0)
 		return -1;
 	socket_event_register(&ctx->sock_info, EV_READ, ev_dns_cb);
-	ctx->name_len = sb->len;
 	ctx->tr_id = rand();
 	INIT_LIST_HEAD(&ctx->list);
-	memcpy(ctx + 1, sb->data, sb->len);
 	timer_add(&ctx->timer, DNS_QUERY_TIMEOUT * 1000, dns_query_timeout_cb,
 		  ctx);
 	return 0;
@@ -252,10 +252,10 @@ int dns_resolve(const sbuf_t *name, void (*cb)(uint32_t ip))
 	dns_query_len = sizeof(dns_query_t) + name->len + 2 +
 		DNS_TYPE_LEN  + DNS_CLASS_LEN;
 	dns = alloca(dns_query_len);
-	if ((ctx = malloc(sizeof(dns_query_ctx_t) + name->len)) == NULL)
+	if ((ctx = obj_pool_alloc(&dns_query_ctx_pool)) == NULL)
 		return -1;
-	if (dns_query_ctx_init(ctx, name) < 0) {
-		free(ctx);
+	if (dns_query_ctx_init(ctx) < 0) {
+		obj_pool_free(&dns_query_ctx_pool, ctx);
 		return -1;
 	}
 
@@ -27,6 +27,11 @@
 #include <stdint.h>
 #include "../sys/buf.h"
 
+/* queries in progress */
+#ifndef CONFIG_DNS_MAX_QUERIES
+#define CONFIG_DNS_MAX_QUERIES 2
+#endif
+
 void dns_init(uint32_t ip);
 int dns_resolve(const sbuf_t *name, void (*cb)(uint32_t ip));
 
@@ -34,6 +34,9 @@ static inline void __eth_input(pkt_t *pkt, iface_t *iface)
 	if ((iface->flags & IF_UP) == 0)
 		goto unsupported;
 
+#ifdef CONFIG_IFACE_STATS
+	iface->rx_packets++;
+#endif
 	eh = btod(pkt);
 #ifdef CONFIG_PROMISC
 	if (iface->flags & IFF_PROMISC) {
@@ -59,6 +62,9 @@ static inline void __eth_input(pkt_t *pkt, iface_t *iface)
 		break;
 	}
  unsupported:
+#ifdef CONFIG_IFACE_STATS
+	iface->rx_dropped++;
+#endif
 	pkt_free(pkt);
 }
 
@@ -83,7 +89,7 @@ eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
 
 	switch (type) {
 	case L3_PROTO_IP:
-		if (arp_find_entry(dst, &mac_dst, &iface) < 0) {
+		if (arp_find_entry(dst, &mac_dst, iface) < 0) {
 			arp_resolve(out, dst, iface);
 			return 0;
 		}
@@ -105,9 +111,14 @@ eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
 		eh->src[i] = iface->hw_addr[i];
 	}
 	eh->type = l3_proto;
+#ifdef CONFIG_IFACE_STATS
+	iface->tx_packets++;
+#endif
 	return iface->send(iface, out);
  end:
 	pkt_free(out);
-	/* TODO update iface stats */
+#ifdef CONFIG_IFACE_STATS
+	iface->tx_dropped++;
+#endif
 	return -1;
 }
@@ -26,67 +26,199 @@
 #include "pkt-mempool.h"
 
 static LIST_HEAD(retry_list);
+static uint8_t resume_scheduled;
+
+/* update the events available, return those wanted */
+static uint8_t event_update(event_t *ev)
+{
+	assert(ev->available <= (EV_READ|EV_WRITE|EV_ERROR|EV_HUNGUP));
+	assert(ev->wanted <= (EV_READ|EV_WRITE|EV_ERROR|EV_HUNGUP));
+
+	if (list_empty(ev->rx_queue))
+		ev->available &= ~EV_READ;
+	if (ev->available & (EV_HUNGUP|EV_ERROR))
+		ev->available &= ~EV_WRITE;
+	else if (pkt_pool_get_nb_free() == 0) {
+		ev->available &= ~EV_WRITE;
+		if ((ev->wanted & EV_WRITE) && list_empty(&ev->list))
+			list_add_tail(&ev->list, &retry_list);
+	} else
+		ev->available |= EV_WRITE;
+	ev->available &= ~ev->blocked;
+	return ev->available & ev->wanted;
+}
 
 static void event_cb(void *arg)
 {
 	event_t *ev = arg;
+	uint8_t events;
+
+	while ((ev->available & ev->wanted) && (events = event_update(ev)))
+		ev->cb(ev, events);
+}
 
-	while (ev->available && (ev->available & ev->wanted)) {
-		uint8_t events;
+#ifdef CONFIG_EVENT_POLL
+static void event_poll_cb(void *arg)
+{
+	event_poll_t *poll = arg;
 
-		assert(ev->available <= (EV_READ|EV_WRITE|EV_ERROR|EV_HUNGUP));
-		assert(ev->wanted <= (EV_READ|EV_WRITE|EV_ERROR|EV_HUNGUP));
+	poll->scheduled = 0;
+	poll->cb(poll);
+	if (!list_empty(&poll->ready) && !poll->scheduled)
+		poll->scheduled = schedule_task(event_poll_cb, poll) == 0;
+}
 
-		if (list_empty(ev->rx_queue))
-			ev->available &= ~EV_READ;
-		if (ev->available & (EV_HUNGUP|EV_ERROR))
-			ev->available &= ~EV_WRITE;
-		else if (pkt_pool_get_nb_free() == 0) {
-			ev->available &= ~EV_WRITE;
-			if ((ev->wanted & EV_WRITE) && list_empty(&ev->list))
-				list_add_tail(&ev->list, &retry_list);
+/* queue ev on the ready list of its poll, a single task drains it */
+static void event_poll_ready(event_t *ev)
+{
+	event_poll_t *poll = ev->poll;
+
+	if (list_empty(&ev->ready))
+		list_add_tail(&ev->ready, &poll->ready);
+	if (poll->cb && !poll->scheduled)
+		poll->scheduled = schedule_task(event_poll_cb, poll) == 0;
+}
+
+void event_poll_add(event_poll_t *poll, event_t *ev, uint8_t flags)
+{
+	event_poll_del(ev);
+	ev->poll = poll;
+	ev->poll_flags = flags;
+	ev->cb = NULL;
+	if (ev->available & ev->wanted)
+		event_poll_ready(ev);
+}
+
+void event_poll_del(event_t *ev)
+{
+	if (ev->poll == NULL)
+		return;
+	if (!list_empty(&ev->ready))
+		list_del_init(&ev->ready);
+	ev->poll = NULL;
+}
+
+int event_poll_wait(event_poll_t *poll, event_ready_t *ready, int max)
+{
+	LIST_HEAD(reported);
+	int n = 0;
+
+	while (n < max && !list_empty(&poll->ready)) {
+		event_t *ev = LIST_FIRST_ENTRY(&poll->ready, event_t, ready);
+		uint8_t events = event_update(ev);
+
+		if (events == 0 || (ev->poll_flags & EV_POLL_EDGE)) {
+			list_del_init(&ev->ready);
+			if (events == 0)
+				continue;
 		} else
-			ev->available |= EV_WRITE;
-		events = ev->available & ev->wanted;
-		if (events)
-			ev->cb(ev, events);
+			list_move_tail(&ev->ready, &reported);
+		ready[n].ev = ev;
+		ready[n].events = events;
+		n++;
 	}
+	/* level triggered events are reported again after the others */
+	list_move_tail_list(&poll->ready, &reported);
+	return n;
 }
+#endif
 
 void event_schedule_event(event_t *ev, uint8_t events)
 {
 	assert(events);
+#ifdef CONFIG_EVENT_POLL
+	if (ev->cb == NULL && ev->poll == NULL)
+		return;
+#else
 	if (ev->cb == NULL)
 		return;
+#endif
 
 	ev->available |= events;
 	if (events & (EV_ERROR | EV_HUNGUP)) {
-		/* EV_WRITE will be removed in event_cb() */
+		/* EV_WRITE will be removed in event_update() */
 		if (!list_empty(&ev->list))
-			__list_del_entry(&ev->list);
+			list_del_init(&ev->list);
+	}
+
+	if ((ev->wanted & events) == 0)
+		return;
+#ifdef CONFIG_EVENT_POLL
+	if (ev->poll) {
+		event_poll_ready(ev);
+		return;
 	}
+#endif
+	schedule_task(event_cb, ev);
+}
 
-	if (ev->wanted & events)
-		schedule_task(event_cb, ev);
+void event_unblock(event_t *ev, uint8_t events)
+{
+	if ((ev->blocked & events) == 0)
+		return;
+	ev->blocked &= ~events;
+	event_schedule_event(ev, events);
 }
 
 void event_unregister(event_t *ev)
 {
-	ev->available = ev->wanted = 0;
+	ev->available = ev->wanted = ev->blocked = 0;
 
 	if (!list_empty(&ev->list))
-		__list_del_entry(&ev->list);
+		list_del_init(&ev->list);
+#ifdef CONFIG_EVENT_POLL
+	event_poll_del(ev);
+#endif
 }
 
-void event_resume_write_events(void)
+/* call the writer back until it takes its quota of packets, it goes back
+ * to the end of the queue if it wants more */
+static void event_resume(event_t *ev)
 {
-	while (pkt_pool_get_nb_free() && !list_empty(&retry_list)) {
+	int nb_free = pkt_pool_get_nb_free();
+	uint8_t events;
+
+	while ((ev->available & ev->wanted) && (events = event_update(ev))) {
+		ev->cb(ev, events);
+		if (nb_free - pkt_pool_get_nb_free()
+		    >= CONFIG_EVENT_RESUME_QUOTA) {
+			if ((ev->wanted & EV_WRITE) && list_empty(&ev->list))
+				list_add_tail(&ev->list, &retry_list);
+			return;
+		}
+	}
+}
+
+static void event_resume_cb(void *arg)
+{
+	uint8_t budget = CONFIG_EVENT_RESUME_BUDGET;
+
+	(void)arg;
+	while (budget-- && pkt_pool_get_nb_free()
+	       && !list_empty(&retry_list)) {
 		event_t *ev = LIST_FIRST_ENTRY(&retry_list, event_t, list);
 
-		__list_del_entry(&ev->list);
-		if (ev->wanted & EV_WRITE) {
-			ev->available |= EV_WRITE;
-			event_cb(ev);
+		list_del_init(&ev->list);
+		if ((ev->wanted & EV_WRITE) == 0)
+			continue;
+		ev->available |= EV_WRITE;
+#ifdef CONFIG_EVENT_POLL
+		if (ev->poll) {
+			event_poll_ready(ev);
+			continue;
 		}
+#endif
+		event_resume(ev);
 	}
+	/* the other tasks run before the next writers */
+	resume_scheduled = 0;
+	event_resume_write_events();
+}
+
+void event_resume_write_events(void)
+{
+	if (resume_scheduled || list_empty(&retry_list)
+	    || pkt_pool_get_nb_free() == 0)
+		return;
+	resume_scheduled = schedule_task(event_resume_cb, NULL) == 0;
 }
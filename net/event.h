@@ -43,25 +43,94 @@ typedef enum event_flags {
 
 #define EV_ALL (EV_READ | EV_WRITE | EV_ERROR | EV_HUNGUP)
 
+/* writers resumed per run of the task handing out freed packets */
+#ifndef CONFIG_EVENT_RESUME_BUDGET
+#define CONFIG_EVENT_RESUME_BUDGET 4
+#endif
+
+/* packets a resumed writer can take before the next one gets its turn */
+#ifndef CONFIG_EVENT_RESUME_QUOTA
+#define CONFIG_EVENT_RESUME_QUOTA 2
+#endif
+
+#ifdef CONFIG_EVENT_POLL
+/* event_poll_add() flags */
+#define EV_POLL_EDGE 0x01 /* report events once, when they occur */
+
+struct event_poll;
+#endif
+
 typedef struct event {
 	void (*cb)(struct event *event_data, uint8_t events);
 	uint8_t wanted;
 	uint8_t available;
+	uint8_t blocked;	/* events held back by the event owner */
 	list_t list;
 	list_t *rx_queue;
+#ifdef CONFIG_EVENT_POLL
+	struct event_poll *poll;
+	list_t ready;		/* entry in the ready list of poll */
+	uint8_t poll_flags;
+#endif
 } event_t;
 
+#ifdef CONFIG_EVENT_POLL
+typedef struct event_poll {
+	list_t ready;		/* events to report */
+	void (*cb)(struct event_poll *poll);
+	uint8_t scheduled;
+} event_poll_t;
+
+typedef struct event_ready {
+	event_t *ev;
+	uint8_t events;
+} event_ready_t;
+#endif
+
 void event_schedule_event(event_t *ev, uint8_t events);
 void event_call(event_t *ev, uint8_t events);
 void event_set(event_t *ev, uint8_t events,
 	       void (*ev_cb)(event_t *ev, uint8_t events));
 void event_schedule_event_error(event_t *event);
+
+/** Resume the writers waiting for free packets
+ *
+ * Called when packets are freed. The writers are resumed in turn from a
+ * task, CONFIG_EVENT_RESUME_BUDGET per run, and each of them gets at most
+ * CONFIG_EVENT_RESUME_QUOTA packets before going back to the end of the
+ * queue.
+ */
 void event_resume_write_events(void);
 
+/** Report events again
+ *
+ * @param[in] ev      event
+ * @param[in] events  events previously blocked with event_block()
+ */
+void event_unblock(event_t *ev, uint8_t events);
+
 static inline void event_init(event_t *ev)
 {
-	ev->wanted = ev->available = 0;
+	ev->wanted = ev->available = ev->blocked = 0;
 	INIT_LIST_HEAD(&ev->list);
+#ifdef CONFIG_EVENT_POLL
+	ev->poll = NULL;
+	INIT_LIST_HEAD(&ev->ready);
+#endif
+}
+
+/** Do not report events until event_unblock() is called
+ *
+ * The event owner uses it when it cannot make progress, eg: a TCP
+ * connection with a closed send window blocks EV_WRITE.
+ *
+ * @param[in] ev      event
+ * @param[in] events  events to hold back
+ */
+static inline void event_block(event_t *ev, uint8_t events)
+{
+	ev->blocked |= events;
+	ev->available &= ~events;
 }
 
 static inline void event_set_mask(event_t *ev, uint8_t events)
@@ -86,4 +155,54 @@ event_register(event_t *ev, uint8_t events, list_t *rx_queue,
 }
 
 void event_unregister(event_t *ev);
+
+#ifdef CONFIG_EVENT_POLL
+/** Initialize an event poll
+ *
+ * The events of the poll members are collected in a ready list instead
+ * of scheduling a task per event. A single task runs cb when the list
+ * fills, however many members are ready.
+ *
+ * @param[in] poll  event poll
+ * @param[in] cb    function draining the poll with event_poll_wait(),
+ *                  NULL if the application calls it from its main loop
+ */
+static inline void
+event_poll_init(event_poll_t *poll, void (*cb)(event_poll_t *poll))
+{
+	INIT_LIST_HEAD(&poll->ready);
+	poll->cb = cb;
+	poll->scheduled = 0;
+}
+
+/** Add an event to a poll
+ *
+ * The event is then registered with a NULL callback, its events are
+ * reported by event_poll_wait(). They are reported as long as they are
+ * available unless flags has EV_POLL_EDGE.
+ *
+ * @param[in] poll   event poll
+ * @param[in] ev     event
+ * @param[in] flags  EV_POLL_EDGE or 0
+ */
+void event_poll_add(event_poll_t *poll, event_t *ev, uint8_t flags);
+
+/** Remove an event from its poll
+ *
+ * @param[in] ev  event
+ */
+void event_poll_del(event_t *ev);
+
+/** Get the ready events of a poll
+ *
+ * The events left are reported by the next call. The poll callback runs
+ * again while level triggered events are available.
+ *
+ * @param[in]  poll   event poll
+ * @param[out] ready  ready events and what they are ready for
+ * @param[in]  max    size of ready
+ * @return number of ready events
+ */
+int event_poll_wait(event_poll_t *poll, event_ready_t *ready, int max);
+#endif
 #endif
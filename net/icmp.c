@@ -23,6 +23,7 @@
 */
 
 #include <sys/chksum.h>
+#include <sys/timer.h>
 #include "icmp.h"
 #include "eth.h"
 #include "ip.h"
@@ -52,38 +53,110 @@ icmp_output(pkt_t *out, iface_t *iface, int type, int code, uint16_t id,
 	return ip_output(out, iface, ip_flags);
 }
 
+#define ICMP_ERROR_TICKS						\
+	(1000000UL / CONFIG_TIMER_RESOLUTION_US / CONFIG_ICMP_ERROR_RATE)
+
+static uint32_t icmp_error_ticks;
+static uint8_t icmp_error_tokens = CONFIG_ICMP_ERROR_RATE;
+
+/* token bucket refilled by CONFIG_ICMP_ERROR_RATE tokens per second */
+static int icmp_error_rate_limit(void)
+{
+	uint32_t tokens = (timer_ticks - icmp_error_ticks) / ICMP_ERROR_TICKS;
+
+	if (tokens) {
+		icmp_error_ticks += tokens * ICMP_ERROR_TICKS;
+		tokens += icmp_error_tokens;
+		icmp_error_tokens = MIN(tokens, CONFIG_ICMP_ERROR_RATE);
+	}
+	if (icmp_error_tokens == 0)
+		return -1;
+	icmp_error_tokens--;
+	return 0;
+}
+
+void icmp_error(const ip_hdr_t *ip, iface_t *iface, uint8_t type,
+		uint8_t code, uint16_t mtu)
+{
+	uint16_t ip_hdr_len = ip->hl * 4;
+	uint16_t len = ntohs(ip->len);
+	ip_hdr_t *ip_hdr_out;
+	pkt_t *out;
+	buf_t data;
+
+	if (ip->p == IPPROTO_ICMP) {
+		const icmp_hdr_t *icmp_hdr;
+
+		if (len <= ip_hdr_len)
+			return;
+		icmp_hdr = (const icmp_hdr_t *)((uint8_t *)ip + ip_hdr_len);
+		if (icmp_hdr->type != ICMP_ECHO
+		    && icmp_hdr->type != ICMP_ECHOREPLY)
+			return;
+	}
+	if (ntohs(ip->off) & IP_OFFMASK)
+		return;
+	if (icmp_error_rate_limit() < 0 || (out = pkt_alloc()) == NULL)
+		return;
+
+	buf_init(&data, (void *)ip, MIN(MAX_ICMP_DATA_SIZE, len));
+	pkt_adj(out, (int)sizeof(eth_hdr_t));
+	ip_hdr_out = btod(out);
+	ip_hdr_out->dst = ip->src;
+	ip_hdr_out->src = ip->dst;
+	ip_hdr_out->p = IPPROTO_ICMP;
+	pkt_adj(out, (int)sizeof(ip_hdr_t));
+
+	icmp_output(out, iface, type, code, 0, htons(mtu), &data, IP_DF);
+}
+
 void icmp_input(pkt_t *pkt, iface_t *iface)
 {
 	icmp_hdr_t *icmp_hdr;
 	ip_hdr_t *ip = btod(pkt);
 	ip_hdr_t *ip2;
 	buf_t id_data;
-	pkt_t *out;
+	uint16_t ip_hdr_len = ip->hl * 4;
+	uint16_t icmp_len = ntohs(ip->len) - ip_hdr_len;
 
 	/* XXX make sure pkt_adj is the same in all *_output() functions */
-	pkt_adj(pkt, ip->hl * 4);
+	pkt_adj(pkt, ip_hdr_len);
 
 	icmp_hdr = btod(pkt);
+	if (pkt_len(pkt) < (int)sizeof(icmp_hdr_t) || icmp_len > pkt_len(pkt))
+		goto end;
 	pkt_adj(pkt, sizeof(icmp_hdr_t));
 	buf_init(&id_data, icmp_hdr->id_data, pkt_len(pkt));
 
 	switch (icmp_hdr->type) {
-	case ICMP_ECHO:
-		if ((out = pkt_alloc()) == NULL) {
-			/* inc stats */
-			pkt_free(pkt);
-			return;
-		}
-		pkt_adj(out, (int)sizeof(eth_hdr_t));
-		ip2 = btod(out);
-		ip2->dst = ip->src;
-		ip2->src = ip->dst;
+	case ICMP_ECHO: {
+		void *tmp = icmp_hdr;
+		uint16_t *type_code = tmp;
+		uint16_t old_type_code = *type_code;
+		uint32_t ip_dst = ip->src;
+		/* reply from the address the request was sent to */
+		uint32_t ip_src = ip->dst;
+
+		/* the request is turned into a reply in place. Only the type
+		 * changes so the checksum is updated rather than computed
+		 * over the whole payload.
+		 */
+		icmp_hdr->type = ICMP_ECHOREPLY;
+		icmp_hdr->cksum = cksum_update16(icmp_hdr->cksum, old_type_code,
+						 *type_code);
+
+		/* drop link layer padding */
+		pkt_adj(pkt, -(int)sizeof(icmp_hdr_t));
+		pkt->buf.len = icmp_len;
+
+		/* ip options are not echoed */
+		pkt_adj(pkt, -(int)sizeof(ip_hdr_t));
+		ip2 = btod(pkt);
+		ip2->dst = ip_dst;
 		ip2->p = IPPROTO_ICMP;
-		/* XXX adj */
-		pkt_adj(out, (int)sizeof(ip_hdr_t));
-		icmp_output(out, iface, ICMP_ECHOREPLY, 0, icmp_hdr->id,
-			    icmp_hdr->seq, &id_data, 0);
-		break;
+		__ip_output(pkt, iface, ip_src, 0);
+		return;
+	}
 	case ICMP_ECHOREPLY:
 		break;
 
@@ -107,5 +180,6 @@ void icmp_input(pkt_t *pkt, iface_t *iface)
 		/* inc stats */
 		break;
 	}
+ end:
 	pkt_free(pkt);
 }
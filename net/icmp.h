@@ -26,6 +26,7 @@
 #define _ICMP_H_
 
 #include "config.h"
+#include "ip.h"
 
 struct icmp {
 	uint8_t   type;  /* type of message */
@@ -41,7 +42,27 @@ typedef struct icmp icmp_hdr_t;
 #define MAX_ICMP_DATA_SIZE (int)(CONFIG_PKT_SIZE - sizeof(eth_hdr_t) \
 				 - sizeof(ip_hdr_t) - sizeof(icmp_hdr_t))
 
+/* maximum number of icmp errors sent per second */
+#ifndef CONFIG_ICMP_ERROR_RATE
+#define CONFIG_ICMP_ERROR_RATE 10
+#endif
+
 void icmp_input(pkt_t *pkt, iface_t *iface);
+
+/** Report an error about a received datagram
+ *
+ * The datagram is quoted in the error message. Errors are not sent
+ * about icmp errors nor about fragments other than the first one and
+ * are rate limited to CONFIG_ICMP_ERROR_RATE per second.
+ *
+ * @param[in] ip     ip header of the datagram
+ * @param[in] iface  interface the datagram was received from
+ * @param[in] type   icmp type
+ * @param[in] code   icmp code
+ * @param[in] mtu    next hop MTU for ICMP_UNREACH_NEEDFRAG, 0 otherwise
+ */
+void icmp_error(const ip_hdr_t *ip, iface_t *iface, uint8_t type,
+		uint8_t code, uint16_t mtu);
 int
 icmp_output(pkt_t *out, iface_t *iface, int type, int code,
 	    uint16_t id, uint16_t seq, const buf_t *id_data, uint16_t ip_flags);
@@ -30,8 +30,64 @@
 #if defined CONFIG_RF_SENDER || defined CONFIG_RF_RECEIVER
 #include "swen.h"
 #endif
+#ifdef CONFIG_LOOPBACK
+#include "lo.h"
+#endif
 #include <sys/scheduler.h>
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+static iface_t *ifaces[CONFIG_IFACE_MAX];
+static uint8_t if_nb;
+
+static void if_register(iface_t *iface)
+{
+	uint8_t i;
+
+	for (i = 0; i < if_nb; i++) {
+		if (ifaces[i] == iface)
+			return;
+	}
+	/* CONFIG_IFACE_MAX is too small */
+	if (if_nb >= CONFIG_IFACE_MAX)
+		__abort();
+	ifaces[if_nb++] = iface;
+}
+
+void if_remove(iface_t *iface)
+{
+	uint8_t i;
+
+	for (i = 0; i < if_nb; i++) {
+		if (ifaces[i] != iface)
+			continue;
+		if_nb--;
+		for (; i < if_nb; i++)
+			ifaces[i] = ifaces[i + 1];
+		return;
+	}
+}
+
+iface_t *if_get(uint8_t idx)
+{
+	return idx < if_nb ? ifaces[idx] : NULL;
+}
+
+#ifdef CONFIG_IP
+iface_t *if_get_by_addr(uint32_t addr)
+{
+	uint8_t i;
+
+	for (i = 0; i < if_nb; i++) {
+		iface_t *iface = ifaces[i];
+
+		if (iface->ip4_addr && *(uint32_t *)iface->ip4_addr == addr)
+			return iface;
+	}
+	return NULL;
+}
+#endif
+#endif
+
 static void if_refill_driver_pkt_pool(const iface_t *iface)
 {
 	pkt_t *pkt;
@@ -63,12 +119,23 @@ void if_init(iface_t *ifce, uint8_t type, ring_t *pkt_pool, ring_t *rx,
 		ifce->if_input = &swen_input;
 #endif
 		break;
+#endif
+#ifdef CONFIG_LOOPBACK
+	case IF_TYPE_LOOPBACK:
+		if (ifce->send == NULL)
+			ifce->send = &lo_send;
+		ifce->if_output = &lo_output;
+		ifce->if_input = &lo_input;
+		break;
 #endif
 	default:
 		__abort();
 	}
 	ifce->rx = rx;
 	ifce->tx = tx;
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	if_register(ifce);
+#endif
 
 	if (is_interrupt_driven) {
 		ifce->pkt_pool = pkt_pool;
@@ -108,14 +175,16 @@ void if_schedule_tx_pkt_free(pkt_t **pkt)
 #if defined(CONFIG_IFACE_STATS) && defined (DEBUG)
 void if_dump_stats(const iface_t *iface)
 {
-	LOG("\nInterface: %p\n");
-#ifdef CONFIG_RF_RECEIVER
+	LOG("\nInterface: %p\n", iface);
+#if defined CONFIG_RF_RECEIVER || defined CONFIG_ETHERNET \
+	|| defined CONFIG_LOOPBACK
 	LOG(" Received: %u\n", iface->rx_packets);
 	LOG(" Errors:   %u\n", iface->rx_errors);
 	LOG(" Dropped:  %u\n", iface->rx_dropped);
 #endif
 	LOG("\n");
-#ifdef CONFIG_RF_SENDER
+#if defined CONFIG_RF_SENDER || defined CONFIG_ETHERNET \
+	|| defined CONFIG_LOOPBACK
 	LOG(" Sent:     %u\n", iface->tx_packets);
 	LOG(" Errors:   %u\n", iface->tx_errors);
 	LOG(" Dropped:  %u\n", iface->tx_dropped);
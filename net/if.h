@@ -35,14 +35,28 @@
 #define IF_NOARP   (1 << 3)
 /*      IF_LAST    (1 << 7) */
 
+/* checksum offload capabilities */
+/* the device completes the transport checksum of PKT_CSUM_PARTIAL pkts */
+#define IF_OFFLOAD_TX_CSUM (1 << 0)
+/* the device marks received pkts with PKT_CSUM_VERIFIED */
+#define IF_OFFLOAD_RX_CSUM (1 << 1)
+
 typedef enum if_type {
 	IF_TYPE_ETHERNET,
 	IF_TYPE_RF,
+	IF_TYPE_LOOPBACK,
 } if_type_t;
 
 struct iface {
 	uint8_t flags;
 	uint8_t type;
+#ifdef CONFIG_CSUM_OFFLOAD
+	uint8_t offload;
+#endif
+#ifdef CONFIG_IP_FRAG
+	/* larger datagrams are fragmented, 0 to use the packet size */
+	uint16_t mtu;
+#endif
 	uint8_t *hw_addr;
 
 	/* only one ip address allowed (network endianess) */
@@ -62,19 +76,21 @@ struct iface {
 	void *priv;
 
 	/* level 2 functions used in bottom halves */
-	/* points to eth_output() or swen_output() */
+	/* points to eth_output(), swen_output() or lo_output() */
 	int (*if_output)(pkt_t *out, struct iface *iface, uint8_t type,
 			 const void *dst);
-	/* points to eth_input() or swen_input() */
+	/* points to eth_input(), swen_input() or lo_input() */
 	void (*if_input)(struct iface *iface);
 
 #ifdef CONFIG_IFACE_STATS
-#ifdef CONFIG_RF_RECEIVER
+#if defined CONFIG_RF_RECEIVER || defined CONFIG_ETHERNET \
+	|| defined CONFIG_LOOPBACK
 	uint16_t rx_packets;
 	uint16_t rx_errors;
 	uint16_t rx_dropped;
 #endif
-#ifdef CONFIG_RF_SENDER
+#if defined CONFIG_RF_SENDER || defined CONFIG_ETHERNET \
+	|| defined CONFIG_LOOPBACK
 	uint16_t tx_packets;
 	uint16_t tx_errors;
 	uint16_t tx_dropped;
@@ -87,7 +103,17 @@ struct iface {
 } __PACKED__;
 typedef struct iface iface_t;
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+/* size of the interface registry */
+#ifndef CONFIG_IFACE_MAX
+#define CONFIG_IFACE_MAX 4
+#endif
+#endif
+
 /** Initialize an interface.
+ *
+ * With CONFIG_MORE_THAN_ONE_INTERFACE, the interface is also added to
+ * the interface registry.
  *
  * @param[in]  iface    interface to initialize
  * @param[in]  type     type of interface (eg: IF_TYPE_ETHERNET)
@@ -100,6 +126,32 @@ typedef struct iface iface_t;
 void if_init(iface_t *iface, uint8_t type, ring_t *pkt_pool, ring_t *rx,
 	     ring_t *tx, uint8_t is_interrupt_driven);
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+/** Remove an interface from the registry
+ *
+ * @param[in]  iface  interface
+ */
+void if_remove(iface_t *iface);
+
+/** Get a registered interface
+ *
+ * Interfaces are kept in registration order.
+ *
+ * @param[in]  idx  index of the interface
+ * @return interface or NULL if idx is out of range
+ */
+iface_t *if_get(uint8_t idx);
+
+#ifdef CONFIG_IP
+/** Get the interface an ipv4 address is assigned to
+ *
+ * @param[in]  addr  ipv4 address (network endianess)
+ * @return interface or NULL if the address is not local
+ */
+iface_t *if_get_by_addr(uint32_t addr);
+#endif
+#endif
+
 /* functions supposed to be called from an interrupt handler */
 
 /** Schedule packet reception
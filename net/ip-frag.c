@@ -0,0 +1,359 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#include <string.h>
+#include <sys/utils.h>
+#include <sys/chksum.h>
+#include <sys/timer.h>
+#include "ip.h"
+#include "ip-frag.h"
+#include "eth.h"
+
+typedef struct ip_frag_ctx {
+	list_t frags;		/* fragments sorted by offset */
+	tim_t timer;
+	uint32_t src;
+	uint32_t dst;
+	uint16_t id;
+	uint16_t total;		/* payload length, 0 until the last fragment */
+	uint16_t received;	/* payload bytes received */
+	uint8_t p;
+	uint8_t nb_frags;	/* 0 if the context is unused */
+} ip_frag_ctx_t;
+
+static ip_frag_ctx_t ip_frag_ctxs[CONFIG_IP_FRAG_MAX_CTX];
+static uint8_t ip_frag_ctx_pos;
+static ip_frag_stats_t ip_frag_stats;
+
+static inline uint16_t ip_frag_offset(const ip_hdr_t *ip)
+{
+	return (ntohs(ip->off) & IP_OFFMASK) * 8;
+}
+
+static void ip_frag_ctx_reset(ip_frag_ctx_t *ctx)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &ctx->frags, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	timer_del(&ctx->timer);
+	ctx->nb_frags = 0;
+}
+
+static void ip_frag_timeout_cb(void *arg)
+{
+	ip_frag_ctx_t *ctx = arg;
+
+	ip_frag_stats.timeouts++;
+	ip_frag_ctx_reset(ctx);
+}
+
+static ip_frag_ctx_t *ip_frag_ctx_get(const ip_hdr_t *ip)
+{
+	ip_frag_ctx_t *ctx = NULL;
+	uint8_t i;
+
+	for (i = 0; i < CONFIG_IP_FRAG_MAX_CTX; i++) {
+		ip_frag_ctx_t *c = &ip_frag_ctxs[i];
+
+		if (c->nb_frags == 0) {
+			if (ctx == NULL)
+				ctx = c;
+			continue;
+		}
+		if (c->id == ip->id && c->src == ip->src && c->dst == ip->dst
+		    && c->p == ip->p)
+			return c;
+	}
+
+	if (ctx == NULL) {
+		/* all contexts are in use, recycle them in turn */
+		ctx = &ip_frag_ctxs[ip_frag_ctx_pos];
+		ip_frag_ctx_pos = (ip_frag_ctx_pos + 1) % CONFIG_IP_FRAG_MAX_CTX;
+		ip_frag_stats.dropped += ctx->nb_frags;
+		ip_frag_ctx_reset(ctx);
+	}
+	INIT_LIST_HEAD(&ctx->frags);
+	timer_init(&ctx->timer);
+	ctx->src = ip->src;
+	ctx->dst = ip->dst;
+	ctx->id = ip->id;
+	ctx->p = ip->p;
+	ctx->total = 0;
+	ctx->received = 0;
+	timer_add(&ctx->timer, CONFIG_IP_FRAG_TIMEOUT * 1000000UL,
+		  ip_frag_timeout_cb, ctx);
+	return ctx;
+}
+
+static inline uint16_t ip_frag_end(const pkt_t *frag)
+{
+	const ip_hdr_t *ip = btod(frag);
+
+	return ip_frag_offset(ip) + pkt_len(frag) - ip->hl * 4;
+}
+
+/* the fragments cover the datagram from offset 0 without holes */
+static int ip_frag_is_complete(const ip_frag_ctx_t *ctx)
+{
+	const pkt_t *frag;
+	uint16_t expected = 0;
+
+	LIST_FOR_EACH_ENTRY(frag, &ctx->frags, list) {
+		if (ip_frag_offset(btod(frag)) != expected)
+			return 0;
+		expected = ip_frag_end(frag);
+	}
+	return expected == ctx->total;
+}
+
+static pkt_t *ip_frag_rebuild(ip_frag_ctx_t *ctx)
+{
+	pkt_t *head = LIST_FIRST_ENTRY(&ctx->frags, pkt_t, list);
+	pkt_t *pkt, *pkt_tmp;
+	ip_hdr_t *ip = btod(head);
+	uint16_t hl = ip->hl * 4;
+	uint16_t len = hl + ctx->total;
+	uint8_t *data;
+
+	list_del(&head->list);
+	ctx->nb_frags--;
+	if (head->buf.size - head->buf.skip < len) {
+		/* the first fragment cannot hold the datagram */
+		if (head->buf.skip + len > CONFIG_PKT_SIZE
+		    || (pkt = pkt_alloc()) == NULL) {
+			ip_frag_stats.dropped += ctx->nb_frags + 1;
+			pkt_free(head);
+			ip_frag_ctx_reset(ctx);
+			return NULL;
+		}
+		pkt_adj(pkt, head->buf.skip);
+		memcpy(btod(pkt), ip, pkt_len(head));
+		pkt->buf.len = pkt_len(head);
+		pkt_free(head);
+		head = pkt;
+		ip = btod(head);
+	}
+	data = btod(head);
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &ctx->frags, list) {
+		ip_hdr_t *frag_ip = btod(pkt);
+		uint16_t frag_hl = frag_ip->hl * 4;
+
+		memcpy(data + hl + ip_frag_offset(frag_ip),
+		       (uint8_t *)frag_ip + frag_hl, pkt_len(pkt) - frag_hl);
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	timer_del(&ctx->timer);
+	ctx->nb_frags = 0;
+
+	head->buf.len = len;
+	ip->len = htons(len);
+	ip->off = 0;
+	ip->chksum = 0;
+	ip->chksum = cksum(ip, hl);
+	ip_frag_stats.reassembled++;
+	return head;
+}
+
+pkt_t *ip_reassemble(pkt_t *pkt)
+{
+	ip_hdr_t *ip = btod(pkt);
+	uint16_t hl = ip->hl * 4;
+	uint16_t len = ntohs(ip->len);
+	uint16_t off = ip_frag_offset(ip);
+	uint32_t end;
+	ip_frag_ctx_t *ctx;
+	list_t *prev;
+	pkt_t *frag;
+
+	if (len <= hl || len > pkt_len(pkt))
+		goto drop;
+	/* strip link layer padding */
+	pkt->buf.len = len;
+	end = (uint32_t)off + len - hl;
+
+	/* all fragments but the last one carry multiples of 8 bytes */
+	if ((ip->off & IP_MF) && ((len - hl) & 7))
+		goto drop;
+	/* the datagram is rebuilt in a single packet */
+	if (hl + end > CONFIG_PKT_SIZE - pkt->buf.skip)
+		goto drop;
+
+	ctx = ip_frag_ctx_get(ip);
+	if ((ip->off & IP_MF) == 0) {
+		if (ctx->total && ctx->total != end)
+			goto drop_ctx;
+		/* no fragment received so far may go past the end */
+		LIST_FOR_EACH_ENTRY(frag, &ctx->frags, list) {
+			if (ip_frag_end(frag) > end)
+				goto drop_ctx;
+		}
+		ctx->total = end;
+	}
+	if (ctx->total && end > ctx->total)
+		goto drop_ctx;
+
+	prev = &ctx->frags;
+	LIST_FOR_EACH_ENTRY(frag, &ctx->frags, list) {
+		uint16_t frag_off = ip_frag_offset(btod(frag));
+		uint16_t frag_end = ip_frag_end(frag);
+
+		if (frag_off >= end)
+			break;
+		if (frag_end <= off) {
+			prev = &frag->list;
+			continue;
+		}
+		if (frag_off == off && frag_end == end) {
+			/* duplicate */
+			pkt_free(pkt);
+			return NULL;
+		}
+		/* overlapping fragments are not trusted */
+		goto drop_ctx;
+	}
+	if (ctx->nb_frags >= CONFIG_IP_FRAG_MAX_FRAGS)
+		goto drop_ctx;
+
+	list_add(&pkt->list, prev);
+	ctx->nb_frags++;
+	ctx->received += end - off;
+
+	/* fragments do not overlap, all the bytes are there */
+	if (ctx->total == 0 || ctx->received != ctx->total)
+		return NULL;
+	if (!ip_frag_is_complete(ctx)) {
+		ip_frag_stats.dropped += ctx->nb_frags;
+		ip_frag_ctx_reset(ctx);
+		return NULL;
+	}
+	return ip_frag_rebuild(ctx);
+
+ drop_ctx:
+	ip_frag_stats.dropped += ctx->nb_frags;
+	ip_frag_ctx_reset(ctx);
+ drop:
+	ip_frag_stats.dropped++;
+	pkt_free(pkt);
+	return NULL;
+}
+
+int ip_fragment(pkt_t *out, iface_t *iface, const uint32_t *dst, uint16_t mtu)
+{
+	ip_hdr_t *ip = btod(out);
+	uint16_t hl = ip->hl * 4;
+	uint16_t len = pkt_len(out) - hl;
+	uint16_t frag_len = (mtu - hl) & ~7;
+	/* the datagram may already be a fragment */
+	uint16_t ip_off = ntohs(ip->off) & IP_OFFMASK;
+	uint16_t ip_mf = ip->off & IP_MF;
+	uint16_t off;
+	pkt_t *pkt, *pkt_tmp;
+	int ret;
+	LIST_HEAD(frags);
+
+	if ((ip->off & IP_DF) || mtu <= hl || frag_len == 0)
+		goto error;
+
+	/* the first fragment stays in the datagram packet, build the
+	 * others before truncating it */
+	for (off = frag_len; off < len; off += frag_len) {
+		uint16_t plen = MIN(frag_len, len - off);
+		ip_hdr_t *frag_ip;
+
+		if ((pkt = pkt_alloc()) == NULL)
+			goto error;
+		pkt_adj(pkt, out->buf.skip);
+		frag_ip = btod(pkt);
+		memcpy(frag_ip, ip, hl);
+		memcpy((uint8_t *)frag_ip + hl, (uint8_t *)ip + hl + off, plen);
+		pkt->buf.len = hl + plen;
+		frag_ip->len = htons(hl + plen);
+		frag_ip->off = htons(ip_off + off / 8);
+		if (off + plen < len || ip_mf)
+			frag_ip->off |= IP_MF;
+		frag_ip->chksum = 0;
+		frag_ip->chksum = cksum(frag_ip, hl);
+		list_add_tail(&pkt->list, &frags);
+	}
+
+	out->buf.len = hl + frag_len;
+	ip->len = htons(hl + frag_len);
+	ip->off |= IP_MF;
+	ip->chksum = 0;
+	ip->chksum = cksum(ip, hl);
+	ip_frag_stats.fragmented++;
+
+	ret = iface->if_output(out, iface, L3_PROTO_IP, dst);
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &frags, list) {
+		list_del(&pkt->list);
+		if (iface->if_output(pkt, iface, L3_PROTO_IP, dst) < 0)
+			ret = -1;
+	}
+	return ret;
+
+ error:
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &frags, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	pkt_free(out);
+	return -1;
+}
+
+uint16_t ip_get_mtu(const iface_t *iface)
+{
+	if (iface->mtu)
+		return iface->mtu;
+	return CONFIG_PKT_SIZE - sizeof(eth_hdr_t);
+}
+
+unsigned ip_frag_get_nb_pkts(void)
+{
+	unsigned nb = 0;
+	uint8_t i;
+
+	for (i = 0; i < CONFIG_IP_FRAG_MAX_CTX; i++)
+		nb += ip_frag_ctxs[i].nb_frags;
+	return nb;
+}
+
+const ip_frag_stats_t *ip_frag_get_stats(void)
+{
+	return &ip_frag_stats;
+}
+
+void ip_frag_flush(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < CONFIG_IP_FRAG_MAX_CTX; i++) {
+		if (ip_frag_ctxs[i].nb_frags)
+			ip_frag_ctx_reset(&ip_frag_ctxs[i]);
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#ifndef _IP_FRAG_H_
+#define _IP_FRAG_H_
+
+#include "config.h"
+
+/* number of datagrams reassembled simultaneously */
+#ifndef CONFIG_IP_FRAG_MAX_CTX
+#define CONFIG_IP_FRAG_MAX_CTX 2
+#endif
+
+/* number of fragments held per datagram */
+#ifndef CONFIG_IP_FRAG_MAX_FRAGS
+#define CONFIG_IP_FRAG_MAX_FRAGS 8
+#endif
+
+/* reassembly timeout in seconds */
+#ifndef CONFIG_IP_FRAG_TIMEOUT
+#define CONFIG_IP_FRAG_TIMEOUT 15
+#endif
+
+typedef struct ip_frag_stats {
+	uint16_t reassembled;
+	uint16_t fragmented;
+	uint16_t timeouts;
+	uint16_t dropped;
+} ip_frag_stats_t;
+
+/** Queue a fragment for reassembly
+ *
+ * Fragments are chained by offset in a context keyed by
+ * (src, dst, id, proto). The datagram is rebuilt in the first fragment
+ * once all of them are received.
+ *
+ * The rebuilt datagram must fit in a single packet, larger ones are
+ * dropped. Packets are fixed size pool buffers and the transport layers,
+ * the sockets and the applications read a datagram as one contiguous
+ * pkt_t. Reassembly only recovers datagrams fragmented on a path with a
+ * smaller MTU than the CONFIG_PKT_SIZE links of this stack.
+ *
+ * @param[in] pkt  fragment, pointing to its ip header
+ * @return reassembled datagram or NULL if not complete yet
+ */
+pkt_t *ip_reassemble(pkt_t *pkt);
+
+/** Fragment and send a datagram
+ *
+ * The first fragment reuses the datagram packet. The fragments keep the
+ * datagram identification, set by __ip_output() for local datagrams.
+ *
+ * @param[in] out    datagram, pointing to its ip header
+ * @param[in] iface  output interface
+ * @param[in] dst    next hop address
+ * @param[in] mtu    interface MTU
+ * @return 0 on success, -1 on failure
+ */
+int ip_fragment(pkt_t *out, iface_t *iface, const uint32_t *dst, uint16_t mtu);
+
+/** Get interface MTU
+ *
+ * @param[in] iface  interface
+ * @return iface->mtu if set, the largest datagram a packet can hold
+ *         otherwise
+ */
+uint16_t ip_get_mtu(const iface_t *iface);
+
+/** Get number of packets held by reassembly contexts
+ *
+ * @return number of packets
+ */
+unsigned ip_frag_get_nb_pkts(void);
+
+/** Get fragmentation statistics
+ *
+ * @return statistics
+ */
+const ip_frag_stats_t *ip_frag_get_stats(void);
+
+/** Drop all pending reassemblies
+ */
+void ip_frag_flush(void);
+
+#endif
@@ -22,10 +22,12 @@
  *
 */
 
+#include <string.h>
 #include <sys/utils.h>
 #include <sys/chksum.h>
 #include "tr-chksum.h"
 #include "ip.h"
+#include "ip-frag.h"
 #include "icmp.h"
 #include "arp.h"
 #include "eth.h"
@@ -33,78 +35,266 @@
 #include "udp.h"
 #include "tcp.h"
 
-int ip_output(pkt_t *out, iface_t *iface, uint16_t flags)
+#ifdef CONFIG_IP_FRAG
+static uint16_t ip_id;
+#endif
+
+static inline int ip_needs_frag(const iface_t *iface, uint16_t len)
+{
+#ifdef CONFIG_IP_FRAG
+	return len > ip_get_mtu(iface);
+#else
+	(void)iface;
+	(void)len;
+	return 0;
+#endif
+}
+
+static void ip_set_transport_cksum(pkt_t *out, const iface_t *iface,
+				   const ip_hdr_t *ip, void *hdr, uint16_t len,
+				   uint16_t hdr_len)
+{
+#ifdef CONFIG_CSUM_OFFLOAD
+	/* the device cannot complete the checksum of a fragmented datagram */
+	if ((iface->offload & IF_OFFLOAD_TX_CSUM)
+	    && !ip_needs_frag(iface, ntohs(ip->len))) {
+		set_transport_pseudo_cksum(ip, hdr, len);
+		out->flags |= PKT_CSUM_PARTIAL;
+		return;
+	}
+	out->flags &= ~PKT_CSUM_PARTIAL;
+#else
+	(void)iface;
+#endif
+	/* the payload has already been summed while being copied */
+	if (out->flags & PKT_FLAG_CSUM_PAYLOAD)
+		set_transport_cksum_partial(ip, hdr, len, hdr_len, out->csum);
+	else
+		set_transport_cksum(ip, hdr, len);
+}
+
+static inline int ip_is_local(uint32_t dst, const iface_t *iface)
+{
+	if (dst == *(uint32_t *)iface->ip4_addr)
+		return 1;
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	/* addresses of the other interfaces are local too */
+	return if_get_by_addr(dst) != NULL;
+#else
+	return 0;
+#endif
+}
+
+int __ip_output(pkt_t *out, iface_t *iface, uint32_t src, uint16_t flags)
 {
 	ip_hdr_t *ip = btod(out);
+	const route_t *route = NULL;
 	uint32_t ip_dst;
 	uint32_t *mask;
 	uint32_t *ip_addr;
 	uint16_t payload_len = pkt_len(out);
 
-	if (iface == NULL)
-		iface = dft_route.iface;
+	/* XXX check for buf_adj coherency with other layers */
+	if (ip->dst == 0) {
+		/* no dest ip address set. Drop the packet */
+		goto error;
+	}
 
 	if (iface == NULL) {
-		/* no interface to send the pkt to */
-		pkt_free(out);
-		return -1;
+		if ((route = route_lookup(ip->dst)) == NULL) {
+			/* no interface to send the pkt to */
+			goto error;
+		}
+		iface = route->iface;
 	}
 	mask = (uint32_t *)iface->ip4_mask;
 	ip_addr = (uint32_t *)iface->ip4_addr;
 
-	/* XXX check for buf_adj coherency with other layers */
-	if (ip->dst == 0) {
-		/* no dest ip address set. Drop the packet */
-		pkt_free(out);
-		return -1;
-	}
-
-	ip->src = *ip_addr;
+	ip->src = src ? src : *ip_addr;
 	ip->v = 4;
 	ip->hl = sizeof(ip_hdr_t) / 4;
 	ip->tos = 0;
 	ip->len = htons(payload_len);
 	ip->id = 0;
+#ifdef CONFIG_IP_FRAG
+	/* fragments of local datagrams need an identification, forwarded
+	 * datagrams keep theirs */
+	if (ip_needs_frag(iface, payload_len)) {
+		ip->id = htons(ip_id);
+		ip_id++;
+	}
+#endif
 	ip->off = flags;
 	ip->ttl = CONFIG_IP_TTL;
 	assert(ip->p); /* must be set by upper layer */
 	ip->chksum = 0;
 	ip->chksum = cksum(ip, sizeof(ip_hdr_t));
 
-	if ((ip->dst & *mask) != (*ip_addr & *mask))
-		ip_dst = dft_route.ip;
-	else
+	if ((ip->dst & *mask) != (*ip_addr & *mask)) {
+		if (route == NULL && (route = route_lookup(ip->dst)) == NULL)
+			goto error;
+		ip_dst = route->ip ? route->ip : ip->dst;
+	} else {
 		ip_dst = ip->dst;
+	}
 
 	pkt_adj(out, (int)sizeof(ip_hdr_t));
 	if (ip->p == IPPROTO_UDP) {
 		udp_hdr_t *udp_hdr = btod(out);
-		set_transport_cksum(ip, udp_hdr, udp_hdr->length);
+		ip_set_transport_cksum(out, iface, ip, udp_hdr,
+				       udp_hdr->length, sizeof(udp_hdr_t));
 	} else if (ip->p == IPPROTO_TCP) {
 		tcp_hdr_t *tcp_hdr = btod(out);
-		set_transport_cksum(ip, tcp_hdr,
-				    htons(payload_len - sizeof(ip_hdr_t)));
+		ip_set_transport_cksum(out, iface, ip, tcp_hdr,
+				       htons(payload_len - sizeof(ip_hdr_t)),
+				       tcp_hdr->hdr_len * 4);
 	}
 
 	pkt_adj(out, -(int)sizeof(ip_hdr_t));
+#ifdef CONFIG_IP_FRAG
+	if (ip_needs_frag(iface, payload_len))
+		return ip_fragment(out, iface, &ip_dst, ip_get_mtu(iface));
+#endif
 	return iface->if_output(out, iface, L3_PROTO_IP, &ip_dst);
+
+ error:
+	pkt_free(out);
+	return -1;
+}
+
+int ip_output(pkt_t *out, iface_t *iface, uint16_t flags)
+{
+	return __ip_output(out, iface, 0, flags);
+}
+
+#ifdef CONFIG_IP_FORWARD
+static inline void
+ip_icmp_error(const ip_hdr_t *ip, iface_t *iface, uint8_t type, uint8_t code,
+	      uint16_t mtu)
+{
+#ifdef CONFIG_ICMP
+	icmp_error(ip, iface, type, code, mtu);
+#else
+	(void)ip;
+	(void)iface;
+	(void)type;
+	(void)code;
+	(void)mtu;
+#endif
 }
 
+/* limited broadcast, multicast or the broadcast address of the subnet
+ * attached to iface if not NULL */
+static int ip_is_broadcast(uint32_t dst, const iface_t *iface)
+{
+	uint32_t mask;
+
+	if (dst == 0xFFFFFFFF)
+		return 1;
+	/* multicast */
+	if ((((uint8_t *)&dst)[0] & 0xF0) == 0xE0)
+		return 1;
+	if (iface == NULL)
+		return 0;
+	mask = *(uint32_t *)iface->ip4_mask;
+	return dst == (*(uint32_t *)iface->ip4_addr | ~mask);
+}
+
+#ifdef CONFIG_CSUM_OFFLOAD
+/* datagrams sent by a local host may only carry a partial transport
+ * checksum. Complete it unless the output device can. */
+static void ip_forward_cksum(pkt_t *pkt, const iface_t *out, uint16_t len)
+{
+	ip_hdr_t *ip = btod(pkt);
+	uint16_t hl = ip->hl * 4;
+
+	if ((pkt->flags & PKT_CSUM_PARTIAL) == 0)
+		return;
+	if (ip->p != IPPROTO_UDP && ip->p != IPPROTO_TCP)
+		return;
+	if ((out->offload & IF_OFFLOAD_TX_CSUM) && !ip_needs_frag(out, len))
+		return;
+	set_transport_cksum(ip, (uint8_t *)ip + hl, htons(len - hl));
+	pkt->flags &= ~PKT_CSUM_PARTIAL;
+}
+#endif
+
+static void ip_forward(pkt_t *pkt, iface_t *iface, const route_t *route)
+{
+	ip_hdr_t *ip = btod(pkt);
+	void *tmp = &ip->ttl;
+	uint16_t *ttl_p = tmp;
+	uint16_t old_ttl_p = *ttl_p;
+	uint16_t len = ntohs(ip->len);
+	uint32_t ip_dst;
+	iface_t *out;
+
+	/* a directed broadcast belongs to the subnet of the interface the
+	 * destination is routed to */
+	if (ip_is_broadcast(ip->dst, route ? route->iface : NULL)
+	    || len < ip->hl * 4 || len > pkt_len(pkt))
+		goto drop;
+	if (ip->ttl <= 1) {
+		ip_icmp_error(ip, iface, ICMP_TIMXCEED, ICMP_TIMXCEED_INTRANS,
+			      0);
+		goto drop;
+	}
+	if (route == NULL) {
+		ip_icmp_error(ip, iface, ICMP_UNREACHABLE, ICMP_UNREACH_NET, 0);
+		goto drop;
+	}
+	out = route->iface;
+	ip_dst = route->ip ? route->ip : ip->dst;
+
+	/* drop link layer padding */
+	pkt->buf.len = len;
+	ip->ttl--;
+	ip->chksum = cksum_update16(ip->chksum, old_ttl_p, *ttl_p);
+#ifdef CONFIG_CSUM_OFFLOAD
+	ip_forward_cksum(pkt, out, len);
+#endif
+
+#ifdef CONFIG_IP_FRAG
+	if (len > ip_get_mtu(out)) {
+		if (ip->off & IP_DF) {
+			ip_icmp_error(ip, iface, ICMP_UNREACHABLE,
+				      ICMP_UNREACH_NEEDFRAG, ip_get_mtu(out));
+			goto drop;
+		}
+		ip_fragment(pkt, out, &ip_dst, ip_get_mtu(out));
+		return;
+	}
+#endif
+	/* the packet is sent as is unless the input link header left
+	 * less room than an ethernet header */
+	if (pkt->buf.skip < (int)sizeof(eth_hdr_t)) {
+		uint8_t *data = pkt->buf.data - pkt->buf.skip
+			+ sizeof(eth_hdr_t);
+
+		if (pkt->buf.size < (int)sizeof(eth_hdr_t) + len)
+			goto drop;
+		memmove(data, pkt->buf.data, len);
+		pkt->buf.data = data;
+		pkt->buf.skip = sizeof(eth_hdr_t);
+	}
+	out->if_output(pkt, out, L3_PROTO_IP, &ip_dst);
+	return;
+
+ drop:
+	pkt_free(pkt);
+}
+#endif
+
 void ip_input(pkt_t *pkt, iface_t *iface)
 {
 	ip_hdr_t *ip;
-	uint32_t *ip_addr = (uint32_t *)iface->ip4_addr;
 	int ip_len;
 
 	ip = btod(pkt);
 
-	if (ip->v != 4 || ip->dst != *ip_addr || ip->ttl == 0)
+	if (ip->v != 4)
 		goto error;
 
-	if (ip->off & IP_MF) {
-		/* ip fragmentation is unsupported */
-		goto error;
-	}
 	if (ip->hl > IP_MAX_HDR_LEN || ip->hl < IP_MIN_HDR_LEN)
 		goto error;
 
@@ -112,6 +302,28 @@ void ip_input(pkt_t *pkt, iface_t *iface)
 	if (cksum(ip, ip_len) != 0)
 		goto error;
 
+	if (!ip_is_local(ip->dst, iface)) {
+#ifdef CONFIG_IP_FORWARD
+		ip_forward(pkt, iface, route_lookup(ip->dst));
+		return;
+#else
+		goto error;
+#endif
+	}
+	if (ip->ttl == 0)
+		goto error;
+
+	if (ip->off & (IP_MF | htons(IP_OFFMASK))) {
+#ifdef CONFIG_IP_FRAG
+		if ((pkt = ip_reassemble(pkt)) == NULL)
+			return;
+		ip = btod(pkt);
+#else
+		/* ip fragmentation is unsupported */
+		goto error;
+#endif
+	}
+
 #ifdef CONFIG_IP_CHKSUM
 #endif
 
@@ -70,4 +70,14 @@ typedef struct ip_hdr ip_hdr_t;
 void ip_input(pkt_t *pkt, iface_t *iface);
 int ip_output(pkt_t *out, iface_t *iface, uint16_t flags);
 
+/** Send a datagram from a given local address
+ *
+ * @param[in] out    datagram, pointing to its ip header
+ * @param[in] iface  output interface, NULL to look up the routing table
+ * @param[in] src    source address, 0 to use the one of the interface
+ * @param[in] flags  IP_DF or 0
+ * @return 0 on success, -1 on failure
+ */
+int __ip_output(pkt_t *out, iface_t *iface, uint32_t src, uint16_t flags);
+
 #endif
@@ -0,0 +1,114 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#include <string.h>
+#include <sys/scheduler.h>
+#include "lo.h"
+#include "ip.h"
+
+int lo_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
+{
+	(void)dst;
+	if ((iface->flags & IF_UP) == 0 || type != L3_PROTO_IP)
+		goto error;
+#ifdef CONFIG_IFACE_STATS
+	iface->tx_packets++;
+#endif
+	return iface->send(iface, out);
+ error:
+	pkt_free(out);
+#ifdef CONFIG_IFACE_STATS
+	iface->tx_dropped++;
+#endif
+	return -1;
+}
+
+static void lo_input_cb(void *arg)
+{
+	lo_input(arg);
+}
+
+void lo_input(iface_t *iface)
+{
+	/* packets looped back meanwhile wait for the next run */
+	int nb = ring_len(iface->rx);
+	pkt_t *pkt;
+
+	while (nb-- && (pkt = pkt_get(iface->rx))) {
+#ifdef CONFIG_IFACE_STATS
+		iface->rx_packets++;
+#endif
+		ip_input(pkt, iface);
+	}
+	if (!ring_is_empty(iface->rx))
+		schedule_task(lo_input_cb, iface);
+}
+
+/* a retained packet (eg: kept for tcp retransmissions) cannot be
+ * modified by the input path, copy it like a device would */
+static pkt_t *lo_unshare(pkt_t *pkt)
+{
+	pkt_t *copy;
+
+	if (!pkt_is_shared(pkt))
+		return pkt;
+	if ((copy = pkt_alloc()) != NULL) {
+		pkt_adj(copy, pkt->buf.skip);
+		memcpy(btod(copy), btod(pkt), pkt_len(pkt));
+		copy->buf.len = pkt_len(pkt);
+		copy->flags = pkt->flags;
+	}
+	pkt_free(pkt);
+	return copy;
+}
+
+int lo_send(iface_t *iface, pkt_t *pkt)
+{
+	uint8_t was_empty = ring_is_empty(iface->rx);
+
+	if ((pkt = lo_unshare(pkt)) == NULL)
+		goto error;
+	/* the packet is received as it has been sent, a partial checksum
+	 * does not need to be completed */
+#ifdef CONFIG_CSUM_OFFLOAD
+	if ((pkt->flags & PKT_CSUM_PARTIAL)
+	    || (iface->offload & IF_OFFLOAD_RX_CSUM))
+		pkt->flags = (pkt->flags & PKT_CSUM_PARTIAL)
+			| PKT_CSUM_VERIFIED;
+	else
+#endif
+		pkt->flags = 0;
+	if (pkt_put(iface->rx, pkt) < 0) {
+		pkt_free(pkt);
+		goto error;
+	}
+	if (was_empty)
+		schedule_task(lo_input_cb, iface);
+	return 0;
+ error:
+#ifdef CONFIG_IFACE_STATS
+	iface->tx_errors++;
+#endif
+	return -1;
+}
@@ -0,0 +1,64 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#ifndef _LO_H_
+#define _LO_H_
+
+#include "config.h"
+
+/* Loopback interfaces hand the packets they send back to the stack.
+ * Packets are queued on the interface rx ring and processed from a
+ * scheduled task, as if they were received by a driver.
+ *
+ * With CONFIG_CSUM_OFFLOAD, IF_OFFLOAD_TX_CSUM and IF_OFFLOAD_RX_CSUM
+ * respectively skip the computation and the verification of transport
+ * checksums. */
+
+/** Loopback output
+ *
+ * @param[in] out    packet, pointing to its ip header
+ * @param[in] iface  loopback interface
+ * @param[in] type   L3_PROTO_IP
+ * @param[in] dst    unused
+ * @return 0 on success, -1 on failure
+ */
+int lo_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst);
+
+/** Process looped back packets
+ *
+ * @param[in] iface  loopback interface
+ */
+void lo_input(iface_t *iface);
+
+/** Loopback driver send function
+ *
+ * Used by if_init() if the interface does not provide one.
+ *
+ * @param[in] iface  loopback interface
+ * @param[in] pkt    packet
+ * @return 0 on success, -1 if the rx ring is full
+ */
+int lo_send(iface_t *iface, pkt_t *pkt);
+
+#endif
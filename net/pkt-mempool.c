@@ -132,6 +132,7 @@ void __pkt_free(pkt_t *pkt, const char *func, int line)
 	DEBUG_LOG("%s() in %s:%d (pkt:%p)\n", __func__, func, line, pkt);
 #endif
 	buf_reset(&pkt->buf);
+	pkt->flags = 0;
 	if (pkt_put(pkt_pool, pkt) < 0)
 		__abort();
 #ifdef CONFIG_EVENT
@@ -191,6 +192,7 @@ void pkt_free(pkt_t *pkt)
 	}
 #endif
 	buf_reset(&pkt->buf);
+	pkt->flags = 0;
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	if (pkt_is_emergency(pkt))
 		return;
@@ -208,6 +210,7 @@ static void pkt_init_pkt(pkt_t *pkt, uint8_t *data)
 {
 	pkt->buf = BUF_INIT(data, CONFIG_PKT_SIZE);
 	pkt->refcnt = 0;
+	pkt->flags = 0;
 
 	INIT_LIST_HEAD(&pkt->list);
 #ifdef DEBUG
@@ -221,6 +224,7 @@ pkt_t *pkt_alloc_emergency(void)
 {
 	assert(emergency_pkt.refcnt == 0);
 	emergency_pkt.refcnt++;
+	emergency_pkt.flags = 0;
 	return &emergency_pkt;
 }
 #endif
@@ -32,11 +32,36 @@
 
 /* #define PKT_TRACE */
 
+/* pkt->csum holds the partial sum of the transport payload */
+#define PKT_FLAG_CSUM_PAYLOAD 0x01
+
+/* checksum offload state (CONFIG_CSUM_OFFLOAD) */
+/* checksums are computed and verified by the stack */
+#define PKT_CSUM_NONE     0x00
+/* the transport checksum field only holds the pseudo header sum,
+ * the device completes it */
+#define PKT_CSUM_PARTIAL  0x04
+/* the transport checksum has been verified by the device */
+#define PKT_CSUM_VERIFIED 0x08
+#define PKT_CSUM_MASK     (PKT_CSUM_PARTIAL | PKT_CSUM_VERIFIED)
+
+/* the tcp segment is acknowledged by a SACK block of the peer */
+#define PKT_FLAG_TCP_SACKED 0x10
+
 typedef struct pkt {
 	buf_t buf;
 	list_t list;
 	uint8_t offset;
 	uint8_t refcnt;
+	uint8_t flags;
+	uint32_t csum;
+#ifdef CONFIG_TCP_RETRANSMIT
+	/* tcp retransmission queue. The packet may be on another list
+	 * while it is being sent. */
+	list_t retrn_list;
+	uint32_t seqid;		/* first seqid of the segment, host endian */
+	uint16_t seqlen;	/* seqids taken, SYN and FIN included */
+#endif
 #if defined(PKT_TRACE) || defined(PKT_DEBUG)
 	const char *last_get_func;
 	const char *last_put_func;
@@ -152,6 +177,36 @@ static inline void pkt_retain(pkt_t *pkt)
 	pkt->refcnt++;
 }
 
+/** Check if a packet is retained by more than one owner
+ *
+ * @param[in] pkt  packet
+ * @return 1 if the packet is shared, 0 otherwise
+ */
+static inline uint8_t pkt_is_shared(const pkt_t *pkt)
+{
+#if defined(PKT_TRACE) || defined(PKT_DEBUG) || defined(DEBUG)
+	/* allocated packets hold a reference */
+	return pkt->refcnt > 1;
+#else
+	return pkt->refcnt > 0;
+#endif
+}
+
+/** Check if the transport checksum has already been verified
+ *
+ * @param[in] pkt  packet
+ * @return 1 if the checksum was verified by the device, 0 otherwise
+ */
+static inline int pkt_csum_verified(const pkt_t *pkt)
+{
+#ifdef CONFIG_CSUM_OFFLOAD
+	return !!(pkt->flags & PKT_CSUM_VERIFIED);
+#else
+	(void)pkt;
+	return 0;
+#endif
+}
+
 /** Get number of available packets
  *
  * @return number of available packets
@@ -22,10 +22,233 @@
  *
 */
 
+#include <string.h>
 #include "route.h"
 
-/* allow only one route, the default one */
-route_t dft_route;
+/* Routes are stored in a path-compressed binary trie. A lookup walks at
+ * most 33 nodes whatever the number of routes. Recently used
+ * destinations are cached in a small direct-mapped table. */
+
+#if CONFIG_ROUTE_TABLE_SIZE > 127
+#error "CONFIG_ROUTE_TABLE_SIZE is limited to 127"
+#endif
+#if !POWEROF2(CONFIG_ROUTE_CACHE_SIZE)
+#error "CONFIG_ROUTE_CACHE_SIZE must be a power of 2"
+#endif
+
+#define ROUTE_NODE_NONE  0xFF
+#define ROUTE_NODE_USED  (1 << 0)
+/* the node holds a route, otherwise it only joins two branches */
+#define ROUTE_NODE_VALID (1 << 1)
+
+typedef struct route_node {
+	uint32_t prefix;	/* host endianess */
+	uint8_t len;
+	uint8_t flags;
+	uint8_t child[2];
+	route_t route;
+} route_node_t;
+
+typedef struct route_cache_entry {
+	uint32_t dst;
+	const route_t *route;
+} route_cache_entry_t;
+
+/* a trie of n routes has at most 2n - 1 nodes, node allocations
+ * cannot fail */
+static route_node_t route_nodes[CONFIG_ROUTE_TABLE_SIZE * 2];
+static uint8_t route_root = ROUTE_NODE_NONE;
+static uint8_t route_nb;
+static route_cache_entry_t route_cache[CONFIG_ROUTE_CACHE_SIZE];
+
+static inline uint32_t route_mask(uint8_t len)
+{
+	return len ? 0xFFFFFFFF << (32 - len) : 0;
+}
+
+static inline uint8_t route_bit(uint32_t addr, uint8_t pos)
+{
+	return (addr >> (31 - pos)) & 1;
+}
+
+static inline uint8_t route_cache_idx(uint32_t dst)
+{
+	dst ^= dst >> 16;
+	dst ^= dst >> 8;
+	return dst & (CONFIG_ROUTE_CACHE_SIZE - 1);
+}
+
+static void route_cache_flush(void)
+{
+	memset(route_cache, 0, sizeof(route_cache));
+}
+
+static uint8_t route_node_alloc(uint32_t prefix, uint8_t len)
+{
+	uint8_t i;
+
+	for (i = 0; i < CONFIG_ROUTE_TABLE_SIZE * 2; i++) {
+		route_node_t *node = &route_nodes[i];
+
+		if (node->flags & ROUTE_NODE_USED)
+			continue;
+		node->prefix = prefix;
+		node->len = len;
+		node->flags = ROUTE_NODE_USED;
+		node->child[0] = node->child[1] = ROUTE_NODE_NONE;
+		return i;
+	}
+	return ROUTE_NODE_NONE;
+}
+
+static void route_node_set(uint8_t n, uint32_t gw, iface_t *iface)
+{
+	route_node_t *node = &route_nodes[n];
+
+	node->flags |= ROUTE_NODE_VALID;
+	node->route.ip = gw;
+	node->route.iface = iface;
+	route_nb++;
+}
+
+int route_add(uint32_t prefix, uint8_t prefix_len, uint32_t gw,
+	      iface_t *iface)
+{
+	uint8_t *link = &route_root;
+	uint8_t leaf, n;
+
+	if (prefix_len > 32 || iface == NULL
+	    || route_nb >= CONFIG_ROUTE_TABLE_SIZE)
+		return -1;
+	prefix = ntohl(prefix) & route_mask(prefix_len);
+	route_cache_flush();
+
+	while (*link != ROUTE_NODE_NONE) {
+		route_node_t *node = &route_nodes[*link];
+		uint8_t common = 0;
+		uint8_t max = MIN(prefix_len, node->len);
+
+		while (common < max && route_bit(prefix, common)
+		       == route_bit(node->prefix, common))
+			common++;
+
+		if (common == node->len) {
+			if (node->len == prefix_len) {
+				if (node->flags & ROUTE_NODE_VALID)
+					return -1;
+				route_node_set(*link, gw, iface);
+				return 0;
+			}
+			link = &node->child[route_bit(prefix, node->len)];
+			continue;
+		}
+		if (common == prefix_len) {
+			/* the new prefix covers the node */
+			n = route_node_alloc(prefix, prefix_len);
+			route_nodes[n].child[route_bit(node->prefix,
+						       prefix_len)] = *link;
+			route_node_set(n, gw, iface);
+			*link = n;
+			return 0;
+		}
+		/* the prefixes diverge, join them */
+		n = route_node_alloc(prefix & route_mask(common), common);
+		leaf = route_node_alloc(prefix, prefix_len);
+		route_node_set(leaf, gw, iface);
+		route_nodes[n].child[route_bit(prefix, common)] = leaf;
+		route_nodes[n].child[route_bit(node->prefix, common)] = *link;
+		*link = n;
+		return 0;
+	}
+	leaf = route_node_alloc(prefix, prefix_len);
+	route_node_set(leaf, gw, iface);
+	*link = leaf;
+	return 0;
+}
+
+/* remove a node without route that has less than two children */
+static void route_node_unlink(uint8_t *link)
+{
+	route_node_t *node = &route_nodes[*link];
+
+	if (node->flags & ROUTE_NODE_VALID)
+		return;
+	if (node->child[0] != ROUTE_NODE_NONE
+	    && node->child[1] != ROUTE_NODE_NONE)
+		return;
+	node->flags = 0;
+	*link = node->child[0] != ROUTE_NODE_NONE ?
+		node->child[0] : node->child[1];
+}
+
+int route_del(uint32_t prefix, uint8_t prefix_len)
+{
+	uint8_t *link = &route_root;
+	uint8_t *parent_link = NULL;
+
+	if (prefix_len > 32)
+		return -1;
+	prefix = ntohl(prefix) & route_mask(prefix_len);
+
+	while (*link != ROUTE_NODE_NONE) {
+		route_node_t *node = &route_nodes[*link];
+
+		if (node->len > prefix_len
+		    || (prefix & route_mask(node->len)) != node->prefix)
+			return -1;
+		if (node->len == prefix_len)
+			break;
+		parent_link = link;
+		link = &node->child[route_bit(prefix, node->len)];
+	}
+	if (*link == ROUTE_NODE_NONE
+	    || (route_nodes[*link].flags & ROUTE_NODE_VALID) == 0)
+		return -1;
+
+	route_cache_flush();
+	route_nodes[*link].flags &= ~ROUTE_NODE_VALID;
+	route_nb--;
+	route_node_unlink(link);
+	if (parent_link)
+		route_node_unlink(parent_link);
+	return 0;
+}
+
+const route_t *route_lookup(uint32_t dst)
+{
+	route_cache_entry_t *entry = &route_cache[route_cache_idx(dst)];
+	const route_t *route = NULL;
+	uint32_t addr = ntohl(dst);
+	uint8_t n = route_root;
+
+	if (entry->route && entry->dst == dst)
+		return entry->route;
+
+	while (n != ROUTE_NODE_NONE) {
+		const route_node_t *node = &route_nodes[n];
+
+		if ((addr & route_mask(node->len)) != node->prefix)
+			break;
+		if (node->flags & ROUTE_NODE_VALID)
+			route = &node->route;
+		if (node->len == 32)
+			break;
+		n = node->child[route_bit(addr, node->len)];
+	}
+	if (route) {
+		entry->dst = dst;
+		entry->route = route;
+	}
+	return route;
+}
+
+void route_flush(void)
+{
+	memset(route_nodes, 0, sizeof(route_nodes));
+	route_root = ROUTE_NODE_NONE;
+	route_nb = 0;
+	route_cache_flush();
+}
 
 #ifdef CONFIG_IPV6
 route6_t dft_route6;
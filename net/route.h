@@ -28,13 +28,52 @@
 #include "proto-defs.h"
 #include "config.h"
 
+/* maximum number of routes */
+#ifndef CONFIG_ROUTE_TABLE_SIZE
+#define CONFIG_ROUTE_TABLE_SIZE 4
+#endif
+
+/* number of cached destinations, must be a power of 2 */
+#ifndef CONFIG_ROUTE_CACHE_SIZE
+#define CONFIG_ROUTE_CACHE_SIZE 4
+#endif
+
 struct route {
-	uint32_t ip;
+	uint32_t ip;	/* gateway, 0 if the destination is on-link */
 	iface_t *iface;
 } __PACKED__;
 typedef struct route route_t;
 
-extern route_t dft_route;
+/** Add a route
+ *
+ * Addresses are in network endianess.
+ * @param[in] prefix      destination prefix
+ * @param[in] prefix_len  prefix length in bits (0 for the default route)
+ * @param[in] gw          gateway or 0 if the prefix is on-link
+ * @param[in] iface       output interface
+ * @return 0 on success, -1 if the route exists or the table is full
+ */
+int route_add(uint32_t prefix, uint8_t prefix_len, uint32_t gw,
+	      iface_t *iface);
+
+/** Delete a route
+ *
+ * @param[in] prefix      destination prefix
+ * @param[in] prefix_len  prefix length in bits
+ * @return 0 on success, -1 if the route does not exist
+ */
+int route_del(uint32_t prefix, uint8_t prefix_len);
+
+/** Find the longest prefix matching route
+ *
+ * @param[in] dst  destination address
+ * @return route or NULL if no route matches
+ */
+const route_t *route_lookup(uint32_t dst);
+
+/** Delete all routes
+ */
+void route_flush(void);
 
 #ifdef CONFIG_IPV6
 struct route6 {
@@ -28,6 +28,8 @@
 #include <sys/list.h>
 #include <sys/hash-tables.h>
 #include <sys/scheduler.h>
+#include <sys/chksum.h>
+#include <sys/obj-pool.h>
 #include "eth.h"
 #include "ip.h"
 #ifdef CONFIG_UDP
@@ -43,6 +45,10 @@ static list_t sock_list = LIST_HEAD_INIT(sock_list);
 #ifdef CONFIG_BSD_COMPAT
 static uint8_t cur_fd = 3;
 static uint8_t max_fds = 100;
+STATIC_OBJ_POOL_DECL(sock_info_pool, sock_info_t, CONFIG_MAX_SOCKS);
+#endif
+#ifdef CONFIG_TCP
+STATIC_OBJ_POOL_DECL(listen_pool, listen_t, CONFIG_TCP_MAX_LISTENS);
 #endif
 
 #ifdef CONFIG_HT_STORAGE
@@ -407,10 +413,8 @@ int sock_info_init(sock_info_t *sock_info, int sock_type)
  again:
 	fd = cur_fd;
 	if (sock_info_add(fd, sock_info) < 0) {
-		if (retries > max_fds) {
-			free(sock_info);
+		if (retries > max_fds)
 			return -1;
-		}
 		retries++;
 		cur_fd++;
 		if (cur_fd > max_fds)
@@ -435,22 +439,18 @@ static void socket_listen_free(listen_t *listen)
 
 	if (listen == NULL)
 		return;
-	if (list_empty(&listen->tcp_conn_list_head)) {
-		free(listen);
-		return;
-	}
 	LIST_FOR_EACH_ENTRY_SAFE(tcp_conn, tcp_conn_tmp,
 				 &listen->tcp_conn_list_head, list) {
 		tcp_conn_delete(tcp_conn);
 	}
-	free(listen);
+	obj_pool_free(&listen_pool, listen);
 }
 
 int sock_info_listen(sock_info_t *sock_info, int backlog)
 {
 	listen_t *listen;
 
-	if ((listen = malloc(sizeof(listen_t))) == NULL)
+	if ((listen = obj_pool_alloc(&listen_pool)) == NULL)
 		return -1;
 
 	INIT_LIST_HEAD(&listen->tcp_conn_list_head);
@@ -471,11 +471,11 @@ int socket(int family, int type, int protocol)
 	if (family != AF_INET || family >= SOCK_LAST)
 		return -1;
 
-	if ((sock_info = malloc(sizeof(sock_info_t))) == NULL)
+	if ((sock_info = obj_pool_alloc(&sock_info_pool)) == NULL)
 		return -1;
 
 	if ((fd = sock_info_init(sock_info, type)) < 0) {
-		free(sock_info);
+		obj_pool_free(&sock_info_pool, sock_info);
 		return -1;
 	}
 	return fd;
@@ -538,10 +538,30 @@ int sock_info_bind(sock_info_t *sock_info, uint16_t port)
 	return bind_on_port(port, sock_info);
 }
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+int sock_info_bind_addr(sock_info_t *sock_info, uint32_t addr, uint16_t port)
+{
+	if (addr && if_get_by_addr(addr) == NULL) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EADDRNOTAVAIL;
+#endif
+		return -1;
+	}
+	if (sock_info_bind(sock_info, port) < 0)
+		return -1;
+	sock_info->addr.ip4_addr = addr;
+	return 0;
+}
+#endif
+
 int sock_info_close(sock_info_t *sock_info)
 {
+#ifdef CONFIG_EVENT_POLL
+	event_poll_del(&sock_info->event);
+#endif
 #ifdef CONFIG_TCP
 	socket_listen_free(sock_info->listen);
+	sock_info->listen = NULL;
 #endif
 	return unbind_port(sock_info);
 }
@@ -586,12 +606,12 @@ int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 	if ((sock_info = fd2sockinfo(sockfd)) == NULL)
 		return -1;
 
-#if 0 /* only one ip address is allowed on an interface */
-	sock_info->addr.ip4_addr = sockaddr->sin_addr.s_addr;
-#endif
-
-	/* TODO check sin_addr for ip addresses on available interfaces */
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	return sock_info_bind_addr(sock_info, sockaddr->sin_addr.s_addr,
+				   sockaddr->sin_port);
+#else
 	return bind_on_port(sockaddr->sin_port, sock_info);
+#endif
 }
 
 #ifdef CONFIG_TCP
@@ -695,14 +715,19 @@ sock_info_accept(sock_info_t *sock_info_server, sock_info_t *sock_info_client,
 #endif
 #endif	/* BSD_COMPAT */
 
-static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf)
+/* The emergency packet is only used for packets sent right away, it
+ * cannot be held on a queue. */
+static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf,
+			       uint8_t emergency)
 {
 	pkt_t *pkt;
-	int needed_pkt_size = sbuf->len + hdrlen;
+	int needed_pkt_size = (int)sizeof(eth_hdr_t) + (int)sizeof(ip_hdr_t)
+		+ hdrlen + sbuf->len;
 
+	(void)emergency;
 	if ((pkt = pkt_alloc()) == NULL
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
-	    && (pkt = pkt_alloc_emergency()) == NULL
+	    && (!emergency || (pkt = pkt_alloc_emergency()) == NULL)
 #endif
 	    ) {
 #ifdef CONFIG_BSD_COMPAT
@@ -711,9 +736,6 @@ static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf)
 		return NULL;
 	}
 
-#ifdef CONFIG_TCP_RETRANSMIT
-	needed_pkt_size += sizeof(tcp_retrn_pkt_t);
-#endif
 	if (pkt->buf.size < needed_pkt_size) {
 #ifdef CONFIG_BSD_COMPAT
 		errno = EMSGSIZE;
@@ -724,7 +746,12 @@ static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf)
 	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
 	pkt_adj(pkt, (int)sizeof(ip_hdr_t));
 	pkt_adj(pkt, hdrlen);
-	__buf_add(&pkt->buf, sbuf->data, sbuf->len);
+	/* sum the payload while copying it, ip_output() will only have to
+	 * add the headers */
+	pkt->csum = 0;
+	cksum_copy(pkt->buf.data, sbuf->data, sbuf->len, &pkt->csum);
+	pkt->buf.len = sbuf->len;
+	pkt->flags |= PKT_FLAG_CSUM_PAYLOAD;
 	pkt_adj(pkt, -hdrlen);
 
 	return pkt;
@@ -762,6 +789,10 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 	pkt_t *pkt;
 #ifdef CONFIG_TCP
 	tcp_conn_t *tcp_conn;
+	pkt_t *pkt_tmp;
+	uint16_t mss, off, room;
+	sbuf_t seg;
+	LIST_HEAD(segs);
 #endif
 	if (sbuf->len == 0)
 		return 0;
@@ -772,7 +803,7 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 		if (sock_info->port == 0 && sock_info_bind(sock_info, 0) < 0)
 			return -1;
 
-		pkt = socket_alloc_pkt((int)sizeof(udp_hdr_t), sbuf);
+		pkt = socket_alloc_pkt((int)sizeof(udp_hdr_t), sbuf, 1);
 		if (pkt == NULL) {
 #ifdef CONFIG_BSD_COMPAT
 			errno = ENOBUFS;
@@ -780,7 +811,8 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 			return -1;
 		}
 
-		return udp_output(pkt, dst_addr, sock_info->port, dst_port);
+		return udp_output(pkt, sock_info_get_addr(sock_info), dst_addr,
+				  sock_info->port, dst_port);
 #endif
 #ifdef CONFIG_TCP
 	case SOCK_TYPE_TCP:
@@ -798,22 +830,131 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 			return -1;
 		}
 
-		pkt = socket_alloc_pkt((int)sizeof(tcp_hdr_t), sbuf);
-		if (pkt == NULL) {
+		if (!tcp_can_send(tcp_conn, sbuf->len)) {
 #ifdef CONFIG_BSD_COMPAT
-			errno = ENOBUFS;
+			errno = EAGAIN;
+#endif
+#ifdef CONFIG_EVENT
+			/* reported again when the peer acknowledges data */
+			event_block(&sock_info->event, EV_WRITE);
 #endif
 			return -1;
 		}
 
-		if (tcp_output(pkt, tcp_conn, TH_PUSH | TH_ACK) < 0) {
+		/* the last queued segment is filled first, the rest of the
+		 * data is cut in segments the peer accepts */
+		room = MIN(tcp_queue_room(tcp_conn), sbuf->len);
+		mss = tcp_conn_mss(tcp_conn);
+		for (off = room; off < sbuf->len; off += seg.len) {
+			sbuf_init(&seg, sbuf->data + off,
+				  MIN(mss, sbuf->len - off));
+			/* room is left for the options of the connection.
+			 * Segments are queued until acknowledged. */
+			pkt = socket_alloc_pkt((int)sizeof(tcp_hdr_t)
+					       + tcp_conn_opts_len(tcp_conn),
+					       &seg, 0);
+			if (pkt == NULL) {
+				LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &segs,
+							 list) {
+					list_del(&pkt->list);
+					pkt_free(pkt);
+				}
+#ifdef CONFIG_BSD_COMPAT
+				errno = ENOBUFS;
+#endif
+				return -1;
+			}
+			list_add_tail(&pkt->list, &segs);
+		}
+		sbuf_init(&seg, sbuf->data, room);
+		tcp_send(tcp_conn, &seg, &segs);
+		return 0;
+#endif
+	default:
+#ifdef CONFIG_BSD_COMPAT
+		errno = EBADF;
+#endif
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The payload is moved right after the headers of the packet if it does not
+ * start there already, the tcp layer rebuilds the headers from the start of
+ * the packet. It is summed like copied data. */
+static int socket_prepare_pkt(pkt_t *pkt, int hdrlen)
+{
+	int headroom = (int)sizeof(eth_hdr_t) + (int)sizeof(ip_hdr_t) + hdrlen;
+	uint16_t len = pkt_len(pkt);
+
+	if (pkt_is_shared(pkt) || headroom + len > pkt->buf.size)
+		return -1;
+	if (pkt->buf.skip != headroom) {
+		memmove(pkt->buf.data - pkt->buf.skip + headroom, btod(pkt),
+			len);
+		pkt_adj(pkt, headroom - pkt->buf.skip);
+		pkt->buf.len = len;
+	}
+	pkt->csum = cksum_partial(btod(pkt), len);
+	pkt->flags = PKT_FLAG_CSUM_PAYLOAD;
+	pkt_adj(pkt, -hdrlen);
+	return 0;
+}
+
+int socket_put_pkt(sock_info_t *sock_info, pkt_t *pkt, uint32_t dst_addr,
+		   uint16_t dst_port)
+{
+	sbuf_t sb;
+#ifdef CONFIG_TCP
+	tcp_conn_t *tcp_conn;
+	LIST_HEAD(segs);
+#endif
+
+	if (pkt_len(pkt) == 0) {
+		pkt_free(pkt);
+		return 0;
+	}
+
+	switch (sock_info->type) {
+#ifdef CONFIG_UDP
+	case SOCK_TYPE_UDP:
+		if (sock_info->port == 0 && sock_info_bind(sock_info, 0) < 0)
+			return -1;
+		if (socket_prepare_pkt(pkt, (int)sizeof(udp_hdr_t)) < 0)
+			break;
+		/* the datagram belongs to the network layer now */
+		udp_output(pkt, sock_info_get_addr(sock_info), dst_addr,
+			   sock_info->port, dst_port);
+		return 0;
+#endif
+#ifdef CONFIG_TCP
+	case SOCK_TYPE_TCP:
+		if ((tcp_conn = socket_get_tcp_conn(sock_info)) == NULL
+		    || tcp_conn->syn.status != SOCK_CONNECTED) {
 #ifdef CONFIG_BSD_COMPAT
 			errno = EBADF;
 #endif
 			return -1;
 		}
-		tcp_conn->syn.seqid = htonl(ntohl(tcp_conn->syn.seqid) +
-					    sbuf->len);
+		if (pkt_len(pkt) > tcp_conn_mss(tcp_conn))
+			break;
+		if (!tcp_can_send(tcp_conn, pkt_len(pkt))) {
+#ifdef CONFIG_BSD_COMPAT
+			errno = EAGAIN;
+#endif
+#ifdef CONFIG_EVENT
+			event_block(&sock_info->event, EV_WRITE);
+#endif
+			return -1;
+		}
+		/* room is left for the options of the connection */
+		if (socket_prepare_pkt(pkt, (int)sizeof(tcp_hdr_t)
+				       + tcp_conn_opts_len(tcp_conn)) < 0)
+			break;
+		list_add_tail(&pkt->list, &segs);
+		sbuf_init(&sb, NULL, 0);
+		tcp_send(tcp_conn, &sb, &segs);
 		return 0;
 #endif
 	default:
@@ -823,6 +964,11 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 		return -1;
 	}
 
+	/* the packet cannot be sent as is, its payload is copied */
+	sb = PKT2SBUF(pkt);
+	if (__socket_put_sbuf(sock_info, &sb, dst_addr, dst_port) < 0)
+		return -1;
+	pkt_free(pkt);
 	return 0;
 }
 
@@ -855,6 +1001,115 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 }
 #endif
 
+#ifdef CONFIG_TCP
+/* segments received on a stream socket, pointing to their ip header */
+static list_t *socket_tcp_rx_queue(sock_info_t *sock_info)
+{
+	list_t *rx_queue;
+#ifdef CONFIG_EVENT
+	rx_queue = sock_info->event.rx_queue;
+#else
+	tcp_conn_t *tcp_conn = socket_get_tcp_conn(sock_info);
+
+	rx_queue = tcp_conn ? &tcp_conn->pkt_list_head : NULL;
+#endif
+	if (rx_queue == NULL) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EBADF;
+#endif
+		return NULL;
+	}
+	if (list_empty(rx_queue)) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EAGAIN;
+#endif
+		return NULL;
+	}
+	return rx_queue;
+}
+
+/* Copy len bytes of the stream to buf if not NULL. Unless peek is set,
+ * they are consumed: segments are freed once read entirely and a partly
+ * read segment stays queued with the rest of its payload. */
+static int
+socket_stream_get(sock_info_t *sock_info, void *buf, int len, uint8_t peek)
+{
+	list_t *rx_queue;
+	pkt_t *pkt, *pkt_tmp;
+	int done = 0;
+
+	if (sock_info->type != SOCK_STREAM) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EBADF;
+#endif
+		return -1;
+	}
+	if ((rx_queue = socket_tcp_rx_queue(sock_info)) == NULL)
+		return -1;
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, rx_queue, list) {
+		ip_hdr_t *ip_hdr = btod(pkt);
+		tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr
+						   + ip_hdr->hl * 4);
+		uint16_t hdrs_len = ip_hdr->hl * 4 + tcp_hdr->hdr_len * 4;
+		int plen = pkt_len(pkt) - hdrs_len;
+		int n;
+
+		if (done == len)
+			break;
+		n = MIN(plen, len - done);
+		if (buf)
+			memcpy((uint8_t *)buf + done, (uint8_t *)ip_hdr + hdrs_len,
+			       n);
+		done += n;
+		if (peek)
+			continue;
+		if (n < plen) {
+			pkt_adj(pkt, hdrs_len);
+			tcp_pkt_trim(pkt, hdrs_len, n);
+			pkt_adj(pkt, -hdrs_len);
+			break;
+		}
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	return done;
+}
+
+int __socket_read(sock_info_t *sock_info, void *buf, int len)
+{
+	return socket_stream_get(sock_info, buf, len, 0);
+}
+
+int __socket_peek(sock_info_t *sock_info, void *buf, int len)
+{
+	return socket_stream_get(sock_info, buf, len, 1);
+}
+
+int __socket_skip(sock_info_t *sock_info, int len)
+{
+	return socket_stream_get(sock_info, NULL, len, 0);
+}
+
+#ifdef CONFIG_TCP_KEEPALIVE
+int __socket_set_keepalive(sock_info_t *sock_info, uint16_t idle,
+			   uint16_t intvl, uint8_t probes)
+{
+	tcp_conn_t *tcp_conn = sock_info->trq.tcp_conn;
+
+	if (sock_info->type != SOCK_STREAM || tcp_conn == NULL
+	    || tcp_conn->syn.status == SOCK_CLOSED) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EBADF;
+#endif
+		return -1;
+	}
+	tcp_conn_set_keepalive(tcp_conn, idle, intvl, probes);
+	return 0;
+}
+#endif
+#endif
+
 int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pktp,
 		     uint32_t *src_addr, uint16_t *src_port)
 {
@@ -865,9 +1120,7 @@ int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pktp,
 #endif
 #ifdef CONFIG_TCP
 	tcp_hdr_t *tcp_hdr;
-#ifndef CONFIG_EVENT
-	tcp_conn_t *tcp_conn;
-#endif
+	list_t *rx_queue;
 #endif
 
 	switch (sock_info->type) {
@@ -896,31 +1149,9 @@ int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pktp,
 #endif
 #ifdef CONFIG_TCP
 	case SOCK_STREAM:
-#ifdef CONFIG_EVENT
-		if (list_empty(sock_info->event.rx_queue)) {
-#ifdef CONFIG_BSD_COMPAT
-			errno = EAGAIN;
-#endif
-			return -1;
-		}
-
-		pkt = LIST_FIRST_ENTRY(sock_info->event.rx_queue, pkt_t, list);
-#else  /* CONFIG_EVENT */
-		if ((tcp_conn = socket_get_tcp_conn(sock_info)) == NULL) {
-#ifdef CONFIG_BSD_COMPAT
-			errno = EBADF;
-#endif
+		if ((rx_queue = socket_tcp_rx_queue(sock_info)) == NULL)
 			return -1;
-		}
-
-		if (list_empty(&tcp_conn->pkt_list_head)) {
-#ifdef CONFIG_BSD_COMPAT
-			errno = EAGAIN;
-#endif
-			return -1;
-		}
-		pkt = LIST_FIRST_ENTRY(&tcp_conn->pkt_list_head, pkt_t, list);
-#endif
+		pkt = LIST_FIRST_ENTRY(rx_queue, pkt_t, list);
 		list_del(&pkt->list);
 
 		ip_hdr = btod(pkt);
@@ -941,6 +1172,20 @@ int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pktp,
 }
 
 #ifdef CONFIG_BSD_COMPAT
+#ifdef CONFIG_TCP_KEEPALIVE
+int socket_set_keepalive(int fd, uint16_t idle, uint16_t intvl,
+			 uint8_t probes)
+{
+	sock_info_t *sock_info = fd2sockinfo(fd);
+
+	if (sock_info == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	return __socket_set_keepalive(sock_info, idle, intvl, probes);
+}
+#endif
+
 int socket_get_pkt(int fd, pkt_t **pktp, struct sockaddr_in *addr_in)
 {
 	sock_info_t *sock_info = fd2sockinfo(fd);
@@ -964,12 +1209,39 @@ int socket_get_pkt(int fd, pkt_t **pktp, struct sockaddr_in *addr_in)
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
 		 struct sockaddr *src_addr, socklen_t *addrlen)
 {
+	sock_info_t *sock_info = fd2sockinfo(sockfd);
+	struct sockaddr_in *addr_in = (struct sockaddr_in *)src_addr;
 	pkt_t *pkt;
 	int __len;
+#ifdef CONFIG_TCP
+	tcp_conn_t *tcp_conn;
+#endif
 
+	if (sock_info == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+#ifdef CONFIG_TCP
+	if (sock_info->type == SOCK_STREAM) {
+		if ((__len = socket_stream_get(sock_info, buf, len,
+					       flags & MSG_PEEK)) < 0)
+			return -1;
+		/* the peer of the connection */
+		tcp_conn = sock_info->trq.tcp_conn;
+		if (addr_in && tcp_conn) {
+			addr_in->sin_family = AF_INET;
+			addr_in->sin_addr.s_addr = tcp_conn->syn.tuid.src_addr;
+			addr_in->sin_port = tcp_conn->syn.tuid.src_port;
+			*addrlen = sizeof(struct sockaddr_in);
+		}
+		return __len;
+	}
+#endif
 	(void)flags;
-	if (socket_get_pkt(sockfd, &pkt, (struct sockaddr_in *)src_addr) < 0)
+	if (__socket_get_pkt(sock_info, &pkt, &addr_in->sin_addr.s_addr,
+			     &addr_in->sin_port) < 0)
 		return -1;
+	addr_in->sin_family = AF_INET;
 	*addrlen = sizeof(struct sockaddr_in);
 	__len = MIN((int)len, pkt->buf.len);
 	memcpy(buf, pkt->buf.data, __len);
@@ -986,7 +1258,7 @@ int close(int fd)
 
 	if (sock_info_close(sock_info) >= 0 && fd == cur_fd - 1)
 		cur_fd--;
-	free(sock_info);
+	obj_pool_free(&sock_info_pool, sock_info);
 	return 0;
 }
 
@@ -1024,7 +1296,7 @@ static int socket_free_cb(sbuf_t *key, sbuf_t *val, void **arg)
 #ifdef CONFIG_BSD_COMPAT
 	socket_listen_free(sock_info->listen);
 #endif
-	free(sock_info);
+	obj_pool_free(&sock_info_pool, sock_info);
 	return 0;
 }
 #endif
@@ -1053,7 +1325,9 @@ void socket_shutdown(void)
 #ifdef CONFIG_TCP
 		socket_listen_free(sock_info->listen);
 #endif
-		free(sock_info);
+#ifdef CONFIG_BSD_COMPAT
+		obj_pool_free(&sock_info_pool, sock_info);
+#endif
 	}
 #endif
 }
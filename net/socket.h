@@ -34,6 +34,20 @@
 #include "event.h"
 #endif
 
+#ifdef CONFIG_BSD_COMPAT
+/* sockets opened with socket() */
+#ifndef CONFIG_MAX_SOCKS
+#define CONFIG_MAX_SOCKS 8
+#endif
+#endif
+
+#ifdef CONFIG_TCP
+/* sockets listening simultaneously */
+#ifndef CONFIG_TCP_MAX_LISTENS
+#define CONFIG_TCP_MAX_LISTENS 2
+#endif
+#endif
+
 /*
  * Socket types
  */
@@ -69,6 +83,11 @@ typedef int ssize_t;
 
 #define INADDR_ANY ((uint32_t)0)
 
+#ifdef CONFIG_BSD_COMPAT
+/* recvfrom() flags */
+#define MSG_PEEK 0x2 /* leave the data read in the socket, streams only */
+#endif
+
 struct sockaddr {
 	sa_family_t sa_family;  /* address family, AF_xxx       */
 	char sa_data[14];       /* 14 bytes of protocol address */
@@ -137,8 +156,8 @@ typedef struct sock_info {
 #ifndef CONFIG_HT_STORAGE
 	struct list_head list;
 #endif
-#if 0 /* only one ip address is allowed on an interface */
-	uaddr_t  addr;
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	uaddr_t  addr; /* local address, 0 for any */
 #endif
 	uint16_t port;
 
@@ -171,6 +190,24 @@ typedef struct sock_info {
 
 #define SBUF2SOCKINFO(sb) *(sock_info_t **)(sb)->data
 
+static inline uint32_t sock_info_get_addr(const sock_info_t *sock_info)
+{
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	return sock_info->addr.ip4_addr;
+#else
+	(void)sock_info;
+	return 0;
+#endif
+}
+
+static inline int
+sock_info_match_addr(const sock_info_t *sock_info, uint32_t addr)
+{
+	uint32_t local = sock_info_get_addr(sock_info);
+
+	return local == 0 || local == addr;
+}
+
 #ifdef CONFIG_EVENT
 /** Register an event on a socket
  *
@@ -224,6 +261,27 @@ socket_event_clear_mask(sock_info_t *sock_info, uint8_t events)
 	event_clear_mask(&sock_info->event, events);
 }
 
+#ifdef CONFIG_EVENT_POLL
+/** Add a socket to an event poll
+ *
+ * The socket must be bound or connected, like for
+ * socket_event_register().
+ *
+ * @param[in] sock_info  network socket
+ * @param[in] poll       event poll
+ * @param[in] events     events to report
+ * @param[in] flags      EV_POLL_EDGE or 0
+ */
+static inline void
+socket_event_poll_add(sock_info_t *sock_info, event_poll_t *poll,
+		      uint8_t events, uint8_t flags)
+{
+	socket_event_register(sock_info, events, NULL);
+	if (sock_info->event.rx_queue)
+		event_poll_add(poll, &sock_info->event, flags);
+}
+#endif
+
 /** Get socket from event
  *
  * @param[in] ev     event
@@ -315,6 +373,9 @@ ssize_t sendto(int fd, const void *buf, size_t len, int flags,
 	       const struct sockaddr *dest_addr, socklen_t addrlen);
 
 /** Receive a buffer from a BSD compatible network socket
+ *
+ * A datagram is truncated to len bytes. On a stream socket, the bytes
+ * left are kept for the next call.
  *
  * @param[in]  fd       file descriptor
  * @param[out] buf      data buffer
@@ -345,6 +406,21 @@ int socket_get_pkt(int fd, pkt_t **pkt, struct sockaddr_in *addr);
  */
 int
 socket_put_sbuf(int fd, const sbuf_t *sbuf, const struct sockaddr_in *addr);
+
+#ifdef CONFIG_TCP_KEEPALIVE
+/** Set keepalive settings of a BSD compatible stream socket
+ *
+ * Keepalive is off on new connections, see __socket_set_keepalive().
+ *
+ * @param[in] fd      file descriptor
+ * @param[in] idle    idle time in seconds, 0 disables keepalive
+ * @param[in] intvl   time between probes in seconds
+ * @param[in] probes  unanswered probes before the connection is dropped
+ * @return 0 on success, -1 on failure
+ */
+int socket_set_keepalive(int fd, uint16_t idle, uint16_t intvl,
+			 uint8_t probes);
+#endif
 #endif
 
 /** Get packet from a network socket
@@ -358,6 +434,55 @@ socket_put_sbuf(int fd, const sbuf_t *sbuf, const struct sockaddr_in *addr);
 int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pkt,
 		     uint32_t *src_addr, uint16_t *src_port);
 
+#ifdef CONFIG_TCP
+/** Read bytes from a stream socket
+ *
+ * The received segments are read as a byte stream. A segment is freed as
+ * soon as all its bytes are read, a partly read one stays in the socket
+ * with the bytes left.
+ *
+ * @param[in]  sock_info  network socket
+ * @param[out] buf        data buffer
+ * @param[in]  len        data buffer length
+ * @return number of bytes read, -1 if there is nothing to read
+ */
+int __socket_read(sock_info_t *sock_info, void *buf, int len);
+
+/** Read bytes from a stream socket without removing them
+ *
+ * @param[in]  sock_info  network socket
+ * @param[out] buf        data buffer
+ * @param[in]  len        data buffer length
+ * @return number of bytes read, -1 if there is nothing to read
+ */
+int __socket_peek(sock_info_t *sock_info, void *buf, int len);
+
+/** Discard bytes from a stream socket
+ *
+ * @param[in]  sock_info  network socket
+ * @param[in]  len        number of bytes to discard
+ * @return number of bytes discarded, -1 if there is nothing to discard
+ */
+int __socket_skip(sock_info_t *sock_info, int len);
+
+#ifdef CONFIG_TCP_KEEPALIVE
+/** Set keepalive settings of a stream socket
+ *
+ * Keepalive is off on new connections. Once enabled, the connection of
+ * the socket is probed when it receives nothing for idle seconds. It is dropped after probes unanswered probes sent every
+ * intvl seconds, see tcp_conn_set_keepalive().
+ *
+ * @param[in] sock_info  connected network socket
+ * @param[in] idle       idle time in seconds, 0 disables keepalive
+ * @param[in] intvl      time between probes in seconds
+ * @param[in] probes     unanswered probes before the connection is dropped
+ * @return 0 on success, -1 if the socket is not connected
+ */
+int __socket_set_keepalive(sock_info_t *sock_info, uint16_t idle,
+			   uint16_t intvl, uint8_t probes);
+#endif
+#endif
+
 /** Send data on a network socket
  *
  * @param[in]  sock_info  network socket
@@ -369,6 +494,24 @@ int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pkt,
 int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 		      uint32_t dst_addr, uint16_t dst_port);
 
+/** Send a packet on a network socket
+ *
+ * The payload is sent without being copied if the packet has room for the
+ * link, ip and transport headers before it, like the packets received from
+ * a socket, and a tcp segment does not exceed the MSS of the connection.
+ * It is copied otherwise. A received packet can be sent back as is.
+ *
+ * @param[in] sock_info  network socket
+ * @param[in] pkt        packet pointing to its payload. It belongs to the
+ *                       stack on success and is left to the caller on
+ *                       failure.
+ * @param[in] dst_addr   dest address
+ * @param[in] dst_port   dest port
+ * @return 0 on success, -1 on failure
+ */
+int socket_put_pkt(sock_info_t *sock_info, pkt_t *pkt, uint32_t dst_addr,
+		   uint16_t dst_port);
+
 /** Initialize a network socket
  *
  * @param[in] sock_info  network socket
@@ -385,6 +528,21 @@ int sock_info_init(sock_info_t *sock_info, int sock_type);
  */
 int sock_info_bind(sock_info_t *sock_info, uint16_t port);
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+/** Bind a network socket to a local address
+ *
+ * The socket only receives datagrams or connections sent to addr and
+ * uses it as source address. The port is still reserved on all the
+ * addresses.
+ *
+ * @param[in] sock_info  network socket
+ * @param[in] addr       local address, 0 for any
+ * @param[in] port       local port
+ * @return 0 on success, -1 on failure
+ */
+int sock_info_bind_addr(sock_info_t *sock_info, uint32_t addr, uint16_t port);
+#endif
+
 /** Close a network socket
  *
  * @param[in] sock_info  network socket
@@ -0,0 +1,210 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#include "tcp-cc.h"
+
+/* duplicate acknowledgments announcing a loss */
+#define TCP_CC_DUPACK_THRESH 3
+
+/* largest window the peer can announce */
+#define TCP_CC_CWND_MAX 0x3FFFFFFFUL
+
+#ifdef CONFIG_TCP_CC_NEWRENO
+const tcp_cc_ops_t *tcp_cc_ops = &tcp_cc_newreno;
+#else
+const tcp_cc_ops_t *tcp_cc_ops = &tcp_cc_compact;
+#endif
+
+void tcp_cc_set(const tcp_cc_ops_t *ops)
+{
+	tcp_cc_ops = ops;
+}
+
+static inline uint32_t tcp_cc_flight(const tcp_conn_t *tcp_conn)
+{
+	return ntohl(tcp_conn->syn.seqid) - tcp_conn->snd_una;
+}
+
+/* RFC 5681 initial window */
+static void tcp_cc_init_wnd(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_t *cc = &tcp_conn->cc;
+	uint16_t mss = tcp_conn_mss(tcp_conn);
+
+	if (mss > 2190)
+		cc->cwnd = 2 * mss;
+	else if (mss > 1095)
+		cc->cwnd = 3 * mss;
+	else
+		cc->cwnd = 4 * mss;
+	cc->ssthresh = TCP_CC_CWND_MAX;
+	cc->dupacks = 0;
+	cc->flags = 0;
+#ifdef CONFIG_TCP_CC_NEWRENO
+	/* set for all algorithms, NewReno may be selected later */
+	cc->recover = tcp_conn->snd_una - 1;
+#endif
+}
+
+/* slow start then congestion avoidance */
+static void tcp_cc_open(tcp_conn_t *tcp_conn, uint32_t acked)
+{
+	tcp_cc_t *cc = &tcp_conn->cc;
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+
+	if (cc->cwnd < cc->ssthresh)
+		cc->cwnd += MIN(acked, mss);
+	else
+		cc->cwnd += MAX(mss * mss / cc->cwnd, 1);
+	if (cc->cwnd > TCP_CC_CWND_MAX)
+		cc->cwnd = TCP_CC_CWND_MAX;
+}
+
+static void tcp_cc_loss(tcp_conn_t *tcp_conn)
+{
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+
+	tcp_conn->cc.ssthresh = MAX(tcp_cc_flight(tcp_conn) / 2, 2 * mss);
+}
+
+static uint8_t tcp_cc_count_dupack(tcp_cc_t *cc)
+{
+	if (cc->dupacks < TCP_CC_DUPACK_THRESH)
+		cc->dupacks++;
+	else
+		return 0;
+	return cc->dupacks == TCP_CC_DUPACK_THRESH;
+}
+
+#ifdef CONFIG_TCP_CC_NEWRENO
+static uint8_t newreno_ack(tcp_conn_t *tcp_conn, uint32_t acked)
+{
+	tcp_cc_t *cc = &tcp_conn->cc;
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+
+	cc->dupacks = 0;
+	if ((cc->flags & TCP_CC_RECOVERY) == 0) {
+		tcp_cc_open(tcp_conn, acked);
+		return 0;
+	}
+	if (SEQ_GT(tcp_conn->snd_una, cc->recover)) {
+		/* full acknowledgment, deflate the window */
+		cc->cwnd = MIN(cc->ssthresh, MAX(tcp_cc_flight(tcp_conn), mss)
+			       + mss);
+		cc->flags &= ~TCP_CC_RECOVERY;
+		return 0;
+	}
+	/* partial acknowledgment, the next hole is resent */
+	cc->cwnd -= MIN(acked, cc->cwnd);
+	if (acked >= mss || cc->cwnd < mss)
+		cc->cwnd += mss;
+	return 1;
+}
+
+static uint8_t newreno_dupack(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_t *cc = &tcp_conn->cc;
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+
+	if (cc->flags & TCP_CC_RECOVERY) {
+		/* a segment left the network */
+		if (cc->cwnd < TCP_CC_CWND_MAX)
+			cc->cwnd += mss;
+		return 0;
+	}
+	if (!tcp_cc_count_dupack(cc))
+		return 0;
+	/* segments sent before the last loss are still acknowledged */
+	if (SEQ_LEQ(tcp_conn->snd_una, cc->recover))
+		return 0;
+	tcp_cc_loss(tcp_conn);
+	cc->recover = ntohl(tcp_conn->syn.seqid) - 1;
+	cc->cwnd = cc->ssthresh + TCP_CC_DUPACK_THRESH * mss;
+	cc->flags |= TCP_CC_RECOVERY;
+	return 1;
+}
+
+static void newreno_timeout(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_t *cc = &tcp_conn->cc;
+
+	tcp_cc_loss(tcp_conn);
+	cc->cwnd = tcp_conn_mss(tcp_conn);
+	cc->dupacks = 0;
+	cc->recover = ntohl(tcp_conn->syn.seqid) - 1;
+	cc->flags &= ~TCP_CC_RECOVERY;
+}
+
+const tcp_cc_ops_t tcp_cc_newreno = {
+	.init = tcp_cc_init_wnd,
+	.ack = newreno_ack,
+	.dupack = newreno_dupack,
+	.timeout = newreno_timeout,
+};
+#endif
+
+#ifdef CONFIG_TCP_CC_COMPACT
+/* a fast recovery started before switching algorithms is ended, the
+ * inflated window is brought back to the threshold */
+static void compact_end_recovery(tcp_cc_t *cc)
+{
+	if ((cc->flags & TCP_CC_RECOVERY) == 0)
+		return;
+	cc->cwnd = MIN(cc->cwnd, cc->ssthresh);
+	cc->flags &= ~TCP_CC_RECOVERY;
+}
+
+static uint8_t compact_ack(tcp_conn_t *tcp_conn, uint32_t acked)
+{
+	compact_end_recovery(&tcp_conn->cc);
+	tcp_conn->cc.dupacks = 0;
+	tcp_cc_open(tcp_conn, acked);
+	return 0;
+}
+
+static uint8_t compact_dupack(tcp_conn_t *tcp_conn)
+{
+	compact_end_recovery(&tcp_conn->cc);
+	if (!tcp_cc_count_dupack(&tcp_conn->cc))
+		return 0;
+	tcp_cc_loss(tcp_conn);
+	tcp_conn->cc.cwnd = tcp_conn->cc.ssthresh;
+	return 1;
+}
+
+static void compact_timeout(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_loss(tcp_conn);
+	tcp_conn->cc.cwnd = tcp_conn_mss(tcp_conn);
+	tcp_conn->cc.dupacks = 0;
+	tcp_conn->cc.flags &= ~TCP_CC_RECOVERY;
+}
+
+const tcp_cc_ops_t tcp_cc_compact = {
+	.init = tcp_cc_init_wnd,
+	.ack = compact_ack,
+	.dupack = compact_dupack,
+	.timeout = compact_timeout,
+};
+#endif
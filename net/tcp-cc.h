@@ -0,0 +1,105 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#ifndef _TCP_CC_H_
+#define _TCP_CC_H_
+
+#include "tcp.h"
+
+/* Congestion control algorithms only set the congestion window and the
+ * slow start threshold of the connections, tcp.c sends and resends the
+ * segments.
+ *
+ * CONFIG_TCP_CC_NEWRENO: slow start, congestion avoidance, fast
+ *   retransmit and fast recovery (RFC 5681, RFC 6582). It is the default.
+ * CONFIG_TCP_CC_COMPACT: slow start, congestion avoidance and fast
+ *   retransmit. The window is halved without inflating it during the
+ *   recovery, there is no recovery point to track.
+ *
+ * Both can be compiled in, NewReno is used unless tcp_cc_set() selects
+ * the other one. */
+
+/* the connection is in fast recovery */
+#define TCP_CC_RECOVERY 0x01
+
+typedef struct tcp_cc_ops {
+	/** Initialize the congestion state of an established connection */
+	void (*init)(tcp_conn_t *tcp_conn);
+
+	/** New data is acknowledged, snd_una is already updated
+	 *
+	 * @return 1 if the first unacknowledged segment has to be resent
+	 */
+	uint8_t (*ack)(tcp_conn_t *tcp_conn, uint32_t acked);
+
+	/** A duplicate acknowledgment is received
+	 *
+	 * @return 1 if the first unacknowledged segment has to be resent
+	 */
+	uint8_t (*dupack)(tcp_conn_t *tcp_conn);
+
+	/** The retransmission timer expired */
+	void (*timeout)(tcp_conn_t *tcp_conn);
+} tcp_cc_ops_t;
+
+#ifdef CONFIG_TCP_CC_NEWRENO
+extern const tcp_cc_ops_t tcp_cc_newreno;
+#endif
+#ifdef CONFIG_TCP_CC_COMPACT
+extern const tcp_cc_ops_t tcp_cc_compact;
+#endif
+
+/** Set the congestion control algorithm of all the connections
+ *
+ * Algorithms share the connection state, they can be changed at any
+ * time. A fast recovery in progress when switching to the compact
+ * algorithm is ended on the next acknowledgment.
+ *
+ * @param[in] ops  algorithm
+ */
+void tcp_cc_set(const tcp_cc_ops_t *ops);
+
+extern const tcp_cc_ops_t *tcp_cc_ops;
+
+static inline void tcp_cc_init(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_ops->init(tcp_conn);
+}
+
+static inline uint8_t tcp_cc_ack(tcp_conn_t *tcp_conn, uint32_t acked)
+{
+	return tcp_cc_ops->ack(tcp_conn, acked);
+}
+
+static inline uint8_t tcp_cc_dupack(tcp_conn_t *tcp_conn)
+{
+	return tcp_cc_ops->dupack(tcp_conn);
+}
+
+static inline void tcp_cc_timeout(tcp_conn_t *tcp_conn)
+{
+	tcp_cc_ops->timeout(tcp_conn);
+}
+
+#endif
@@ -24,7 +24,12 @@
 
 #include <sys/hash-tables.h>
 #include <sys/scheduler.h>
+#include <sys/chksum.h>
+#include <sys/timer.h>
 #include "tcp.h"
+#ifdef CONFIG_TCP_RETRANSMIT
+#include "tcp-cc.h"
+#endif
 #include "ip.h"
 #include "icmp.h"
 #include "eth.h"
@@ -36,68 +41,247 @@ static HTABLE_DECL(tcp_conns, CONFIG_MAX_SOCK_HT_SIZE);
 #else
 static list_t tcp_conns = LIST_HEAD_INIT(tcp_conns);
 #endif
-static uint8_t tcp_conn_cnt;
+STATIC_OBJ_POOL_DECL(tcp_conn_pool, tcp_conn_t, CONFIG_TCP_MAX_CONNS);
 
 typedef struct syn_entries {
 	tcp_syn_t conns[CONFIG_TCP_SYN_TABLE_SIZE];
-	uint8_t pos;
+	uint32_t ticks[CONFIG_TCP_SYN_TABLE_SIZE];	/* SYN reception time */
 } syn_entries_t;
 
-syn_entries_t syn_entries;
+static syn_entries_t syn_entries;
+static tcp_syn_stats_t syn_stats;
+static uint32_t syn_secret;
 
 #ifdef CONFIG_TCP_CLIENT
 list_t tcp_client_conns = LIST_HEAD_INIT(tcp_client_conns);
 #endif
 
+#define TCP_MS_TO_TICKS(ms) ((ms) * 1000UL / CONFIG_TIMER_RESOLUTION_US)
+
 #ifdef CONFIG_TCP_RETRANSMIT
-#define TCP_IN_PROGRESS_RETRIES 3
+#define TCP_RTO_MIN TCP_MS_TO_TICKS(CONFIG_TCP_RTO_MIN)
+#define TCP_RTO_MAX TCP_MS_TO_TICKS(CONFIG_TCP_RTO_MAX)
+#endif
+
+#define TCP_MSS (CONFIG_PKT_SIZE - sizeof(eth_hdr_t) - sizeof(ip_hdr_t) \
+		 - sizeof(tcp_hdr_t) - TCPOLEN_MAXSEG)
+
+/* smallest MSS accepted from a peer, above the 40 bytes of options a
+ * segment can carry */
+#define TCP_MSS_MIN 64
+
+/* free packets not accounted in the receive window, they are left for
+ * acknowledgments and the other connections */
+#define TCP_RCV_WND_RESERVE 2
+
+#ifdef CONFIG_TCP_WSCALE
+/* RFC 7323 limit of the window scale shift */
+#define TCP_WSCALE_MAX 14
 #endif
 
+/* entries probed from the one a connection hashes to */
+#define TCP_SYN_PROBES MIN(CONFIG_TCP_SYN_TABLE_SIZE, 4)
+#define TCP_SYN_TIMEOUT TCP_MS_TO_TICKS(CONFIG_TCP_SYN_TIMEOUT)
+
+#ifdef CONFIG_TCP_SYN_COOKIES
+/* a cookie is valid during the period it is sent in and the next one */
+#define TCP_SYN_COOKIE_PERIOD TCP_MS_TO_TICKS(64000)
+#define TCP_SYN_COOKIE_MSS_MASK 0x07
+
+/* MSS values a cookie can encode */
+static const uint16_t syn_cookie_mss[] = {
+	64, 128, 256, 384, 512, 536, 1220, 1460,
+};
+#endif
+
+/* Jenkins one-at-a-time hash */
+static uint32_t tcp_hash(const void *data, uint8_t len, uint32_t hash)
+{
+	const uint8_t *d = data;
+
+	while (len--) {
+		hash += *d++;
+		hash += hash << 10;
+		hash ^= hash >> 6;
+	}
+	hash += hash << 3;
+	hash ^= hash >> 11;
+	hash += hash << 15;
+	return hash;
+}
+
+/* the secret keeps the entries a connection takes unpredictable */
+static inline unsigned syn_hash(const tcp_uid_t *uid)
+{
+	return tcp_hash(uid, sizeof(tcp_uid_t), syn_secret)
+		& (CONFIG_TCP_SYN_TABLE_SIZE - 1);
+}
+
+#define SYN_ENTRY_POS(hash, i) \
+	(((hash) + (i)) & (CONFIG_TCP_SYN_TABLE_SIZE - 1))
+
 static tcp_syn_t *syn_find_entry(const tcp_uid_t *uid)
 {
-	int i;
+	unsigned hash = syn_hash(uid);
+	uint8_t i;
+
+	for (i = 0; i < TCP_SYN_PROBES; i++) {
+		tcp_syn_t *tsyn_entry;
 
-	for (i = 0; i < CONFIG_TCP_SYN_TABLE_SIZE; i++) {
-		if (memcmp(&syn_entries.conns[i].tuid, uid,
-			   sizeof(tcp_uid_t)) == 0)
-			return &syn_entries.conns[i];
+		tsyn_entry = &syn_entries.conns[SYN_ENTRY_POS(hash, i)];
+		if (tsyn_entry->status == SOCK_TCP_SYN_ACK_SENT
+		    && memcmp(&tsyn_entry->tuid, uid, sizeof(tcp_uid_t)) == 0)
+			return tsyn_entry;
 	}
 	return NULL;
 }
 
+/* Entries are freed when their connection is established or reset, those
+ * of half-open connections are reused after CONFIG_TCP_SYN_TIMEOUT. */
+static tcp_syn_t *syn_alloc_entry(const tcp_uid_t *uid)
+{
+	unsigned hash = syn_hash(uid);
+	unsigned pos, oldest = hash;
+	uint8_t i;
+
+	for (i = 0; i < TCP_SYN_PROBES; i++) {
+		pos = SYN_ENTRY_POS(hash, i);
+		if (syn_entries.conns[pos].status != SOCK_TCP_SYN_ACK_SENT
+		    || timer_ticks - syn_entries.ticks[pos] >= TCP_SYN_TIMEOUT)
+			goto found;
+		if (SEQ_LT(syn_entries.ticks[pos], syn_entries.ticks[oldest]))
+			oldest = pos;
+	}
+	syn_stats.overflows++;
+#ifdef CONFIG_TCP_SYN_COOKIES
+	return NULL;
+#else
+	/* the oldest half-open connection is dropped */
+	syn_stats.evicted++;
+	pos = oldest;
+#endif
+ found:
+	syn_entries.ticks[pos] = timer_ticks;
+	return &syn_entries.conns[pos];
+}
+
+#ifdef CONFIG_TCP_SYN_COOKIES
+/* the upper bits of the cookie authenticate the connection, its initial
+ * sequence number and the period, the lower ones carry the MSS index */
+static uint32_t
+syn_cookie_hash(const tcp_uid_t *uid, uint32_t isn, uint32_t period)
+{
+	uint32_t hash = tcp_hash(uid, sizeof(tcp_uid_t), syn_secret);
+
+	hash = tcp_hash(&isn, sizeof(isn), hash);
+	return tcp_hash(&period, sizeof(period), hash)
+		& ~TCP_SYN_COOKIE_MSS_MASK;
+}
+
+static uint32_t syn_cookie_make(const tcp_uid_t *uid, uint32_t isn,
+				uint16_t mss)
+{
+	uint8_t i = countof(syn_cookie_mss) - 1;
+
+	/* RFC 879 default */
+	if (mss == 0)
+		mss = 536;
+	while (i && syn_cookie_mss[i] > mss)
+		i--;
+	return syn_cookie_hash(uid, isn, timer_ticks / TCP_SYN_COOKIE_PERIOD)
+		| i;
+}
+
+/* return the MSS encoded in a valid cookie, 0 otherwise */
+static uint16_t
+syn_cookie_check(const tcp_uid_t *uid, uint32_t isn, uint32_t cookie)
+{
+	uint32_t period = timer_ticks / TCP_SYN_COOKIE_PERIOD;
+	uint32_t hash = cookie & ~TCP_SYN_COOKIE_MSS_MASK;
+
+	if (syn_cookie_hash(uid, isn, period) != hash
+	    && syn_cookie_hash(uid, isn, period - 1) != hash)
+		return 0;
+	return syn_cookie_mss[cookie & TCP_SYN_COOKIE_MSS_MASK];
+}
+#endif
+
 #ifdef CONFIG_TCP_RETRANSMIT
 static inline void tcp_retransmit_init(tcp_retrn_t *retrn)
 {
 	timer_init(&retrn->timer);
 	retrn->timer.cb = NULL;
 	INIT_LIST_HEAD(&retrn->retrn_pkt_list);
+	retrn->cnt = 0;
+	retrn->rtt_flags = 0;
+	retrn->rto = TCP_MS_TO_TICKS(CONFIG_TCP_RETRANSMIT_TIMEOUT);
+	retrn->rxt_nxt = 0;
+	retrn->rxt_end = 0;
 }
 
 static void tcp_retrn_wipe(tcp_conn_t *tcp_conn)
 {
-	tcp_retrn_pkt_t *retrn_pkt, *retrn_pkt_tmp;
+	pkt_t *pkt, *pkt_tmp;
 
 	timer_del(&tcp_conn->retrn.timer);
-	LIST_FOR_EACH_ENTRY_SAFE(retrn_pkt, retrn_pkt_tmp,
-				 &tcp_conn->retrn.retrn_pkt_list, list) {
-		list_del(&retrn_pkt->list);
-		pkt_free(retrn_pkt->pkt);
-		free(retrn_pkt);
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->retrn.retrn_pkt_list,
+				 retrn_list) {
+		list_del(&pkt->retrn_list);
+		pkt_free(pkt);
 	}
 }
 #endif
 
-static void __tcp_adj_out_pkt(pkt_t *out)
+#ifdef CONFIG_TCP_DELAYED_ACK
+/* the acknowledgment goes along with the segment being sent */
+static void tcp_ack_sent(tcp_conn_t *tcp_conn)
+{
+	tcp_conn->ack_pending = 0;
+	timer_del(&tcp_conn->ack_timer);
+}
+#endif
+
+/* out points to the tcp header, followed by opts_len bytes of options */
+static void __tcp_adj_out_pkt(pkt_t *out, uint8_t opts_len)
 {
 	pkt_adj(out, (int)sizeof(eth_hdr_t) + (int)sizeof(ip_hdr_t)
 		+ (int)sizeof(tcp_hdr_t));
 	pkt_adj(out, -(int)sizeof(tcp_hdr_t));
+	out->buf.len += opts_len;
 }
 
+static void tcp_rcv_wipe(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->pkt_list_head, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->ooo_list, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	tcp_conn->ooo_nb = 0;
+}
+
+static void tcp_queue_wipe(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->snd_queue, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	tcp_conn->snd_queued = 0;
+}
+
+static void __tcp_push(tcp_conn_t *tcp_conn, uint8_t force);
+
 static void tcp_close(tcp_conn_t *tcp_conn, pkt_t *fin_pkt)
 {
 	tcp_conn->syn.status = SOCK_TCP_FIN_SENT;
-	__tcp_adj_out_pkt(fin_pkt);
+	__tcp_adj_out_pkt(fin_pkt, tcp_conn_opts_len(tcp_conn));
 	tcp_output(fin_pkt, tcp_conn, TH_FIN|TH_ACK);
 	tcp_conn->syn.seqid = htonl(ntohl(tcp_conn->syn.seqid) + 1);
 }
@@ -105,55 +289,71 @@ static void tcp_close(tcp_conn_t *tcp_conn, pkt_t *fin_pkt)
 void __tcp_conn_delete(tcp_conn_t *tcp_conn)
 {
 	sock_info_t *sock_info = tcp_conn->sock_info;
-	pkt_t *pkt, *pkt_tmp;
 
 	if (sock_info)
 		sock_info->trq.tcp_conn = NULL;
-	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->pkt_list_head, list) {
-		list_del(&pkt->list);
-		pkt_free(pkt);
-	}
+#ifdef CONFIG_TCP_DELAYED_ACK
+	tcp_ack_sent(tcp_conn);
+#endif
+	tcp_rcv_wipe(tcp_conn);
 
 	if (tcp_conn->syn.status == SOCK_CONNECTED) {
 		pkt_t *fin_pkt = pkt_alloc();
 
 		if (fin_pkt != NULL) {
+			/* the queued data goes before the FIN */
+			__tcp_push(tcp_conn, 1);
 			tcp_close(tcp_conn, fin_pkt);
 			return;
 		}
 	}
+	tcp_queue_wipe(tcp_conn);
 #ifdef CONFIG_TCP_RETRANSMIT
 	tcp_retrn_wipe(tcp_conn);
 #endif
-	assert(tcp_conn_cnt <= CONFIG_TCP_MAX_CONNS);
 
 	/* make sure tcp_conn is removed from the connection list */
 	if (!list_empty(&tcp_conn->list) && tcp_conn->list.next != LIST_POISON1)
 		list_del(&tcp_conn->list);
-	free(tcp_conn);
-	tcp_conn_cnt--;
+	obj_pool_free(&tcp_conn_pool, tcp_conn);
 }
 
+#ifdef CONFIG_TCP_KEEPALIVE
+static void tcp_keepalive_arm(void);
+#endif
+
 static tcp_conn_t *
 tcp_conn_create(const tcp_uid_t *tuid, uint8_t status, sock_info_t *sock_info)
 {
 	tcp_conn_t *conn;
 
-	if (tcp_conn_cnt >= CONFIG_TCP_MAX_CONNS)
+	if ((conn = obj_pool_alloc(&tcp_conn_pool)) == NULL)
 		return NULL;
 
-	conn = malloc(sizeof(tcp_conn_t));
-	if (conn == NULL)
-		return NULL;
-
-	tcp_conn_cnt++;
 	INIT_LIST_HEAD(&conn->pkt_list_head);
+	INIT_LIST_HEAD(&conn->ooo_list);
 	INIT_LIST_HEAD(&conn->list);
+	INIT_LIST_HEAD(&conn->snd_queue);
+	conn->ooo_nb = 0;
+	conn->snd_queued = 0;
+	conn->snd_una = 0;
+	conn->snd_wnd = 0;
 	conn->syn.status = status;
 	conn->syn.tuid = *tuid;
+	memset(&conn->syn.opts, 0, sizeof(tcp_options_t));
 	conn->sock_info = sock_info;
+#ifdef CONFIG_TCP_DELAYED_ACK
+	conn->ack_pending = 0;
+	timer_init(&conn->ack_timer);
+#endif
 #ifdef CONFIG_TCP_RETRANSMIT
 	tcp_retransmit_init(&conn->retrn);
+	tcp_cc_init(conn);
+#endif
+#ifdef CONFIG_TCP_KEEPALIVE
+	/* RFC 1122, keepalive is off until the application enables it */
+	tcp_conn_set_keepalive(conn, 0, 0, 0);
+	conn->ka.rcv_ticks = timer_ticks;
 #endif
 
 	return conn;
@@ -230,7 +430,50 @@ static tcp_conn_t *tcp_client_conn_lookup(const tcp_uid_t *uid)
 }
 #endif
 
-static int tcp_set_options(void *data, const tcp_options_t *tcp_opts)
+#ifdef CONFIG_TCP_WSCALE
+/* the shift of the windows we advertise lets the whole packet pool be
+ * announced */
+static uint8_t tcp_rcv_wscale(void)
+{
+	uint32_t wnd = (uint32_t)CONFIG_PKT_NB_MAX * TCP_MSS;
+	uint8_t shift = 0;
+
+	while ((wnd >> shift) > 0xFFFF && shift < TCP_WSCALE_MAX)
+		shift++;
+	return shift;
+}
+#endif
+
+#ifdef CONFIG_TCP_TIMESTAMPS
+/* RFC 7323 appendix A layout, the values are aligned on 4 bytes. Timer
+ * ticks are the timestamp clock. */
+static void tcp_set_ts_opt(uint8_t *opts, uint32_t ts_ecr)
+{
+	opts[0] = TCPOPT_NOP;
+	opts[1] = TCPOPT_NOP;
+	opts[2] = TCPOPT_TIMESTAMP;
+	opts[3] = TCPOLEN_TIMESTAMP;
+	*(uint32_t *)(opts + 4) = htonl(timer_ticks);
+	*(uint32_t *)(opts + 8) = htonl(ts_ecr);
+}
+#endif
+
+/* length of the options set in the segments but SYNs */
+static inline uint8_t tcp_opts_len(const tcp_syn_t *tcp_syn, uint8_t ctrl)
+{
+#ifdef CONFIG_TCP_TIMESTAMPS
+	if ((ctrl & (TH_SYN|TH_RST)) == 0
+	    && (tcp_syn->opts.flags & TCP_OPT_TS))
+		return TCPOLEN_TSTAMP_APPA;
+#else
+	(void)tcp_syn;
+	(void)ctrl;
+#endif
+	return 0;
+}
+
+static int
+tcp_set_options(void *data, const tcp_options_t *tcp_opts, uint8_t ctrl)
 {
 	uint8_t *opts = data;
 	uint16_t opts_len = 0;
@@ -239,14 +482,105 @@ static int tcp_set_options(void *data, const tcp_options_t *tcp_opts)
 	/* MSS */
 	opts[0] = TCPOPT_MAXSEG;
 	opts[1] = TCPOLEN_MAXSEG;
-	opts += 2;
-	mss = CONFIG_PKT_SIZE - sizeof(eth_hdr_t)
-		- sizeof(ip_hdr_t) - sizeof(tcp_hdr_t) - TCPOLEN_MAXSEG;
-	*(uint16_t *)opts = htons(mss);
+	mss = TCP_MSS;
+	*(uint16_t *)(opts + 2) = htons(mss);
+	opts += TCPOLEN_MAXSEG;
 	opts_len += TCPOLEN_MAXSEG;
+#ifdef CONFIG_TCP_SACK
+	/* offered in SYNs, accepted in SYN-ACKs if the peer offered it */
+	if ((ctrl & TH_ACK) == 0 || tcp_opts->sack_permitted) {
+		opts[0] = TCPOPT_NOP;
+		opts[1] = TCPOPT_NOP;
+		opts[2] = TCPOPT_SACK_PERMITTED;
+		opts[3] = TCPOLEN_SACK_PERMITTED;
+		opts += 2 + TCPOLEN_SACK_PERMITTED;
+		opts_len += 2 + TCPOLEN_SACK_PERMITTED;
+	}
+#endif
+#ifdef CONFIG_TCP_WSCALE
+	/* RFC 7323, same negotiation */
+	if ((ctrl & TH_ACK) == 0 || (tcp_opts->flags & TCP_OPT_WSCALE)) {
+		opts[0] = TCPOPT_NOP;
+		opts[1] = TCPOPT_WINDOW;
+		opts[2] = TCPOLEN_WINDOW;
+		opts[3] = tcp_rcv_wscale();
+		opts += 1 + TCPOLEN_WINDOW;
+		opts_len += 1 + TCPOLEN_WINDOW;
+	}
+#endif
+#ifdef CONFIG_TCP_TIMESTAMPS
+	if ((ctrl & TH_ACK) == 0 || (tcp_opts->flags & TCP_OPT_TS)) {
+		tcp_set_ts_opt(opts, (ctrl & TH_ACK) ? tcp_opts->ts_val : 0);
+		opts_len += TCPOLEN_TSTAMP_APPA;
+	}
+#endif
 	return opts_len;
 }
 
+/* every received segment takes a packet, whatever its size */
+static uint32_t tcp_rcv_wnd(void)
+{
+	unsigned nb_free = pkt_pool_get_nb_free();
+
+	if (nb_free <= TCP_RCV_WND_RESERVE)
+		return 0;
+	return (uint32_t)(nb_free - TCP_RCV_WND_RESERVE) * TCP_MSS;
+}
+
+/* window field of a segment, network endian. The windows of SYNs are
+ * never scaled. */
+static uint16_t tcp_win_size(const tcp_options_t *tcp_opts, uint8_t ctrl)
+{
+	uint32_t wnd;
+
+	if (ctrl & TH_RST)
+		return 0;
+	wnd = tcp_rcv_wnd();
+#ifdef CONFIG_TCP_WSCALE
+	if ((ctrl & TH_SYN) == 0 && (tcp_opts->flags & TCP_OPT_WSCALE))
+		wnd >>= tcp_rcv_wscale();
+#else
+	(void)tcp_opts;
+#endif
+	return htons(MIN(wnd, 0xFFFF));
+}
+
+/* window advertised by the peer in a segment */
+static uint32_t tcp_peer_wnd(const tcp_conn_t *tcp_conn,
+			     const tcp_hdr_t *tcp_hdr)
+{
+	uint32_t wnd = ntohs(tcp_hdr->win_size);
+
+#ifdef CONFIG_TCP_WSCALE
+	if ((tcp_hdr->ctrl & TH_SYN) == 0
+	    && (tcp_conn->syn.opts.flags & TCP_OPT_WSCALE))
+		wnd <<= tcp_conn->syn.opts.wscale;
+#else
+	(void)tcp_conn;
+#endif
+	return wnd;
+}
+
+static inline tcp_hdr_t *tcp_pkt_hdr(const pkt_t *pkt)
+{
+	const ip_hdr_t *ip_hdr = btod(pkt);
+
+	return (tcp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->hl * 4);
+}
+
+uint16_t tcp_conn_mss(const tcp_conn_t *tcp_conn)
+{
+	/* RFC 879 default */
+	uint16_t mss = tcp_conn->syn.opts.mss ? tcp_conn->syn.opts.mss : 536;
+
+	uint8_t opts_len = tcp_conn_opts_len(tcp_conn);
+
+	/* RFC 6691, the MSS does not account for the options. Segments
+	 * carry at least a byte. */
+	mss = MIN(mss, TCP_MSS);
+	return mss > opts_len ? mss - opts_len : 1;
+}
+
 #ifdef CONFIG_TCP_RETRANSMIT
 static void __tcp_pkt_adj_reset(pkt_t *pkt, int len)
 {
@@ -259,44 +593,89 @@ static void tcp_conn_delete_task(void *tcp_conn)
 	tcp_conn_delete(tcp_conn);
 }
 
+/* RFC 6298, srtt and rttvar are scaled like in BSD stacks */
+static void tcp_rtt_update(tcp_retrn_t *retrn, uint32_t rtt)
+{
+	int32_t delta;
+	uint32_t rto;
+
+	if ((retrn->rtt_flags & TCP_RTT_VALID) == 0) {
+		retrn->srtt = rtt << 3;
+		retrn->rttvar = rtt << 1;
+		retrn->rtt_flags |= TCP_RTT_VALID;
+	} else {
+		delta = (int32_t)(rtt << 3) - (int32_t)retrn->srtt;
+		retrn->srtt += delta >> 3;
+		if (delta < 0)
+			delta = -delta;
+		retrn->rttvar += ((delta >> 1) - (int32_t)retrn->rttvar) >> 2;
+	}
+	/* the clock granularity is one tick */
+	rto = (retrn->srtt >> 3) + MAX(retrn->rttvar, 1);
+	if (rto < TCP_RTO_MIN)
+		rto = TCP_RTO_MIN;
+	else if (rto > TCP_RTO_MAX)
+		rto = TCP_RTO_MAX;
+	retrn->rto = rto;
+}
+
+/* Karn's algorithm: a segment is timed unless it is retransmitted */
+static void tcp_rtt_ack(tcp_retrn_t *retrn, uint32_t remote_ack)
+{
+	if ((retrn->rtt_flags & TCP_RTT_TIMING)
+	    && SEQ_GT(remote_ack, retrn->rtt_seqid)) {
+		retrn->rtt_flags &= ~TCP_RTT_TIMING;
+		tcp_rtt_update(retrn, timer_ticks - retrn->rtt_ticks);
+	}
+}
+
+/* exponential backoff of the timeout */
+static uint32_t tcp_retrn_timeout(const tcp_retrn_t *retrn)
+{
+	uint32_t rto = retrn->rto;
+	uint8_t i;
+
+	for (i = 0; i < retrn->cnt && rto < TCP_RTO_MAX; i++)
+		rto <<= 1;
+	return MIN(rto, TCP_RTO_MAX) * CONFIG_TIMER_RESOLUTION_US;
+}
+
 static void tcp_retransmit(void *tcp_conn);
 static inline void tcp_arm_retrn_timer(tcp_conn_t *tcp_conn, pkt_t *pkt)
 {
 	if (pkt) {
-		tcp_retrn_pkt_t *retrn_pkt;
+		tcp_retrn_t *retrn = &tcp_conn->retrn;
 
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 		/* no retransmission for emergency packets */
 		if (pkt_is_emergency(pkt))
 			return;
 #endif
-		/* XXX TODO: check if there is room at the begining or
-		 * the end of the packet to avoid this malloc. */
-		if ((retrn_pkt = malloc(sizeof(tcp_retrn_pkt_t))) == NULL)
-			return;
-		tcp_conn->retrn.cnt = 0;
-		INIT_LIST_HEAD(&retrn_pkt->list);
-		retrn_pkt->pkt = pkt;
+		/* the queue is sorted by seqid */
 		pkt_retain(pkt);
-		list_add_tail(&retrn_pkt->list,
-			      &tcp_conn->retrn.retrn_pkt_list);
+		list_add_tail(&pkt->retrn_list, &retrn->retrn_pkt_list);
+		if ((retrn->rtt_flags & TCP_RTT_TIMING) == 0) {
+			retrn->rtt_flags |= TCP_RTT_TIMING;
+			retrn->rtt_seqid = ntohl(tcp_conn->syn.seqid);
+			retrn->rtt_ticks = timer_ticks;
+		}
 	}
 
 	if (timer_is_pending(&tcp_conn->retrn.timer))
 		return;
 
-	timer_add(&tcp_conn->retrn.timer, CONFIG_TCP_RETRANSMIT_TIMEOUT * 1000UL
-		  * (tcp_conn->retrn.cnt + 1), tcp_retransmit, tcp_conn);
+	timer_add(&tcp_conn->retrn.timer, tcp_retrn_timeout(&tcp_conn->retrn),
+		  tcp_retransmit, tcp_conn);
 }
 
 static void tcp_delayed_close(void *arg)
 {
 	tcp_conn_t *tcp_conn = arg;
 
-	if (list_empty(&tcp_conn->pkt_list_head)) {
-		schedule_task(tcp_conn_delete_task, tcp_conn);
+	/* the timer retries if the scheduler is full */
+	if (list_empty(&tcp_conn->pkt_list_head)
+	    && schedule_task(tcp_conn_delete_task, tcp_conn) == 0)
 		return;
-	}
 	timer_add(&tcp_conn->retrn.timer,
 		  CONFIG_TCP_RETRANSMIT_TIMEOUT * 1000UL,
 		  tcp_delayed_close, tcp_conn);
@@ -306,7 +685,11 @@ static void tcp_conn_mark_closed(tcp_conn_t *tcp_conn, uint8_t error)
 {
 	tcp_conn->syn.status = SOCK_CLOSED;
 	tcp_conn->sock_info->trq.tcp_conn = NULL;
+	tcp_queue_wipe(tcp_conn);
 	tcp_retrn_wipe(tcp_conn);
+#ifdef CONFIG_TCP_DELAYED_ACK
+	tcp_ack_sent(tcp_conn);
+#endif
 	timer_add(&tcp_conn->retrn.timer,
 		  CONFIG_TCP_RETRANSMIT_TIMEOUT * 1000UL,
 		  tcp_delayed_close, tcp_conn);
@@ -317,12 +700,177 @@ static void tcp_conn_mark_closed(tcp_conn_t *tcp_conn, uint8_t error)
 	tcp_conn->sock_info = NULL;
 }
 
+static void tcp_retrn_send(tcp_conn_t *tcp_conn, pkt_t *pkt)
+{
+	tcp_hdr_t *tcp_hdr;
+
+	pkt_retain(pkt);
+	/* adjust the pkt to ip header */
+	__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t));
+
+	/* peers drop segments acknowledging data too far behind */
+	tcp_hdr = tcp_pkt_hdr(pkt);
+	tcp_hdr->ack = tcp_conn->syn.ack;
+	if ((tcp_hdr->ctrl & TH_RST) == 0)
+		tcp_hdr->win_size = tcp_win_size(&tcp_conn->syn.opts,
+						 tcp_hdr->ctrl);
+#ifdef CONFIG_TCP_TIMESTAMPS
+	/* the peer times the retransmission, not the original segment */
+	if (tcp_opts_len(&tcp_conn->syn, tcp_hdr->ctrl))
+		tcp_set_ts_opt((uint8_t *)(tcp_hdr + 1),
+			       tcp_conn->syn.opts.ts_val);
+#endif
+#ifdef CONFIG_TCP_DELAYED_ACK
+	tcp_ack_sent(tcp_conn);
+#endif
+	__ip_output(pkt, NULL, tcp_conn->syn.tuid.dst_addr, IP_DF);
+}
+
+#ifdef CONFIG_TCP_SACK
+/* RFC 2018, the receiver may have dropped the data it SACKed */
+static void tcp_sack_reset(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt;
+
+	LIST_FOR_EACH_ENTRY(pkt, &tcp_conn->retrn.retrn_pkt_list, retrn_list)
+		pkt->flags &= ~PKT_FLAG_TCP_SACKED;
+	tcp_conn->retrn.sack_high = tcp_conn->snd_una;
+	tcp_conn->retrn.sack_rxt = tcp_conn->snd_una;
+}
+
+static void tcp_sack_mark(tcp_conn_t *tcp_conn, uint32_t left, uint32_t right)
+{
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	pkt_t *pkt;
+
+	/* blocks out of the data in flight are ignored */
+	if (SEQ_GEQ(left, right) || SEQ_LEQ(right, tcp_conn->snd_una)
+	    || SEQ_GT(right, ntohl(tcp_conn->syn.seqid)))
+		return;
+	LIST_FOR_EACH_ENTRY(pkt, &retrn->retrn_pkt_list, retrn_list) {
+		if (SEQ_GEQ(pkt->seqid, right))
+			break;
+		if (SEQ_GEQ(pkt->seqid, left)
+		    && SEQ_LEQ(pkt->seqid + pkt->seqlen, right))
+			pkt->flags |= PKT_FLAG_TCP_SACKED;
+	}
+	if (SEQ_GT(right, retrn->sack_high))
+		retrn->sack_high = right;
+}
+
+/* mark the segments the SACK blocks of an acknowledgment cover */
+static void tcp_sack_input(tcp_conn_t *tcp_conn, const tcp_hdr_t *tcp_hdr)
+{
+	const uint8_t *ops = (const uint8_t *)(tcp_hdr + 1);
+	const uint8_t *ops_end = (const uint8_t *)tcp_hdr
+		+ tcp_hdr->hdr_len * 4;
+
+	if (SEQ_LT(tcp_conn->retrn.sack_high, tcp_conn->snd_una))
+		tcp_conn->retrn.sack_high = tcp_conn->snd_una;
+	if (!tcp_conn->syn.opts.sack_permitted)
+		return;
+
+	while (ops < ops_end && ops[0] != TCPOPT_EOL) {
+		const uint8_t *b;
+		uint8_t len;
+
+		if (ops[0] == TCPOPT_NOP) {
+			ops++;
+			continue;
+		}
+		if (ops + 1 >= ops_end || (len = ops[1]) < 2
+		    || ops + len > ops_end)
+			return;
+		if (ops[0] == TCPOPT_SACK) {
+			for (b = ops + TCPOLEN_SACKHDR;
+			     b + TCPOLEN_SACK <= ops + len; b += TCPOLEN_SACK)
+				tcp_sack_mark(tcp_conn,
+					      ntohl(*(uint32_t *)b),
+					      ntohl(*(uint32_t *)(b + 4)));
+		}
+		ops += len;
+	}
+}
+
+/* resend the first segment of the holes below the highest SACKed one
+ * not resent yet during the recovery.
+ * Return -1 if there is no hole left. */
+static int tcp_sack_retrn(tcp_conn_t *tcp_conn)
+{
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	pkt_t *pkt;
+
+	if (SEQ_LT(retrn->sack_rxt, tcp_conn->snd_una))
+		retrn->sack_rxt = tcp_conn->snd_una;
+	LIST_FOR_EACH_ENTRY(pkt, &retrn->retrn_pkt_list, retrn_list) {
+		if (SEQ_GEQ(pkt->seqid, retrn->sack_high))
+			break;
+		if ((pkt->flags & PKT_FLAG_TCP_SACKED)
+		    || SEQ_LT(pkt->seqid, retrn->sack_rxt))
+			continue;
+		retrn->rtt_flags &= ~TCP_RTT_TIMING;
+		tcp_retrn_send(tcp_conn, pkt);
+		retrn->sack_rxt = pkt->seqid + pkt->seqlen;
+		return 0;
+	}
+	return -1;
+}
+#endif
+
+/* fast retransmit, resend the first unacknowledged segment. With SACK,
+ * the holes are resent first. */
+static void tcp_retrn_first(tcp_conn_t *tcp_conn)
+{
+	list_t *head = &tcp_conn->retrn.retrn_pkt_list;
+
+#ifdef CONFIG_TCP_SACK
+	if (SEQ_GT(tcp_conn->retrn.sack_high, tcp_conn->snd_una)
+	    && tcp_sack_retrn(tcp_conn) >= 0)
+		return;
+#endif
+	if (list_empty(head))
+		return;
+	tcp_conn->retrn.rtt_flags &= ~TCP_RTT_TIMING;
+	tcp_retrn_send(tcp_conn, LIST_FIRST_ENTRY(head, pkt_t, retrn_list));
+}
+
+/* after a timeout, resend the segments sent before it as long as the
+ * congestion window allows it */
+static void tcp_retrn_output(tcp_conn_t *tcp_conn)
+{
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	pkt_t *pkt;
+
+	if (SEQ_LT(retrn->rxt_nxt, tcp_conn->snd_una))
+		retrn->rxt_nxt = tcp_conn->snd_una;
+	if (SEQ_GEQ(retrn->rxt_nxt, retrn->rxt_end)) {
+		retrn->rxt_end = retrn->rxt_nxt;
+		return;
+	}
+	LIST_FOR_EACH_ENTRY(pkt, &retrn->retrn_pkt_list, retrn_list) {
+		uint32_t end = pkt->seqid + pkt->seqlen;
+
+		if (SEQ_GEQ(pkt->seqid, retrn->rxt_end))
+			break;
+		if (SEQ_LT(pkt->seqid, retrn->rxt_nxt))
+			continue;
+#ifdef CONFIG_TCP_SACK
+		if (pkt->flags & PKT_FLAG_TCP_SACKED)
+			continue;
+#endif
+		if (pkt->seqid != tcp_conn->snd_una
+		    && end - tcp_conn->snd_una > tcp_conn->cc.cwnd)
+			break;
+		tcp_retrn_send(tcp_conn, pkt);
+		retrn->rxt_nxt = end;
+	}
+}
+
 static void tcp_retransmit(void *arg)
 {
-	tcp_retrn_pkt_t *retrn_pkt;
 	tcp_conn_t *tcp_conn = arg;
 
-	if (tcp_conn->retrn.cnt >= TCP_IN_PROGRESS_RETRIES) {
+	if (tcp_conn->retrn.cnt >= CONFIG_TCP_RETRANSMIT_RETRIES) {
 		tcp_retrn_wipe(tcp_conn);
 		if (tcp_conn->syn.status != SOCK_CLOSED)
 			tcp_conn_mark_closed(tcp_conn, 1);
@@ -331,24 +879,28 @@ static void tcp_retransmit(void *arg)
 		return;
 	}
 
-	LIST_FOR_EACH_ENTRY(retrn_pkt, &tcp_conn->retrn.retrn_pkt_list, list) {
-		pkt_t *pkt = retrn_pkt->pkt;
-
-		pkt_retain(pkt);
-		/* adjust the pkt to ip header */
-		__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t));
-
-		ip_output(pkt, NULL, IP_DF);
-	}
+	/* the segments are resent as the congestion window opens */
+	tcp_cc_timeout(tcp_conn);
+#ifdef CONFIG_TCP_SACK
+	tcp_sack_reset(tcp_conn);
+#endif
+	tcp_conn->retrn.rxt_nxt = tcp_conn->snd_una;
+	tcp_conn->retrn.rxt_end = ntohl(tcp_conn->syn.seqid);
+	tcp_retrn_output(tcp_conn);
 
+	tcp_conn->retrn.rtt_flags &= ~TCP_RTT_TIMING;
 	tcp_conn->retrn.cnt++;
 	tcp_arm_retrn_timer(tcp_conn, NULL);
 }
 #endif
 
+/* The opts_len bytes following the tcp header are options, counted in
+ * the packet length. The timestamps option is set first, the caller sets
+ * the others. The options of SYNs are set here. */
 static int
-__tcp_output(pkt_t *pkt, uint32_t ip_dst, uint8_t ctrl, uint16_t sport,
-	     uint16_t dport, tcp_syn_t *tcp_syn)
+__tcp_output(pkt_t *pkt, uint32_t ip_src, uint32_t ip_dst, uint8_t ctrl,
+	     uint16_t sport, uint16_t dport, tcp_syn_t *tcp_syn,
+	     uint8_t opts_len)
 {
 	tcp_hdr_t *tcp_hdr = btod(pkt);
 	ip_hdr_t *ip_hdr;
@@ -365,82 +917,530 @@ __tcp_output(pkt_t *pkt, uint32_t ip_dst, uint8_t ctrl, uint16_t sport,
 	tcp_hdr->ack = tcp_syn->ack;
 	tcp_hdr->reserved = 0;
 	tcp_hdr->ctrl = ctrl;
-	tcp_hdr->win_size = (ctrl & TH_RST) ? 0 : htons(pkt->buf.size * 2);
+	tcp_hdr->win_size = tcp_win_size(&tcp_syn->opts, ctrl);
 	tcp_hdr->urg_ptr = 0;
 	if (ctrl & TH_SYN) {
-		int opts_len = tcp_set_options(tcp_hdr + 1, &tcp_syn->opts);
-
-		tcp_hdr_len += opts_len;
+		opts_len = tcp_set_options(tcp_hdr + 1, &tcp_syn->opts, ctrl);
 		pkt->buf.len += opts_len;
 	}
+#ifdef CONFIG_TCP_TIMESTAMPS
+	else if (tcp_opts_len(tcp_syn, ctrl))
+		tcp_set_ts_opt((uint8_t *)(tcp_hdr + 1), tcp_syn->opts.ts_val);
+#endif
+	tcp_hdr_len += opts_len;
 	tcp_hdr->hdr_len = tcp_hdr_len / 4;
 
-	return ip_output(pkt, NULL, IP_DF);
+	return __ip_output(pkt, NULL, ip_src, IP_DF);
 }
 
 int tcp_output(pkt_t *pkt, tcp_conn_t *tcp_conn, uint8_t flags)
 {
+	uint8_t opts_len = tcp_opts_len(&tcp_conn->syn, flags);
+
 #ifdef CONFIG_TCP_RETRANSMIT
+	/* pkt points to the tcp header, the options of SYNs are not added
+	 * yet */
+	pkt->seqid = ntohl(tcp_conn->syn.seqid);
+	pkt->seqlen = pkt_len(pkt) - sizeof(tcp_hdr_t) - opts_len;
+	/* SYN and FIN take a sequence number */
+	if (flags & (TH_SYN|TH_FIN))
+		pkt->seqlen++;
 	tcp_arm_retrn_timer(tcp_conn, pkt);
+#endif
+#ifdef CONFIG_TCP_DELAYED_ACK
+	tcp_ack_sent(tcp_conn);
 #endif
 	/* XXX */
-	return __tcp_output(pkt, tcp_conn->syn.tuid.src_addr, flags,
+	return __tcp_output(pkt, tcp_conn->syn.tuid.dst_addr,
+			    tcp_conn->syn.tuid.src_addr, flags,
 			    tcp_conn->syn.tuid.dst_port,
-			    tcp_conn->syn.tuid.src_port, &tcp_conn->syn);
+			    tcp_conn->syn.tuid.src_port, &tcp_conn->syn, opts_len);
 }
 
 static int
 tcp_send_pkt(const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr, uint8_t flags,
 	     tcp_syn_t *tcp_syn)
+{
+	uint8_t opts_len = tcp_opts_len(tcp_syn, flags);
+	pkt_t *out;
+
+	if ((out = pkt_alloc()) == NULL
+#ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
+	    && (out = pkt_alloc_emergency()) == NULL
+#endif
+	    )
+		return -1;
+
+	__tcp_adj_out_pkt(out, opts_len);
+	return __tcp_output(out, ip_hdr->dst, ip_hdr->src, flags,
+			    tcp_hdr->dst_port, tcp_hdr->src_port, tcp_syn,
+			    opts_len);
+}
+
+#ifdef CONFIG_TCP_SACK
+/* blocks fitting in the options along with two NOPs aligning them */
+#define TCP_SACK_BLOCKS_MAX 4
+
+/* RFC 2018, the out of order queue is described by blocks of contiguous
+ * data, the one holding the last segment received comes first */
+static uint8_t tcp_set_sack_opts(uint8_t *opts, const tcp_conn_t *tcp_conn)
+{
+	uint32_t blocks[TCP_SACK_BLOCKS_MAX][2];
+	uint8_t nb = 0, nb_max = TCP_SACK_BLOCKS_MAX, first = 0, i;
+	uint8_t *b;
+	pkt_t *pkt;
+
+	if (!tcp_conn->syn.opts.sack_permitted)
+		return 0;
+	/* the timestamps option takes the room of a block */
+	if (tcp_conn_opts_len(tcp_conn))
+		nb_max--;
+	LIST_FOR_EACH_ENTRY(pkt, &tcp_conn->ooo_list, list) {
+		const ip_hdr_t *ip_hdr = btod(pkt);
+		const tcp_hdr_t *tcp_hdr = tcp_pkt_hdr(pkt);
+		uint32_t left = ntohl(tcp_hdr->seq);
+		uint32_t right = left + pkt_len(pkt) - ip_hdr->hl * 4
+			- tcp_hdr->hdr_len * 4;
+
+		if (nb && SEQ_GEQ(blocks[nb - 1][1], left)) {
+			if (SEQ_GT(right, blocks[nb - 1][1]))
+				blocks[nb - 1][1] = right;
+			continue;
+		}
+		if (nb == nb_max)
+			break;
+		blocks[nb][0] = left;
+		blocks[nb][1] = right;
+		if (SEQ_GEQ(tcp_conn->ooo_last, left))
+			first = nb;
+		nb++;
+	}
+	if (nb == 0)
+		return 0;
+
+	opts[0] = TCPOPT_NOP;
+	opts[1] = TCPOPT_NOP;
+	opts[2] = TCPOPT_SACK;
+	opts[3] = TCPOLEN_SACKHDR + nb * TCPOLEN_SACK;
+	b = opts + 4;
+	for (i = 0; i < nb; i++) {
+		/* the first block is moved ahead of the others */
+		uint8_t j = i == 0 ? first : (i <= first ? i - 1 : i);
+
+		*(uint32_t *)b = htonl(blocks[j][0]);
+		*(uint32_t *)(b + 4) = htonl(blocks[j][1]);
+		b += TCPOLEN_SACK;
+	}
+	return 2 + opts[3];
+}
+#endif
+
+/* out points to the tcp header of a segment without data */
+static int tcp_ack_output(tcp_conn_t *tcp_conn, pkt_t *out, uint8_t flags)
+{
+	uint8_t opts_len = tcp_conn_opts_len(tcp_conn);
+
+#ifdef CONFIG_TCP_SACK
+	opts_len += tcp_set_sack_opts((uint8_t *)btod(out) + sizeof(tcp_hdr_t)
+				      + opts_len, tcp_conn);
+#endif
+	out->buf.len += opts_len;
+	return __tcp_output(out, tcp_conn->syn.tuid.dst_addr,
+			    tcp_conn->syn.tuid.src_addr, flags,
+			    tcp_conn->syn.tuid.dst_port,
+			    tcp_conn->syn.tuid.src_port, &tcp_conn->syn,
+			    opts_len);
+}
+
+/* acknowledge the received segments right away */
+static int tcp_ack_now(tcp_conn_t *tcp_conn, uint8_t flags)
 {
 	pkt_t *out;
 
+#ifdef CONFIG_TCP_DELAYED_ACK
+	tcp_ack_sent(tcp_conn);
+#endif
 	if ((out = pkt_alloc()) == NULL
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	    && (out = pkt_alloc_emergency()) == NULL
 #endif
 	    )
 		return -1;
+	__tcp_adj_out_pkt(out, 0);
+	return tcp_ack_output(tcp_conn, out, flags);
+}
+
+#ifdef CONFIG_TCP_DELAYED_ACK
+static void tcp_delayed_ack(void *arg)
+{
+	tcp_conn_t *tcp_conn = arg;
+	pkt_t *out;
+
+	if ((out = pkt_alloc()) == NULL
+#ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
+	    && (out = pkt_alloc_emergency()) == NULL
+#endif
+	    ) {
+		timer_add(&tcp_conn->ack_timer,
+			  CONFIG_TCP_DELAYED_ACK_TIMEOUT * 1000UL,
+			  tcp_delayed_ack, tcp_conn);
+		return;
+	}
+	tcp_conn->ack_pending = 0;
+	__tcp_adj_out_pkt(out, 0);
+	tcp_ack_output(tcp_conn, out, TH_ACK);
+}
+
+/* RFC 1122, every second segment is acknowledged, a single one waits
+ * for data to be sent back or for the timer.
+ * Return -1 if the acknowledgment cannot be delayed. */
+static int tcp_ack_delay(tcp_conn_t *tcp_conn)
+{
+	if (tcp_conn->ack_pending)
+		return -1;
+	tcp_conn->ack_pending = 1;
+	timer_add(&tcp_conn->ack_timer, CONFIG_TCP_DELAYED_ACK_TIMEOUT * 1000UL,
+		  tcp_delayed_ack, tcp_conn);
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_TCP_KEEPALIVE
+#define TCP_S_TO_TICKS(s) \
+	((uint32_t)(s) * (1000000UL / CONFIG_TIMER_RESOLUTION_US))
+
+/* all the connections are checked by a single timer */
+#define TCP_KEEPALIVE_PERIOD 1000000UL
+
+static tim_t tcp_keepalive_timer = TIMER_INIT(tcp_keepalive_timer);
+static tcp_keepalive_stats_t keepalive_stats;
 
-	__tcp_adj_out_pkt(out);
-	return __tcp_output(out, ip_hdr->src, flags, tcp_hdr->dst_port,
-			    tcp_hdr->src_port, tcp_syn);
+void tcp_conn_set_keepalive(tcp_conn_t *tcp_conn, uint16_t idle,
+			    uint16_t intvl, uint8_t probes)
+{
+	tcp_conn->ka.idle = idle;
+	tcp_conn->ka.intvl = intvl;
+	tcp_conn->ka.probes = probes;
+	tcp_conn->ka.sent = 0;
+	if (idle)
+		tcp_keepalive_arm();
 }
 
+/* RFC 1122, the probe carries the seqid preceding the next one to be sent,
+ * the peer acknowledges it if it is still there */
+static void tcp_keepalive_probe(tcp_conn_t *tcp_conn)
+{
+	uint32_t seqid = tcp_conn->syn.seqid;
+
+	tcp_conn->syn.seqid = htonl(ntohl(seqid) - 1);
+	tcp_ack_now(tcp_conn, TH_ACK);
+	tcp_conn->syn.seqid = seqid;
+	tcp_conn->ka.sent++;
+	keepalive_stats.probes++;
+}
+
+static void tcp_keepalive_check(tcp_conn_t *tcp_conn)
+{
+	tcp_keepalive_t *ka = &tcp_conn->ka;
+	uint32_t idle = timer_ticks - ka->rcv_ticks;
+
+	/* segments in flight are retransmitted until the peer answers or
+	 * the connection is dropped */
+	if (tcp_conn->syn.status != SOCK_CONNECTED || ka->idle == 0
+	    || !list_empty(&tcp_conn->retrn.retrn_pkt_list))
+		return;
+	if (idle < TCP_S_TO_TICKS(ka->idle)
+	    + TCP_S_TO_TICKS(ka->intvl) * ka->sent)
+		return;
+	if (ka->sent < ka->probes) {
+		tcp_keepalive_probe(tcp_conn);
+		return;
+	}
+	/* the peer is gone, the data it sent is dropped like on a reset */
+	tcp_rcv_wipe(tcp_conn);
+	tcp_conn_mark_closed(tcp_conn, 1);
+	keepalive_stats.reaped++;
+}
+
+#ifdef CONFIG_HT_STORAGE
+static int tcp_keepalive_check_cb(sbuf_t *key, sbuf_t *val, void **arg)
+{
+	tcp_keepalive_check(*(tcp_conn_t **)val->data);
+	return 0;
+}
+#endif
+
+static void tcp_keepalive_cb(void *arg)
+{
+#ifdef CONFIG_HT_STORAGE
+	htable_for_each(&tcp_conns, tcp_keepalive_check_cb, NULL);
+#else
+	tcp_conn_t *tcp_conn;
+
+	/* closed connections stay in the list until their delayed close */
+	LIST_FOR_EACH_ENTRY(tcp_conn, &tcp_conns, list)
+		tcp_keepalive_check(tcp_conn);
+#endif
+	if (obj_pool_get_stats(&tcp_conn_pool)->used)
+		timer_add(&tcp_keepalive_timer, TCP_KEEPALIVE_PERIOD,
+			  tcp_keepalive_cb, NULL);
+}
+
+static void tcp_keepalive_arm(void)
+{
+	if (timer_is_pending(&tcp_keepalive_timer))
+		return;
+	timer_add(&tcp_keepalive_timer, TCP_KEEPALIVE_PERIOD,
+		  tcp_keepalive_cb, NULL);
+}
+
+const tcp_keepalive_stats_t *tcp_get_keepalive_stats(void)
+{
+	return &keepalive_stats;
+}
+#endif
+
 #ifdef CONFIG_TCP_RETRANSMIT
 static void tcp_retrn_ack_pkts(tcp_conn_t *tcp_conn, uint32_t remote_ack)
 {
-	tcp_retrn_pkt_t *retrn_pkt, *retrn_pkt_tmp;
+	pkt_t *pkt, *pkt_tmp;
 
-	LIST_FOR_EACH_ENTRY_SAFE(retrn_pkt, retrn_pkt_tmp,
-				 &tcp_conn->retrn.retrn_pkt_list, list) {
-		pkt_t *pkt = retrn_pkt->pkt;
-		tcp_hdr_t *tcp_hdr;
-		int payload_len;
-		uint32_t seqid;
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->retrn.retrn_pkt_list,
+				 retrn_list) {
+		if (SEQ_GT(pkt->seqid + pkt->seqlen, remote_ack))
+			break;
+		list_del(&pkt->retrn_list);
+		pkt_free(pkt);
+	}
+	if (tcp_conn->retrn.timer.cb == tcp_delayed_close)
+		return;
+	tcp_rtt_ack(&tcp_conn->retrn, remote_ack);
+	/* new data is acknowledged, the peer is alive */
+	tcp_conn->retrn.cnt = 0;
+	timer_del(&tcp_conn->retrn.timer);
+	if (!list_empty(&tcp_conn->retrn.retrn_pkt_list))
+		tcp_arm_retrn_timer(tcp_conn, NULL);
+}
+#endif
+
+static uint32_t tcp_snd_wnd(const tcp_conn_t *tcp_conn)
+{
+#ifdef CONFIG_TCP_RETRANSMIT
+	return MIN(tcp_conn->snd_wnd, tcp_conn->cc.cwnd);
+#else
+	return tcp_conn->snd_wnd;
+#endif
+}
+
+int tcp_can_send(const tcp_conn_t *tcp_conn, uint16_t len)
+{
+	uint32_t pending = ntohl(tcp_conn->syn.seqid) - tcp_conn->snd_una
+		+ tcp_conn->snd_queued;
+
+	return pending == 0 || pending + len <= tcp_snd_wnd(tcp_conn);
+}
+
+static inline uint16_t
+tcp_seg_len(const tcp_conn_t *tcp_conn, const pkt_t *pkt)
+{
+	return pkt_len(pkt) - sizeof(tcp_hdr_t) - tcp_conn_opts_len(tcp_conn);
+}
+
+/* send the queued segments the windows accept, all of them if force is
+ * set */
+static void __tcp_push(tcp_conn_t *tcp_conn, uint8_t force)
+{
+	pkt_t *pkt, *pkt_tmp;
 
-		/* get tcp payload size */
-		__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t) +
-				    (int)sizeof(ip_hdr_t));
-		tcp_hdr = btod(pkt);
-		seqid = ntohl(tcp_hdr->seq);
-		payload_len = pkt->buf.len - tcp_hdr->hdr_len * 4;
-
-		if (seqid + payload_len <= remote_ack) {
-			pkt_free(retrn_pkt->pkt);
-			list_del(&retrn_pkt->list);
-			free(retrn_pkt);
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->snd_queue, list) {
+		uint32_t seqid = ntohl(tcp_conn->syn.seqid);
+		uint32_t in_flight = seqid - tcp_conn->snd_una;
+		uint16_t len = tcp_seg_len(tcp_conn, pkt);
+		uint8_t flags = TH_ACK;
+
+		if (!force && in_flight) {
+			if (in_flight + len > tcp_snd_wnd(tcp_conn))
+				break;
+#ifdef CONFIG_TCP_NAGLE
+			/* RFC 896 with Minshall's change, a single small
+			 * segment is in flight. The end of a large write
+			 * does not wait for the delayed acknowledgment of
+			 * the full segments. */
+			if (len < tcp_conn_mss(tcp_conn)
+			    && SEQ_GT(tcp_conn->snd_sml, tcp_conn->snd_una))
+				break;
+#endif
 		}
-#if 0
-		else if (seqid >= remote_ack)
-			break;
+#ifdef CONFIG_TCP_NAGLE
+		if (len < tcp_conn_mss(tcp_conn))
+			tcp_conn->snd_sml = seqid + len;
 #endif
+		list_del(&pkt->list);
+		tcp_conn->snd_queued -= len;
+		if (list_empty(&tcp_conn->snd_queue))
+			flags |= TH_PUSH;
+		/* with CONFIG_TCP_RETRANSMIT, a segment failing to go out
+		 * is resent later */
+		tcp_output(pkt, tcp_conn, flags);
+		tcp_conn->syn.seqid = htonl(seqid + len);
+	}
+}
+
+uint16_t tcp_queue_room(const tcp_conn_t *tcp_conn)
+{
+	uint16_t mss = tcp_conn_mss(tcp_conn);
+	pkt_t *pkt;
+	uint16_t len;
+
+	if (list_empty(&tcp_conn->snd_queue))
+		return 0;
+	pkt = LIST_LAST_ENTRY(&tcp_conn->snd_queue, pkt_t, list);
+	len = tcp_seg_len(tcp_conn, pkt);
+	if (len >= mss)
+		return 0;
+	/* the segment is appended to in place */
+	return MIN(mss - len, buf_get_free_space(&pkt->buf));
+}
+
+void tcp_send(tcp_conn_t *tcp_conn, const sbuf_t *sbuf, list_t *segs)
+{
+	pkt_t *pkt;
+
+	if (sbuf->len) {
+		uint16_t len;
+
+		pkt = LIST_LAST_ENTRY(&tcp_conn->snd_queue, pkt_t, list);
+		len = tcp_seg_len(tcp_conn, pkt);
+		/* the payload sum can only be continued from an even
+		 * offset, it is computed again on output otherwise */
+		if (len & 1) {
+			memcpy(pkt->buf.data + pkt->buf.len, sbuf->data,
+			       sbuf->len);
+			pkt->flags &= ~PKT_FLAG_CSUM_PAYLOAD;
+		} else
+			cksum_copy(pkt->buf.data + pkt->buf.len, sbuf->data,
+				   sbuf->len, &pkt->csum);
+		pkt->buf.len += sbuf->len;
+		tcp_conn->snd_queued += sbuf->len;
 	}
-	if (list_empty(&tcp_conn->retrn.retrn_pkt_list) &&
-	    tcp_conn->retrn.timer.cb != tcp_delayed_close)
-		timer_del(&tcp_conn->retrn.timer);
+	LIST_FOR_EACH_ENTRY(pkt, segs, list)
+		tcp_conn->snd_queued += tcp_seg_len(tcp_conn, pkt);
+	list_move_tail_list(&tcp_conn->snd_queue, segs);
+	__tcp_push(tcp_conn, 0);
 }
+
+static void tcp_ack_input(tcp_conn_t *tcp_conn, const tcp_hdr_t *tcp_hdr,
+			  uint16_t plen)
+{
+	uint32_t remote_ack = ntohl(tcp_hdr->ack);
+	uint32_t win_size = tcp_peer_wnd(tcp_conn, tcp_hdr);
+#ifdef CONFIG_TCP_RETRANSMIT
+	uint32_t snd_una = tcp_conn->snd_una;
+	uint32_t snd_wnd = tcp_conn->snd_wnd;
+#endif
+
+	/* reordered acknowledgments do not update the window */
+	if (SEQ_LT(remote_ack, tcp_conn->snd_una))
+		return;
+	tcp_conn->snd_una = remote_ack;
+	tcp_conn->snd_wnd = win_size;
+#ifdef CONFIG_TCP_RETRANSMIT
+	if (SEQ_GT(remote_ack, snd_una))
+		tcp_retrn_ack_pkts(tcp_conn, remote_ack);
+#ifdef CONFIG_TCP_SACK
+	tcp_sack_input(tcp_conn, tcp_hdr);
+#endif
+	if (SEQ_GT(remote_ack, snd_una)) {
+		if (tcp_cc_ack(tcp_conn, remote_ack - snd_una))
+			tcp_retrn_first(tcp_conn);
+		tcp_retrn_output(tcp_conn);
+	} else if (plen == 0 && (tcp_hdr->ctrl & (TH_SYN|TH_FIN)) == 0
+		   && win_size <= snd_wnd
+		   && tcp_conn->syn.seqid != htonl(snd_una)) {
+		/* the receiver shrinks its window as it keeps out of order
+		 * segments, only a window opening is not a duplicate */
+		if (tcp_cc_dupack(tcp_conn)) {
+#ifdef CONFIG_TCP_SACK
+			tcp_conn->retrn.sack_rxt = snd_una;
+#endif
+			tcp_retrn_first(tcp_conn);
+		}
+#ifdef CONFIG_TCP_SACK
+		/* a segment left the network, the next hole takes its
+		 * place before new data */
+		else if ((tcp_conn->cc.flags & TCP_CC_RECOVERY)
+			 && tcp_sack_retrn(tcp_conn) >= 0)
+			return;
 #endif
+	}
+#endif
+	if (!list_empty(&tcp_conn->snd_queue))
+		__tcp_push(tcp_conn, 0);
+#ifdef CONFIG_EVENT
+	if (tcp_conn->sock_info && tcp_can_send(tcp_conn, 1))
+		event_unblock(&tcp_conn->sock_info->event, EV_WRITE);
+#endif
+}
+
+void tcp_pkt_trim(pkt_t *pkt, uint16_t hdrs_len, uint16_t len)
+{
+	uint8_t *hdrs = (uint8_t *)btod(pkt) - hdrs_len;
+
+	memmove(hdrs + len, hdrs, hdrs_len);
+	pkt_adj(pkt, len);
+}
+
+/* pkt points to the ip header of a segment received ahead of the
+ * expected sequence number */
+static int tcp_ooo_queue(tcp_conn_t *tcp_conn, pkt_t *pkt, uint32_t seqid)
+{
+	list_t *prev = &tcp_conn->ooo_list;
+	pkt_t *p;
+
+	if (tcp_conn->ooo_nb >= CONFIG_TCP_OOO_MAX)
+		return -1;
+	LIST_FOR_EACH_ENTRY(p, &tcp_conn->ooo_list, list) {
+		uint32_t p_seqid = ntohl(tcp_pkt_hdr(p)->seq);
+
+		if (p_seqid == seqid)
+			return -1;
+		if (SEQ_GT(p_seqid, seqid))
+			break;
+		prev = &p->list;
+	}
+	list_add(&pkt->list, prev);
+	tcp_conn->ooo_nb++;
+	return 0;
+}
+
+/* move the segments filling the hole to the socket queue, return the
+ * next expected sequence number */
+static uint32_t tcp_ooo_drain(tcp_conn_t *tcp_conn, uint32_t ack)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &tcp_conn->ooo_list, list) {
+		ip_hdr_t *ip_hdr = btod(pkt);
+		tcp_hdr_t *tcp_hdr = tcp_pkt_hdr(pkt);
+		uint16_t hdrs_len = ip_hdr->hl * 4 + tcp_hdr->hdr_len * 4;
+		uint32_t seqid = ntohl(tcp_hdr->seq);
+
+		if (SEQ_GT(seqid, ack))
+			break;
+		list_del(&pkt->list);
+		tcp_conn->ooo_nb--;
+		if (SEQ_LEQ(seqid + pkt_len(pkt) - hdrs_len, ack)) {
+			pkt_free(pkt);
+			continue;
+		}
+		pkt_adj(pkt, hdrs_len);
+		tcp_pkt_trim(pkt, hdrs_len, ack - seqid);
+		ack += pkt_len(pkt);
+		pkt_adj(pkt, -hdrs_len);
+		socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
+	}
+	return ack;
+}
 
 static void
 set_tuid(tcp_uid_t *tuid, const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr)
@@ -451,32 +1451,52 @@ set_tuid(tcp_uid_t *tuid, const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr)
 	tuid->dst_port = tcp_hdr->dst_port;
 }
 
-void tcp_parse_options(tcp_options_t *tcp_opts, tcp_hdr_t *tcp_hdr, int opt_len)
+void tcp_parse_options(tcp_options_t *tcp_opts, const tcp_hdr_t *tcp_hdr,
+		       int opt_len)
 {
-	uint8_t *ops = (uint8_t *)(tcp_hdr + 1);
-	uint8_t *ops_end = ops + opt_len;
+	const uint8_t *ops = (const uint8_t *)(tcp_hdr + 1);
+	const uint8_t *ops_end = ops + opt_len;
 	uint8_t op;
 
 	while (ops < ops_end && (op = ops[0]) != 0) {
 		int len;
 
+		/* the values of truncated options are not read */
+		if (op != TCPOPT_NOP
+		    && (ops + 1 >= ops_end || ops[1] < 2
+			|| ops + ops[1] > ops_end))
+			break;
+
 		switch (op) {
 		case TCPOPT_NOP:
 			len = TCPOLEN_NOP;
 			break;
 		case TCPOPT_MAXSEG:
-			tcp_opts->mss = ntohs(*(uint16_t *)(ops + 2));
-			len = TCPOLEN_MAXSEG;
+			len = ops[1];
+			if (len != TCPOLEN_MAXSEG)
+				break;
+			tcp_opts->mss = MAX(ntohs(*(uint16_t *)(ops + 2)),
+					    TCP_MSS_MIN);
 			break;
 		case TCPOPT_WINDOW:
+#ifdef CONFIG_TCP_WSCALE
+			tcp_opts->flags |= TCP_OPT_WSCALE;
+			tcp_opts->wscale = MIN(ops[2], TCP_WSCALE_MAX);
+#endif
 			len = TCPOLEN_WINDOW;
 			break;
-		case TCPOPT_SACK:
-			ops += TCPOLEN_SACK;
 		case TCPOPT_SACK_PERMITTED:
+#ifdef CONFIG_TCP_SACK
+			tcp_opts->sack_permitted = 1;
+#endif
 			len = TCPOLEN_SACK_PERMITTED;
 			break;
 		case TCPOPT_TIMESTAMP:
+#ifdef CONFIG_TCP_TIMESTAMPS
+			tcp_opts->flags |= TCP_OPT_TS;
+			tcp_opts->ts_val = ntohl(*(uint32_t *)(ops + 2));
+			tcp_opts->ts_ecr = ntohl(*(uint32_t *)(ops + 6));
+#endif
 			len = TCPOLEN_TIMESTAMP;
 			break;
 		case TCPOPT_SIGNATURE:
@@ -489,6 +1509,42 @@ void tcp_parse_options(tcp_options_t *tcp_opts, tcp_hdr_t *tcp_hdr, int opt_len)
 	}
 }
 
+#ifdef CONFIG_TCP_TIMESTAMPS
+/* RFC 7323 PAWS, a segment carrying a timestamp older than the last one
+ * received is an old duplicate. The acknowledgments of new data give
+ * RTT samples, retransmitted segments included.
+ * Return -1 if the segment is to be dropped. */
+static int
+tcp_ts_input(tcp_conn_t *tcp_conn, const tcp_hdr_t *tcp_hdr, uint32_t ack)
+{
+	tcp_options_t *opts = &tcp_conn->syn.opts;
+	tcp_options_t seg_opts;
+
+	if ((opts->flags & TCP_OPT_TS) == 0)
+		return 0;
+	seg_opts.flags = 0;
+	tcp_parse_options(&seg_opts, tcp_hdr,
+			  tcp_hdr->hdr_len * 4 - sizeof(tcp_hdr_t));
+	if ((seg_opts.flags & TCP_OPT_TS) == 0)
+		return 0;
+	if (SEQ_LT(seg_opts.ts_val, opts->ts_val))
+		return -1;
+	/* the timestamp echoed is the one of the oldest segment not
+	 * acknowledged yet */
+	if (SEQ_LEQ(ntohl(tcp_hdr->seq), ack))
+		opts->ts_val = seg_opts.ts_val;
+#ifdef CONFIG_TCP_RETRANSMIT
+	if ((tcp_hdr->ctrl & TH_ACK)
+	    && SEQ_GT(ntohl(tcp_hdr->ack), tcp_conn->snd_una)
+	    && SEQ_LEQ(ntohl(tcp_hdr->ack), ntohl(tcp_conn->syn.seqid))) {
+		tcp_conn->retrn.rtt_flags &= ~TCP_RTT_TIMING;
+		tcp_rtt_update(&tcp_conn->retrn, timer_ticks - seg_opts.ts_ecr);
+	}
+#endif
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_TCP_CLIENT
 int tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *si)
 {
@@ -510,20 +1566,106 @@ int tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *si)
 		return -1;
 
 	if ((pkt = pkt_alloc()) == NULL) {
-		free(tcp_conn);
+		obj_pool_free(&tcp_conn_pool, tcp_conn);
 		return -1;
 	}
 
 	list_add(&tcp_conn->list, &tcp_client_conns);
 	tcp_conn->syn.seqid = rand();
 	tcp_conn->syn.ack = 0;
+	tcp_conn->snd_una = ntohl(tcp_conn->syn.seqid);
+#ifdef CONFIG_TCP_NAGLE
+	tcp_conn->snd_sml = tcp_conn->snd_una;
+#endif
 	sock_info->trq.tcp_conn = tcp_conn;
 
-	__tcp_adj_out_pkt(pkt);
+	__tcp_adj_out_pkt(pkt, 0);
 	return tcp_output(pkt, tcp_conn, TH_SYN);
 }
 #endif
 
+#ifdef CONFIG_TCP_SYN_COOKIES
+/* RFC 4987, the SYN table is full: the half-open connection is kept in the
+ * sequence number of the SYN-ACK. Only the MSS is offered. */
+static void syn_cookie_output(const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr,
+			      const tcp_uid_t *tuid)
+{
+	uint32_t isn = ntohl(tcp_hdr->seq);
+	tcp_syn_t ts;
+	uint16_t mss;
+
+	memset(&ts, 0, sizeof(tcp_syn_t));
+	tcp_parse_options(&ts.opts, tcp_hdr,
+			  tcp_hdr->hdr_len * 4 - sizeof(tcp_hdr_t));
+	mss = ts.opts.mss;
+	memset(&ts.opts, 0, sizeof(tcp_options_t));
+	ts.seqid = htonl(syn_cookie_make(tuid, isn, mss));
+	ts.ack = htonl(isn + 1);
+	tcp_send_pkt(ip_hdr, tcp_hdr, TH_SYN|TH_ACK, &ts);
+	syn_stats.cookies_sent++;
+}
+
+/* rebuild the half-open connection an ACK completes from its cookie */
+static int syn_cookie_input(tcp_syn_t *tcp_syn, const tcp_hdr_t *tcp_hdr,
+			    const tcp_uid_t *tuid)
+{
+	uint16_t mss = syn_cookie_check(tuid, ntohl(tcp_hdr->seq) - 1,
+					ntohl(tcp_hdr->ack) - 1);
+
+	if (mss == 0) {
+		syn_stats.cookies_failed++;
+		return -1;
+	}
+	syn_stats.cookies_ok++;
+	memset(tcp_syn, 0, sizeof(tcp_syn_t));
+	tcp_syn->seqid = tcp_hdr->ack;
+	tcp_syn->ack = tcp_hdr->seq;
+	tcp_syn->opts.mss = mss;
+	tcp_syn->tuid = *tuid;
+	tcp_syn->status = SOCK_TCP_SYN_ACK_SENT;
+	return 0;
+}
+#endif
+
+static void tcp_syn_input(const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr,
+			  const tcp_uid_t *tuid)
+{
+	uint32_t ack = htonl(ntohl(tcp_hdr->seq) + 1);
+	tcp_syn_t *tsyn_entry;
+
+	syn_stats.received++;
+	if (syn_secret == 0)
+		syn_secret = ((uint32_t)rand() << 16) ^ rand();
+
+	if ((tsyn_entry = syn_find_entry(tuid)) != NULL
+	    && tsyn_entry->ack == ack) {
+		/* retransmitted SYN, the SYN-ACK is sent again */
+		tsyn_entry->seqid = htonl(ntohl(tsyn_entry->seqid) - 1);
+	} else {
+		if (tsyn_entry == NULL
+		    && (tsyn_entry = syn_alloc_entry(tuid)) == NULL) {
+#ifdef CONFIG_TCP_SYN_COOKIES
+			syn_cookie_output(ip_hdr, tcp_hdr, tuid);
+#endif
+			return;
+		}
+		/* network endian for seqid and ack */
+#ifdef TEST
+		tsyn_entry->seqid = 0x1207E77B;
+#else
+		tsyn_entry->seqid = rand();
+#endif
+		tsyn_entry->ack = ack;
+		tsyn_entry->tuid = *tuid;
+		tsyn_entry->status = SOCK_TCP_SYN_ACK_SENT;
+	}
+	memset(&tsyn_entry->opts, 0, sizeof(tcp_options_t));
+	tcp_parse_options(&tsyn_entry->opts, tcp_hdr,
+			  tcp_hdr->hdr_len * 4 - sizeof(tcp_hdr_t));
+	tcp_send_pkt(ip_hdr, tcp_hdr, TH_SYN|TH_ACK, tsyn_entry);
+	tsyn_entry->seqid = htonl(ntohl(tsyn_entry->seqid) + 1);
+}
+
 void tcp_input(pkt_t *pkt)
 {
 	tcp_hdr_t *tcp_hdr;
@@ -540,6 +1682,9 @@ void tcp_input(pkt_t *pkt)
 #endif
 	tcp_conn_t *tcp_conn;
 	tcp_syn_t ts;
+#ifdef CONFIG_TCP_SYN_COOKIES
+	tcp_syn_t cookie_syn;
+#endif
 
 	STATIC_ASSERT(POWEROF2(CONFIG_TCP_SYN_TABLE_SIZE));
 
@@ -549,7 +1694,8 @@ void tcp_input(pkt_t *pkt)
 		goto end;
 
 	tcp_hdr_len = tcp_hdr->hdr_len * 4;
-	if (transport_cksum(ip_hdr, tcp_hdr, htons(ip_plen)) != 0)
+	if (!pkt_csum_verified(pkt)
+	    && transport_cksum(ip_hdr, tcp_hdr, htons(ip_plen)) != 0)
 		goto end;
 
 	set_tuid(&tuid, ip_hdr, tcp_hdr);
@@ -562,8 +1708,12 @@ void tcp_input(pkt_t *pkt)
 	};
 
 	if ((tcp_conn = tcp_conn_lookup(&tuid)) != NULL) {
-		int flags = 0, plen;
+		int flags = 0;
+		uint16_t plen, trim = 0;
 		uint32_t ack, seqid;
+#ifdef CONFIG_TCP_DELAYED_ACK
+		uint8_t quick;
+#endif
 
 		if (tcp_hdr->ctrl & TH_RST) {
 			if (tcp_conn->syn.status != SOCK_CLOSED) {
@@ -575,25 +1725,63 @@ void tcp_input(pkt_t *pkt)
 			}
 			goto end;
 		}
+		if (ip_plen < tcp_hdr_len)
+			goto end;
+		plen = ip_plen - tcp_hdr_len;
 
 		ack = ntohl(tcp_conn->syn.ack);
 		seqid = ntohl(tcp_conn->syn.seqid);
-		if (remote_seqid < ack) {
-			tcp_send_pkt(ip_hdr, tcp_hdr, TH_ACK, &tcp_conn->syn);
+#ifdef CONFIG_TCP_TIMESTAMPS
+		if (tcp_ts_input(tcp_conn, tcp_hdr, ack) < 0) {
+			if (plen || (tcp_hdr->ctrl & TH_FIN))
+				tcp_ack_now(tcp_conn, TH_ACK);
 			goto end;
 		}
-		if (remote_seqid > ack)
-			goto end;
-
+#endif
+#ifdef CONFIG_TCP_KEEPALIVE
+		tcp_conn->ka.rcv_ticks = timer_ticks;
+		tcp_conn->ka.sent = 0;
+#endif
 		if ((tcp_hdr->ctrl & TH_ACK)) {
-			if (remote_ack > seqid) {
+			if (SEQ_GT(remote_ack, seqid)) {
 				/* drop the packet */
 				goto end;
 			}
-#ifdef CONFIG_TCP_RETRANSMIT
-			tcp_retrn_ack_pkts(tcp_conn, remote_ack);
+			tcp_ack_input(tcp_conn, tcp_hdr, plen);
+		}
+		if (SEQ_GT(remote_seqid, ack)) {
+			int queued = -1;
+
+			/* a segment is missing, keep this one until it is
+			 * received and ask for it again */
+#ifdef CONFIG_TCP_DELAYED_ACK
+			if (SEQ_GT(remote_seqid + plen, tcp_conn->rcv_high))
+				tcp_conn->rcv_high = remote_seqid + plen;
 #endif
+			if (plen && pkt->buf.len >= tcp_hdr_len + plen) {
+				pkt->buf.len = tcp_hdr_len + plen;
+				pkt_adj(pkt, -ip_hdr_len);
+				queued = tcp_ooo_queue(tcp_conn, pkt,
+						       remote_seqid);
+			}
+#ifdef CONFIG_TCP_SACK
+			tcp_conn->ooo_last = remote_seqid;
+#endif
+			tcp_ack_now(tcp_conn, TH_ACK);
+			if (queued < 0)
+				goto end;
+			return;
 		}
+		if (SEQ_LT(remote_seqid, ack)) {
+			/* retransmitted data, only the end may be new */
+			trim = ack - remote_seqid;
+			if (trim > plen
+			    || (trim == plen && !(tcp_hdr->ctrl & TH_FIN))) {
+				tcp_ack_now(tcp_conn, TH_ACK);
+				goto end;
+			}
+		}
+
 		if (tcp_hdr->ctrl & TH_FIN) {
 			ack++;
 			if (tcp_conn->syn.status == SOCK_CONNECTED) {
@@ -612,18 +1800,45 @@ void tcp_input(pkt_t *pkt)
 		}
 
 		pkt_adj(pkt, tcp_hdr_len);
+		if (pkt->buf.len < plen)
+			goto end;
 		/* truncate pkt to the tcp payload length */
-		plen = ip_plen - tcp_hdr_len;
-		if (pkt->buf.len > plen)
-			pkt->buf.len = plen;
+		pkt->buf.len = plen;
+		if (trim) {
+			tcp_pkt_trim(pkt, ip_hdr_len + tcp_hdr_len, trim);
+			ip_hdr = (ip_hdr_t *)((uint8_t *)btod(pkt) - tcp_hdr_len
+					      - ip_hdr_len);
+			tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr_len);
+		}
+		plen = pkt->buf.len;
+#ifdef CONFIG_TCP_DELAYED_ACK
+		/* segments filling a hole, even one left by out of order
+		 * segments not kept, and FINs are not delayed */
+		quick = SEQ_LT(ack, tcp_conn->rcv_high)
+			|| (tcp_hdr->ctrl & TH_FIN);
+#endif
 
-		ack += pkt->buf.len;
+		ack += plen;
+		if (plen) {
+			pkt_adj(pkt, -(tcp_hdr_len + ip_hdr_len));
+			socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
+			if (!list_empty(&tcp_conn->ooo_list)
+			    && !(tcp_hdr->ctrl & TH_FIN))
+				ack = tcp_ooo_drain(tcp_conn, ack);
+		}
 		tcp_conn->syn.ack = htonl(ack);
-		if (remote_seqid < ack)
-			tcp_send_pkt(ip_hdr, tcp_hdr, flags | TH_ACK,
-				     &tcp_conn->syn);
+#ifdef CONFIG_TCP_DELAYED_ACK
+		if (SEQ_GT(ack, tcp_conn->rcv_high))
+			tcp_conn->rcv_high = ack;
+#endif
+		if (SEQ_LT(remote_seqid, ack)
+#ifdef CONFIG_TCP_DELAYED_ACK
+		    && (quick || tcp_ack_delay(tcp_conn) < 0)
+#endif
+		    )
+			tcp_ack_now(tcp_conn, flags | TH_ACK);
 #ifdef CONFIG_EVENT
-		if (pkt->buf.len)
+		if (plen)
 			event_schedule_event(&tcp_conn->sock_info->event,
 					     EV_READ);
 #endif
@@ -638,11 +1853,8 @@ void tcp_input(pkt_t *pkt)
 #endif
 		}
 
-		if (pkt->buf.len == 0)
+		if (plen == 0)
 			goto end;
-
-		pkt_adj(pkt, -(tcp_hdr_len + ip_hdr_len));
-		socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
 		return;
 	}
 
@@ -650,9 +1862,8 @@ void tcp_input(pkt_t *pkt)
 	dst_addr = tuid.dst_addr;
 	tuid.dst_addr = 0;
 	tcp_conn = tcp_client_conn_lookup(&tuid);
-	if (tcp_hdr->ctrl & TH_RST) {
-		if (tcp_conn != NULL)
-			tcp_conn_mark_closed(tcp_conn, 1);
+	if ((tcp_hdr->ctrl & TH_RST) && tcp_conn != NULL) {
+		tcp_conn_mark_closed(tcp_conn, 1);
 		goto end;
 	}
 	tuid.dst_addr = dst_addr;
@@ -674,6 +1885,14 @@ void tcp_input(pkt_t *pkt)
 
 		tcp_conn->syn.tuid.dst_addr = dst_addr;
 		tcp_conn->syn.ack = htonl(remote_seqid + 1);
+#ifdef CONFIG_TCP_DELAYED_ACK
+		tcp_conn->rcv_high = remote_seqid + 1;
+#endif
+		tcp_conn->snd_una = remote_ack;
+		tcp_conn->snd_wnd = tcp_peer_wnd(tcp_conn, tcp_hdr);
+#ifdef CONFIG_TCP_NAGLE
+		tcp_conn->snd_sml = remote_ack;
+#endif
 		tcp_conn->syn.status = SOCK_CONNECTED;
 		tcp_parse_options(&tcp_conn->syn.opts, tcp_hdr,
 				  tcp_hdr_len - sizeof(tcp_hdr_t));
@@ -683,6 +1902,10 @@ void tcp_input(pkt_t *pkt)
 		list_del(&tcp_conn->list);
 #ifdef CONFIG_TCP_RETRANSMIT
 		tcp_retrn_ack_pkts(tcp_conn, remote_ack);
+		tcp_cc_init(tcp_conn);
+#ifdef CONFIG_TCP_SACK
+		tcp_sack_reset(tcp_conn);
+#endif
 #endif
 #ifdef CONFIG_EVENT
 		if (tcp_conn_add(tcp_conn) < 0) {
@@ -699,31 +1922,24 @@ void tcp_input(pkt_t *pkt)
 	}
 #endif
 
+	if (tcp_hdr->ctrl & TH_RST) {
+		/* a reset in the window aborts a half-open connection */
+		if ((tsyn_entry = syn_find_entry(&tuid)) != NULL
+		    && tcp_hdr->seq == tsyn_entry->ack)
+			tsyn_entry->status = SOCK_CLOSED;
+		goto end;
+	}
+
 	sock_info = tcpport2sockinfo(tcp_hdr->dst_port);
+	if (sock_info && !sock_info_match_addr(sock_info, ip_hdr->dst))
+		sock_info = NULL;
 	if (tcp_hdr->ctrl == TH_SYN) {
 		if (sock_info == NULL) {
 			ts.ack = htonl(remote_seqid + 1);
 			tcp_send_pkt(ip_hdr, tcp_hdr, TH_RST|TH_ACK, &ts);
 			goto end;
 		}
-
-		tsyn_entry = &syn_entries.conns[syn_entries.pos];
-
-		/* network endian for seqid and ack */
-#ifdef TEST
-		tsyn_entry->seqid = 0x1207E77B;
-#else
-		tsyn_entry->seqid = rand();
-#endif
-		tsyn_entry->ack = htonl(remote_seqid + 1);
-		tsyn_entry->status = SOCK_TCP_SYN_ACK_SENT;
-		tcp_parse_options(&tsyn_entry->opts, tcp_hdr,
-				  tcp_hdr_len - sizeof(tcp_hdr_t));
-		tcp_send_pkt(ip_hdr, tcp_hdr, TH_SYN|TH_ACK, tsyn_entry);
-		tsyn_entry->seqid = htonl(ntohl(tsyn_entry->seqid) + 1);
-		syn_entries.pos = (syn_entries.pos + 1)
-			& (CONFIG_TCP_SYN_TABLE_SIZE - 1);
-		set_tuid(&tsyn_entry->tuid, ip_hdr, tcp_hdr);
+		tcp_syn_input(ip_hdr, tcp_hdr, &tuid);
 		goto end;
 	}
 
@@ -737,7 +1953,13 @@ void tcp_input(pkt_t *pkt)
 		goto end;
 	}
 
-	if ((tsyn_entry = syn_find_entry(&tuid)) == NULL) {
+	tsyn_entry = syn_find_entry(&tuid);
+#ifdef CONFIG_TCP_SYN_COOKIES
+	if (tsyn_entry == NULL && sock_info
+	    && syn_cookie_input(&cookie_syn, tcp_hdr, &tuid) >= 0)
+		tsyn_entry = &cookie_syn;
+#endif
+	if (tsyn_entry == NULL) {
 		tcp_send_pkt(ip_hdr, tcp_hdr, TH_RST, &ts);
 		goto end;
 	}
@@ -759,9 +1981,24 @@ void tcp_input(pkt_t *pkt)
 			goto end;
 		}
 		socket_add_backlog(l, tcp_conn);
+		tsyn_entry->status = SOCK_CLOSED;
 		tcp_conn->syn.seqid = tsyn_entry->seqid;
 		tcp_conn->syn.ack = tcp_hdr->seq;
+#ifdef CONFIG_TCP_DELAYED_ACK
+		tcp_conn->rcv_high = remote_seqid;
+#endif
 		tcp_conn->syn.opts = tsyn_entry->opts;
+		tcp_conn->snd_una = remote_ack;
+		tcp_conn->snd_wnd = tcp_peer_wnd(tcp_conn, tcp_hdr);
+#ifdef CONFIG_TCP_NAGLE
+		tcp_conn->snd_sml = remote_ack;
+#endif
+#ifdef CONFIG_TCP_RETRANSMIT
+		tcp_cc_init(tcp_conn);
+#ifdef CONFIG_TCP_SACK
+		tcp_sack_reset(tcp_conn);
+#endif
+#endif
 #ifdef CONFIG_EVENT
 		event_schedule_event(&sock_info->event, EV_READ);
 #endif
@@ -780,6 +2017,16 @@ void tcp_init(void)
 	htable_init(&tcp_conns);
 }
 #endif
+const obj_pool_stats_t *tcp_get_conn_pool_stats(void)
+{
+	return obj_pool_get_stats(&tcp_conn_pool);
+}
+
+const tcp_syn_stats_t *tcp_get_syn_stats(void)
+{
+	return &syn_stats;
+}
+
 void tcp_shutdown(void)
 {
 #ifndef CONFIG_HT_STORAGE
@@ -792,4 +2039,7 @@ void tcp_shutdown(void)
 #else
 	htable_free(&tcp_conns);
 #endif
+#ifdef CONFIG_TCP_KEEPALIVE
+	timer_del(&tcp_keepalive_timer);
+#endif
 }
@@ -25,12 +25,75 @@
 #ifndef _TCP_H_
 #define _TCP_H_
 
-#ifdef CONFIG_TCP_RETRANSMIT
+#if defined(CONFIG_TCP_RETRANSMIT) || defined(CONFIG_TCP_DELAYED_ACK) \
+	|| defined(CONFIG_TCP_TIMESTAMPS) || defined(CONFIG_TCP_KEEPALIVE)
 #include <sys/timer.h>
 #endif
+#include <sys/obj-pool.h>
 #include "config.h"
 #include "socket.h"
 
+#ifdef CONFIG_TCP_RETRANSMIT
+/* retransmission timeout bounds in ms, the initial timeout is
+ * CONFIG_TCP_RETRANSMIT_TIMEOUT */
+#ifndef CONFIG_TCP_RTO_MIN
+#define CONFIG_TCP_RTO_MIN 200
+#endif
+#ifndef CONFIG_TCP_RTO_MAX
+#define CONFIG_TCP_RTO_MAX 60000
+#endif
+
+/* retransmissions of a segment before the connection is dropped */
+#ifndef CONFIG_TCP_RETRANSMIT_RETRIES
+#define CONFIG_TCP_RETRANSMIT_RETRIES 6
+#endif
+
+/* congestion control algorithms, see tcp-cc.h */
+#if !defined(CONFIG_TCP_CC_NEWRENO) && !defined(CONFIG_TCP_CC_COMPACT)
+#define CONFIG_TCP_CC_NEWRENO
+#endif
+#endif
+
+#ifdef CONFIG_TCP_DELAYED_ACK
+/* time in ms an acknowledgment waits for data to be sent with */
+#ifndef CONFIG_TCP_DELAYED_ACK_TIMEOUT
+#define CONFIG_TCP_DELAYED_ACK_TIMEOUT 40
+#endif
+#endif
+
+/* number of out of order segments queued per connection */
+#ifndef CONFIG_TCP_OOO_MAX
+#define CONFIG_TCP_OOO_MAX 4
+#endif
+
+/* time in ms a half-open connection keeps its SYN table entry */
+#ifndef CONFIG_TCP_SYN_TIMEOUT
+#define CONFIG_TCP_SYN_TIMEOUT 3000
+#endif
+
+#ifdef CONFIG_TCP_KEEPALIVE
+/* keepalive is off on new connections (RFC 1122), these are the settings
+ * applications pass to __socket_set_keepalive() to enable it, in
+ * seconds. RFC 1122 requires an idle time of at least two hours. */
+#ifndef CONFIG_TCP_KEEPALIVE_IDLE
+#define CONFIG_TCP_KEEPALIVE_IDLE 7200
+#endif
+#ifndef CONFIG_TCP_KEEPALIVE_INTVL
+#define CONFIG_TCP_KEEPALIVE_INTVL 75
+#endif
+
+/* unanswered probes before the connection is dropped */
+#ifndef CONFIG_TCP_KEEPALIVE_PROBES
+#define CONFIG_TCP_KEEPALIVE_PROBES 9
+#endif
+#endif
+
+/* sequence number comparisons, valid across wraparound */
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
 #define TH_FIN  0x01
 #define TH_SYN  0x02
 #define TH_RST  0x04
@@ -94,20 +157,66 @@ typedef struct tcp_uid {
 } tcp_uid_t;
 
 #ifdef CONFIG_TCP_RETRANSMIT
-typedef struct tcp_retrn_pkt {
-	pkt_t *pkt;
-	list_t list;
-} tcp_retrn_pkt_t;
+#define TCP_RTT_TIMING 0x01	/* a segment is timed */
+#define TCP_RTT_VALID  0x02	/* srtt and rttvar are set */
 
 typedef struct tcp_retrn {
 	tim_t timer;
 	uint8_t cnt;
-	list_t retrn_pkt_list;
+	uint8_t rtt_flags;
+	list_t retrn_pkt_list;	/* segments sent, linked by pkt->retrn_list */
+	uint32_t rtt_seqid;	/* timed segment seqid, host endian */
+	uint32_t rtt_ticks;	/* timed segment send time */
+	uint32_t srtt;		/* smoothed rtt, in ticks << 3 */
+	uint32_t rttvar;	/* rtt variation, in ticks << 2 */
+	uint32_t rto;		/* retransmission timeout, in ticks */
+	uint32_t rxt_nxt;	/* next seqid to resend after a timeout */
+	uint32_t rxt_end;	/* seqid sent when the timeout expired */
+#ifdef CONFIG_TCP_SACK
+	uint32_t sack_high;	/* end of the highest SACKed segment */
+	uint32_t sack_rxt;	/* next hole to resend during a recovery */
+#endif
 } tcp_retrn_t;
+
+typedef struct tcp_cc {
+	uint32_t cwnd;		/* congestion window, in bytes */
+	uint32_t ssthresh;	/* slow start threshold, in bytes */
+#ifdef CONFIG_TCP_CC_NEWRENO
+	uint32_t recover;	/* seqid sent when the loss was detected */
+#endif
+	uint8_t dupacks;	/* consecutive duplicate acknowledgments */
+	uint8_t flags;
+} tcp_cc_t;
 #endif
 
+#ifdef CONFIG_TCP_KEEPALIVE
+typedef struct tcp_keepalive {
+	uint16_t idle;		/* seconds without segments before probing */
+	uint16_t intvl;		/* seconds between probes */
+	uint8_t probes;		/* unanswered probes before dropping */
+	uint8_t sent;		/* probes sent since the last segment */
+	uint32_t rcv_ticks;	/* reception time of the last segment */
+} tcp_keepalive_t;
+#endif
+
+#define TCP_OPT_WSCALE 0x01	/* window scale option received */
+#define TCP_OPT_TS     0x02	/* timestamps option received */
+
 typedef struct tcp_options {
 	uint16_t mss;
+#ifdef CONFIG_TCP_SACK
+	uint8_t sack_permitted;
+#endif
+#if defined(CONFIG_TCP_WSCALE) || defined(CONFIG_TCP_TIMESTAMPS)
+	uint8_t flags;
+#endif
+#ifdef CONFIG_TCP_WSCALE
+	uint8_t wscale;		/* shift of the windows the peer advertises */
+#endif
+#ifdef CONFIG_TCP_TIMESTAMPS
+	uint32_t ts_val;	/* TS.Recent once connected, host endian */
+	uint32_t ts_ecr;
+#endif
 } tcp_options_t;
 
 typedef struct tcp_syn {
@@ -126,8 +235,33 @@ typedef struct tcp_conn {
 	sock_info_t *sock_info;
 	list_t list;
 	list_t pkt_list_head;
+	list_t ooo_list;	/* out of order segments sorted by seqid */
+	uint32_t snd_una;	/* oldest unacknowledged seqid, host endian */
+#ifdef CONFIG_TCP_WSCALE
+	uint32_t snd_wnd;	/* receive window advertised by the peer */
+#else
+	uint16_t snd_wnd;	/* receive window advertised by the peer */
+#endif
+	uint8_t ooo_nb;
+#ifdef CONFIG_TCP_SACK
+	uint32_t ooo_last;	/* seqid of the last out of order segment */
+#endif
+	list_t snd_queue;	/* segments waiting for the windows to open */
+	uint16_t snd_queued;	/* payload bytes in snd_queue */
+#ifdef CONFIG_TCP_NAGLE
+	uint32_t snd_sml;	/* end of the last small segment sent */
+#endif
+#ifdef CONFIG_TCP_DELAYED_ACK
+	uint8_t ack_pending;	/* segments received and not acknowledged */
+	uint32_t rcv_high;	/* highest seqid received, host endian */
+	tim_t ack_timer;
+#endif
 #ifdef CONFIG_TCP_RETRANSMIT
 	tcp_retrn_t retrn;
+	tcp_cc_t cc;
+#endif
+#ifdef CONFIG_TCP_KEEPALIVE
+	tcp_keepalive_t ka;
 #endif
 } tcp_conn_t;
 
@@ -141,12 +275,144 @@ void __tcp_conn_delete(tcp_conn_t *tcp_conn);
 int
 tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *sock_info);
 int tcp_output(pkt_t *pkt, tcp_conn_t *tcp_conn, uint8_t flags);
+
+/** Get the largest segment the peer accepts
+ *
+ * @param[in] tcp_conn  connection
+ * @return MSS announced by the peer, bounded by the packet size
+ */
+uint16_t tcp_conn_mss(const tcp_conn_t *tcp_conn);
+
+/** Get the length of the options every segment carries
+ *
+ * With CONFIG_TCP_TIMESTAMPS, the timestamps option is set in all the
+ * segments of a connection once the peer accepted it. Data segments
+ * reserve room for it between the tcp header and the payload.
+ *
+ * @param[in] tcp_conn  connection
+ * @return options length in bytes
+ */
+static inline uint8_t tcp_conn_opts_len(const tcp_conn_t *tcp_conn)
+{
+#ifdef CONFIG_TCP_TIMESTAMPS
+	if (tcp_conn->syn.opts.flags & TCP_OPT_TS)
+		return TCPOLEN_TSTAMP_APPA;
+#else
+	(void)tcp_conn;
+#endif
+	return 0;
+}
+
+/** Check if the peer window can take more data
+ *
+ * With CONFIG_TCP_RETRANSMIT, the congestion window limits the data in
+ * flight as well. Queued data counts as if it was in flight.
+ * Data is accepted when nothing is in flight or queued even if the window
+ * is closed. The first segment probes the window, the others wait in the
+ * send queue until the peer opens it again.
+ *
+ * @param[in] tcp_conn  connection
+ * @param[in] len       length of the data to send
+ * @return 1 if the data can be sent, 0 otherwise
+ */
+int tcp_can_send(const tcp_conn_t *tcp_conn, uint16_t len);
+
+/** Get the room left in the last queued segment
+ *
+ * @param[in] tcp_conn  connection
+ * @return number of bytes tcp_send() can append to it
+ */
+uint16_t tcp_queue_room(const tcp_conn_t *tcp_conn);
+
+/** Queue data and send what the windows accept
+ *
+ * The rest is sent as acknowledgments come in. With CONFIG_TCP_NAGLE, a
+ * segment smaller than the MSS waits while a previous small segment is
+ * not acknowledged.
+ *
+ * @param[in] tcp_conn  connection
+ * @param[in] sbuf      data appended to the last queued segment, at most
+ *                      tcp_queue_room() bytes
+ * @param[in] segs      segments queued after it, pointing to their tcp
+ *                      header. The list is emptied.
+ */
+void tcp_send(tcp_conn_t *tcp_conn, const sbuf_t *sbuf, list_t *segs);
 void tcp_input(pkt_t *pkt);
 
+/** Drop the beginning of a received segment payload
+ *
+ * The headers are moved forward for the socket layer to find them in
+ * front of the data left.
+ *
+ * @param[in] pkt       segment pointing to its payload
+ * @param[in] hdrs_len  ip and tcp headers length
+ * @param[in] len       payload bytes to drop
+ */
+void tcp_pkt_trim(pkt_t *pkt, uint16_t hdrs_len, uint16_t len);
+
 #ifdef CONFIG_HT_STORAGE
 void tcp_init(void);
 #else
 static inline void tcp_init(void) {}
 #endif
 void tcp_shutdown(void);
+
+typedef struct tcp_syn_stats {
+	uint16_t received;	/* SYNs to listening sockets */
+	uint16_t overflows;	/* SYNs finding no SYN table entry */
+	uint16_t evicted;	/* half-open connections dropped */
+#ifdef CONFIG_TCP_SYN_COOKIES
+	uint16_t cookies_sent;
+	uint16_t cookies_ok;
+	uint16_t cookies_failed;
+#endif
+} tcp_syn_stats_t;
+
+/** Get half-open connection statistics
+ *
+ * The SYN table holds CONFIG_TCP_SYN_TABLE_SIZE connections. When the
+ * entries a connection hashes to are taken, the oldest one is dropped or,
+ * with CONFIG_TCP_SYN_COOKIES, the connection is kept in a SYN cookie.
+ *
+ * @return statistics
+ */
+const tcp_syn_stats_t *tcp_get_syn_stats(void);
+
+#ifdef CONFIG_TCP_KEEPALIVE
+typedef struct tcp_keepalive_stats {
+	uint16_t probes;	/* keepalive probes sent */
+	uint16_t reaped;	/* connections dropped for lack of answer */
+} tcp_keepalive_stats_t;
+
+/** Set keepalive settings of a connection
+ *
+ * Keepalive is disabled on new connections. A single timer checks the
+ * connections every second while one of them uses it. Once a connection
+ * received nothing for idle seconds and has no data in flight, a probe is
+ * sent every intvl seconds. After probes unanswered probes, the connection
+ * is closed with EV_ERROR and its packets are freed. With probes set to 0,
+ * the connection is closed after idle seconds without probing.
+ *
+ * @param[in] tcp_conn  connection
+ * @param[in] idle      idle time in seconds, 0 disables keepalive
+ * @param[in] intvl     time between probes in seconds
+ * @param[in] probes    number of probes
+ */
+void tcp_conn_set_keepalive(tcp_conn_t *tcp_conn, uint16_t idle,
+			    uint16_t intvl, uint8_t probes);
+
+/** Get keepalive statistics
+ *
+ * @return statistics
+ */
+const tcp_keepalive_stats_t *tcp_get_keepalive_stats(void);
+#endif
+
+/** Get connection pool statistics
+ *
+ * The pool holds CONFIG_TCP_MAX_CONNS connections.
+ *
+ * @return statistics
+ */
+const obj_pool_stats_t *tcp_get_conn_pool_stats(void);
 #endif
@@ -23,15 +23,27 @@
 */
 
 #include <crypto/xtea.h>
+#include <sys/chksum.h>
+#include <sys/timer.h>
+#include <sys/scheduler.h>
 #include "config.h"
 #include "tests.h"
 #include "arp.h"
 #include "eth.h"
 #include "udp.h"
+#include "icmp.h"
+#include "ip-frag.h"
+#include "tr-chksum.h"
 #include "route.h"
 #include "socket.h"
 #include "pkt-mempool.h"
 #include "swen-l3.h"
+#ifdef CONFIG_TCP_RETRANSMIT
+#include "tcp-cc.h"
+#endif
+#ifdef CONFIG_LOOPBACK
+#include "lo.h"
+#endif
 
 void recv(iface_t *iface) {}
 
@@ -197,7 +209,9 @@ int net_arp_tests(void)
 #endif
 	uint8_t mac_dst[] = { 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x65 };
 	const uint8_t *mac = NULL;
-	iface_t *interface = NULL;
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	iface_t other_iface;
+#endif
 
 	pkt_mempool_init();
 	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
@@ -235,14 +249,15 @@ int net_arp_tests(void)
 		pkt_free(pkt);
 		goto end;
 	}
-	if (arp_find_entry(&ip, &mac, &interface) < 0) {
+	if (arp_find_entry(&ip, &mac, &iface) < 0) {
 		fprintf(stderr, "%s: failed find arp entry\n", __func__);
 		pkt_free(pkt);
 		ret = -1;
 		goto end;
 	}
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-	if (interface != &iface) {
+	/* the entry is only valid on the interface it has been learnt on */
+	if (arp_find_entry(&ip, &mac, &other_iface) == 0) {
 		fprintf(stderr, "%s: bad interface\n", __func__);
 		pkt_free(pkt);
 		ret = -1;
@@ -271,6 +286,350 @@ int net_arp_tests(void)
 	return ret;
 }
 
+static void net_arp_neighbor(unsigned n, uint32_t *ip_addr, uint8_t *mac_addr)
+{
+	uint8_t *ip_p = (uint8_t *)ip_addr;
+
+	ip_p[0] = 10;
+	ip_p[1] = 0;
+	ip_p[2] = n >> 8;
+	ip_p[3] = n;
+	memcpy(mac_addr, mac, ETHER_ADDR_LEN);
+	mac_addr[4] = n >> 8;
+	mac_addr[5] = n;
+}
+
+static int net_arp_check_neighbor(unsigned n, int present)
+{
+	uint32_t ip_addr;
+	uint8_t mac_addr[ETHER_ADDR_LEN];
+	const uint8_t *mac_dst;
+
+	net_arp_neighbor(n, &ip_addr, mac_addr);
+	if (arp_find_entry(&ip_addr, &mac_dst, &iface) < 0)
+		return present ? -1 : 0;
+	if (!present || memcmp(mac_dst, mac_addr, ETHER_ADDR_LEN))
+		return -1;
+	return 0;
+}
+
+#ifdef CONFIG_ARP_EXPIRY
+static void net_arp_wait(uint32_t seconds_x4)
+{
+	uint32_t i;
+
+	for (i = 0; i < seconds_x4 * 250000UL / CONFIG_TIMER_RESOLUTION_US; i++)
+		timer_process();
+}
+
+static int net_arp_expiry_tests(void)
+{
+	uint32_t ip_addr;
+	uint8_t mac_addr[ETHER_ADDR_LEN];
+	eth_hdr_t *eh;
+	pkt_t *pkt;
+
+	arp_flush();
+	net_arp_neighbor(1, &ip_addr, mac_addr);
+	arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+
+	/* an aging entry is still used while it is refreshed by unicast */
+	net_arp_wait(CONFIG_ARP_EXPIRY * 3 + 1);
+	if (net_arp_check_neighbor(1, 1) < 0
+	    || (pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: entry not refreshed\n", __func__);
+		return -1;
+	}
+	eh = btod(pkt);
+	if (eh->type != ETHERTYPE_ARP
+	    || memcmp(eh->dst, mac_addr, ETHER_ADDR_LEN)) {
+		fprintf(stderr, "%s: bad refresh request\n", __func__);
+		pkt_free(pkt);
+		return -1;
+	}
+	pkt_free(pkt);
+	/* one request per probe interval */
+	if (net_arp_check_neighbor(1, 1) < 0 || pkt_get(iface.tx)) {
+		fprintf(stderr, "%s: too many refresh requests\n", __func__);
+		return -1;
+	}
+
+	/* the neighbor answers */
+	arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+	net_arp_wait(CONFIG_ARP_EXPIRY * 2);
+	if (net_arp_check_neighbor(1, 1) < 0) {
+		fprintf(stderr, "%s: refreshed entry expired\n", __func__);
+		return -1;
+	}
+
+	/* it does not anymore */
+	net_arp_wait(CONFIG_ARP_EXPIRY * 2 + 1);
+	net_arp_check_neighbor(1, 1);
+	while ((pkt = pkt_get(iface.tx)))
+		pkt_free(pkt);
+	if (net_arp_check_neighbor(1, 0) < 0) {
+		fprintf(stderr, "%s: entry did not expire\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+int net_arp_cache_tests(void)
+{
+	uint32_t ip_addr;
+	uint8_t mac_addr[ETHER_ADDR_LEN];
+	unsigned i, half = CONFIG_ARP_TABLE_SIZE / 2;
+	int ret = -1;
+
+	pkt_mempool_init();
+	/* the addresses are sent in the refresh requests */
+	iface.hw_addr = mac;
+	iface.ip4_addr = ip;
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+	arp_flush();
+
+	for (i = 1; i <= CONFIG_ARP_TABLE_SIZE; i++) {
+		net_arp_neighbor(i, &ip_addr, mac_addr);
+		arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+	}
+	for (i = 1; i <= CONFIG_ARP_TABLE_SIZE; i++) {
+		if (net_arp_check_neighbor(i, 1) < 0) {
+			fprintf(stderr, "%s: neighbor %u not found\n",
+				__func__, i);
+			goto end;
+		}
+	}
+
+	/* use the first half again, the other one gets evicted */
+	for (i = 1; i <= half; i++)
+		net_arp_check_neighbor(i, 1);
+	for (i = CONFIG_ARP_TABLE_SIZE + 1;
+	     i <= CONFIG_ARP_TABLE_SIZE + half; i++) {
+		net_arp_neighbor(i, &ip_addr, mac_addr);
+		arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+	}
+	for (i = 1; i <= CONFIG_ARP_TABLE_SIZE + half; i++) {
+		int present = i <= half || i > CONFIG_ARP_TABLE_SIZE;
+
+		if (net_arp_check_neighbor(i, present) < 0) {
+			fprintf(stderr, "%s: bad eviction of neighbor %u\n",
+				__func__, i);
+			goto end;
+		}
+	}
+
+	/* an update does not duplicate the entry, which would evict the
+	 * least recently used neighbor */
+	net_arp_check_neighbor(1, 1);
+	net_arp_neighbor(1, &ip_addr, mac_addr);
+	mac_addr[0] ^= 0x02;
+	arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+	if (net_arp_check_neighbor(2, 1) < 0
+	    || net_arp_check_neighbor(1, 1) == 0) {
+		fprintf(stderr, "%s: bad update\n", __func__);
+		goto end;
+	}
+#ifdef CONFIG_ARP_EXPIRY
+	if (net_arp_expiry_tests() < 0)
+		goto end;
+#endif
+	ret = 0;
+ end:
+	arp_flush();
+	pkt_mempool_shutdown();
+	return ret;
+}
+
+static int net_arp_queue_send(unsigned n)
+{
+	uint32_t ip_addr;
+	uint8_t mac_addr[ETHER_ADDR_LEN];
+	ip_hdr_t *ip_hdr;
+	pkt_t *pkt;
+
+	if ((pkt = pkt_alloc()) == NULL)
+		return -1;
+	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
+	ip_hdr = btod(pkt);
+	memset(ip_hdr, 0, sizeof(ip_hdr_t) + sizeof(udp_hdr_t));
+	ip_hdr->p = IPPROTO_UDP;
+	pkt->buf.len = sizeof(ip_hdr_t) + sizeof(udp_hdr_t);
+	net_arp_neighbor(n, &ip_addr, mac_addr);
+	return eth_output(pkt, &iface, L3_PROTO_IP, &ip_addr);
+}
+
+static unsigned net_arp_queue_drain(const uint8_t *dst)
+{
+	unsigned nb = 0;
+	pkt_t *pkt;
+
+	while ((pkt = pkt_get(iface.tx))) {
+		eth_hdr_t *eh = btod(pkt);
+
+		if (dst == NULL || memcmp(eh->dst, dst, ETHER_ADDR_LEN) == 0)
+			nb++;
+		pkt_free(pkt);
+	}
+	return nb;
+}
+
+int net_arp_queue_tests(void)
+{
+	const arp_stats_t *stats = arp_get_stats();
+	arp_stats_t prev;
+	uint32_t ip_addr;
+	uint8_t mac_addr[ETHER_ADDR_LEN];
+	iface_t neighbor;
+	unsigned i, n, nb_free;
+	pkt_t *pkt;
+	int ret = -1;
+
+	pkt_mempool_init();
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+	arp_flush();
+	net_arp_queue_drain(NULL);
+	nb_free = pkt_pool_get_nb_free();
+	prev = *stats;
+
+	/* a single request per resolution, the oldest packets are
+	 * dropped */
+	for (i = 0; i <= CONFIG_ARP_QUEUE_LEN; i++)
+		net_arp_queue_send(1);
+	if (arp_get_nb_pkts() != CONFIG_ARP_QUEUE_LEN
+	    || stats->dropped != prev.dropped + 1
+	    || net_arp_queue_drain(broadcast_mac) != 1) {
+		fprintf(stderr, "%s: per neighbor limit failed\n", __func__);
+		goto end;
+	}
+
+	/* the oldest resolution pays for the global limit */
+	for (n = 2; arp_get_nb_pkts() < CONFIG_ARP_QUEUE_MAX; n++)
+		net_arp_queue_send(n);
+	net_arp_queue_send(n);
+	if (arp_get_nb_pkts() != CONFIG_ARP_QUEUE_MAX
+	    || stats->dropped != prev.dropped + 2) {
+		fprintf(stderr, "%s: global limit failed\n", __func__);
+		goto end;
+	}
+	net_arp_queue_drain(NULL);
+
+	/* the first neighbor answers */
+	net_arp_neighbor(1, &ip_addr, mac_addr);
+	memset(&neighbor, 0, sizeof(neighbor));
+	neighbor.flags = IF_UP;
+	neighbor.hw_addr = mac_addr;
+	neighbor.ip4_addr = (uint8_t *)&ip_addr;
+	neighbor.send = &send;
+	neighbor.tx = iface.tx;
+	arp_output(&neighbor, ARPOP_REPLY, iface.hw_addr, iface.ip4_addr);
+	if ((pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: no arp reply\n", __func__);
+		goto end;
+	}
+	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
+	arp_input(pkt, &iface);
+	if (net_arp_queue_drain(mac_addr) != CONFIG_ARP_QUEUE_LEN - 1
+	    || stats->sent != prev.sent + CONFIG_ARP_QUEUE_LEN - 1
+	    || arp_get_nb_pkts() != CONFIG_ARP_QUEUE_MAX
+	    - CONFIG_ARP_QUEUE_LEN + 1) {
+		fprintf(stderr, "%s: queue not flushed\n", __func__);
+		goto end;
+	}
+
+	/* the others do not */
+	for (i = 0; i < 7000000UL / CONFIG_TIMER_RESOLUTION_US; i++)
+		timer_process();
+	net_arp_queue_drain(NULL);
+	if (arp_get_nb_pkts() || stats->timeouts != prev.timeouts
+	    + CONFIG_ARP_QUEUE_MAX - CONFIG_ARP_QUEUE_LEN + 1
+	    || pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: resolutions did not expire\n", __func__);
+		goto end;
+	}
+	ret = 0;
+ end:
+	arp_flush();
+	net_arp_queue_drain(NULL);
+	pkt_mempool_shutdown();
+	return ret;
+}
+
+static int net_route_check(uint32_t dst, uint32_t gw, const iface_t *ifa)
+{
+	const route_t *route = route_lookup(htonl(dst));
+
+	if (ifa == NULL)
+		return route ? -1 : 0;
+	if (route == NULL || route->ip != htonl(gw) || route->iface != ifa) {
+		fprintf(stderr, "%s: invalid route for 0x%X\n", __func__, dst);
+		return -1;
+	}
+	return 0;
+}
+
+int net_route_tests(void)
+{
+	iface_t iface2;
+	int i;
+
+	memset(&iface2, 0, sizeof(iface_t));
+	route_flush();
+	if (route_add(0, 0, htonl(0xC0A800FEUL), &iface) < 0
+	    || route_add(htonl(0x0A000000UL), 8, htonl(0x0A000001UL), &iface) < 0
+	    || route_add(htonl(0x0A010000UL), 16, 0, &iface2) < 0
+	    || route_add(htonl(0x0A010203UL), 32, htonl(0x0A010001UL),
+			 &iface2) < 0) {
+		fprintf(stderr, "%s: can't add routes\n", __func__);
+		return -1;
+	}
+	if (CONFIG_ROUTE_TABLE_SIZE == 4
+	    && route_add(htonl(0x0B000000UL), 8, 0, &iface) == 0) {
+		fprintf(stderr, "%s: routing table overflow\n", __func__);
+		return -1;
+	}
+	if (route_add(htonl(0x0A000000UL), 8, 0, &iface) == 0) {
+		fprintf(stderr, "%s: duplicate route added\n", __func__);
+		return -1;
+	}
+
+	/* the second pass hits the route cache */
+	for (i = 0; i < 2; i++) {
+		if (net_route_check(0x0A010203, 0x0A010001, &iface2) < 0
+		    || net_route_check(0x0A010204, 0, &iface2) < 0
+		    || net_route_check(0x0A020001, 0x0A000001, &iface) < 0
+		    || net_route_check(0x0B000001, 0xC0A800FE, &iface) < 0)
+			return -1;
+	}
+
+	/* deletions invalidate cached routes */
+	if (route_del(htonl(0x0A010000UL), 16) < 0
+	    || route_del(htonl(0x0A010000UL), 16) == 0
+	    || route_del(htonl(0x0A000000UL), 24) == 0
+	    || net_route_check(0x0A010204, 0x0A000001, &iface) < 0
+	    || net_route_check(0x0A010203, 0x0A010001, &iface2) < 0)
+		return -1;
+	if (route_del(0, 0) < 0 || net_route_check(0x0B000001, 0, NULL) < 0)
+		return -1;
+
+	/* diverging prefixes share a branching node */
+	if (route_add(htonl(0x0A800000UL), 9, 0, &iface2) < 0
+	    || net_route_check(0x0A800001, 0, &iface2) < 0
+	    || net_route_check(0x0A7F0001, 0x0A000001, &iface) < 0
+	    || route_del(htonl(0x0A000000UL), 8) < 0
+	    || route_del(htonl(0x0A010203UL), 32) < 0
+	    || net_route_check(0x0A7F0001, 0, NULL) < 0
+	    || net_route_check(0x0A800001, 0, &iface2) < 0
+	    || route_del(htonl(0x0A800000UL), 9) < 0
+	    || net_route_check(0x0A800001, 0, NULL) < 0)
+		return -1;
+
+	route_flush();
+	return 0;
+}
+
 /* mac_src: 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x65,
  * mac_dst: 0xe8, 0x39, 0x35, 0x10, 0xfc, 0xed
  * ip_src:  192.168.2.163
@@ -312,6 +671,9 @@ int net_icmp_tests(void)
 	buf_init(&pkt->buf, icmp_echo_pkt, sizeof(icmp_echo_pkt));
 
 	arp_add_entry(mac_dst, (uint8_t *)&ip_dst, &iface);
+	/* the remote host is not on the interface subnet */
+	route_flush();
+	route_add(0, 0, ip_dst, &iface);
 	if (pkt_put(iface.rx, pkt) < 0) {
 		fprintf(stderr , "%s: can't put rx packet\n", __func__);
 		pkt_free(pkt);
@@ -355,205 +717,2598 @@ unsigned char icmp_port_unrecheable_pkt[] = {
 	/*	0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c, 0x48, 0x83, 0xc7, 0xbc, 0x7d, 0x06, 0x08, 0x00, 0x45, 0x00, 0x00, 0x38, 0xf6, 0xe8, 0x40, 0x00, 0x40, 0x01, 0xc2, 0x7f, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x0b, 0x03, 0x03, 0x3e, 0xc3, 0x00, 0x00, 0x00, 0x00, 0x45, 0x00, 0x00, 0x29, 0xdd, 0x22, 0x40, 0x00, 0x40, 0x11, 0xdc, 0x44, 0xc0, 0xa8, 0x00, 0x0b, 0xc0, 0xa8, 0x00, 0x01, 0xbb, 0x1b, 0x03, 0x09, 0x00, 0x15, 0x00, 0x00, 0x20, 0x08, */
 };
 
-#ifdef CONFIG_UDP
-#ifdef CONFIG_BSD_COMPAT
-static int udp_fd;
-static int udp_server(uint16_t port)
+#ifdef CONFIG_UDP
+#ifdef CONFIG_BSD_COMPAT
+static int udp_fd;
+static int udp_server(uint16_t port)
+{
+	int fd;
+	struct sockaddr_in sockaddr;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		fprintf(stderr, "%s: can't create socket\n", __func__);
+		return -1;
+	}
+	sockaddr.sin_family = AF_INET;
+	sockaddr.sin_addr.s_addr = INADDR_ANY;
+	sockaddr.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr *)&sockaddr,
+		 sizeof(struct sockaddr_in)) < 0) {
+		fprintf(stderr, "%s: can't bind\n", __func__);
+		return -1;
+	}
+	return fd;
+}
+#endif
+/* feed udp_pkt with a corrupted payload byte: nothing must be answered */
+static int net_udp_corrupted_input(void)
+{
+	pkt_t *pkt;
+	int ret = 0;
+
+	if ((pkt = pkt_alloc()) == NULL)
+		return -1;
+	buf_init(&pkt->buf, udp_pkt, sizeof(udp_pkt));
+	udp_pkt[sizeof(udp_pkt) - 1] ^= 0xFF;
+	if (pkt_put(iface.rx, pkt) < 0) {
+		pkt_free(pkt);
+		ret = -1;
+	} else
+		eth_input(&iface);
+	udp_pkt[sizeof(udp_pkt) - 1] ^= 0xFF;
+
+	if (ret == 0 && (pkt = pkt_get(iface.tx)) != NULL) {
+		pkt_free(pkt);
+		ret = -1;
+	}
+	return ret;
+}
+
+int net_udp_tests(void)
+{
+	pkt_t *pkt;
+	buf_t out;
+	/* ip_src: 192.168.0.11 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t ip_src = 0xc0a8000b;
+#else
+	uint32_t ip_src = 0x0b00a8c0;
+#endif
+	/* ip_dst: 192.168.0.1 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t ip_dst = 0xc0a80001;
+#else
+	uint32_t ip_dst = 0x0100a8c0;
+#endif
+	uint8_t mac_dst[] = { 0x48, 0x83, 0xc7, 0xbc, 0x7d, 0x06 };
+	uint8_t mac_src[] = { 0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c };
+	uint16_t port = 777;
+#ifdef CONFIG_BSD_COMPAT
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	char out_buf[sizeof(udp_pkt)];
+#else
+	sock_info_t sock_info;
+	uint32_t src_addr;
+	uint16_t src_port;
+	pkt_t *out_pkt;
+#endif
+	ip_hdr_t *ip_hdr;
+	udp_hdr_t *udp_hdr;
+	sbuf_t sb;
+	int buf_size = 512, len, ret = 0;
+	char buf[buf_size];
+
+	memset(buf, 0, buf_size);
+	pkt_mempool_init();
+	iface.ip4_addr = (void *)&ip_dst;
+	iface.hw_addr = mac_dst;
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+
+	if ((pkt = pkt_alloc()) == NULL) {
+		fprintf(stderr, "%s: can't alloc a packet\n", __func__);
+		ret = -1;
+		goto end;
+	}
+	memset(pkt->buf.data, 0, pkt->buf.size);
+	buf_init(&pkt->buf, udp_pkt, sizeof(udp_pkt));
+
+#ifdef CONFIG_HT_STORAGE
+	socket_init();
+#endif
+	arp_add_entry(mac_src, (uint8_t *)&ip_src, &iface);
+
+	(void)out;
+	if (net_udp_corrupted_input() < 0) {
+		fprintf(stderr, "%s: corrupted datagram answered\n", __func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+#ifdef CONFIG_ICMP
+	buf_init(&out, icmp_port_unrecheable_pkt,
+		 sizeof(icmp_port_unrecheable_pkt));
+
+	if (pkt_put(iface.rx, pkt) < 0) {
+		fprintf(stderr , "%s: can't put rx packet\n", __func__);
+		ret = -1;
+		goto end;
+	}
+
+	eth_input(&iface);
+	if ((pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: can't get tx packet\n", __func__);
+		ret = -1;
+		goto end;
+	}
+
+	if (buf_cmp(&pkt->buf, &out) < 0) {
+		printf("out pkt:\n");
+		buf_print_hex(&pkt->buf);
+		printf("expected:\n");
+		buf_print_hex(&out);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+#endif
+	route_flush();
+	route_add(0, 0, 0, &iface);
+#ifdef CONFIG_BSD_COMPAT
+	if ((udp_fd = udp_server(port)) < 0) {
+		fprintf(stderr, "%s: can't start udp server\n", __func__);
+		ret = -1;
+		pkt_free(pkt);
+		goto end;
+	}
+#else
+	if (sock_info_init(&sock_info, SOCK_DGRAM) < 0) {
+		fprintf(stderr, "%s: can't init udp sock_info\n", __func__);
+		return -1;
+	}
+
+	if (sock_info_bind(&sock_info, htons(port)) < 0) {
+		fprintf(stderr, "%s: can't start udp server\n", __func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+
+#endif
+	if (net_udp_corrupted_input() < 0) {
+		fprintf(stderr, "%s: corrupted datagram answered\n", __func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+
+	buf_init(&pkt->buf, udp_pkt, sizeof(udp_pkt));
+	if (pkt_put(iface.rx, pkt) < 0) {
+		fprintf(stderr , "%s: can't put rx packet\n", __func__);
+		ret = -1;
+		pkt_free(pkt);
+		goto end;
+	}
+
+	eth_input(&iface);
+	if ((pkt = pkt_get(iface.tx)) != NULL) {
+		fprintf(stderr, "shouldn't get tx packet\n");
+		ret = -1;
+		goto end;
+	}
+#ifdef CONFIG_BSD_COMPAT
+	if ((len = recvfrom(udp_fd, buf, buf_size, 0, (struct sockaddr *)&addr,
+			    &addrlen)) < 0) {
+		fprintf(stderr, "%s: can't get udp pkt\n", __func__);
+		ret = -1;
+		goto end;
+	}
+#else
+	if (__socket_get_pkt(&sock_info, &pkt, &src_addr, &src_port) < 0) {
+		fprintf(stderr, "%s: can't get udp pkt 2\n", __func__);
+		ret = -1;
+		goto end;
+	}
+	len = pkt->buf.len;
+	memcpy(buf, pkt->buf.data, len);
+#endif
+	/* the corrupted datagram must not have been queued */
+#ifdef CONFIG_BSD_COMPAT
+	if (recvfrom(udp_fd, out_buf, sizeof(out_buf), 0,
+		     (struct sockaddr *)&addr, &addrlen) >= 0) {
+#else
+	if (__socket_get_pkt(&sock_info, &out_pkt, &src_addr, &src_port) >= 0) {
+#endif
+		fprintf(stderr, "%s: corrupted datagram queued\n", __func__);
+		ret = -1;
+		goto end;
+	}
+
+	sbuf_init(&sb, buf, len);
+#ifdef CONFIG_BSD_COMPAT
+	if (sendto(udp_fd, sb.data, sb.len, 0, (struct sockaddr *)&addr,
+		   sizeof(struct sockaddr_in)) < 0) {
+		fprintf(stderr, "%s: can't put sbuf to udp socket\n", __func__);
+		ret = -1;
+		pkt_free(pkt);
+		goto end;
+	}
+#else
+	if (__socket_put_sbuf(&sock_info, &sb, src_addr, src_port) < 0) {
+		fprintf(stderr, "%s: can't put sbuf to udp socket\n", __func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+#endif
+	if ((pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: can't get udp echo packet\n", __func__);
+		ret = -1;
+		goto end;
+	}
+	/* the payload sum computed while copying must give a valid
+	 * checksum */
+	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
+	ip_hdr = btod(pkt);
+	pkt_adj(pkt, ip_hdr->hl * 4);
+	udp_hdr = btod(pkt);
+	if (ntohs(udp_hdr->length) != sizeof(udp_hdr_t) + len
+	    || transport_cksum(ip_hdr, udp_hdr, udp_hdr->length) != 0) {
+		fprintf(stderr, "%s: invalid udp echo checksum\n", __func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+	pkt_free(pkt);
+
+#ifdef CONFIG_BSD_COMPAT
+	if (close(udp_fd) < 0) {
+		fprintf(stderr, "%s: can't close udp socket\n", __func__);
+		ret = -1;
+		goto end;
+	}
+#else
+	if (sock_info_close(&sock_info) < 0) {
+		fprintf(stderr, "%s: can't close udp socket\n", __func__);
+		ret = -1;
+		goto end;
+	}
+#endif
+ end:
+	socket_shutdown();
+	pkt_mempool_shutdown();
+	return ret;
+}
+#endif
+
+#if defined(CONFIG_IP_FRAG) && defined(CONFIG_UDP)
+#define IP_FRAG_TEST_MTU   128
+#define IP_FRAG_TEST_LEN   400
+#define IP_FRAG_TEST_ROUNDS 64
+
+static int net_ip_frag_get_frags(pkt_t **frags, uint16_t ip_off)
+{
+	pkt_t *pkt;
+	int nb = 0;
+
+	while ((pkt = pkt_get(iface.tx))) {
+		ip_hdr_t *ip_hdr;
+
+		if (nb == CONFIG_IP_FRAG_MAX_FRAGS) {
+			pkt_free(pkt);
+			return -1;
+		}
+		frags[nb++] = pkt;
+		ip_hdr = (ip_hdr_t *)(pkt->buf.data + sizeof(eth_hdr_t));
+		if (ntohs(ip_hdr->len) > IP_FRAG_TEST_MTU
+		    || cksum(ip_hdr, ip_hdr->hl * 4) != 0
+		    || (ntohs(ip_hdr->off) & IP_OFFMASK) * 8 != ip_off)
+			return -1;
+		/* all the fragments carry the datagram identification */
+		if (nb > 1 && ip_hdr->id != ((ip_hdr_t *)(frags[0]->buf.data
+						       + sizeof(eth_hdr_t)))->id)
+			return -1;
+		ip_off += ntohs(ip_hdr->len) - ip_hdr->hl * 4;
+		if ((ip_hdr->off & IP_MF) == 0)
+			break;
+	}
+	if (ip_off != sizeof(udp_hdr_t) + IP_FRAG_TEST_LEN)
+		return -1;
+	return nb;
+}
+
+static void net_ip_frag_free_frags(pkt_t **frags, int nb)
+{
+	int i;
+
+	for (i = 0; i < nb; i++)
+		pkt_free(frags[i]);
+}
+
+/* feed a zeroed fragment of plen bytes at offset off to the interface */
+static int net_ip_frag_input(uint32_t ip_addr, const uint8_t *mac_addr,
+			     uint16_t id, uint16_t off, uint16_t plen,
+			     uint8_t mf)
+{
+	pkt_t *pkt;
+	eth_hdr_t *eh;
+	ip_hdr_t *ip_hdr;
+	uint16_t len = sizeof(ip_hdr_t) + plen;
+
+	if ((pkt = pkt_alloc()) == NULL)
+		return -1;
+	eh = btod(pkt);
+	memcpy(eh->dst, mac_addr, ETHER_ADDR_LEN);
+	memset(eh->src, 0x42, ETHER_ADDR_LEN);
+	eh->type = ETHERTYPE_IP;
+	ip_hdr = (ip_hdr_t *)(eh + 1);
+	memset(ip_hdr, 0, len);
+	ip_hdr->v = 4;
+	ip_hdr->hl = sizeof(ip_hdr_t) / 4;
+	ip_hdr->len = htons(len);
+	ip_hdr->id = htons(id);
+	ip_hdr->off = htons(off / 8);
+	if (mf)
+		ip_hdr->off |= IP_MF;
+	ip_hdr->ttl = 64;
+	ip_hdr->p = IPPROTO_UDP;
+	ip_hdr->src = ip_addr;
+	ip_hdr->dst = ip_addr;
+	ip_hdr->chksum = cksum(ip_hdr, sizeof(ip_hdr_t));
+	pkt->buf.len = sizeof(eth_hdr_t) + len;
+	if (pkt_put(iface.rx, pkt) < 0) {
+		pkt_free(pkt);
+		return -1;
+	}
+	eth_input(&iface);
+	return 0;
+}
+
+int net_ip_frag_tests(void)
+{
+	/* ip: 192.168.0.1 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t ip_addr = 0xc0a80001;
+#else
+	uint32_t ip_addr = 0x0100a8c0;
+#endif
+	uint8_t mac_addr[] = { 0x48, 0x83, 0xc7, 0xbc, 0x7d, 0x06 };
+	uint16_t port = htons(777);
+#ifdef CONFIG_BSD_COMPAT
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	int fd = -1;
+#else
+	sock_info_t sock_info;
+	uint32_t src_addr;
+	uint16_t src_port;
+#endif
+	pkt_t *frags[CONFIG_IP_FRAG_MAX_FRAGS];
+	const ip_frag_stats_t *stats = ip_frag_get_stats();
+	uint8_t buf[IP_FRAG_TEST_LEN];
+	unsigned nb_free;
+	uint16_t timeouts, reassembled;
+	uint32_t i;
+	pkt_t *pkt;
+	sbuf_t sb;
+	int nb, j, len, ret = -1;
+
+	pkt_mempool_init();
+	iface.ip4_addr = (void *)&ip_addr;
+	iface.hw_addr = mac_addr;
+	iface.mtu = IP_FRAG_TEST_MTU;
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+	/* datagrams are sent to ourselves */
+	arp_add_entry(mac_addr, (uint8_t *)&ip_addr, &iface);
+	route_flush();
+	route_add(0, 0, 0, &iface);
+#ifdef CONFIG_HT_STORAGE
+	socket_init();
+#endif
+#ifdef CONFIG_BSD_COMPAT
+	if ((fd = udp_server(ntohs(port))) < 0) {
+		fprintf(stderr, "%s: can't start udp server\n", __func__);
+		goto end;
+	}
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = ip_addr;
+	addr.sin_port = port;
+#else
+	if (sock_info_init(&sock_info, SOCK_DGRAM) < 0
+	    || sock_info_bind(&sock_info, port) < 0) {
+		fprintf(stderr, "%s: can't start udp server\n", __func__);
+		goto end;
+	}
+#endif
+	nb_free = pkt_pool_get_nb_free();
+
+	for (i = 0; i < IP_FRAG_TEST_ROUNDS; i++) {
+		for (j = 0; j < IP_FRAG_TEST_LEN; j++)
+			buf[j] = i + j;
+		sbuf_init(&sb, buf, IP_FRAG_TEST_LEN);
+#ifdef CONFIG_BSD_COMPAT
+		if (sendto(fd, sb.data, sb.len, 0, (struct sockaddr *)&addr,
+			   sizeof(struct sockaddr_in)) < 0) {
+#else
+		if (__socket_put_sbuf(&sock_info, &sb, ip_addr, port) < 0) {
+#endif
+			fprintf(stderr, "%s: can't send datagram\n", __func__);
+			goto end;
+		}
+		if ((nb = net_ip_frag_get_frags(frags, 0)) < 2) {
+			fprintf(stderr, "%s: invalid fragments\n", __func__);
+			goto end;
+		}
+
+		/* deliver the fragments in reverse order */
+		for (j = nb - 1; j >= 0; j--) {
+			if (pkt_put(iface.rx, frags[j]) < 0) {
+				net_ip_frag_free_frags(frags, j + 1);
+				goto end;
+			}
+			eth_input(&iface);
+			/* only the fragments are held while reassembling */
+			if (j && ip_frag_get_nb_pkts() != (unsigned)(nb - j)) {
+				fprintf(stderr, "%s: %u pkts held, expected %d\n",
+					__func__, ip_frag_get_nb_pkts(), nb - j);
+				net_ip_frag_free_frags(frags, j);
+				goto end;
+			}
+		}
+
+#ifdef CONFIG_BSD_COMPAT
+		addrlen = sizeof(struct sockaddr_in);
+		len = recvfrom(fd, buf, sizeof(buf), 0,
+			       (struct sockaddr *)&addr, &addrlen);
+#else
+		if (__socket_get_pkt(&sock_info, &pkt, &src_addr,
+				     &src_port) < 0) {
+			fprintf(stderr, "%s: can't get datagram\n", __func__);
+			goto end;
+		}
+		len = pkt_len(pkt);
+		memcpy(buf, btod(pkt), len);
+		pkt_free(pkt);
+#endif
+		if (len != IP_FRAG_TEST_LEN) {
+			fprintf(stderr, "%s: invalid datagram length %d\n",
+				__func__, len);
+			goto end;
+		}
+		for (j = 0; j < IP_FRAG_TEST_LEN; j++) {
+			if (buf[j] != (uint8_t)(i + j)) {
+				fprintf(stderr, "%s: invalid datagram\n",
+					__func__);
+				goto end;
+			}
+		}
+		if (pkt_pool_get_nb_free() != nb_free) {
+			fprintf(stderr, "%s: leaked packets\n", __func__);
+			goto end;
+		}
+	}
+	if (stats->reassembled < IP_FRAG_TEST_ROUNDS) {
+		fprintf(stderr, "%s: datagrams not reassembled\n", __func__);
+		goto end;
+	}
+	reassembled = stats->reassembled;
+
+	/* a fragment received before the last one may not end past it */
+	if (net_ip_frag_input(ip_addr, mac_addr, 1, 200, 16, 1) < 0
+	    || net_ip_frag_input(ip_addr, mac_addr, 1, 16, 184, 0) < 0)
+		goto end;
+	if (ip_frag_get_nb_pkts() || stats->reassembled != reassembled
+	    || pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: fragment past the end kept\n", __func__);
+		goto end;
+	}
+
+	/* a datagram with a hole is not rebuilt until it is filled */
+	if (net_ip_frag_input(ip_addr, mac_addr, 2, 0, 8, 1) < 0
+	    || net_ip_frag_input(ip_addr, mac_addr, 2, 16, 8, 0) < 0)
+		goto end;
+	if (ip_frag_get_nb_pkts() != 2 || stats->reassembled != reassembled) {
+		fprintf(stderr, "%s: datagram with a hole rebuilt\n",
+			__func__);
+		goto end;
+	}
+	if (net_ip_frag_input(ip_addr, mac_addr, 2, 8, 8, 1) < 0)
+		goto end;
+	if (ip_frag_get_nb_pkts() || stats->reassembled != reassembled + 1
+	    || pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: filled datagram not rebuilt\n", __func__);
+		goto end;
+	}
+
+	/* incomplete datagrams expire */
+	sbuf_init(&sb, buf, IP_FRAG_TEST_LEN);
+#ifdef CONFIG_BSD_COMPAT
+	if (sendto(fd, sb.data, sb.len, 0, (struct sockaddr *)&addr,
+		   sizeof(struct sockaddr_in)) < 0) {
+#else
+	if (__socket_put_sbuf(&sock_info, &sb, ip_addr, port) < 0) {
+#endif
+		fprintf(stderr, "%s: can't send datagram\n", __func__);
+		goto end;
+	}
+	if ((nb = net_ip_frag_get_frags(frags, 0)) < 2) {
+		fprintf(stderr, "%s: invalid fragments\n", __func__);
+		goto end;
+	}
+	net_ip_frag_free_frags(frags + 1, nb - 1);
+	/* duplicates are dropped */
+	if ((pkt = pkt_alloc()) == NULL) {
+		pkt_free(frags[0]);
+		goto end;
+	}
+	memcpy(btod(pkt), btod(frags[0]), pkt_len(frags[0]));
+	pkt->buf.len = pkt_len(frags[0]);
+	pkt_put(iface.rx, frags[0]);
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (ip_frag_get_nb_pkts() != 1) {
+		fprintf(stderr, "%s: duplicate fragment queued\n", __func__);
+		goto end;
+	}
+	timeouts = stats->timeouts;
+	for (i = 0; i <= CONFIG_IP_FRAG_TIMEOUT * 1000000UL
+		     / CONFIG_TIMER_RESOLUTION_US + 1; i++)
+		timer_process();
+	if (ip_frag_get_nb_pkts() || stats->timeouts != timeouts + 1
+	    || pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: reassembly did not expire\n", __func__);
+		goto end;
+	}
+	ret = 0;
+
+ end:
+	ip_frag_flush();
+#ifdef CONFIG_BSD_COMPAT
+	close(fd);
+#else
+	sock_info_close(&sock_info);
+#endif
+	iface.mtu = 0;
+	socket_shutdown();
+	pkt_mempool_shutdown();
+	return ret;
+}
+#endif
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+static uint8_t fwd_ip[] = { 10, 0, 0, 1 };
+static uint8_t fwd_ip_mask[] = { 255, 255, 255, 0 };
+static uint8_t fwd_mac[] = { 0x54, 0x52, 0x00, 0x02, 0x00, 0x41 };
+
+static iface_t fwd_iface = {
+	.flags = IF_UP|IF_RUNNING,
+	.hw_addr = fwd_mac,
+	.ip4_addr = fwd_ip,
+	.ip4_mask = fwd_ip_mask,
+	.send = &send,
+	.recv = &recv,
+};
+
+static struct iface_queues fwd_iface_queues = {
+	.pkt_pool = RING_INIT(fwd_iface_queues.pkt_pool),
+	.rx = RING_INIT(fwd_iface_queues.rx),
+	.tx = RING_INIT(fwd_iface_queues.tx),
+};
+
+static pkt_t *net_udp_pkt(uint32_t ip_src, uint32_t ip_dst, uint8_t ttl)
+{
+	pkt_t *pkt;
+	eth_hdr_t *eh;
+	ip_hdr_t *ip_hdr;
+	udp_hdr_t *udp_hdr;
+	uint16_t len = sizeof(ip_hdr_t) + sizeof(udp_hdr_t) + 4;
+
+	if ((pkt = pkt_alloc()) == NULL)
+		return NULL;
+	eh = btod(pkt);
+	memcpy(eh->dst, mac, ETHER_ADDR_LEN);
+	memset(eh->src, 0x42, ETHER_ADDR_LEN);
+	eh->type = ETHERTYPE_IP;
+	ip_hdr = (ip_hdr_t *)(eh + 1);
+	memset(ip_hdr, 0, sizeof(ip_hdr_t));
+	ip_hdr->v = 4;
+	ip_hdr->hl = sizeof(ip_hdr_t) / 4;
+	ip_hdr->len = htons(len);
+	ip_hdr->ttl = ttl;
+	ip_hdr->p = IPPROTO_UDP;
+	ip_hdr->src = ip_src;
+	ip_hdr->dst = ip_dst;
+	ip_hdr->chksum = cksum(ip_hdr, sizeof(ip_hdr_t));
+	udp_hdr = (udp_hdr_t *)(ip_hdr + 1);
+	udp_hdr->src_port = htons(1234);
+	udp_hdr->dst_port = htons(777);
+	udp_hdr->length = htons(sizeof(udp_hdr_t) + 4);
+	udp_hdr->checksum = 0;
+	memcpy(udp_hdr + 1, "fwd!", 4);
+	pkt->buf.len = sizeof(eth_hdr_t) + len;
+	return pkt;
+}
+
+#ifdef CONFIG_UDP
+int net_multi_iface_tests(void)
+{
+	/* ip_src: 192.168.2.163 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t ip_src = 0xC0A802A3;
+#else
+	uint32_t ip_src = 0xA302A8C0;
+#endif
+	uint32_t ip_peer = htonl(0x0A000002UL);
+	uint32_t *ip_local = (void *)ip;
+	uint32_t *ip_fwd = (void *)fwd_ip;
+	uint8_t mac_src[] = { 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x65 };
+	uint8_t mac_peer[] = { 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x66 };
+	const uint8_t *mac_dst;
+	sock_info_t sock_info;
+	uint32_t src_addr;
+	uint16_t src_port;
+#ifdef CONFIG_IFACE_STATS
+	uint16_t rx_packets = iface.rx_packets;
+	uint16_t tx_packets = fwd_iface.tx_packets;
+#endif
+	unsigned nb_free;
+	ip_hdr_t *ip_hdr;
+	pkt_t *pkt;
+	sbuf_t sb;
+	int ret = -1;
+
+	pkt_mempool_init();
+	iface.ip4_addr = ip;
+	iface.hw_addr = mac;
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+	if_init(&fwd_iface, IF_TYPE_ETHERNET, &fwd_iface_queues.pkt_pool,
+		&fwd_iface_queues.rx, &fwd_iface_queues.tx, 0);
+	route_flush();
+	route_add(htonl(0xC0A80200UL), 24, 0, &iface);
+	route_add(htonl(0x0A000000UL), 24, 0, &fwd_iface);
+	nb_free = pkt_pool_get_nb_free();
+
+	if (if_get_by_addr(*ip_local) != &iface
+	    || if_get_by_addr(*ip_fwd) != &fwd_iface
+	    || if_get_by_addr(ip_peer) != NULL) {
+		fprintf(stderr, "%s: invalid interface registry\n", __func__);
+		goto end;
+	}
+
+	/* neighbors are learnt per interface */
+	arp_add_entry(mac_src, (uint8_t *)&ip_src, &iface);
+	arp_add_entry(mac_peer, (uint8_t *)&ip_peer, &fwd_iface);
+	if (arp_find_entry(&ip_peer, &mac_dst, &iface) == 0
+	    || arp_find_entry(&ip_peer, &mac_dst, &fwd_iface) < 0
+	    || memcmp(mac_dst, mac_peer, ETHER_ADDR_LEN)) {
+		fprintf(stderr, "%s: invalid arp entries\n", __func__);
+		goto end;
+	}
+
+	if (sock_info_init(&sock_info, SOCK_DGRAM) < 0)
+		goto end;
+	if (sock_info_bind_addr(&sock_info, ip_peer, htons(777)) == 0) {
+		fprintf(stderr, "%s: bound to a remote address\n", __func__);
+		goto end;
+	}
+	if (sock_info_bind_addr(&sock_info, *ip_fwd, htons(777)) < 0) {
+		fprintf(stderr, "%s: can't bind socket\n", __func__);
+		goto end;
+	}
+
+	/* the address of the second interface is local */
+	if ((pkt = net_udp_pkt(ip_src, *ip_fwd, 64)) == NULL)
+		goto end_sock;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (pkt_get(fwd_iface.tx) != NULL
+	    || __socket_get_pkt(&sock_info, &pkt, &src_addr, &src_port) < 0) {
+		fprintf(stderr, "%s: datagram not delivered\n", __func__);
+		goto end_sock;
+	}
+	pkt_free(pkt);
+
+	/* the socket does not accept datagrams sent to other addresses */
+	if ((pkt = net_udp_pkt(ip_src, *ip_local, 64)) == NULL)
+		goto end_sock;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	while ((pkt = pkt_get(iface.tx)))
+		pkt_free(pkt);
+	if (__socket_get_pkt(&sock_info, &pkt, &src_addr, &src_port) == 0) {
+		fprintf(stderr, "%s: datagram delivered\n", __func__);
+		pkt_free(pkt);
+		goto end_sock;
+	}
+
+	/* replies carry the bound address */
+	sbuf_init(&sb, "multi", 5);
+	if (__socket_put_sbuf(&sock_info, &sb, ip_peer, htons(1234)) < 0
+	    || pkt_get(iface.tx) != NULL
+	    || (pkt = pkt_get(fwd_iface.tx)) == NULL) {
+		fprintf(stderr, "%s: can't get udp packet\n", __func__);
+		goto end_sock;
+	}
+	ip_hdr = (ip_hdr_t *)(pkt->buf.data + sizeof(eth_hdr_t));
+	if (ip_hdr->src != *ip_fwd || ip_hdr->dst != ip_peer) {
+		fprintf(stderr, "%s: invalid udp packet\n", __func__);
+		pkt_free(pkt);
+		goto end_sock;
+	}
+	pkt_free(pkt);
+
+	/* and are routed according to their destination */
+	if (__socket_put_sbuf(&sock_info, &sb, ip_src, htons(1234)) < 0
+	    || pkt_get(fwd_iface.tx) != NULL
+	    || (pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: can't get udp packet 2\n", __func__);
+		goto end_sock;
+	}
+	ip_hdr = (ip_hdr_t *)(pkt->buf.data + sizeof(eth_hdr_t));
+	if (ip_hdr->src != *ip_fwd || ip_hdr->dst != ip_src) {
+		fprintf(stderr, "%s: invalid udp packet 2\n", __func__);
+		pkt_free(pkt);
+		goto end_sock;
+	}
+	pkt_free(pkt);
+#ifdef CONFIG_IFACE_STATS
+	if (iface.rx_packets != rx_packets + 2
+	    || fwd_iface.tx_packets != tx_packets + 1) {
+		fprintf(stderr, "%s: invalid interface stats\n", __func__);
+		goto end_sock;
+	}
+#endif
+
+	if_remove(&fwd_iface);
+	if (if_get_by_addr(*ip_fwd) != NULL) {
+		fprintf(stderr, "%s: interface not removed\n", __func__);
+		goto end_sock;
+	}
+	if (pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: leaked packets\n", __func__);
+		goto end_sock;
+	}
+	ret = 0;
+
+ end_sock:
+	sock_info_close(&sock_info);
+ end:
+	route_flush();
+	pkt_mempool_shutdown();
+	return ret;
+}
+#endif
+#endif
+
+#if defined(CONFIG_IP_FORWARD) && defined(CONFIG_ICMP)
+#define IP_FORWARD_TEST_ROUNDS 256
+
+static int net_ip_forward_icmp_error(uint32_t ip_dst, uint8_t type,
+				     uint8_t code)
+{
+	pkt_t *pkt;
+	ip_hdr_t *ip_hdr;
+	icmp_hdr_t *icmp_hdr;
+	int ret = -1;
+
+	if ((pkt = pkt_get(fwd_iface.tx)) != NULL) {
+		fprintf(stderr, "%s: packet forwarded\n", __func__);
+		pkt_free(pkt);
+		return -1;
+	}
+	if ((pkt = pkt_get(iface.tx)) == NULL) {
+		fprintf(stderr, "%s: no icmp error\n", __func__);
+		return -1;
+	}
+	ip_hdr = (ip_hdr_t *)(pkt->buf.data + sizeof(eth_hdr_t));
+	icmp_hdr = (icmp_hdr_t *)(ip_hdr + 1);
+	if (ip_hdr->p == IPPROTO_ICMP && ip_hdr->dst == ip_dst
+	    && icmp_hdr->type == type && icmp_hdr->code == code)
+		ret = 0;
+	else
+		fprintf(stderr, "%s: invalid icmp error\n", __func__);
+	pkt_free(pkt);
+	return ret;
+}
+
+int net_ip_forward_tests(void)
+{
+	/* ip_src: 192.168.2.163 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint32_t ip_src = 0xC0A802A3;
+#else
+	uint32_t ip_src = 0xA302A8C0;
+#endif
+	uint32_t ip_dst = htonl(0x0A000002UL);
+	uint32_t ip_unknown = htonl(0xAC100001UL);
+	uint32_t ip_bcast = htonl(0x0A0000FFUL);
+	uint32_t ip_remote = htonl(0xAC1101FFUL);
+	uint8_t mac_src[] = { 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x65 };
+	uint8_t mac_dst[] = { 0x48, 0x4d, 0x7e, 0xe4, 0xda, 0x66 };
+	unsigned nb_free;
+	ip_hdr_t *ip_short;
+	pkt_t *pkt, *out;
+	int i, errors, ret = -1;
+
+	pkt_mempool_init();
+	iface.ip4_addr = ip;
+	iface.hw_addr = mac;
+	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
+		&iface_queues.rx, &iface_queues.tx, 0);
+	if_init(&fwd_iface, IF_TYPE_ETHERNET, &fwd_iface_queues.pkt_pool,
+		&fwd_iface_queues.rx, &fwd_iface_queues.tx, 0);
+	route_flush();
+	route_add(htonl(0xC0A80200UL), 24, 0, &iface);
+	route_add(htonl(0x0A000000UL), 24, 0, &fwd_iface);
+	arp_add_entry(mac_src, (uint8_t *)&ip_src, &iface);
+	arp_add_entry(mac_dst, (uint8_t *)&ip_dst, &fwd_iface);
+	nb_free = pkt_pool_get_nb_free();
+
+	for (i = 0; i < IP_FORWARD_TEST_ROUNDS; i++) {
+		ip_hdr_t *ip_hdr;
+		eth_hdr_t *eh;
+
+		if ((pkt = net_udp_pkt(ip_src, ip_dst, 64)) == NULL)
+			goto end;
+		pkt_put(iface.rx, pkt);
+		eth_input(&iface);
+
+		/* the received packet is sent as is */
+		if ((out = pkt_get(fwd_iface.tx)) != pkt) {
+			fprintf(stderr, "%s: packet not forwarded\n", __func__);
+			if (out)
+				pkt_free(out);
+			goto end;
+		}
+		eh = btod(out);
+		ip_hdr = (ip_hdr_t *)(eh + 1);
+		if (ip_hdr->ttl != 63 || cksum(ip_hdr, sizeof(ip_hdr_t)) != 0
+		    || memcmp(eh->dst, mac_dst, ETHER_ADDR_LEN)
+		    || memcmp(eh->src, fwd_mac, ETHER_ADDR_LEN)) {
+			fprintf(stderr, "%s: invalid forwarded packet\n",
+				__func__);
+			pkt_free(out);
+			goto end;
+		}
+		pkt_free(out);
+	}
+	if (pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: leaked packets\n", __func__);
+		goto end;
+	}
+
+	/* the broadcast address of the output subnet is not forwarded */
+	if ((pkt = net_udp_pkt(ip_src, ip_bcast, 64)) == NULL)
+		goto end;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (pkt_get(fwd_iface.tx) || pkt_get(iface.tx)) {
+		fprintf(stderr, "%s: broadcast forwarded\n", __func__);
+		goto end;
+	}
+
+	/* a total length shorter than the header is invalid */
+	if ((pkt = net_udp_pkt(ip_src, ip_dst, 64)) == NULL)
+		goto end;
+	ip_short = (ip_hdr_t *)((eth_hdr_t *)btod(pkt) + 1);
+	ip_short->len = htons(sizeof(ip_hdr_t) - 4);
+	ip_short->chksum = 0;
+	ip_short->chksum = cksum(ip_short, sizeof(ip_hdr_t));
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (pkt_get(fwd_iface.tx) || pkt_get(iface.tx)
+	    || pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: truncated datagram forwarded\n", __func__);
+		goto end;
+	}
+
+	/* a remote address looking like a broadcast on the input subnet
+	 * is */
+	route_add(htonl(0xAC110000UL), 16, ip_dst, &fwd_iface);
+	if ((pkt = net_udp_pkt(ip_src, ip_remote, 64)) == NULL)
+		goto end;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if ((out = pkt_get(fwd_iface.tx)) != pkt) {
+		fprintf(stderr, "%s: remote packet not forwarded\n", __func__);
+		if (out)
+			pkt_free(out);
+		goto end;
+	}
+	pkt_free(out);
+
+	if ((pkt = net_udp_pkt(ip_src, ip_dst, 1)) == NULL)
+		goto end;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (net_ip_forward_icmp_error(ip_src, ICMP_TIMXCEED,
+				      ICMP_TIMXCEED_INTRANS) < 0)
+		goto end;
+
+	if ((pkt = net_udp_pkt(ip_src, ip_unknown, 64)) == NULL)
+		goto end;
+	pkt_put(iface.rx, pkt);
+	eth_input(&iface);
+	if (net_ip_forward_icmp_error(ip_src, ICMP_UNREACHABLE,
+				      ICMP_UNREACH_NET) < 0)
+		goto end;
+
+	/* errors are rate limited */
+	errors = 0;
+	for (i = 0; i < CONFIG_ICMP_ERROR_RATE * 2; i++) {
+		if ((pkt = net_udp_pkt(ip_src, ip_dst, 1)) == NULL)
+			goto end;
+		pkt_put(iface.rx, pkt);
+		eth_input(&iface);
+		while ((out = pkt_get(iface.tx))) {
+			errors++;
+			pkt_free(out);
+		}
+	}
+	if (errors == 0 || errors > CONFIG_ICMP_ERROR_RATE) {
+		fprintf(stderr, "%s: %d icmp errors sent\n", __func__, errors);
+		goto end;
+	}
+	if (pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: leaked packets\n", __func__);
+		goto end;
+	}
+	ret = 0;
+
+ end:
+	route_flush();
+	pkt_mempool_shutdown();
+	return ret;
+}
+#endif
+
+#if defined(CONFIG_LOOPBACK) && defined(CONFIG_UDP) \
+	&& defined(CONFIG_MORE_THAN_ONE_INTERFACE)
+static uint8_t lo_ip[] = { 127, 0, 0, 1 };
+static uint8_t lo_ip_mask[] = { 255, 0, 0, 0 };
+
+static iface_t lo_iface = {
+	.flags = IF_UP|IF_RUNNING,
+	.ip4_addr = lo_ip,
+	.ip4_mask = lo_ip_mask,
+};
+
+static struct iface_queues lo_iface_queues = {
+	.pkt_pool = RING_INIT(lo_iface_queues.pkt_pool),
+	.rx = RING_INIT(lo_iface_queues.rx),
+	.tx = RING_INIT(lo_iface_queues.tx),
+};
+
+static void net_lo_flush_scheduler(void)
+{
+	int i;
+
+	for (i = 0; i < 10 && !ring_is_empty(lo_iface.rx); i++)
+		scheduler_run_task();
+}
+
+#ifdef CONFIG_EVENT
+static void net_lo_run_tasks(void)
+{
+	int i;
+
+	for (i = 0; i < 16 && scheduler_get_nb_tasks(); i++)
+		scheduler_run_task();
+}
+#endif
+
+static int net_lo_recv(sock_info_t *sock_info, const char *data,
+		       uint16_t port)
+{
+	uint32_t src_addr;
+	uint16_t src_port;
+	pkt_t *pkt;
+	int ret = -1;
+
+	if (__socket_get_pkt(sock_info, &pkt, &src_addr, &src_port) < 0)
+		return -1;
+	if (src_addr == *(uint32_t *)lo_ip && src_port == port
+	    && pkt_len(pkt) == strlen(data)
+	    && memcmp(btod(pkt), data, pkt_len(pkt)) == 0)
+		ret = 0;
+	pkt_free(pkt);
+	return ret;
+}
+
+/* the packet itself is received by the peer */
+static int net_lo_put_pkt(sock_info_t *sock_info, sock_info_t *sock_peer,
+			  pkt_t *pkt, uint32_t addr, uint16_t port,
+			  const char *data)
+{
+	pkt_t *echo;
+	int ret = -1;
+
+	if (socket_put_pkt(sock_info, pkt, addr, port) < 0) {
+		pkt_free(pkt);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (__socket_get_pkt(sock_peer, &echo, &addr, &port) < 0)
+		return -1;
+	if (echo == pkt && pkt_len(echo) == strlen(data)
+	    && memcmp(btod(echo), data, pkt_len(echo)) == 0)
+		ret = 0;
+	pkt_free(echo);
+	return ret;
+}
+
+#ifdef CONFIG_EVENT_POLL
+#define NET_LO_POLL_SOCKS 4
+
+static event_ready_t net_lo_ready[NET_LO_POLL_SOCKS];
+static unsigned net_lo_nb_ready;
+
+static void net_lo_poll_read(event_t *ev)
+{
+	pkt_t *pkt;
+
+	if (__socket_get_pkt(socket_event_get_sock_info(ev), &pkt, NULL,
+			     NULL) >= 0)
+		pkt_free(pkt);
+}
+
+static void net_lo_poll_ev_cb(event_t *ev, uint8_t events)
+{
+	net_lo_nb_ready++;
+	net_lo_poll_read(ev);
+}
+
+static void net_lo_poll_cb(event_poll_t *poll)
+{
+	int i, n = event_poll_wait(poll, net_lo_ready, NET_LO_POLL_SOCKS);
+
+	for (i = 0; i < n; i++)
+		net_lo_poll_read(net_lo_ready[i].ev);
+	net_lo_nb_ready += n;
+}
+
+/* send a datagram to nb sockets and loop them back at once, return the
+ * number of tasks scheduled to deliver them */
+static int net_lo_poll_burst(sock_info_t *sock_client, sock_info_t *socks,
+			     int nb)
+{
+	sbuf_t sb = SBUF_INITS("poll");
+	unsigned nb_tasks;
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		if (__socket_put_sbuf(sock_client, &sb, *(uint32_t *)lo_ip,
+				      socks[i].port) < 0)
+			return -1;
+	}
+	nb_tasks = scheduler_get_nb_tasks();
+	lo_input(&lo_iface);
+	return scheduler_get_nb_tasks() - nb_tasks;
+}
+
+static int net_lo_event_poll_checks(sock_info_t *sock_client)
+{
+	sock_info_t socks[NET_LO_POLL_SOCKS];
+	event_poll_t poll;
+	int i, nb_tasks, ret = -1;
+
+	for (i = 0; i < NET_LO_POLL_SOCKS; i++) {
+		if (sock_info_init(&socks[i], SOCK_DGRAM) < 0)
+			goto end;
+		if (sock_info_bind(&socks[i], htons(2000 + i)) < 0) {
+			sock_info_close(&socks[i]);
+			goto end;
+		}
+	}
+
+	/* a task per socket */
+	net_lo_run_tasks();
+	for (i = 0; i < NET_LO_POLL_SOCKS; i++)
+		socket_event_register(&socks[i], EV_READ, net_lo_poll_ev_cb);
+	net_lo_nb_ready = 0;
+	nb_tasks = net_lo_poll_burst(sock_client, socks, NET_LO_POLL_SOCKS);
+	net_lo_run_tasks();
+	if (nb_tasks != NET_LO_POLL_SOCKS
+	    || net_lo_nb_ready != NET_LO_POLL_SOCKS) {
+		fprintf(stderr, "%s: %d tasks for %u events\n", __func__,
+			nb_tasks, net_lo_nb_ready);
+		goto end;
+	}
+
+	/* a task per burst */
+	event_poll_init(&poll, net_lo_poll_cb);
+	for (i = 0; i < NET_LO_POLL_SOCKS; i++)
+		socket_event_poll_add(&socks[i], &poll, EV_READ, 0);
+	net_lo_nb_ready = 0;
+	nb_tasks = net_lo_poll_burst(sock_client, socks, NET_LO_POLL_SOCKS);
+	net_lo_run_tasks();
+	if (nb_tasks != 1 || net_lo_nb_ready != NET_LO_POLL_SOCKS
+	    || !list_empty(&poll.ready)) {
+		fprintf(stderr, "%s: %d tasks for %u ready sockets\n",
+			__func__, nb_tasks, net_lo_nb_ready);
+		goto end;
+	}
+
+	/* level triggered events are reported until they are handled, edge
+	 * triggered ones once */
+	event_poll_init(&poll, NULL);
+	socket_event_poll_add(&socks[0], &poll, EV_READ, 0);
+	socket_event_poll_add(&socks[1], &poll, EV_READ, EV_POLL_EDGE);
+	if (net_lo_poll_burst(sock_client, socks, 2) != 0
+	    || event_poll_wait(&poll, net_lo_ready, NET_LO_POLL_SOCKS) != 2
+	    || event_poll_wait(&poll, net_lo_ready, NET_LO_POLL_SOCKS) != 1
+	    || net_lo_ready[0].ev != &socks[0].event
+	    || net_lo_ready[0].events != EV_READ) {
+		fprintf(stderr, "%s: invalid ready events\n", __func__);
+		goto end;
+	}
+	net_lo_poll_read(&socks[0].event);
+	net_lo_poll_read(&socks[1].event);
+	if (event_poll_wait(&poll, net_lo_ready, NET_LO_POLL_SOCKS) != 0
+	    || !list_empty(&poll.ready)) {
+		fprintf(stderr, "%s: handled events reported\n", __func__);
+		goto end;
+	}
+	ret = 0;
+
+ end:
+	while (i--) {
+		socket_event_unregister(&socks[i]);
+		sock_info_close(&socks[i]);
+	}
+	return ret;
+}
+#endif
+
+#ifdef CONFIG_EVENT
+#define NET_LO_WRITERS (CONFIG_EVENT_RESUME_BUDGET + 2)
+
+static sock_info_t net_lo_writers[NET_LO_WRITERS];
+static uint8_t net_lo_writes[NET_LO_WRITERS];
+static LIST_HEAD(net_lo_held);
+
+/* writers keep the packets they get */
+static void net_lo_writer_cb(event_t *ev, uint8_t events)
+{
+	sock_info_t *sock_info = socket_event_get_sock_info(ev);
+	pkt_t *pkt;
+
+	if ((events & EV_WRITE) == 0 || (pkt = pkt_alloc()) == NULL)
+		return;
+	list_add_tail(&pkt->list, &net_lo_held);
+	net_lo_writes[sock_info - net_lo_writers]++;
+}
+
+static void net_lo_free_held(int nb)
+{
+	while (nb-- && !list_empty(&net_lo_held)) {
+		pkt_t *pkt = LIST_FIRST_ENTRY(&net_lo_held, pkt_t, list);
+
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+}
+
+static int net_lo_write_resume_checks(void)
+{
+	unsigned nb_tasks;
+	pkt_t *pkt;
+	int i, ret = -1;
+
+	for (i = 0; i < NET_LO_WRITERS; i++) {
+		if (sock_info_init(&net_lo_writers[i], SOCK_DGRAM) < 0)
+			goto end;
+		if (sock_info_bind(&net_lo_writers[i], htons(3000 + i)) < 0) {
+			sock_info_close(&net_lo_writers[i]);
+			goto end;
+		}
+		socket_event_register(&net_lo_writers[i], EV_WRITE,
+				      net_lo_writer_cb);
+	}
+
+	/* the writers wait for packets */
+	while ((pkt = pkt_alloc()) != NULL)
+		list_add_tail(&pkt->list, &net_lo_held);
+	for (i = 0; i < NET_LO_WRITERS; i++)
+		event_schedule_event(&net_lo_writers[i].event, EV_WRITE);
+	net_lo_run_tasks();
+	memset(net_lo_writes, 0, sizeof(net_lo_writes));
+
+	/* they are resumed from a single task, not from pkt_free() */
+	nb_tasks = scheduler_get_nb_tasks();
+	net_lo_free_held(NET_LO_WRITERS * CONFIG_EVENT_RESUME_QUOTA);
+	if (scheduler_get_nb_tasks() != nb_tasks + 1 || net_lo_writes[0]) {
+		fprintf(stderr, "%s: writers resumed from pkt_free()\n",
+			__func__);
+		goto end;
+	}
+
+	/* and get their quota in turn */
+	net_lo_run_tasks();
+	for (i = 0; i < NET_LO_WRITERS; i++) {
+		if (net_lo_writes[i] != CONFIG_EVENT_RESUME_QUOTA) {
+			fprintf(stderr, "%s: writer %d got %u packets\n",
+				__func__, i, net_lo_writes[i]);
+			i = NET_LO_WRITERS;
+			goto end;
+		}
+	}
+	ret = 0;
+
+ end:
+	while (i--) {
+		socket_event_unregister(&net_lo_writers[i]);
+		sock_info_close(&net_lo_writers[i]);
+	}
+	net_lo_free_held(-1);
+	return ret;
+}
+#endif
+
+int net_lo_tests(void)
+{
+	uint32_t *ip_lo = (void *)lo_ip;
+	sock_info_t sock_server, sock_client;
+#ifdef CONFIG_IFACE_STATS
+	uint16_t rx_packets = lo_iface.rx_packets;
+	uint16_t tx_packets = lo_iface.tx_packets;
+#endif
+	uint8_t data[sizeof(ip_hdr_t) + sizeof(udp_hdr_t) + 4];
+	uint32_t src_addr;
+	uint16_t src_port;
+	unsigned nb_free;
+	pkt_t *pkt;
+	sbuf_t sb;
+	int ret = -1;
+
+	pkt_mempool_init();
+	if_init(&lo_iface, IF_TYPE_LOOPBACK, &lo_iface_queues.pkt_pool,
+		&lo_iface_queues.rx, &lo_iface_queues.tx, 0);
+	route_flush();
+	route_add(htonl(0x7F000000UL), 8, 0, &lo_iface);
+	nb_free = pkt_pool_get_nb_free();
+
+	if (sock_info_init(&sock_server, SOCK_DGRAM) < 0)
+		goto end;
+	if (sock_info_init(&sock_client, SOCK_DGRAM) < 0)
+		goto end_server;
+	if (sock_info_bind(&sock_server, htons(777)) < 0
+	    || sock_info_bind(&sock_client, htons(1234)) < 0) {
+		fprintf(stderr, "%s: can't bind sockets\n", __func__);
+		goto end_sock;
+	}
+
+	/* looped back datagrams are delivered from the scheduler */
+	sbuf_init(&sb, "ping", 4);
+	if (__socket_put_sbuf(&sock_client, &sb, *ip_lo, htons(777)) < 0
+	    || ring_len(lo_iface.rx) != 1
+	    || net_lo_recv(&sock_server, "ping", htons(1234)) == 0) {
+		fprintf(stderr, "%s: datagram not queued\n", __func__);
+		goto end_sock;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_recv(&sock_server, "ping", htons(1234)) < 0) {
+		fprintf(stderr, "%s: datagram not delivered\n", __func__);
+		goto end_sock;
+	}
+	sbuf_init(&sb, "pong", 4);
+	if (__socket_put_sbuf(&sock_server, &sb, *ip_lo, htons(1234)) < 0) {
+		fprintf(stderr, "%s: can't send reply\n", __func__);
+		goto end_sock;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_recv(&sock_client, "pong", htons(777)) < 0) {
+		fprintf(stderr, "%s: reply not delivered\n", __func__);
+		goto end_sock;
+	}
+
+	/* received datagrams are sent back in place, the others get room for
+	 * the headers */
+	if (__socket_put_sbuf(&sock_client, &sb, *ip_lo, htons(777)) < 0)
+		goto end_sock;
+	net_lo_flush_scheduler();
+	if (__socket_get_pkt(&sock_server, &pkt, &src_addr, &src_port) < 0)
+		goto end_sock;
+	if (net_lo_put_pkt(&sock_server, &sock_client, pkt, src_addr,
+			   src_port, "pong") < 0) {
+		fprintf(stderr, "%s: datagram not sent in place\n", __func__);
+		goto end_sock;
+	}
+	if ((pkt = pkt_alloc()) == NULL)
+		goto end_sock;
+	memcpy(btod(pkt), "app", 3);
+	pkt->buf.len = 3;
+	if (net_lo_put_pkt(&sock_server, &sock_client, pkt, src_addr,
+			   src_port, "app") < 0) {
+		fprintf(stderr, "%s: packet not sent in place\n", __func__);
+		goto end_sock;
+	}
+
+	/* retained packets are copied before going up the stack */
+	if ((pkt = net_udp_pkt(*ip_lo, *ip_lo, 64)) == NULL)
+		goto end_sock;
+	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
+	memcpy(data, btod(pkt), sizeof(data));
+	pkt_retain(pkt);
+	if (lo_iface.if_output(pkt, &lo_iface, L3_PROTO_IP, ip_lo) < 0) {
+		fprintf(stderr, "%s: can't send retained packet\n", __func__);
+		pkt_free(pkt);
+		goto end_sock;
+	}
+	net_lo_flush_scheduler();
+	if (pkt_len(pkt) != sizeof(data)
+	    || memcmp(btod(pkt), data, sizeof(data))) {
+		fprintf(stderr, "%s: retained packet modified\n", __func__);
+		pkt_free(pkt);
+		goto end_sock;
+	}
+	pkt_free(pkt);
+	if (net_lo_recv(&sock_server, "fwd!", htons(1234)) < 0) {
+		fprintf(stderr, "%s: copy not delivered\n", __func__);
+		goto end_sock;
+	}
+
+#ifdef CONFIG_IFACE_STATS
+	if (lo_iface.rx_packets != rx_packets + 6
+	    || lo_iface.tx_packets != tx_packets + 6) {
+		fprintf(stderr, "%s: invalid interface stats\n", __func__);
+		goto end_sock;
+	}
+#endif
+#ifdef CONFIG_EVENT_POLL
+	if (net_lo_event_poll_checks(&sock_client) < 0)
+		goto end_sock;
+#endif
+#ifdef CONFIG_EVENT
+	if (net_lo_write_resume_checks() < 0)
+		goto end_sock;
+#endif
+	if (pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: leaked packets\n", __func__);
+		goto end_sock;
+	}
+	ret = 0;
+
+ end_sock:
+	sock_info_close(&sock_client);
+ end_server:
+	sock_info_close(&sock_server);
+ end:
+	if_remove(&lo_iface);
+	route_flush();
+	pkt_mempool_shutdown();
+	return ret;
+}
+
+/* the connections are accepted with sock_info_accept() */
+#if defined(CONFIG_TCP) && defined(CONFIG_TCP_CLIENT) \
+	&& !defined(CONFIG_BSD_COMPAT)
+static int net_lo_tcp_send(sock_info_t *sock_info, const char *data)
+{
+	sbuf_t sb = SBUF_INIT(data, strlen(data));
+
+	return __socket_put_sbuf(sock_info, &sb, 0, 0);
+}
+
+static int net_lo_tcp_recv(sock_info_t *sock_info, const char *data)
+{
+	uint16_t len = strlen(data);
+	pkt_t *pkt;
+
+	while (len) {
+		uint16_t plen;
+
+		if (__socket_get_pkt(sock_info, &pkt, NULL, NULL) < 0)
+			return -1;
+		plen = pkt_len(pkt);
+		if (plen > len || memcmp(btod(pkt), data, plen)) {
+			pkt_free(pkt);
+			return -1;
+		}
+		data += plen;
+		len -= plen;
+		pkt_free(pkt);
+	}
+	return 0;
+}
+
+#define NET_LO_TCP_TICKS(ms) ((ms) * 1000UL / CONFIG_TIMER_RESOLUTION_US)
+
+static void net_lo_tcp_wait(uint32_t ticks)
+{
+	while (ticks--)
+		timer_process();
+}
+
+static void net_lo_tcp_flush_acks(void)
+{
+#ifdef CONFIG_TCP_DELAYED_ACK
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(CONFIG_TCP_DELAYED_ACK_TIMEOUT));
+	net_lo_flush_scheduler();
+#endif
+}
+
+/* send a small segment even if one is in flight */
+static int net_lo_tcp_send_now(sock_info_t *sock_info, const char *data)
+{
+#ifdef CONFIG_TCP_NAGLE
+	tcp_conn_t *tcp_conn = sock_info->trq.tcp_conn;
+
+	tcp_conn->snd_sml = tcp_conn->snd_una;
+#endif
+	return net_lo_tcp_send(sock_info, data);
+}
+
+static int net_lo_tcp_window_checks(sock_info_t *sock_client,
+				    sock_info_t *sock_conn)
+{
+	pkt_t *pkt;
+#ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
+	pkt_t *pkt_tmp;
+	LIST_HEAD(pkts);
+	int ret;
+#endif
+
+	/* several segments are in flight until the window is full */
+	sock_client->trq.tcp_conn->snd_wnd = 4;
+	if (net_lo_tcp_send(sock_client, "aa") < 0
+	    || net_lo_tcp_send(sock_client, "bb") < 0) {
+		fprintf(stderr, "%s: window not used\n", __func__);
+		return -1;
+	}
+	if (net_lo_tcp_send(sock_client, "cc") >= 0) {
+		fprintf(stderr, "%s: window not honored\n", __func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+#ifdef CONFIG_TCP_NAGLE
+	/* "bb" waits for the acknowledgment of "aa" */
+	net_lo_tcp_flush_acks();
+#endif
+	if (net_lo_tcp_recv(sock_conn, "aabb") < 0) {
+		fprintf(stderr, "%s: data not delivered\n", __func__);
+		return -1;
+	}
+	if (tcp_can_send(sock_client->trq.tcp_conn, 2) == 0) {
+		fprintf(stderr, "%s: window not opened\n", __func__);
+		return -1;
+	}
+
+	/* the first segment is received last */
+	if (net_lo_tcp_send_now(sock_client, "cc") < 0
+	    || net_lo_tcp_send_now(sock_client, "dd") < 0
+	    || net_lo_tcp_send_now(sock_client, "ee") < 0
+	    || ring_len(lo_iface.rx) != 3) {
+		fprintf(stderr, "%s: segments not sent\n", __func__);
+		return -1;
+	}
+	pkt = pkt_get(lo_iface.rx);
+	pkt_put(lo_iface.rx, pkt);
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "ccddee") < 0
+	    || !list_empty(&sock_conn->trq.tcp_conn->pkt_list_head)
+	    || !list_empty(&sock_conn->trq.tcp_conn->ooo_list)) {
+		fprintf(stderr, "%s: segments not reordered\n", __func__);
+		return -1;
+	}
+#ifdef CONFIG_TCP_RETRANSMIT
+	if (!list_empty(&sock_client->trq.tcp_conn->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: acknowledged segments kept\n", __func__);
+		return -1;
+	}
+#endif
+#ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
+	/* segments are queued, they are never sent in the emergency packet */
+	while ((pkt = pkt_alloc()) != NULL)
+		list_add_tail(&pkt->list, &pkts);
+	ret = net_lo_tcp_send(sock_client, "ff");
+	LIST_FOR_EACH_ENTRY_SAFE(pkt, pkt_tmp, &pkts, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	if (ret >= 0) {
+		fprintf(stderr, "%s: emergency packet queued\n", __func__);
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+static int net_lo_tcp_put_pkt_checks(sock_info_t *sock_client,
+				     sock_info_t *sock_conn)
+{
+	char data[CONFIG_PKT_SIZE];
+	uint16_t len;
+	pkt_t *pkt;
+
+	/* a received segment is sent back in place */
+	if (net_lo_tcp_send(sock_client, "echo") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	if (__socket_get_pkt(sock_conn, &pkt, NULL, NULL) < 0)
+		return -1;
+	if (socket_put_pkt(sock_conn, pkt, 0, 0) < 0) {
+		fprintf(stderr, "%s: segment not sent back\n", __func__);
+		pkt_free(pkt);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_client, "echo") < 0) {
+		fprintf(stderr, "%s: segment not received\n", __func__);
+		return -1;
+	}
+
+	/* a packet larger than the MSS is cut in segments */
+	len = tcp_conn_mss(sock_conn->trq.tcp_conn) + 1;
+	memset(data, 'z', len);
+	data[len] = '\0';
+	if ((pkt = pkt_alloc()) == NULL)
+		return -1;
+	memcpy(btod(pkt), data, len);
+	pkt->buf.len = len;
+	if (socket_put_pkt(sock_conn, pkt, 0, 0) < 0) {
+		fprintf(stderr, "%s: large packet not sent\n", __func__);
+		pkt_free(pkt);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_client, data) < 0) {
+		fprintf(stderr, "%s: large packet not received\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+static int net_lo_tcp_stream_checks(sock_info_t *sock_client,
+				    sock_info_t *sock_conn)
+{
+	char buf[16];
+	unsigned nb_free;
+
+	/* three segments */
+	if (net_lo_tcp_send_now(sock_client, "abc") < 0
+	    || net_lo_tcp_send_now(sock_client, "defg") < 0
+	    || net_lo_tcp_send_now(sock_client, "hi") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	nb_free = pkt_pool_get_nb_free();
+
+	if (__socket_peek(sock_conn, buf, 4) != 4 || memcmp(buf, "abcd", 4)
+	    || __socket_read(sock_conn, buf, 2) != 2 || memcmp(buf, "ab", 2)) {
+		fprintf(stderr, "%s: cannot read the first segment\n",
+			__func__);
+		return -1;
+	}
+	/* the first segment is freed as soon as it is read */
+	if (__socket_skip(sock_conn, 3) != 3
+	    || pkt_pool_get_nb_free() == nb_free) {
+		fprintf(stderr, "%s: segment not freed\n", __func__);
+		return -1;
+	}
+	if (__socket_read(sock_conn, buf, sizeof(buf)) != 4
+	    || memcmp(buf, "fghi", 4)) {
+		fprintf(stderr, "%s: cannot read the stream\n", __func__);
+		return -1;
+	}
+	if (__socket_read(sock_conn, buf, sizeof(buf)) >= 0
+	    || !list_empty(&sock_conn->trq.tcp_conn->pkt_list_head)) {
+		fprintf(stderr, "%s: segments left\n", __func__);
+		return -1;
+	}
+	net_lo_tcp_flush_acks();
+	return 0;
+}
+
+/* SYN or ACK from an address the loopback cannot answer */
+static int net_lo_tcp_spoof(uint32_t src, uint16_t port, uint8_t ctrl,
+			    uint32_t seq, uint32_t ack)
+{
+	uint16_t len = sizeof(ip_hdr_t) + sizeof(tcp_hdr_t);
+	ip_hdr_t *ip_hdr;
+	tcp_hdr_t *tcp_hdr;
+	pkt_t *pkt;
+
+	if ((pkt = pkt_alloc()) == NULL)
+		return -1;
+	ip_hdr = btod(pkt);
+	memset(ip_hdr, 0, len);
+	ip_hdr->v = 4;
+	ip_hdr->hl = sizeof(ip_hdr_t) / 4;
+	ip_hdr->len = htons(len);
+	ip_hdr->ttl = 64;
+	ip_hdr->p = IPPROTO_TCP;
+	ip_hdr->src = src;
+	ip_hdr->dst = *(uint32_t *)lo_ip;
+	ip_hdr->chksum = cksum(ip_hdr, sizeof(ip_hdr_t));
+	tcp_hdr = (tcp_hdr_t *)(ip_hdr + 1);
+	tcp_hdr->src_port = htons(1024);
+	tcp_hdr->dst_port = port;
+	tcp_hdr->seq = htonl(seq);
+	tcp_hdr->ack = htonl(ack);
+	tcp_hdr->hdr_len = sizeof(tcp_hdr_t) / 4;
+	tcp_hdr->ctrl = ctrl;
+	tcp_hdr->win_size = htons(1024);
+	set_transport_cksum(ip_hdr, tcp_hdr, htons(sizeof(tcp_hdr_t)));
+	pkt->buf.len = len;
+	return lo_iface.send(&lo_iface, pkt);
+}
+
+/* the SYN table cannot hold the flood */
+#define NET_LO_TCP_FLOOD (CONFIG_TCP_SYN_TABLE_SIZE + 6)
+
+static int net_lo_tcp_syn_flood(uint16_t port, unsigned first, unsigned nb)
+{
+	unsigned i;
+
+	for (i = first; i < first + nb; i++) {
+		if (net_lo_tcp_spoof(htonl(0x0A000001UL + i), port, TH_SYN,
+				     0x5EED0000UL + i, 0) < 0)
+			return -1;
+		/* the packet pool is smaller than the flood */
+		if ((i & 3) == 3)
+			net_lo_flush_scheduler();
+	}
+	net_lo_flush_scheduler();
+	return 0;
+}
+
+/* A connection is established while its listening socket is flooded.
+ * Return 1 if it is, 0 if not and -1 on failure. */
+static int net_lo_tcp_syn_flood_connect(sock_info_t *sock_server,
+					uint16_t port, uint8_t flood_first)
+{
+	uint32_t *ip_lo = (void *)lo_ip;
+	sock_info_t sock_client, sock_conn;
+	uint32_t src_addr;
+	uint16_t src_port;
+	pkt_t *syn_ack;
+	int flood, ret = -1;
+
+	if (sock_info_init(&sock_client, SOCK_STREAM) < 0)
+		return -1;
+	/* new sources, enough for all the entries to be taken */
+	if (flood_first && net_lo_tcp_syn_flood(port, NET_LO_TCP_FLOOD,
+						4 * NET_LO_TCP_FLOOD) < 0)
+		goto end;
+	if (sock_info_connect(&sock_client, *ip_lo, port) < 0)
+		goto end;
+	if (!flood_first) {
+		/* the SYN-ACK is held while the flood comes in */
+		scheduler_run_task();
+		if ((syn_ack = pkt_get(lo_iface.rx)) == NULL)
+			goto end;
+		net_lo_tcp_wait(1);
+		flood = net_lo_tcp_syn_flood(port, 0, NET_LO_TCP_FLOOD);
+		if (lo_iface.send(&lo_iface, syn_ack) < 0 || flood < 0)
+			goto end;
+	}
+	net_lo_flush_scheduler();
+	if (sock_info_state(&sock_client) != SOCK_CONNECTED) {
+		ret = 0;
+		goto end;
+	}
+	if (sock_info_accept(sock_server, &sock_conn, &src_addr,
+			     &src_port) < 0)
+		goto end;
+#ifdef CONFIG_EVENT
+	socket_event_register(&sock_client, 0, NULL);
+	socket_event_register(&sock_conn, 0, NULL);
+#endif
+	if (net_lo_tcp_send(&sock_client, "syn flood") >= 0) {
+		net_lo_flush_scheduler();
+		if (net_lo_tcp_recv(&sock_conn, "syn flood") >= 0)
+			ret = 1;
+	}
+	sock_info_close(&sock_conn);
+ end:
+	sock_info_close(&sock_client);
+	net_lo_flush_scheduler();
+	return ret;
+}
+
+static int net_lo_tcp_syn_flood_checks(void)
+{
+	const tcp_syn_stats_t *stats = tcp_get_syn_stats();
+	tcp_syn_stats_t prev = *stats;
+	sock_info_t sock_server;
+	uint16_t port = htons(778);
+	int connected, ret = -1;
+	uint8_t i;
+
+	if (sock_info_init(&sock_server, SOCK_STREAM) < 0)
+		return -1;
+	if (sock_info_listen(&sock_server, 1) < 0
+	    || sock_info_bind(&sock_server, port) < 0)
+		goto end;
+
+	/* the SYN table holds fewer connections than the flood */
+	connected = net_lo_tcp_syn_flood_connect(&sock_server, port, 0);
+	if (stats->received - prev.received != NET_LO_TCP_FLOOD + 1
+	    || stats->overflows == prev.overflows) {
+		fprintf(stderr, "%s: SYN table not full\n", __func__);
+		goto end;
+	}
+#ifdef CONFIG_TCP_SYN_COOKIES
+	if (connected != 1 || stats->evicted != prev.evicted
+	    || stats->cookies_sent - prev.cookies_sent
+	    != stats->overflows - prev.overflows) {
+		fprintf(stderr, "%s: handshake not kept\n", __func__);
+		goto end;
+	}
+#else
+	if (connected < 0 || stats->evicted == prev.evicted) {
+		fprintf(stderr, "%s: no half-open connection evicted\n",
+			__func__);
+		goto end;
+	}
+#endif
+
+	/* the handshake itself finds the table full */
+	prev = *stats;
+	if (net_lo_tcp_syn_flood_connect(&sock_server, port, 1) != 1) {
+		fprintf(stderr, "%s: can't connect\n", __func__);
+		goto end;
+	}
+#ifdef CONFIG_TCP_SYN_COOKIES
+	if (stats->cookies_ok - prev.cookies_ok != 1) {
+		fprintf(stderr, "%s: cookie not used\n", __func__);
+		goto end;
+	}
+
+	/* an ACK with a wrong cookie is reset */
+	prev = *stats;
+	if (net_lo_tcp_spoof(htonl(0x0A0000FFUL), port, TH_ACK, 0x5EED0001UL,
+			     0xC00C1E) < 0)
+		goto end;
+	net_lo_flush_scheduler();
+	if (stats->cookies_failed - prev.cookies_failed != 1
+	    || stats->cookies_ok != prev.cookies_ok
+	    || !list_empty(&sock_server.listen->tcp_conn_list_head)) {
+		fprintf(stderr, "%s: wrong cookie accepted\n", __func__);
+		goto end;
+	}
+#endif
+	ret = 0;
+
+ end:
+	sock_info_close(&sock_server);
+	/* half-open connections time out, closed ones are freed */
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(CONFIG_TCP_SYN_TIMEOUT));
+#ifdef CONFIG_TCP_RETRANSMIT
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(CONFIG_TCP_RETRANSMIT_TIMEOUT));
+#endif
+	for (i = 0; i < 10; i++)
+		scheduler_run_task();
+	return ret;
+}
+
+#ifdef CONFIG_TCP_RETRANSMIT
+/* deliver the acknowledgments delayed by the receiver */
+static int net_lo_tcp_rto_checks(sock_info_t *sock_client,
+				 sock_info_t *sock_conn)
+{
+	tcp_retrn_t *retrn = &sock_client->trq.tcp_conn->retrn;
+	uint32_t rto;
+	int i;
+
+	/* looped back segments are acknowledged within a tick */
+	if (retrn->rto != NET_LO_TCP_TICKS(CONFIG_TCP_RTO_MIN)) {
+		fprintf(stderr, "%s: timeout not clamped\n", __func__);
+		return -1;
+	}
+
+	/* the timeout follows slower acknowledgments, the second segment
+	 * is acknowledged without delay */
+	for (i = 0; i < 4; i++) {
+		rto = retrn->rto;
+		if (net_lo_tcp_send_now(sock_client, "ff") < 0
+		    || net_lo_tcp_send_now(sock_client, "ff") < 0)
+			return -1;
+		net_lo_tcp_wait(rto - 1);
+		if (ring_len(lo_iface.rx) != 2) {
+			fprintf(stderr, "%s: early retransmission\n",
+				__func__);
+			return -1;
+		}
+		net_lo_flush_scheduler();
+		if (net_lo_tcp_recv(sock_conn, "ffff") < 0)
+			return -1;
+	}
+	if (retrn->rto <= NET_LO_TCP_TICKS(CONFIG_TCP_RTO_MIN)
+	    || retrn->rto > NET_LO_TCP_TICKS(CONFIG_TCP_RTO_MAX)) {
+		fprintf(stderr, "%s: timeout not updated\n", __func__);
+		return -1;
+	}
+
+	/* retransmissions are backed off and not timed */
+	rto = retrn->rto;
+	if (net_lo_tcp_send(sock_client, "gg") < 0)
+		return -1;
+	net_lo_tcp_wait(rto);
+	if (ring_len(lo_iface.rx) != 2 || retrn->cnt != 1) {
+		fprintf(stderr, "%s: segment not retransmitted\n", __func__);
+		return -1;
+	}
+	net_lo_tcp_wait(rto);
+	if (ring_len(lo_iface.rx) != 2) {
+		fprintf(stderr, "%s: timeout not backed off\n", __func__);
+		return -1;
+	}
+	net_lo_tcp_wait(rto);
+	if (ring_len(lo_iface.rx) != 3) {
+		fprintf(stderr, "%s: segment not retransmitted again\n",
+			__func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "gg") < 0
+	    || !list_empty(&sock_conn->trq.tcp_conn->pkt_list_head)) {
+		fprintf(stderr, "%s: retransmission not delivered\n",
+			__func__);
+		return -1;
+	}
+#ifdef CONFIG_TCP_TIMESTAMPS
+	/* the echoed timestamp times the last retransmission */
+	if (retrn->rto == rto || retrn->cnt != 0
+	    || timer_is_pending(&retrn->timer)) {
+		fprintf(stderr, "%s: retransmission not timed\n", __func__);
+		return -1;
+	}
+#else
+	if (retrn->rto != rto || retrn->cnt != 0
+	    || timer_is_pending(&retrn->timer)) {
+		fprintf(stderr, "%s: retransmission timed\n", __func__);
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+#ifdef CONFIG_TCP_DELAYED_ACK
+static int net_lo_tcp_delack_checks(sock_info_t *sock_client,
+				    sock_info_t *sock_conn)
+{
+	tcp_conn_t *client = sock_client->trq.tcp_conn;
+	tcp_conn_t *conn = sock_conn->trq.tcp_conn;
+	uint32_t ticks = NET_LO_TCP_TICKS(CONFIG_TCP_DELAYED_ACK_TIMEOUT);
+#ifdef CONFIG_IFACE_STATS
+	uint16_t tx_packets;
+#endif
+
+	/* a single segment is acknowledged by the timer */
+	if (net_lo_tcp_send(sock_client, "d1") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "d1") < 0)
+		return -1;
+	net_lo_tcp_wait(ticks - 1);
+	if (!ring_is_empty(lo_iface.rx)
+	    || list_empty(&client->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: acknowledgment not delayed\n", __func__);
+		return -1;
+	}
+	net_lo_tcp_wait(1);
+	net_lo_flush_scheduler();
+	if (!list_empty(&client->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: delayed acknowledgment not sent\n",
+			__func__);
+		return -1;
+	}
+
+	/* every second segment is acknowledged right away */
+	if (net_lo_tcp_send_now(sock_client, "d2") < 0
+	    || net_lo_tcp_send_now(sock_client, "d3") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "d2d3") < 0
+	    || !list_empty(&client->retrn.retrn_pkt_list)
+	    || timer_is_pending(&conn->ack_timer)) {
+		fprintf(stderr, "%s: second segment not acknowledged\n",
+			__func__);
+		return -1;
+	}
+
+	/* the reply carries the acknowledgment of the request */
+#ifdef CONFIG_IFACE_STATS
+	tx_packets = lo_iface.tx_packets;
+#endif
+	if (net_lo_tcp_send(sock_client, "req") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "req") < 0
+	    || net_lo_tcp_send(sock_conn, "rsp") < 0)
+		return -1;
+	if (ring_len(lo_iface.rx) != 1 || timer_is_pending(&conn->ack_timer)) {
+		fprintf(stderr, "%s: acknowledgment not piggybacked\n",
+			__func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_client, "rsp") < 0
+	    || !list_empty(&client->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: request not acknowledged\n", __func__);
+		return -1;
+	}
+#ifdef CONFIG_IFACE_STATS
+	if (lo_iface.tx_packets != tx_packets + 2) {
+		fprintf(stderr, "%s: %u packets for a request/response\n",
+			__func__, lo_iface.tx_packets - tx_packets);
+		return -1;
+	}
+#endif
+	net_lo_tcp_flush_acks();
+	if (!list_empty(&conn->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: response not acknowledged\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_TCP_DELAYED_ACK
+#define NET_LO_TCP_NAGLE_PKTS 3
+#else
+#define NET_LO_TCP_NAGLE_PKTS 4
+#endif
+
+static int net_lo_tcp_mss_checks(sock_info_t *sock_client,
+				 sock_info_t *sock_conn)
+{
+	tcp_conn_t *tcp_conn = sock_client->trq.tcp_conn;
+	uint16_t mss = tcp_conn_mss(tcp_conn);
+	static char data[3 * CONFIG_PKT_SIZE];
+	uint16_t peer_mss;
+	unsigned len;
+	pkt_t *pkt;
+#if defined(CONFIG_TCP_NAGLE) && defined(CONFIG_IFACE_STATS)
+	uint16_t tx_packets;
+#endif
+
+	/* the options set in every segment are taken from it */
+	if (tcp_conn->syn.opts.mss == 0
+	    || mss + tcp_conn_opts_len(tcp_conn) != tcp_conn->syn.opts.mss) {
+		fprintf(stderr, "%s: peer MSS not used\n", __func__);
+		return -1;
+	}
+
+	/* a large write is cut in segments, those the window cannot take
+	 * wait for the acknowledgment to open it */
+	memset(data, 'm', 2 * mss + 10);
+	data[2 * mss + 10] = 0;
+	tcp_conn->snd_wnd = mss;
+	tcp_conn->cc.cwnd = 4 * mss;
+	if (net_lo_tcp_send(sock_client, data) < 0) {
+		fprintf(stderr, "%s: large write failed\n", __func__);
+		return -1;
+	}
+	if (ring_len(lo_iface.rx) != 1 || tcp_conn->snd_queued != mss + 10) {
+		fprintf(stderr, "%s: write not segmented\n", __func__);
+		return -1;
+	}
+	pkt = pkt_get(lo_iface.rx);
+	len = pkt_len(pkt);
+	pkt_put(lo_iface.rx, pkt);
+	if (len != sizeof(ip_hdr_t) + sizeof(tcp_hdr_t)
+	    + tcp_conn_opts_len(tcp_conn) + mss) {
+		fprintf(stderr, "%s: segment of %u bytes\n", __func__, len);
+		return -1;
+	}
+	pkt = LIST_FIRST_ENTRY(&tcp_conn->retrn.retrn_pkt_list, pkt_t,
+			       retrn_list);
+	if (!list_is_singular(&tcp_conn->retrn.retrn_pkt_list)
+	    || pkt->seqid != tcp_conn->snd_una || pkt->seqlen != mss) {
+		fprintf(stderr, "%s: segment not kept for retransmission\n",
+			__func__);
+		return -1;
+	}
+	if (net_lo_tcp_send(sock_client, "zz") >= 0) {
+		fprintf(stderr, "%s: queued data not accounted\n", __func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	if (tcp_conn->snd_queued != 0) {
+		fprintf(stderr, "%s: queued segments not sent\n", __func__);
+		return -1;
+	}
+	if (net_lo_tcp_recv(sock_conn, data) < 0) {
+		fprintf(stderr, "%s: data not delivered\n", __func__);
+		return -1;
+	}
+	net_lo_tcp_flush_acks();
+	if (!list_empty(&tcp_conn->retrn.retrn_pkt_list)) {
+		fprintf(stderr, "%s: segments not acknowledged\n", __func__);
+		return -1;
+	}
+
+	/* an MSS not larger than the options leaves room for a byte */
+	peer_mss = tcp_conn->syn.opts.mss;
+	tcp_conn->syn.opts.mss = tcp_conn_opts_len(tcp_conn);
+	len = tcp_conn_mss(tcp_conn);
+	tcp_conn->syn.opts.mss = peer_mss;
+	if (len == 0 || len > mss) {
+		fprintf(stderr, "%s: MSS of %u bytes\n", __func__, len);
+		return -1;
+	}
+
+#ifdef CONFIG_TCP_NAGLE
+	/* small writes are appended to the segment waiting for the first
+	 * small one to be acknowledged */
+#ifdef CONFIG_IFACE_STATS
+	tx_packets = lo_iface.tx_packets;
+#endif
+	if (net_lo_tcp_send(sock_client, "n1") < 0
+	    || net_lo_tcp_send(sock_client, "ab") < 0
+	    || net_lo_tcp_send(sock_client, "cde") < 0
+	    || net_lo_tcp_send(sock_client, "f") < 0)
+		return -1;
+	if (ring_len(lo_iface.rx) != 1 || tcp_conn->snd_queued != 6) {
+		fprintf(stderr, "%s: small segments not held\n", __func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	if (tcp_conn->snd_queued != 0) {
+		fprintf(stderr, "%s: small segments not sent\n", __func__);
+		return -1;
+	}
+	if (net_lo_tcp_recv(sock_conn, "n1abcdef") < 0) {
+		fprintf(stderr, "%s: coalesced data not delivered\n",
+			__func__);
+		return -1;
+	}
+#ifdef CONFIG_IFACE_STATS
+	/* both segments and their acknowledgments, the second one is
+	 * acknowledged later with delayed ACKs */
+	if (lo_iface.tx_packets != tx_packets + NET_LO_TCP_NAGLE_PKTS) {
+		fprintf(stderr, "%s: small writes not coalesced\n", __func__);
+		return -1;
+	}
+#endif
+	net_lo_tcp_flush_acks();
+#endif
+	return 0;
+}
+
+#ifdef CONFIG_TCP_CC_NEWRENO
+/* drop the looped back packets set in mask, bit 0 being the oldest */
+static void net_lo_drop(uint8_t mask)
+{
+	int nb = ring_len(lo_iface.rx);
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		pkt_t *pkt = pkt_get(lo_iface.rx);
+
+		if (mask & (1 << i))
+			pkt_free(pkt);
+		else
+			pkt_put(lo_iface.rx, pkt);
+	}
+}
+
+#define NET_LO_TCP_SEGS "s1s2s3s4s5s6"
+
+static int net_lo_tcp_send_lossy(sock_info_t *sock_client, uint8_t mask)
+{
+	const char *segs[] = { "s1", "s2", "s3", "s4", "s5", "s6" };
+	unsigned i;
+
+	for (i = 0; i < countof(segs); i++) {
+		if (net_lo_tcp_send_now(sock_client, segs[i]) < 0)
+			return -1;
+	}
+	net_lo_drop(mask);
+	net_lo_flush_scheduler();
+	return 0;
+}
+
+static int net_lo_tcp_cc_checks(sock_info_t *sock_client,
+				sock_info_t *sock_conn)
+{
+	tcp_conn_t *tcp_conn = sock_client->trq.tcp_conn;
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	tcp_cc_t *cc = &tcp_conn->cc;
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+	static char data[3 * CONFIG_PKT_SIZE];
+
+	/* a loss is repaired once three duplicates are received */
+	if (net_lo_tcp_send_lossy(sock_client, 0x01) < 0
+	    || net_lo_tcp_recv(sock_conn, NET_LO_TCP_SEGS) < 0
+	    || retrn->cnt != 0) {
+		fprintf(stderr, "%s: no fast retransmission\n", __func__);
+		return -1;
+	}
+	if (cc->ssthresh != 2 * mss || cc->cwnd != 2 * mss
+	    || (cc->flags & TCP_CC_RECOVERY)) {
+		fprintf(stderr, "%s: window not reduced\n", __func__);
+		return -1;
+	}
+
+	/* NewReno resends the next hole on partial acknowledgments */
+	if (net_lo_tcp_send_lossy(sock_client, 0x05) < 0
+	    || net_lo_tcp_recv(sock_conn, NET_LO_TCP_SEGS) < 0
+	    || retrn->cnt != 0 || (cc->flags & TCP_CC_RECOVERY)) {
+		fprintf(stderr, "%s: no fast recovery\n", __func__);
+		return -1;
+	}
+
+#ifdef CONFIG_TCP_CC_COMPACT
+	/* the compact algorithm waits for the timeout, a recovery left
+	 * by NewReno is ended */
+	tcp_cc_set(&tcp_cc_compact);
+	cc->flags |= TCP_CC_RECOVERY;
+	/* the last acknowledgment may have closed the window as the
+	 * receiver was holding the segments */
+	tcp_conn->snd_wnd = 0xFFFF;
+	if (net_lo_tcp_send_lossy(sock_client, 0x05) < 0
+	    || net_lo_tcp_recv(sock_conn, "s1s2") < 0
+	    || !list_empty(&sock_conn->trq.tcp_conn->pkt_list_head)
+	    || (cc->flags & TCP_CC_RECOVERY)) {
+		fprintf(stderr, "%s: compact: no fast retransmission\n",
+			__func__);
+		goto error;
+	}
+	net_lo_tcp_wait(retrn->rto);
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "s3s4s5s6") < 0) {
+		fprintf(stderr, "%s: compact: no retransmission\n", __func__);
+		goto error;
+	}
+	tcp_cc_set(&tcp_cc_newreno);
+#endif
+
+	/* the congestion window limits the data in flight */
+	memset(data, 'x', mss);
+	data[mss] = 0;
+	tcp_conn->snd_wnd = 0xFFFF;
+	cc->cwnd = mss;
+	if (net_lo_tcp_send(sock_client, data) < 0
+	    || net_lo_tcp_send(sock_client, "zz") >= 0) {
+		fprintf(stderr, "%s: window not honored\n", __func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, data) < 0)
+		return -1;
+	net_lo_tcp_flush_acks();
+
+	/* segments are resent as the window opens after a timeout */
+	tcp_conn->snd_wnd = 0xFFFF;
+	cc->cwnd = 4 * mss;
+	if (net_lo_tcp_send(sock_client, data) < 0
+	    || net_lo_tcp_send(sock_client, data) < 0
+	    || net_lo_tcp_send(sock_client, data) < 0)
+		return -1;
+	net_lo_drop(0x07);
+	net_lo_tcp_wait(retrn->rto);
+	if (ring_len(lo_iface.rx) != 1 || cc->cwnd != mss
+	    || cc->ssthresh != 2 * mss) {
+		fprintf(stderr, "%s: window not reset\n", __func__);
+		return -1;
+	}
+	net_lo_flush_scheduler();
+	/* the receiver does not know about the hole and delays the
+	 * acknowledgment of the first segment */
+	net_lo_tcp_flush_acks();
+	memset(data, 'x', 3 * mss);
+	data[3 * mss] = 0;
+	if (net_lo_tcp_recv(sock_conn, data) < 0 || retrn->cnt != 0
+	    || !list_empty(&retrn->retrn_pkt_list)) {
+		fprintf(stderr, "%s: segments not resent\n", __func__);
+		return -1;
+	}
+	return 0;
+
+#ifdef CONFIG_TCP_CC_COMPACT
+ error:
+	tcp_cc_set(&tcp_cc_newreno);
+	return -1;
+#endif
+}
+
+#ifdef CONFIG_TCP_SACK
+/* looped back packets point to the ip header */
+static int net_lo_tcp_seg_cmp(const pkt_t *pkt, const char *data)
+{
+	const ip_hdr_t *ip_hdr = btod(pkt);
+	const tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr
+						 + ip_hdr->hl * 4);
+	uint16_t len = strlen(data);
+
+	if (pkt_len(pkt) != ip_hdr->hl * 4 + tcp_hdr->hdr_len * 4 + len)
+		return -1;
+	return memcmp((uint8_t *)tcp_hdr + tcp_hdr->hdr_len * 4, data, len);
+}
+
+static int net_lo_tcp_sack_checks(sock_info_t *sock_client,
+				  sock_info_t *sock_conn)
 {
-	int fd;
-	struct sockaddr_in sockaddr;
+	const char *segs[] = { "s1", "s2", "s3", "s4", "s5", "s6" };
+	tcp_conn_t *tcp_conn = sock_client->trq.tcp_conn;
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	uint32_t mss = tcp_conn_mss(tcp_conn);
+	pkt_t *pkt;
+	unsigned i, sacked = 0;
 
-	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		fprintf(stderr, "%s: can't create socket\n", __func__);
+	if (!tcp_conn->syn.opts.sack_permitted
+	    || !sock_conn->trq.tcp_conn->syn.opts.sack_permitted) {
+		fprintf(stderr, "%s: SACK not negotiated\n", __func__);
 		return -1;
 	}
-	sockaddr.sin_family = AF_INET;
-	sockaddr.sin_addr.s_addr = INADDR_ANY;
-	sockaddr.sin_port = htons(port);
 
-	if (bind(fd, (struct sockaddr *)&sockaddr,
-		 sizeof(struct sockaddr_in)) < 0) {
-		fprintf(stderr, "%s: can't bind\n", __func__);
+	tcp_conn->snd_wnd = 0xFFFF;
+	tcp_conn->cc.cwnd = 8 * mss;
+	for (i = 0; i < countof(segs); i++) {
+		if (net_lo_tcp_send_now(sock_client, segs[i]) < 0)
+			return -1;
+	}
+	net_lo_drop(0x05);
+
+	/* the receiver reports the segments it holds */
+	scheduler_run_task();
+	for (i = ring_len(lo_iface.rx); i; i--) {
+		const ip_hdr_t *ip_hdr;
+		const tcp_hdr_t *tcp_hdr;
+
+		pkt = pkt_get(lo_iface.rx);
+		ip_hdr = btod(pkt);
+		tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->hl * 4);
+		if (tcp_hdr->hdr_len * 4 == sizeof(tcp_hdr_t)) {
+			fprintf(stderr, "%s: no SACK blocks\n", __func__);
+			pkt_free(pkt);
+			return -1;
+		}
+		pkt_put(lo_iface.rx, pkt);
+	}
+
+	/* both holes are resent from the duplicates, the SACKed segments
+	 * are not */
+	scheduler_run_task();
+	LIST_FOR_EACH_ENTRY(pkt, &retrn->retrn_pkt_list, retrn_list) {
+		if (pkt->flags & PKT_FLAG_TCP_SACKED)
+			sacked++;
+	}
+	if (sacked != 4 || ring_len(lo_iface.rx) != 2) {
+		fprintf(stderr, "%s: scoreboard not used (%u SACKed, %u "
+			"resent)\n", __func__, sacked, ring_len(lo_iface.rx));
 		return -1;
 	}
-	return fd;
+	for (i = 0; i < 2; i++) {
+		pkt = pkt_get(lo_iface.rx);
+		if (net_lo_tcp_seg_cmp(pkt, segs[2 * i]) != 0) {
+			fprintf(stderr, "%s: wrong segment resent\n",
+				__func__);
+			pkt_free(pkt);
+			return -1;
+		}
+		pkt_put(lo_iface.rx, pkt);
+	}
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	if (net_lo_tcp_recv(sock_conn, NET_LO_TCP_SEGS) < 0
+	    || retrn->cnt != 0 || !list_empty(&retrn->retrn_pkt_list)
+	    || (tcp_conn->cc.flags & TCP_CC_RECOVERY)) {
+		fprintf(stderr, "%s: holes not repaired\n", __func__);
+		return -1;
+	}
+	return 0;
 }
 #endif
-int net_udp_tests(void)
+#endif
+
+#if defined(CONFIG_TCP_WSCALE) || defined(CONFIG_TCP_TIMESTAMPS)
+/* looped back packets point to the ip header */
+static tcp_hdr_t *net_lo_tcp_hdr(const pkt_t *pkt)
+{
+	const ip_hdr_t *ip_hdr = btod(pkt);
+
+	return (tcp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->hl * 4);
+}
+
+static int net_lo_tcp_rfc7323_checks(sock_info_t *sock_client,
+				     sock_info_t *sock_conn)
 {
+	tcp_conn_t *tcp_conn = sock_client->trq.tcp_conn;
+	tcp_conn_t *peer_conn = sock_conn->trq.tcp_conn;
 	pkt_t *pkt;
-	buf_t out;
-	/* ip_src: 192.168.0.11 */
-#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-	uint32_t ip_src = 0xc0a8000b;
-#else
-	uint32_t ip_src = 0x0b00a8c0;
+#ifdef CONFIG_TCP_WSCALE
+	uint32_t wnd;
 #endif
-	/* ip_dst: 192.168.0.1 */
-#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-	uint32_t ip_dst = 0xc0a80001;
-#else
-	uint32_t ip_dst = 0x0100a8c0;
-#endif
-	uint8_t mac_dst[] = { 0x48, 0x83, 0xc7, 0xbc, 0x7d, 0x06 };
-	uint8_t mac_src[] = { 0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c };
-	uint16_t port = 777;
-#ifdef CONFIG_BSD_COMPAT
-	struct sockaddr_in addr;
-	socklen_t addrlen;
-#else
-	sock_info_t sock_info;
-	uint32_t src_addr;
-	uint16_t src_port;
+#ifdef CONFIG_TCP_TIMESTAMPS
+	tcp_retrn_t *retrn = &tcp_conn->retrn;
+	tcp_hdr_t *tcp_hdr;
+	const uint8_t *opts;
+	uint32_t ts_val, ack;
+	pkt_t *dup;
 #endif
-	sbuf_t sb;
-	int buf_size = 512, len, ret = 0;
-	char buf[buf_size];
-
-	memset(buf, 0, buf_size);
-	pkt_mempool_init();
-	iface.ip4_addr = (void *)&ip_dst;
-	iface.hw_addr = mac_dst;
-	if_init(&iface, IF_TYPE_ETHERNET, &iface_queues.pkt_pool,
-		&iface_queues.rx, &iface_queues.tx, 0);
 
-	if ((pkt = pkt_alloc()) == NULL) {
-		fprintf(stderr, "%s: can't alloc a packet\n", __func__);
-		ret = -1;
-		goto end;
+#ifdef CONFIG_TCP_WSCALE
+	if ((tcp_conn->syn.opts.flags & TCP_OPT_WSCALE) == 0
+	    || (peer_conn->syn.opts.flags & TCP_OPT_WSCALE) == 0) {
+		fprintf(stderr, "%s: window scaling not negotiated\n",
+			__func__);
+		return -1;
 	}
-	memset(pkt->buf.data, 0, pkt->buf.size);
-	buf_init(&pkt->buf, udp_pkt, sizeof(udp_pkt));
 
-#ifdef CONFIG_HT_STORAGE
-	socket_init();
+	/* the window of the acknowledgment is scaled beyond 16 bits */
+	tcp_conn->syn.opts.wscale = 4;
+	if (net_lo_tcp_send(sock_client, "w1") < 0)
+		goto error;
+	scheduler_run_task();
+#ifdef CONFIG_TCP_DELAYED_ACK
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(CONFIG_TCP_DELAYED_ACK_TIMEOUT));
 #endif
-	arp_add_entry(mac_src, (uint8_t *)&ip_src, &iface);
-
-	(void)out;
-#ifdef CONFIG_ICMP
-	buf_init(&out, icmp_port_unrecheable_pkt,
-		 sizeof(icmp_port_unrecheable_pkt));
-
-	if (pkt_put(iface.rx, pkt) < 0) {
-		fprintf(stderr , "%s: can't put rx packet\n", __func__);
-		ret = -1;
-		goto end;
+	if (ring_len(lo_iface.rx) != 1) {
+		fprintf(stderr, "%s: no acknowledgment\n", __func__);
+		goto error;
+	}
+	pkt = pkt_get(lo_iface.rx);
+	wnd = (uint32_t)ntohs(net_lo_tcp_hdr(pkt)->win_size) << 4;
+	pkt_put(lo_iface.rx, pkt);
+	net_lo_flush_scheduler();
+	tcp_conn->syn.opts.wscale = 0;
+	if (net_lo_tcp_recv(sock_conn, "w1") < 0 || tcp_conn->snd_wnd != wnd
+	    || wnd <= 0xFFFF) {
+		fprintf(stderr, "%s: window not scaled\n", __func__);
+		return -1;
 	}
+#endif
 
-	eth_input(&iface);
-	if ((pkt = pkt_get(iface.tx)) == NULL) {
-		fprintf(stderr, "%s: can't get tx packet\n", __func__);
-		ret = -1;
-		goto end;
+#ifdef CONFIG_TCP_TIMESTAMPS
+	if ((tcp_conn->syn.opts.flags & TCP_OPT_TS) == 0
+	    || (peer_conn->syn.opts.flags & TCP_OPT_TS) == 0) {
+		fprintf(stderr, "%s: timestamps not negotiated\n", __func__);
+		return -1;
 	}
 
-	if (buf_cmp(&pkt->buf, &out) < 0) {
-		printf("out pkt:\n");
-		buf_print_hex(&pkt->buf);
-		printf("expected:\n");
-		buf_print_hex(&out);
-		pkt_free(pkt);
-		ret = -1;
-		goto end;
+	/* data segments carry the clock and echo the peer one */
+	if (net_lo_tcp_send(sock_client, "t1") < 0 || ring_len(lo_iface.rx) != 1)
+		return -1;
+	pkt = pkt_get(lo_iface.rx);
+	tcp_hdr = net_lo_tcp_hdr(pkt);
+	opts = (uint8_t *)(tcp_hdr + 1);
+	ts_val = ntohl(*(uint32_t *)(opts + 4));
+	pkt_put(lo_iface.rx, pkt);
+	if (tcp_hdr->hdr_len * 4 != sizeof(tcp_hdr_t) + TCPOLEN_TSTAMP_APPA
+	    || opts[2] != TCPOPT_TIMESTAMP || ts_val != timer_ticks
+	    || ntohl(*(uint32_t *)(opts + 8)) != tcp_conn->syn.opts.ts_val) {
+		fprintf(stderr, "%s: no timestamps\n", __func__);
+		return -1;
 	}
-#endif
-	dft_route.iface = &iface;
-#ifdef CONFIG_BSD_COMPAT
-	if ((udp_fd = udp_server(port)) < 0) {
-		fprintf(stderr, "%s: can't start udp server\n", __func__);
-		ret = -1;
-		pkt_free(pkt);
-		goto end;
+	net_lo_flush_scheduler();
+	if (net_lo_tcp_recv(sock_conn, "t1") < 0
+	    || peer_conn->syn.opts.ts_val != ts_val) {
+		fprintf(stderr, "%s: timestamp not recorded\n", __func__);
+		return -1;
 	}
-#else
-	if (sock_info_init(&sock_info, SOCK_DGRAM) < 0) {
-		fprintf(stderr, "%s: can't init udp sock_info\n", __func__);
+	net_lo_tcp_flush_acks();
+
+	/* unlike Karn's algorithm, the timestamps time retransmissions */
+	if (net_lo_tcp_send(sock_client, "t2") < 0)
+		return -1;
+	pkt_free(pkt_get(lo_iface.rx));
+	retrn->rtt_flags &= ~TCP_RTT_VALID;
+	net_lo_tcp_wait(retrn->rto);
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	if (net_lo_tcp_recv(sock_conn, "t2") < 0
+	    || (retrn->rtt_flags & TCP_RTT_VALID) == 0
+	    || !list_empty(&retrn->retrn_pkt_list)) {
+		fprintf(stderr, "%s: retransmission not timed\n", __func__);
 		return -1;
 	}
 
-	if (sock_info_bind(&sock_info, htons(port)) < 0) {
-		fprintf(stderr, "%s: can't start udp server\n", __func__);
-		pkt_free(pkt);
-		ret = -1;
-		goto end;
+	/* PAWS, an old duplicate in the window is dropped */
+	if (net_lo_tcp_send(sock_client, "p1") < 0
+	    || (dup = pkt_alloc()) == NULL)
+		return -1;
+	pkt = pkt_get(lo_iface.rx);
+	pkt_adj(dup, pkt->buf.skip);
+	memcpy(btod(dup), btod(pkt), pkt_len(pkt));
+	dup->buf.len = pkt_len(pkt);
+	dup->flags = pkt->flags;
+	pkt_put(lo_iface.rx, pkt);
+	net_lo_tcp_wait(1);
+	if (net_lo_tcp_send_now(sock_client, "p2") < 0) {
+		pkt_free(dup);
+		return -1;
+	}
+	/* the copy of the first segment follows the second one */
+	ack = htonl(ntohl(peer_conn->syn.ack) + 4);
+	tcp_hdr = net_lo_tcp_hdr(dup);
+	tcp_hdr->seq = ack;
+	set_transport_cksum(btod(dup), tcp_hdr,
+			    htons(pkt_len(dup) - sizeof(ip_hdr_t)));
+	pkt_put(lo_iface.rx, dup);
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	if (net_lo_tcp_recv(sock_conn, "p1p2") < 0
+	    || !list_empty(&peer_conn->pkt_list_head)
+	    || peer_conn->syn.ack != ack) {
+		fprintf(stderr, "%s: old duplicate accepted\n", __func__);
+		return -1;
 	}
+#endif
+	return 0;
 
+#ifdef CONFIG_TCP_WSCALE
+ error:
+	tcp_conn->syn.opts.wscale = 0;
+	return -1;
+#endif
+}
+#endif
 #endif
 
-	buf_init(&pkt->buf, udp_pkt, sizeof(udp_pkt));
-	if (pkt_put(iface.rx, pkt) < 0) {
-		fprintf(stderr , "%s: can't put rx packet\n", __func__);
-		ret = -1;
-		pkt_free(pkt);
-		goto end;
-	}
+#ifdef CONFIG_TCP_KEEPALIVE
+static int net_lo_tcp_keepalive_checks(sock_info_t *sock_client,
+				       sock_info_t *sock_conn)
+{
+	const tcp_keepalive_stats_t *stats = tcp_get_keepalive_stats();
+	tcp_keepalive_stats_t prev = *stats;
+	tcp_conn_t *tcp_conn = sock_client->trq.tcp_conn;
+	uint16_t used = tcp_get_conn_pool_stats()->used;
+	unsigned nb_free;
+	int i;
 
-	eth_input(&iface);
-	if ((pkt = pkt_get(iface.tx)) != NULL) {
-		fprintf(stderr, "shouldn't get tx packet\n");
-		ret = -1;
-		goto end;
+	/* the delayed close of the connection needs room in the
+	 * scheduler */
+	for (i = 0; i < 16 && scheduler_get_nb_tasks(); i++)
+		scheduler_run_task();
+
+	/* the received data is left unread */
+	if (net_lo_tcp_send(sock_conn, "kk") < 0)
+		return -1;
+	net_lo_flush_scheduler();
+	net_lo_tcp_flush_acks();
+	nb_free = pkt_pool_get_nb_free();
+
+	/* keepalive is off by default */
+	if (tcp_conn->ka.idle || sock_conn->trq.tcp_conn->ka.idle) {
+		fprintf(stderr, "%s: keepalive enabled\n", __func__);
+		return -1;
 	}
-#ifdef CONFIG_BSD_COMPAT
-	if ((len = recvfrom(udp_fd, buf, buf_size, 0, (struct sockaddr *)&addr,
-			    &addrlen)) < 0) {
-		fprintf(stderr, "%s: can't get udp pkt\n", __func__);
-		ret = -1;
-		goto end;
+
+	/* a probe is sent after a second without segments, the peer
+	 * acknowledges it */
+	if (__socket_set_keepalive(sock_client, 1, 3, 2) < 0)
+		return -1;
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(2000));
+	if (ring_len(lo_iface.rx) != 1
+	    || stats->probes != prev.probes + 1) {
+		fprintf(stderr, "%s: probe not sent\n", __func__);
+		return -1;
 	}
-#else
-	if (__socket_get_pkt(&sock_info, &pkt, &src_addr, &src_port) < 0) {
-		fprintf(stderr, "%s: can't get udp pkt 2\n", __func__);
-		ret = -1;
-		goto end;
+	net_lo_flush_scheduler();
+	if (tcp_conn->ka.sent != 0 || ring_len(lo_iface.rx)) {
+		fprintf(stderr, "%s: probe not acknowledged\n", __func__);
+		return -1;
 	}
-	len = pkt->buf.len;
-#endif
 
-	sbuf_init(&sb, buf, len);
-#ifdef CONFIG_BSD_COMPAT
-	if (sendto(udp_fd, sb.data, sb.len, 0, (struct sockaddr *)&addr,
-		   sizeof(struct sockaddr_in)) < 0) {
-		fprintf(stderr, "%s: can't put sbuf to udp socket\n", __func__);
-		ret = -1;
-		pkt_free(pkt);
-		goto end;
+	/* the peer is gone, the connection is dropped once the probes are
+	 * lost */
+	for (i = 0; i < 9; i++) {
+		net_lo_tcp_wait(NET_LO_TCP_TICKS(1000));
+		while (ring_len(lo_iface.rx))
+			pkt_free(pkt_get(lo_iface.rx));
 	}
-#else
-	if (__socket_put_sbuf(&sock_info, &sb, src_addr, src_port) < 0) {
-		fprintf(stderr, "%s: can't put sbuf to udp socket\n", __func__);
-		pkt_free(pkt);
-		ret = -1;
-		goto end;
+	if (stats->probes != prev.probes + 3
+	    || stats->reaped != prev.reaped + 1
+	    || sock_info_state(sock_client) != SOCK_CLOSED) {
+		fprintf(stderr, "%s: connection not dropped\n", __func__);
+		return -1;
 	}
-#endif
-	if ((pkt = pkt_get(iface.tx)) == NULL) {
-		fprintf(stderr, "%s: can't get udp echo packet\n", __func__);
-		ret = -1;
-		goto end;
+	if (pkt_pool_get_nb_free() != nb_free + 1) {
+		fprintf(stderr, "%s: received data not freed\n", __func__);
+		return -1;
 	}
-	pkt_free(pkt);
+	net_lo_tcp_wait(NET_LO_TCP_TICKS(CONFIG_TCP_RETRANSMIT_TIMEOUT));
+	for (i = 0; i < 16 && scheduler_get_nb_tasks(); i++)
+		scheduler_run_task();
+	if (tcp_get_conn_pool_stats()->used != used - 1) {
+		fprintf(stderr, "%s: connection not freed\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+#endif
 
-#ifdef CONFIG_BSD_COMPAT
-	if (close(udp_fd) < 0) {
-		fprintf(stderr, "%s: can't close udp socket\n", __func__);
-		ret = -1;
+int net_lo_tcp_tests(void)
+{
+	uint32_t *ip_lo = (void *)lo_ip;
+	sock_info_t sock_server, sock_client, sock_conn;
+	uint32_t src_addr;
+	uint16_t src_port;
+	unsigned nb_free;
+	int ret = -1;
+
+	pkt_mempool_init();
+	if_init(&lo_iface, IF_TYPE_LOOPBACK, &lo_iface_queues.pkt_pool,
+		&lo_iface_queues.rx, &lo_iface_queues.tx, 0);
+	route_flush();
+	route_add(htonl(0x7F000000UL), 8, 0, &lo_iface);
+	nb_free = pkt_pool_get_nb_free();
+
+	if (net_lo_tcp_syn_flood_checks() < 0)
 		goto end;
-	}
-#else
-	if (sock_info_close(&sock_info) < 0) {
-		fprintf(stderr, "%s: can't close udp socket\n", __func__);
-		ret = -1;
+	if (sock_info_init(&sock_server, SOCK_STREAM) < 0)
 		goto end;
+	if (sock_info_listen(&sock_server, 1) < 0
+	    || sock_info_bind(&sock_server, htons(777)) < 0)
+		goto end_server;
+	if (sock_info_init(&sock_client, SOCK_STREAM) < 0)
+		goto end_server;
+	if (sock_info_connect(&sock_client, *ip_lo, htons(777)) < 0)
+		goto end_client;
+	net_lo_flush_scheduler();
+	if (sock_info_state(&sock_client) != SOCK_CONNECTED
+	    || sock_info_accept(&sock_server, &sock_conn, &src_addr,
+				&src_port) < 0) {
+		fprintf(stderr, "%s: can't connect\n", __func__);
+		goto end_client;
 	}
+#ifdef CONFIG_EVENT
+	socket_event_register(&sock_client, 0, NULL);
+	socket_event_register(&sock_conn, 0, NULL);
+#endif
+
+	if (net_lo_tcp_window_checks(&sock_client, &sock_conn) < 0
+	    || net_lo_tcp_put_pkt_checks(&sock_client, &sock_conn) < 0
+	    || net_lo_tcp_stream_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#ifdef CONFIG_TCP_RETRANSMIT
+	if (net_lo_tcp_rto_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#ifdef CONFIG_TCP_DELAYED_ACK
+	if (net_lo_tcp_delack_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#endif
+	if (net_lo_tcp_mss_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#ifdef CONFIG_TCP_CC_NEWRENO
+	if (net_lo_tcp_cc_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#ifdef CONFIG_TCP_SACK
+	if (net_lo_tcp_sack_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#endif
 #endif
+#if defined(CONFIG_TCP_WSCALE) || defined(CONFIG_TCP_TIMESTAMPS)
+	if (net_lo_tcp_rfc7323_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#endif
+#ifdef CONFIG_TCP_KEEPALIVE
+	/* the client connection is dropped */
+	if (net_lo_tcp_keepalive_checks(&sock_client, &sock_conn) < 0)
+		goto end_conn;
+#endif
+#endif
+	ret = 0;
+
+ end_conn:
+	sock_info_close(&sock_conn);
+ end_client:
+	sock_info_close(&sock_client);
+	net_lo_flush_scheduler();
+ end_server:
+	sock_info_close(&sock_server);
  end:
-	socket_shutdown();
+	if (ret == 0 && pkt_pool_get_nb_free() != nb_free) {
+		fprintf(stderr, "%s: leaked packets\n", __func__);
+		ret = -1;
+	}
+	if_remove(&lo_iface);
+	route_flush();
 	pkt_mempool_shutdown();
 	return ret;
 }
 #endif
+#endif
+
 #ifdef CONFIG_TCP
 /* SYN => RST */
 unsigned char tcp_pkt[] = {
@@ -569,9 +3324,16 @@ unsigned char tcp_syn_pkt[] = {
 	0x00, 0x1c, 0xbf, 0xca, 0x8e, 0xba, 0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c, 0x08, 0x00, 0x45, 0x00, 0x00, 0x3c, 0x9c, 0x3a, 0x40, 0x00, 0x40, 0x06, 0x1c, 0xe2, 0xc0, 0xa8, 0x00, 0x0b, 0xc0, 0xa8, 0x00, 0x44, 0xce, 0x18, 0x03, 0x09, 0x76, 0xde, 0x61, 0x18, 0x00, 0x00, 0x00, 0x00, 0xa0, 0x02, 0x72, 0x10, 0xad, 0xde, 0x00, 0x00, 0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a, 0x00, 0x36, 0xfd, 0x22, 0x00, 0x00, 0x00, 0x00, 0x01, 0x03, 0x03, 0x07,
 };
 
+#ifdef CONFIG_TCP_SACK
+/* the SYN allows SACK, it is allowed back */
 unsigned char tcp_syn_ack_pkt[] = {
-	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x2C, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x2C, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x12, 0x76, 0xDE, 0x61, 0x19, 0x60, 0x12, 0x03, 0xE8, 0xEA, 0x75, 0x00, 0x00, 0x02, 0x04, 0x01, 0xBA
+	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x30, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x28, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x12, 0x76, 0xDE, 0x61, 0x19, 0x70, 0x12, 0x12, 0xFE, 0xC6, 0x58, 0x00, 0x00, 0x02, 0x04, 0x01, 0xBA, 0x01, 0x01, 0x04, 0x02,
 };
+#else
+unsigned char tcp_syn_ack_pkt[] = {
+	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x2C, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x2C, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x12, 0x76, 0xDE, 0x61, 0x19, 0x60, 0x12, 0x12, 0xFE, 0xDB, 0x5F, 0x00, 0x00, 0x02, 0x04, 0x01, 0xBA
+};
+#endif
 
 unsigned char tcp_ack_pkt[] = {
 	0x00, 0x1c, 0xbf, 0xca, 0x8e, 0xba, 0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c, 0x08, 0x00, 0x45, 0x00, 0x00, 0x34, 0x9c, 0x3b, 0x40, 0x00, 0x40, 0x06, 0x1c, 0xe9, 0xc0, 0xa8, 0x00, 0x0b, 0xc0, 0xa8, 0x00, 0x44, 0xce, 0x18, 0x03, 0x09, 0x76, 0xde, 0x61, 0x19, 0x7b, 0xe7, 0x07, 0x13, 0x80, 0x10, 0x00, 0xe5, 0x9f, 0xc5, 0x00, 0x00, 0x01, 0x01, 0x08, 0x0a, 0x00, 0x36, 0xfd, 0x22, 0x00, 0xb4, 0x2a, 0x52,
@@ -582,7 +3344,7 @@ unsigned char tcp_data_pkt[] = {
 };
 
 unsigned char tcp_data_ack_pkt[] = {
-	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x30, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x13, 0x76, 0xDE, 0x61, 0x20, 0x50, 0x10, 0x03, 0xE8, 0xFE, 0x31, 0x00, 0x00
+	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x30, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x13, 0x76, 0xDE, 0x61, 0x20, 0x50, 0x10, 0x12, 0xFE, 0xEF, 0x1B, 0x00, 0x00
 };
 
 unsigned char tcp_fin_ack_client_pkt[] = {
@@ -590,7 +3352,7 @@ unsigned char tcp_fin_ack_client_pkt[] = {
 };
 
 unsigned char tcp_fin_ack_server_pkt[] = {
-	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x30, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x13, 0x76, 0xDE, 0x61, 0x21, 0x50, 0x11, 0x03, 0xE8, 0xFE, 0x2F, 0x00, 0x00
+	0x9C, 0xD6, 0x43, 0xAE, 0x22, 0x6C, 0x00, 0x1C, 0xBF, 0xCA, 0x8E, 0xBA, 0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x38, 0x06, 0xC1, 0x30, 0xC0, 0xA8, 0x00, 0x44, 0xC0, 0xA8, 0x00, 0x0B, 0x03, 0x09, 0xCE, 0x18, 0x7B, 0xE7, 0x07, 0x13, 0x76, 0xDE, 0x61, 0x21, 0x50, 0x11, 0x12, 0xFE, 0xEF, 0x19, 0x00, 0x00
 };
 
 unsigned char tcp_ack_client_pkt[] = {
@@ -624,6 +3386,29 @@ static int tcp_server(uint16_t port)
 }
 #endif
 
+#if defined(CONFIG_TCP_WSCALE) || defined(CONFIG_TCP_TIMESTAMPS)
+/* The captured SYN offers window scaling and timestamps. They are removed
+ * for the replies to stay the same, the timestamps of the next segments
+ * are then ignored. */
+static void tcp_syn_strip_opts(uint8_t *frame)
+{
+	ip_hdr_t *ip_hdr = (ip_hdr_t *)(frame + sizeof(eth_hdr_t));
+	tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->hl * 4);
+	uint8_t *ops = (uint8_t *)(tcp_hdr + 1);
+	uint8_t *ops_end = (uint8_t *)tcp_hdr + tcp_hdr->hdr_len * 4;
+
+	while (ops < ops_end && ops[0] != TCPOPT_EOL) {
+		uint8_t len = ops[0] == TCPOPT_NOP ? TCPOLEN_NOP : ops[1];
+
+		if (ops[0] == TCPOPT_WINDOW || ops[0] == TCPOPT_TIMESTAMP)
+			memset(ops, TCPOPT_NOP, len);
+		ops += len;
+	}
+	set_transport_cksum(ip_hdr, tcp_hdr,
+			    htons(ntohs(ip_hdr->len) - ip_hdr->hl * 4));
+}
+#endif
+
 int net_tcp_tests(void)
 {
 	pkt_t *pkt;
@@ -644,6 +3429,9 @@ int net_tcp_tests(void)
 	uint8_t mac_dst[] = { 0x00, 0x1c, 0xbf, 0xca, 0x8e, 0xba };
 	uint8_t mac_src[] = { 0x9c, 0xd6, 0x43, 0xae, 0x22, 0x6c };
 	uint16_t port = 777;
+#ifdef CONFIG_TCP_DELAYED_ACK
+	unsigned i;
+#endif
 #ifdef CONFIG_BSD_COMPAT
 	struct sockaddr_in addr;
 	socklen_t addr_len;
@@ -667,7 +3455,8 @@ int net_tcp_tests(void)
 	}
 
 	socket_init();
-	dft_route.iface = &iface;
+	route_flush();
+	route_add(0, 0, 0, &iface);
 	arp_add_entry(mac_src, (uint8_t *)&ip_src, &iface);
 
 	/* SYN => RST */
@@ -728,6 +3517,9 @@ int net_tcp_tests(void)
 	}
 #endif
 	/* SYN => SYN_ACK */
+#if defined(CONFIG_TCP_WSCALE) || defined(CONFIG_TCP_TIMESTAMPS)
+	tcp_syn_strip_opts(tcp_syn_pkt);
+#endif
 	buf_init(&pkt->buf, tcp_syn_pkt, sizeof(tcp_syn_pkt));
 	buf_init(&out, tcp_syn_ack_pkt, sizeof(tcp_syn_ack_pkt));
 
@@ -790,6 +3582,19 @@ int net_tcp_tests(void)
 	}
 
 	eth_input(&iface);
+#ifdef CONFIG_TCP_DELAYED_ACK
+	/* nothing is sent back, the acknowledgment goes alone */
+	if ((pkt = pkt_get(iface.tx)) != NULL) {
+		fprintf(stderr, "%s: TCP EST: ACK to data packet not delayed\n",
+			__func__);
+		pkt_free(pkt);
+		ret = -1;
+		goto end;
+	}
+	for (i = 0; i < CONFIG_TCP_DELAYED_ACK_TIMEOUT * 1000UL
+		     / CONFIG_TIMER_RESOLUTION_US; i++)
+		timer_process();
+#endif
 	if ((pkt = pkt_get(iface.tx)) == NULL) {
 		fprintf(stderr, "%s: TCP EST: can't get ACK to data packet\n",
 			__func__);
@@ -938,6 +3743,9 @@ int net_swen_generic_cmds_tests(void)
 	iface.send = iface_send;
 	if_init(&iface, IF_TYPE_RF, &iface_queues.pkt_pool, NULL, NULL, 0);
 	ret = swen_generic_cmds_check(&iface);
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	if_remove(&iface);
+#endif
 	pkt_mempool_shutdown();
 	return ret;
 }
@@ -1298,6 +4106,10 @@ int net_swen_l3_tests(void)
 	}
 
  end:
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	if_remove(&iface_swen_l3_local);
+	if_remove(&iface_swen_l3_remote);
+#endif
 	pkt_mempool_shutdown();
 	return ret;
 }
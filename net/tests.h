@@ -26,8 +26,16 @@
 #define _TEST_H_
 
 int net_arp_tests(void);
+int net_arp_cache_tests(void);
+int net_arp_queue_tests(void);
+int net_route_tests(void);
 int net_icmp_tests(void);
 int net_udp_tests(void);
+int net_ip_frag_tests(void);
+int net_multi_iface_tests(void);
+int net_ip_forward_tests(void);
+int net_lo_tests(void);
+int net_lo_tcp_tests(void);
 int net_tcp_tests(void);
 int net_swen_generic_cmds_tests(void);
 int net_swen_l3_tests(void);
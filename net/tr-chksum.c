@@ -25,9 +25,11 @@
 #include <stdint.h>
 #include "tr-chksum.h"
 
-/* len is in network byte order */
-uint16_t
-transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
+/* len is in network byte order, only the first hdr_len bytes of hdr are
+ * summed */
+static uint32_t
+transport_cksum_hdr(const ip_hdr_t *ip, const void *hdr, uint16_t len,
+		    uint16_t hdr_len)
 {
 	uint32_t csum;
 
@@ -40,18 +42,19 @@ transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
 	csum += htons(ip->p);
 
 	csum += cksum_partial(&len, sizeof(len));
-	csum += cksum_partial(hdr, ntohs(len));
-	csum = (csum & 0xFFFF) + (csum >> 16);
-	csum += csum >> 16;
-
-	csum = ~csum;
+	csum += cksum_partial(hdr, hdr_len);
 	return csum;
 }
 
-void set_transport_cksum(const void *iph, void *trans_hdr, int len)
+/* len is in network byte order */
+uint16_t
+transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
+{
+	return cksum_finish(transport_cksum_hdr(ip, hdr, len, ntohs(len)));
+}
+
+static uint16_t *transport_cksum_field(const ip_hdr_t *ip_hdr, void *trans_hdr)
 {
-	const ip_hdr_t *ip_hdr = iph;
-	uint16_t *checksum;
 	void *tmp;
 
 	if (ip_hdr->p == IPPROTO_UDP) {
@@ -62,11 +65,37 @@ void set_transport_cksum(const void *iph, void *trans_hdr, int len)
 		tmp = &tcp_hdr->checksum;
 	} else {
 		assert(0);
-		return;
+		return NULL;
 	}
-	checksum = tmp;
+	return tmp;
+}
+
+void set_transport_cksum_partial(const void *iph, void *trans_hdr, int len,
+				 uint16_t hdr_len, uint32_t payload_csum)
+{
+	const ip_hdr_t *ip_hdr = iph;
+	uint16_t *checksum;
+
+	if ((checksum = transport_cksum_field(ip_hdr, trans_hdr)) == NULL)
+		return;
 	*checksum = 0;
-	*checksum = transport_cksum(ip_hdr, trans_hdr, len);
+	*checksum = cksum_finish(transport_cksum_hdr(ip_hdr, trans_hdr, len,
+						     hdr_len) + payload_csum);
 	if (*checksum == 0)
 		*checksum = 0xFFFF;
 }
+
+void set_transport_pseudo_cksum(const void *iph, void *trans_hdr, int len)
+{
+	const ip_hdr_t *ip_hdr = iph;
+	uint16_t *checksum;
+
+	if ((checksum = transport_cksum_field(ip_hdr, trans_hdr)) == NULL)
+		return;
+	*checksum = ~cksum_finish(transport_cksum_hdr(ip_hdr, trans_hdr, len, 0));
+}
+
+void set_transport_cksum(const void *iph, void *trans_hdr, int len)
+{
+	set_transport_cksum_partial(iph, trans_hdr, len, ntohs(len), 0);
+}
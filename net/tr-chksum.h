@@ -30,7 +30,15 @@
 #include "tcp.h"
 
 void set_transport_cksum(const void *iph, void *trans_hdr, int len);
+
+/* same as set_transport_cksum() but only the hdr_len first bytes of
+ * trans_hdr are summed, the rest is accounted for by payload_csum */
+void set_transport_cksum_partial(const void *iph, void *trans_hdr, int len,
+				 uint16_t hdr_len, uint32_t payload_csum);
 uint16_t
 transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len);
+/* only set the pseudo header sum, the transport checksum is completed by
+ * the device */
+void set_transport_pseudo_cksum(const void *iph, void *trans_hdr, int len);
 
 #endif
@@ -30,7 +30,8 @@
 #include "socket.h"
 #include "../sys/hash-tables.h"
 
-int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport)
+int udp_output(pkt_t *pkt, uint32_t ip_src, uint32_t ip_dst, uint16_t sport,
+	       uint16_t dport)
 {
 	udp_hdr_t *udp_hdr = btod(pkt);
 	ip_hdr_t *ip_hdr;
@@ -44,7 +45,7 @@ int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport)
 	udp_hdr->src_port = sport;
 	udp_hdr->dst_port = dport;
 
-	return ip_output(pkt, NULL, 0);
+	return __ip_output(pkt, NULL, ip_src, 0);
 }
 
 void udp_input(pkt_t *pkt, iface_t *iface)
@@ -63,34 +64,20 @@ void udp_input(pkt_t *pkt, iface_t *iface)
 	    length > pkt_len(pkt) + sizeof(udp_hdr_t))
 		goto error;
 
-	if ((sock_info = udpport2sockinfo(udp_hdr->dst_port)) == NULL) {
-#ifdef CONFIG_ICMP
-		ip_hdr_t *ip_hdr_out;
-		pkt_t *out;
-		buf_t data;
-
-		if ((out = pkt_alloc()) == NULL)
-			goto error;
-
-		buf_init(&data, ip_hdr, MIN(MAX_ICMP_DATA_SIZE,
-					    (uint16_t)ntohs(ip_hdr->len)));
-		pkt_adj(out, (int)sizeof(eth_hdr_t));
-		ip_hdr_out = btod(out);
-		ip_hdr_out->dst = ip_hdr->src;
-		ip_hdr_out->src = ip_hdr->dst;
-		ip_hdr_out->p = IPPROTO_ICMP;
-		pkt_adj(out, (int)sizeof(ip_hdr_t));
+	/* corrupted datagrams are neither queued nor answered */
+	if (udp_hdr->checksum && !pkt_csum_verified(pkt)
+	    && transport_cksum(ip_hdr, udp_hdr, udp_hdr->length) != 0)
+		goto error;
 
-		icmp_output(out, iface, ICMP_UNREACHABLE, ICMP_UNREACH_PORT, 0,
-			    0, &data, IP_DF);
+	if ((sock_info = udpport2sockinfo(udp_hdr->dst_port)) == NULL
+	    || !sock_info_match_addr(sock_info, ip_hdr->dst)) {
+#ifdef CONFIG_ICMP
+		icmp_error(ip_hdr, iface, ICMP_UNREACHABLE, ICMP_UNREACH_PORT,
+			   0);
 #endif
 		goto error;
 	}
 
-	if (udp_hdr->checksum && transport_cksum(ip_hdr, udp_hdr,
-						 udp_hdr->length) != 0)
-		goto error;
-
 	pkt_adj(pkt, sizeof(udp_hdr_t));
 	/* truncate pkt to the udp payload length */
 	pkt->buf.len = length - sizeof(udp_hdr_t);
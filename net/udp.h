@@ -37,6 +37,7 @@ struct udp_hdr {
 typedef struct udp_hdr udp_hdr_t;
 
 void udp_input(pkt_t *pkt, iface_t *iface);
-int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport);
+int udp_output(pkt_t *pkt, uint32_t ip_src, uint32_t ip_dst, uint16_t sport,
+	       uint16_t dport);
 
 #endif
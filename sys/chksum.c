@@ -41,12 +41,77 @@ uint32_t cksum_partial(const void *data, uint16_t len)
 	return sum;
 }
 
-uint16_t cksum_finish(uint32_t csum)
+void cksum_copy(void *dst, const void *src, uint16_t len, uint32_t *partial)
+{
+	const uint16_t *s = src;
+	uint16_t *d = dst;
+	uint32_t sum = *partial;
+
+	while (len > 1)  {
+		uint16_t w = *s++;
+
+		*d++ = w;
+		sum += w;
+		len -= 2;
+	}
+
+	if (len == 1) {
+		uint8_t b = *(uint8_t *)s;
+
+		*(uint8_t *)d = b;
+		sum += b;
+	}
+	*partial = sum;
+}
+
+static uint16_t cksum_fold(uint32_t csum)
 {
 	csum = (csum >> 16) + (csum & 0xffff);
 	csum += csum >> 16;
 
-	return ~csum;
+	return csum;
+}
+
+uint16_t cksum_finish(uint32_t csum)
+{
+	return ~cksum_fold(csum);
+}
+
+/* HC' = ~(~HC + ~m + m') */
+uint16_t cksum_update16(uint16_t csum, uint16_t old, uint16_t new)
+{
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~old;
+	sum += new;
+	return cksum_finish(sum);
+}
+
+uint16_t cksum_update32(uint16_t csum, uint32_t old, uint32_t new)
+{
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~(old >> 16);
+	sum += (uint16_t)~old;
+	sum += new >> 16;
+	sum += new & 0xffff;
+	return cksum_finish(sum);
+}
+
+uint16_t cksum_add(uint16_t csum, uint32_t partial)
+{
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += cksum_fold(partial);
+	return cksum_finish(sum);
+}
+
+uint16_t cksum_sub(uint16_t csum, uint32_t partial)
+{
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~cksum_fold(partial);
+	return cksum_finish(sum);
 }
 
 uint16_t cksum(const void *data, uint16_t len)
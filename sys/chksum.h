@@ -30,4 +30,22 @@ uint16_t cksum(const void *data, uint16_t len);
 uint32_t cksum_partial(const void *data, uint16_t len);
 uint16_t cksum_finish(uint32_t csum);
 
+/* copy len bytes from src to dst and add them to the partial sum *partial.
+ * If the sum is to be continued, len must be even.
+ */
+void cksum_copy(void *dst, const void *src, uint16_t len, uint32_t *partial);
+
+/* incremental checksum updates (RFC 1624). Fields are passed as they are
+ * stored in the summed data (network byte order).
+ */
+uint16_t cksum_update16(uint16_t csum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t csum, uint32_t old, uint32_t new);
+
+/* update a checksum when data of partial sum `partial' is appended to
+ * (cksum_add) or removed from (cksum_sub) the summed data. The data must
+ * start at an even offset.
+ */
+uint16_t cksum_add(uint16_t csum, uint32_t partial);
+uint16_t cksum_sub(uint16_t csum, uint32_t partial);
+
 #endif
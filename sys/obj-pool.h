@@ -0,0 +1,140 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+
+#ifndef _OBJ_POOL_H_
+#define _OBJ_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Fixed-size object pool
+ *
+ * Objects are taken from a static array. Released objects are chained
+ * through their first bytes, objects never allocated are handed out in
+ * order, so allocations and releases are O(1) and the pool needs no
+ * initialization.
+ */
+
+typedef struct obj_pool_stats {
+	uint16_t used;
+	uint16_t high_water;	/* highest number of objects in use */
+	uint16_t failures;	/* allocations on an exhausted pool */
+} obj_pool_stats_t;
+
+typedef struct obj_pool {
+	void *free_list;
+	uint8_t *objs;
+	uint16_t obj_size;
+	uint16_t nb;
+	uint16_t nb_touched;	/* objects allocated at least once */
+	obj_pool_stats_t stats;
+} obj_pool_t;
+
+#define __OBJ_POOL_DECL(storage, name, type, nb_objs)		\
+	union name##__obj {					\
+		type obj;					\
+		void *next;					\
+	};							\
+	static union name##__obj name##__objs[nb_objs];		\
+	storage obj_pool_t name = {				\
+		.objs = (uint8_t *)name##__objs,		\
+		.obj_size = sizeof(union name##__obj),		\
+		.nb = nb_objs,					\
+	}
+
+/** Pool declaration
+ * Declares a pool of nb objects of the given type as global variables
+ * of a C file.
+ */
+#define OBJ_POOL_DECL(name, type, nb_objs)			\
+	__OBJ_POOL_DECL(, name, type, nb_objs)
+
+/** Static pool declaration
+ */
+#define STATIC_OBJ_POOL_DECL(name, type, nb_objs)		\
+	__OBJ_POOL_DECL(static, name, type, nb_objs)
+
+/** Allocate an object
+ *
+ * @param[in] pool  pool
+ * @return object or NULL if the pool is exhausted
+ */
+static inline void *obj_pool_alloc(obj_pool_t *pool)
+{
+	void *obj;
+
+	if (pool->free_list) {
+		obj = pool->free_list;
+		pool->free_list = *(void **)obj;
+	} else if (pool->nb_touched < pool->nb) {
+		obj = pool->objs + pool->nb_touched * pool->obj_size;
+		pool->nb_touched++;
+	} else {
+		pool->stats.failures++;
+		return NULL;
+	}
+	pool->stats.used++;
+	if (pool->stats.used > pool->stats.high_water)
+		pool->stats.high_water = pool->stats.used;
+	return obj;
+}
+
+/** Release an object to its pool
+ *
+ * @param[in] pool  pool
+ * @param[in] obj   object returned by obj_pool_alloc()
+ */
+static inline void obj_pool_free(obj_pool_t *pool, void *obj)
+{
+	*(void **)obj = pool->free_list;
+	pool->free_list = obj;
+	pool->stats.used--;
+}
+
+/** Check whether an object was taken from a pool
+ *
+ * @param[in] pool  pool
+ * @param[in] obj   object
+ * @return 1 if obj belongs to the pool, 0 otherwise
+ */
+static inline uint8_t obj_pool_owns(const obj_pool_t *pool, const void *obj)
+{
+	const uint8_t *o = obj;
+
+	return o >= pool->objs && o < pool->objs + pool->nb * pool->obj_size;
+}
+
+/** Get pool statistics
+ *
+ * @param[in] pool  pool
+ * @return statistics
+ */
+static inline const obj_pool_stats_t *
+obj_pool_get_stats(const obj_pool_t *pool)
+{
+	return &pool->stats;
+}
+
+#endif
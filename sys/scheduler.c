@@ -68,10 +68,10 @@ static void __scheduler_run_task(ring_t *r)
 }
 
 #ifdef DEBUG
-void __schedule_task(void (*cb)(void *arg), void *arg,
-		     const char *func, int line)
+int __schedule_task(void (*cb)(void *arg), void *arg,
+		    const char *func, int line)
 #else
-void schedule_task(void (*cb)(void *arg), void *arg)
+int schedule_task(void (*cb)(void *arg), void *arg)
 #endif
 {
 	task_t task = {
@@ -81,8 +81,14 @@ void schedule_task(void (*cb)(void *arg), void *arg)
 	ring_t *r = IRQ_CHECK() ? ring : ring_irq;
 
 	if (ring_add(r, &task, sizeof(task_t)) >= 0)
-		return;
+		return 0;
 	DEBUG_LOG("cannot schedule task %p from %s:%d\n", cb, func, line);
+	return -1;
+}
+
+unsigned scheduler_get_nb_tasks(void)
+{
+	return (ring_len(ring) + ring_len(ring_irq)) / sizeof(task_t);
 }
 
 void scheduler_run_task(void)
@@ -26,8 +26,8 @@
 #define _SCHEDULER_H_
 
 #ifdef DEBUG
-void __schedule_task(void (*cb)(void *arg), void *arg,
-		     const char *func, int line);
+int __schedule_task(void (*cb)(void *arg), void *arg,
+		    const char *func, int line);
 #define schedule_task(cb, arg) __schedule_task(cb, arg, __func__, __LINE__)
 #else
 
@@ -35,8 +35,9 @@ void __schedule_task(void (*cb)(void *arg), void *arg,
  *
  * Scheduling tasks is safe from an interrupt handler and from an other task.
  * @param[in] cb  task function to be scheduled
+ * @return 0 on success, -1 if the task queue is full
  */
-void schedule_task(void (*cb)(void *arg), void *arg);
+int schedule_task(void (*cb)(void *arg), void *arg);
 #endif
 
 /** Run first task in queue
@@ -45,6 +46,12 @@ void schedule_task(void (*cb)(void *arg), void *arg);
 void scheduler_run_task(void);
 
 
+/** Get the number of scheduled tasks
+ *
+ * @return number of tasks waiting to run
+ */
+unsigned scheduler_get_nb_tasks(void);
+
 /** Run all tasks in loop
  *
  * This function should be used as a main loop in user application